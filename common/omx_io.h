@@ -40,7 +40,7 @@
  * or modified, or when the user-mapped driver- and endpoint-descriptors
  * are modified.
  */
-#define OMX_DRIVER_ABI_VERSION		0x20f
+#define OMX_DRIVER_ABI_VERSION		0x217
 
 /************************
  * Common parameters or IOCTL subtypes
@@ -87,6 +87,12 @@ typedef uint32_t omx_eventq_index_t;
 #define OMX_EXP_RELEASE_SLOTS_BATCH_NR		(OMX_EXP_EVENTQ_ENTRY_NR/4)
 #define OMX_UNEXP_RELEASE_SLOTS_BATCH_NR	(OMX_UNEXP_EVENTQ_ENTRY_NR/4)
 
+/* submitq: where send commands are posted for the driver submission thread */
+#define OMX_SUBMITQ_ENTRY_NR	64UL
+#define OMX_SUBMITQ_ENTRY_SHIFT	7
+#define OMX_SUBMITQ_ENTRY_SIZE	(1UL << OMX_SUBMITQ_ENTRY_SHIFT)
+#define OMX_SUBMITQ_SIZE	(OMX_SUBMITQ_ENTRY_NR << OMX_SUBMITQ_ENTRY_SHIFT)
+
 /* Event ids go from 1 to a power-of-two, 0 means unused yet.
  * This ensures that the same slot of the eventq will not use the same id
  * during two consecutive fills of the eventq.
@@ -150,6 +156,9 @@ struct omx_driver_desc {
 
 #define OMX_DRIVER_FEATURE_SHARED		(1<<1)
 #define OMX_DRIVER_FEATURE_PIN_INVALIDATE	(1<<2)
+#define OMX_DRIVER_FEATURE_SUBMITQ		(1<<3)
+#define OMX_DRIVER_FEATURE_EXP_MEDIUM		(1<<4)
+#define OMX_DRIVER_FEATURE_PUSH			(1<<5)
 
 /* endpoint desc */
 struct omx_endpoint_desc {
@@ -160,6 +169,12 @@ struct omx_endpoint_desc {
 	uint32_t session_id;
 	uint32_t user_event_index;
 	/* 24 */
+	omx_eventq_index_t exp_eventq_consumed_index;
+	omx_eventq_index_t unexp_eventq_consumed_index;
+	/* 32 */
+	uint32_t submitq_need_wakeup;
+	uint32_t pad;
+	/* 40 */
 };
 
 #define OMX_ENDPOINT_DESC_SIZE	sizeof(struct omx_endpoint_desc)
@@ -180,6 +195,8 @@ struct omx_endpoint_desc {
 #define OMX_UNEXP_EVENTQ_FILE_OFFSET	(4*4096)
 #define OMX_DRIVER_DESC_FILE_OFFSET	(5*4096)
 #define OMX_ENDPOINT_DESC_FILE_OFFSET	(6*4096)
+#define OMX_SUBMITQ_FILE_OFFSET		(7*4096)
+#define OMX_EXP_MEDIUM_SEQNUMS_FILE_OFFSET	(8*4096)
 
 #define OMX_NO_WAKEUP_JIFFIES 0
 
@@ -387,13 +404,43 @@ struct omx_cmd_send_mediumva {
 	uint32_t length;
 	/* 16 */
 	uint16_t checksum;
-	uint16_t pad;
+	uint16_t first_frag; /* only send frags starting at this one */
 	uint32_t nr_segments;
 	/* 24 */
 	uint64_t segments;
 	/* 32 */
 	uint64_t match_info;
 	/* 40 */
+	uint16_t frags_nr; /* number of frags to send, 0 for all remaining ones */
+	uint16_t pad1;
+	uint32_t pad2;
+	/* 48 */
+};
+
+/*
+ * Pushed large messages.
+ *
+ * Without OMX_MX_WIRE_COMPAT, a mediumva message may be up to
+ * OMX_PUSH_FRAGS_MAX fragments long, so that the sender may push a large
+ * message instead of going through a rendez-vous and pull.
+ * The receiver library tells which fragments it got with a push sack.
+ * It acknowledges all fragments before frag_base, and those within the
+ * next OMX_PUSH_SACK_FRAGS_NR fragments whose bit is set in the mask.
+ * The sender then only resends the missing ones using first_frag/frags_nr.
+ */
+struct omx_cmd_send_push_sack {
+	uint16_t peer_index;
+	uint8_t dest_endpoint;
+	uint8_t pad1;
+	uint32_t session_id;
+	/* 8 */
+	uint16_t lib_seqnum;
+	uint8_t frag_base;
+	uint8_t pad2;
+	uint32_t pad3;
+	/* 16 */
+	uint32_t frags_mask[OMX_PUSH_SACK_MASK_NR];
+	/* 32 */
 };
 
 struct omx_cmd_send_rndv {
@@ -404,7 +451,8 @@ struct omx_cmd_send_rndv {
 	/* 8 */
 	uint16_t seqnum;
 	uint16_t piggyack;
-	uint32_t pad1;
+	uint16_t pulled_rdma_offset; /* 16bits on the wire */
+	uint16_t pad1;
 	/* 16 */
 	uint64_t match_info;
 	/* 24 */
@@ -467,6 +515,9 @@ struct omx_cmd_pull {
 	/* 32 */
 	uint64_t lib_cookie;
 	/* 40 */
+	uint32_t puller_rdma_offset;
+	uint32_t pad;
+	/* 48 */
 };
 
 struct omx_cmd_send_notify {
@@ -500,6 +551,119 @@ struct omx_cmd_send_liback {
 	/* 24 */
 };
 
+/*
+ * Submission ring entry.
+ * The library fills cmd with the usual parameter of the OMX_EPCMD_* given
+ * in type, then sets status to READY. The driver submission thread resets
+ * it to FREE once the command has been submitted.
+ */
+#define OMX_SUBMITQ_ENTRY_STATUS_FREE	0
+#define OMX_SUBMITQ_ENTRY_STATUS_READY	1
+
+struct omx_submitq_entry {
+	uint16_t status;
+	uint16_t type;
+	uint32_t pad;
+	/* 8 */
+	union {
+		struct omx_cmd_send_tiny tiny;
+		struct omx_cmd_send_notify notify;
+		struct omx_cmd_send_liback liback;
+		char pad[OMX_SUBMITQ_ENTRY_SIZE-8];
+	} cmd;
+	/* 128 */
+};
+
+/*
+ * Start the submission thread of an endpoint.
+ * The thread sleeps after idle_us microseconds without any command, and
+ * sets submitq_need_wakeup in the endpoint descriptor, the library then
+ * has to call OMX_CMD_SUBMITQ_WAKEUP after posting.
+ */
+struct omx_cmd_submitq_start {
+	uint32_t idle_us;
+	uint32_t pad;
+	/* 8 */
+};
+
+/*
+ * Submit several send commands at once.
+ * Each entry gives the OMX_EPCMD_* index of a send command and a pointer to
+ * its usual parameter. All entries are checked before any is submitted,
+ * then they are submitted in order until one fails. On failure, the number
+ * of commands that were submitted is returned in submitted_nr.
+ */
+#define OMX_SEND_BATCH_NR_MAX	32
+
+struct omx_cmd_send_batch_entry {
+	uint32_t type;
+	uint32_t pad;
+	/* 8 */
+	uint64_t param;
+	/* 16 */
+};
+
+struct omx_cmd_send_batch {
+	uint32_t nr;
+	uint32_t submitted_nr;
+	/* 8 */
+	uint64_t entries;
+	/* 16 */
+};
+
+/*
+ * Expected medium slots.
+ * The library arms a slot with a posted receive buffer that it registered
+ * as user region rdma_id, starting at region_offset. The first medium whose (match_info & match_mask)
+ * equals match_info and whose length fits claims the slot, and its fragments
+ * are then copied by the driver straight into the region. Their events get
+ * exp_slot set to slot+1 and exp_cookie set to the given cookie.
+ * The driver releases the slot by itself once the whole message is received,
+ * the last fragment event has OMX_EVT_MEDIUM_FRAG_EXP_DONE set.
+ * Otherwise, the library has to release the slot explicitly.
+ *
+ * Only the oldest armed slot whose match_info matches may be claimed, the
+ * library must not arm a slot while an earlier posted receive that may match
+ * the same messages is not armed.
+ *
+ * The library also maps the seqnums table (one entry per partner, indexed by
+ * endpoint_index + peer_index * endpoint_max) and keeps the next seqnum it will
+ * match for each partner there, or 0 if there is no such partner. A medium
+ * whose seqnum is not within the early window starting at this seqnum cannot
+ * claim a slot.
+ */
+#define OMX_EXP_MEDIUM_SLOT_NR	8
+
+#define OMX_EXP_MEDIUM_SEQNUM_VALID	(1U<<16)
+#define OMX_EXP_MEDIUM_SEQNUM_MASK	0x3fff /* the upper bits are the session number */
+#define OMX_EXP_MEDIUM_SEQNUM_EARLY_MAX	0xff
+#define OMX_EXP_MEDIUM_SEQNUMS_SIZE(peer_max, endpoint_max) ((peer_max) * (endpoint_max) * sizeof(uint32_t))
+
+/* exp_flags of medium frag events */
+#define OMX_EVT_MEDIUM_FRAG_EXP_DONE	(1<<0)
+
+struct omx_cmd_post_exp_medium {
+	uint32_t slot;
+	uint32_t rdma_id;
+	/* 8 */
+	uint64_t match_info;
+	/* 16 */
+	uint64_t match_mask;
+	/* 24 */
+	uint32_t length;
+	uint32_t cookie;
+	/* 32 */
+	uint32_t region_offset;
+	uint32_t pad;
+	/* 40 */
+};
+
+struct omx_cmd_release_exp_medium {
+	uint32_t slot;
+	uint32_t pad;
+	/* 8 */
+};
+
 struct omx_cmd_create_user_region {
 	uint32_t nr_segments;
 	uint32_t id;
@@ -611,6 +775,12 @@ struct omx_cmd_bench {
 #define OMX_CMD_RAW_SEND		_IOR(OMX_CMD_MAGIC, 0x31, struct omx_cmd_raw_send)
 #define OMX_CMD_RAW_GET_EVENT		_IOWR(OMX_CMD_MAGIC, 0x32, struct omx_cmd_raw_get_event)
 #define OMX_CMD_OPEN_ENDPOINT		_IOR(OMX_CMD_MAGIC, 0x71, struct omx_cmd_open_endpoint)
+#define OMX_CMD_SEND_BATCH		_IOWR(OMX_CMD_MAGIC, 0x72, struct omx_cmd_send_batch)
+#define OMX_CMD_SUBMITQ_START		_IOR(OMX_CMD_MAGIC, 0x73, struct omx_cmd_submitq_start)
+#define OMX_CMD_SUBMITQ_WAKEUP		_IO(OMX_CMD_MAGIC, 0x74)
+#define OMX_CMD_POST_EXP_MEDIUM		_IOR(OMX_CMD_MAGIC, 0x75, struct omx_cmd_post_exp_medium)
+#define OMX_CMD_RELEASE_EXP_MEDIUM	_IOR(OMX_CMD_MAGIC, 0x76, struct omx_cmd_release_exp_medium)
+#define OMX_CMD_SEND_PUSH_SACK		_IOR(OMX_CMD_MAGIC, 0x77, struct omx_cmd_send_push_sack)
 #define OMX_CMD_XEN_PEER_TABLE_GET_STATE        _IOR(OMX_CMD_MAGIC, 0xa0, struct omx_cmd_peer_table_state)
 #define OMX_CMD_XEN_PEER_TABLE_SET_STATE        _IOR(OMX_CMD_MAGIC, 0xa1, struct omx_cmd_peer_table_state)
 #define OMX_CMD_XEN_GET_BOARD_COUNT		_IOW(OMX_CMD_MAGIC, 0xa2, uint32_t)
@@ -723,6 +893,18 @@ omx_strcmd(unsigned cmd)
 		return "Raw Get Event";
 	case OMX_CMD_OPEN_ENDPOINT:
 		return "Open Endpoint";
+	case OMX_CMD_SEND_BATCH:
+		return "Send Batch";
+	case OMX_CMD_SUBMITQ_START:
+		return "Start Submission Ring";
+	case OMX_CMD_SUBMITQ_WAKEUP:
+		return "Wakeup Submission Ring";
+	case OMX_CMD_POST_EXP_MEDIUM:
+		return "Post Expected Medium";
+	case OMX_CMD_RELEASE_EXP_MEDIUM:
+		return "Release Expected Medium";
+	case OMX_CMD_SEND_PUSH_SACK:
+		return "Send Push Sack";
 	case OMX_CMD_BENCH:
 		return "Command Benchmark";
 	case OMX_CMD_SEND_TINY:
@@ -785,6 +967,7 @@ omx_strcmd(unsigned cmd)
 #define OMX_EVT_RECV_NOTIFY		0x17
 #define OMX_EVT_RECV_LIBACK		0x18
 #define OMX_EVT_RECV_NACK_LIB		0x19
+#define OMX_EVT_RECV_PUSH_SACK		0x1a
 #define OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE	0x20
 #define OMX_EVT_PULL_DONE		0x21
 
@@ -829,6 +1012,8 @@ omx_strevt(unsigned type)
 		return "Receive LibAck";
 	case OMX_EVT_RECV_NACK_LIB:
 		return "Receive Nack Lib";
+	case OMX_EVT_RECV_PUSH_SACK:
+		return "Receive Push Sack";
 	case OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE:
 		return "Send MediumSQ Fragment Done";
 	case OMX_EVT_PULL_DONE:
@@ -930,6 +1115,21 @@ union omx_evt {
 		/* 64 */
 	} recv_liback;
 
+	struct omx_evt_recv_push_sack {
+		uint16_t peer_index;
+		uint8_t src_endpoint;
+		uint8_t frag_base;
+		uint16_t lib_seqnum;
+		uint16_t pad1;
+		/* 8 */
+		uint32_t frags_mask[OMX_PUSH_SACK_MASK_NR];
+		/* 24 */
+		uint8_t pad2[38];
+		uint8_t type;
+		uint8_t id;
+		/* 64 */
+	} recv_push_sack;
+
 	struct omx_evt_recv_nack_lib {
 		uint16_t peer_index;
 		uint8_t src_endpoint;
@@ -979,7 +1179,11 @@ union omx_evt {
 				uint8_t frag_pipeline;
 				/* 12 */
 				uint16_t checksum;
-				uint16_t pad2[13];
+				uint8_t exp_slot; /* expected slot + 1, or 0 if copied in the recvq */
+				uint8_t exp_flags;
+				/* 16 */
+				uint32_t exp_cookie;
+				uint32_t pad2[5];
 				/* 40 */
 			} medium_frag;
 
@@ -1112,6 +1316,38 @@ enum omx_counter_index {
 	OMX_COUNTER_SHARED_DMA_LARGE,
 	OMX_COUNTER_SHARED_DMA_PARTIAL_LARGE,
 
+	OMX_COUNTER_XEN_PGRANT_HIT,
+	OMX_COUNTER_XEN_PGRANT_MISS,
+
+	OMX_COUNTER_SUBMITQ_CMD,
+	OMX_COUNTER_SUBMITQ_CMD_FAILED,
+	OMX_COUNTER_SUBMITQ_SLEEP,
+
+	OMX_COUNTER_RECV_MEDIUM_FRAG_EXP,
+	OMX_COUNTER_EXP_MEDIUM_DUP,
+	OMX_COUNTER_EXP_MEDIUM_OBSOLETE,
+
+	OMX_COUNTER_PULL_RTT_SAMPLE,
+	OMX_COUNTER_PULL_RTO_BACKOFF,
+	OMX_COUNTER_PULL_WINDOW_GROW,
+	OMX_COUNTER_PULL_WINDOW_SHRINK,
+	OMX_COUNTER_PULL_LAST_SRTT_US,
+	OMX_COUNTER_PULL_LAST_RTO_US,
+
+	OMX_COUNTER_SEND_PUSH_SACK,
+	OMX_COUNTER_RECV_PUSH_SACK,
+
+	OMX_COUNTER_PULL_RAIL_REQ,
+	OMX_COUNTER_PULL_RAIL_DOWN,
+	OMX_COUNTER_PULL_RAIL_REMOTE_ENDPOINT,
+
+	OMX_COUNTER_SEND_BATCH,
+	OMX_COUNTER_SEND_BATCH_LAST_SKBS,
+
+	OMX_COUNTER_RECV_STEER,
+	OMX_COUNTER_RECV_STEER_BACKLOG_FULL,
+	OMX_COUNTER_RECV_STEER_DROP,
+
 	OMX_COUNTER_INDEX_MAX
 };
 
@@ -1289,6 +1525,54 @@ omx_strcounter(enum omx_counter_index index)
 		return "DMA Shared Large";
 	case OMX_COUNTER_SHARED_DMA_PARTIAL_LARGE:
 		return "DMA Shared Large only Partial";
+	case OMX_COUNTER_XEN_PGRANT_HIT:
+		return "Xen Persistent Grant Hit";
+	case OMX_COUNTER_XEN_PGRANT_MISS:
+		return "Xen Persistent Grant Miss";
+	case OMX_COUNTER_SUBMITQ_CMD:
+		return "Submission Ring Command";
+	case OMX_COUNTER_SUBMITQ_CMD_FAILED:
+		return "Submission Ring Command Failed";
+	case OMX_COUNTER_SUBMITQ_SLEEP:
+		return "Submission Ring Thread Sleep";
+	case OMX_COUNTER_RECV_MEDIUM_FRAG_EXP:
+		return "Recv Medium Frag in Expected Buffer";
+	case OMX_COUNTER_EXP_MEDIUM_DUP:
+		return "Expected Medium Duplicate Frag Dropped";
+	case OMX_COUNTER_EXP_MEDIUM_OBSOLETE:
+		return "Expected Medium Slot not Claimed by Obsolete Seqnum";
+	case OMX_COUNTER_PULL_RTT_SAMPLE:
+		return "Pull Block RTT Sample";
+	case OMX_COUNTER_PULL_RTO_BACKOFF:
+		return "Pull Retransmit Timeout Backoff";
+	case OMX_COUNTER_PULL_WINDOW_GROW:
+		return "Pull Block Window Grow";
+	case OMX_COUNTER_PULL_WINDOW_SHRINK:
+		return "Pull Block Window Shrink";
+	case OMX_COUNTER_PULL_LAST_SRTT_US:
+		return "Pull Last Smoothed RTT (us)";
+	case OMX_COUNTER_PULL_LAST_RTO_US:
+		return "Pull Last Retransmit Timeout (us)";
+	case OMX_COUNTER_SEND_PUSH_SACK:
+		return "Send Push Sack";
+	case OMX_COUNTER_RECV_PUSH_SACK:
+		return "Recv Push Sack";
+	case OMX_COUNTER_PULL_RAIL_REQ:
+		return "Pull Request Sent on Another Rail";
+	case OMX_COUNTER_PULL_RAIL_DOWN:
+		return "Pull Rail Marked Down";
+	case OMX_COUNTER_PULL_RAIL_REMOTE_ENDPOINT:
+		return "Pull Request for Endpoint on Another Iface";
+	case OMX_COUNTER_SEND_BATCH:
+		return "Send Batch";
+	case OMX_COUNTER_SEND_BATCH_LAST_SKBS:
+		return "Send Batch Last Packets";
+	case OMX_COUNTER_RECV_STEER:
+		return "Recv Steered to Endpoint Owner Core";
+	case OMX_COUNTER_RECV_STEER_BACKLOG_FULL:
+		return "Recv Steering Backlog Full";
+	case OMX_COUNTER_RECV_STEER_DROP:
+		return "Recv Steering Dropped to Keep Order";
 	default:
 		return "** Unknown **";
 	}
@@ -112,6 +112,12 @@
 
 #endif /* !OMX_MX_WIRE_COMPAT */
 
+/* pushed large messages, see omx_io.h */
+#define OMX_PUSH_FRAGS_MAX		256 /* the frag seqnum is 8bits on the wire */
+#define OMX_PUSH_MSG_LENGTH_MAX		(OMX_PUSH_FRAGS_MAX * OMX_MEDIUM_FRAG_LENGTH_MAX)
+#define OMX_PUSH_SACK_FRAGS_NR		128
+#define OMX_PUSH_SACK_MASK_NR		(OMX_PUSH_SACK_FRAGS_NR/32)
+
 #define OMX_ENDPOINT_INDEX_MAX 256
 #define OMX_PEER_INDEX_MAX 65536
 
@@ -287,12 +293,22 @@ struct omx_pkt_truc {
 			uint8_t pad1;
 			/* 28 */
 		} liback;
+		struct omx_pkt_truc_push_sack_data {
+			uint8_t type;
+			uint8_t frag_base;
+			uint16_t lib_seqnum;
+			/* 16 */
+			uint32_t frags_mask[OMX_PUSH_SACK_MASK_NR];
+			/* 32 */
+		} push_sack;
 	};
 };
 #define OMX_PKT_TRUC_LIBACK_DATA_LENGTH sizeof(struct omx_pkt_truc_liback_data)
+#define OMX_PKT_TRUC_PUSH_SACK_DATA_LENGTH sizeof(struct omx_pkt_truc_push_sack_data)
 
 enum omx_pkt_truc_data_type {
-	OMX_PKT_TRUC_DATA_TYPE_ACK = 0x55
+	OMX_PKT_TRUC_DATA_TYPE_ACK = 0x55,
+	OMX_PKT_TRUC_DATA_TYPE_PUSH_SACK = 0x56
 };
 
 struct omx_pkt_connect { /* MX's pkt_connect + MX's lib connect_data */
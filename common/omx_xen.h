@@ -33,10 +33,37 @@
 #define OMX_XEN_MAX_ENDPOINTS OMX_ENDPOINT_INDEX_MAX
 #define OMX_XEN_GRANT_PAGES_MAX 16
 
+/* Ring pairs negotiated per guest over xenbus. Queue 0 uses the legacy
+ * xenstore keys and also carries the board-wide misc commands, others live
+ * under "queue-%u/". Endpoints are hashed onto a queue by their index. */
+#define OMX_XEN_MAX_QUEUES 8
+
+static inline unsigned int omx_xen_queue_index(uint32_t eid,
+					       unsigned int nr_queues)
+{
+	return nr_queues ? eid % nr_queues : 0;
+}
+
+#define OMX_XEN_QUEUE_NODE_MAX 32
+
+/* xenstore node of a per-queue key, relative to the device directory */
+static inline void omx_xen_queue_node(char *node, unsigned int index,
+				      const char *key)
+{
+	if (index)
+		snprintf(node, OMX_XEN_QUEUE_NODE_MAX, "queue-%u/%s", index,
+			 key);
+	else
+		snprintf(node, OMX_XEN_QUEUE_NODE_MAX, "%s", key);
+}
+
 /* FIXME: Don't miss this one!!!,
  * allocated memory in the backend rises exponentially  */
 #define OMX_XEN_COOKIES 1
 
+/* request flags, echoed back by the backend in the response */
+#define OMX_XEN_REQUEST_FLAG_ASYNC	0x1	/* nobody waits for the response */
+
 struct omx_cmd_xen_send_mediumsq_frag_done {
 	struct omx_evt_send_mediumsq_frag_done sq_frag_done;
 } __attribute__ ((__packed__));
@@ -181,8 +208,19 @@ struct omx_ring_msg_register_user_segment {
 	/* 32 */
 	uint16_t gref_offset;
 	uint8_t nr_parts;
+	uint8_t flags;
+	uint16_t nr_list_parts;
 } __attribute__ ((__packed__));
 
+/* the frontend keeps the page grants alive, see feature-persistent-grants */
+#define OMX_XEN_SEGMENT_PERSISTENT	(1 << 0)
+/* gref[] holds nr_parts indirect pages, which carry the grant references
+ * of the nr_list_parts gref list pages, see feature-indirect-grefs */
+#define OMX_XEN_SEGMENT_INDIRECT	(1 << 1)
+
+/* grant references held by a gref list or indirect page */
+#define OMX_XEN_GREFS_PER_PAGE	(PAGE_SIZE / sizeof(uint32_t))
+
 struct omx_ring_msg_deregister_user_segment {
 	uint32_t rid;
 	uint32_t eid;
@@ -245,6 +283,14 @@ struct omx_ring_msg_endpoint {
 	grant_ref_t recvq_gref;
 	grant_ref_t endpoint_gref;
 	uint16_t endpoint_offset;
+	/* event queues the backend writes into directly,
+	 * a zero size means the frontend did not grant them */
+	uint32_t exp_eventq_gref_size;
+	uint32_t unexp_eventq_gref_size;
+	uint16_t egref_exp_eventq_offset;
+	uint16_t egref_unexp_eventq_offset;
+	grant_ref_t exp_eventq_gref;
+	grant_ref_t unexp_eventq_gref;
 } __attribute__ ((__packed__));
 
 struct omx_xenif_request {
@@ -252,6 +298,8 @@ struct omx_xenif_request {
 	uint32_t board_index;
 	uint32_t eid;
 	int ret;
+	uint32_t id;
+	uint32_t flags;
 	union {
 		struct omx_ring_msg_register_user_segment cus;
 		struct omx_ring_msg_deregister_user_segment dus;
@@ -292,6 +340,8 @@ struct omx_xenif_response {
 	uint32_t board_index;
 	uint32_t eid;
 	int ret;
+	uint32_t id;
+	uint32_t flags;
 	union {
 		struct omx_ring_msg_register_user_segment cus;
 		struct omx_ring_msg_deregister_user_segment dus;
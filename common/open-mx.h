@@ -336,10 +336,37 @@ enum omx_info_key {
   /* returns the values of all counters */
   OMX_INFO_COUNTER_VALUES,
   /* returns the label of a counter */
-  OMX_INFO_COUNTER_LABEL
+  OMX_INFO_COUNTER_LABEL,
+  /* returns the registration cache counters of an endpoint (as a struct omx_regcache_counters) */
+  OMX_INFO_ENDPOINT_REGCACHE_COUNTERS,
+  /* returns the request and buffer allocator counters of an endpoint (as a struct omx_alloc_counters) */
+  OMX_INFO_ENDPOINT_ALLOC_COUNTERS
 };
 typedef enum omx_info_key omx_info_key_t;
 
+struct omx_regcache_counters {
+  uint64_t hits; /* reused a window registered for the exact same segments */
+  uint64_t superset_hits; /* reused a larger window, at an offset */
+  uint64_t misses; /* had to register a new window */
+  uint64_t evictions; /* unused windows released to make room */
+  uint64_t invalidations; /* windows released because their memory was freed */
+  uint64_t cached_bytes; /* bytes currently covered by cached windows */
+};
+
+struct omx_slab_counters {
+  uint64_t in_use; /* objects currently allocated */
+  uint64_t high_water; /* highest number of objects allocated at once */
+  uint64_t total; /* objects available, allocated or not */
+  uint64_t chunks; /* times the cache had to grow */
+  uint64_t failures; /* allocations that failed because the cache could not grow */
+};
+
+struct omx_alloc_counters {
+  struct omx_slab_counters requests;
+  struct omx_slab_counters early_packets;
+  struct omx_slab_counters small_buffers;
+};
+
 omx_return_t
 omx_cancel(omx_endpoint_t ep, omx_request_t *request, uint32_t *result);
 
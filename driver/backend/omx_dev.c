@@ -37,6 +37,7 @@
 #include "omx_peer.h"
 #include "omx_endpoint.h"
 #include "omx_reg.h"
+#include "omx_shared.h"
 //#define EXTRA_DEBUG_OMX
 #include "omx_xen_debug.h"
 
@@ -64,6 +65,8 @@ omx_endpoint_alloc_resources(struct omx_endpoint * endpoint)
 	}
 	userdesc->status = 0;
 	userdesc->session_id = endpoint->session_id;
+	userdesc->exp_eventq_consumed_index = 0;
+	userdesc->unexp_eventq_consumed_index = 0;
 	endpoint->userdesc = userdesc;
 
 	/* alloc and init user queues */
@@ -386,6 +389,29 @@ omx_endpoint_acquire_by_iface_index(const struct omx_iface * iface, uint8_t inde
 	return ERR_PTR(err);
 }
 
+/* shared communication hooks, the destination must be attached to a local iface */
+struct omx_endpoint *
+omx_shared_acquire_endpoint(struct omx_endpoint *src_endpoint,
+			    uint16_t peer_index, uint8_t endpoint_index)
+{
+	struct omx_endpoint *endpoint;
+
+	endpoint = omx_local_peer_acquire_endpoint(peer_index, endpoint_index);
+	if (endpoint && !IS_ERR(endpoint) && endpoint->xen) {
+		/* guest queues are only reachable through omx_xenback_shared.c */
+		omx_endpoint_release(endpoint);
+		return NULL;
+	}
+
+	return endpoint;
+}
+
+uint32_t
+omx_shared_peer_index(const struct omx_endpoint *endpoint)
+{
+	return endpoint->iface->peer.index;
+}
+
 /******************************
  * File operations
  */
@@ -454,6 +480,79 @@ static int (*omx_ioctl_with_endpoint_handlers[])(struct omx_endpoint * endpoint,
 	[OMX_EPCMD_RELEASE_UNEXP_SLOTS]		= omx_ioctl_release_unexp_slots,
 };
 
+
+/* the commands that may be submitted within a batch */
+#define OMX_SEND_BATCH_EPCMDS ((1ULL << OMX_EPCMD_SEND_TINY)		\
+			       | (1ULL << OMX_EPCMD_SEND_SMALL)		\
+			       | (1ULL << OMX_EPCMD_SEND_MEDIUMSQ_FRAG)	\
+			       | (1ULL << OMX_EPCMD_SEND_MEDIUMVA)	\
+			       | (1ULL << OMX_EPCMD_SEND_RNDV)		\
+			       | (1ULL << OMX_EPCMD_SEND_NOTIFY)	\
+			       | (1ULL << OMX_EPCMD_SEND_LIBACK))
+
+/*
+ * Submit a batch of send commands within a single ioctl.
+ * All entries are read and checked first, so that a malformed batch
+ * is rejected before anything goes on the wire.
+ */
+static int
+omx_ioctl_send_batch(struct omx_endpoint * endpoint, void __user * uparam)
+{
+	struct omx_cmd_send_batch cmd;
+	struct omx_cmd_send_batch_entry entries[OMX_SEND_BATCH_NR_MAX];
+	uint32_t i;
+	int ret;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send batch cmd hdr\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = -EINVAL;
+	if (unlikely(cmd.nr > OMX_SEND_BATCH_NR_MAX)) {
+		printk(KERN_ERR "Open-MX: Cannot send a batch of %ld commands (max %ld)\n",
+		       (unsigned long) cmd.nr, (unsigned long) OMX_SEND_BATCH_NR_MAX);
+		goto out;
+	}
+
+	ret = copy_from_user(entries, (void __user *)(unsigned long) cmd.entries,
+			     cmd.nr * sizeof(entries[0]));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send batch cmd entries\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for(i=0; i<cmd.nr; i++)
+		if (unlikely(entries[i].type >= 64
+			     || !(OMX_SEND_BATCH_EPCMDS & (1ULL << entries[i].type)))) {
+			printk(KERN_ERR "Open-MX: Cannot send command %ld in a batch\n",
+			       (unsigned long) entries[i].type);
+			ret = -EINVAL;
+			goto out;
+		}
+
+	ret = 0;
+	for(i=0; i<cmd.nr; i++) {
+		ret = omx_ioctl_with_endpoint_handlers[entries[i].type](endpoint,
+									(void __user *)(unsigned long) entries[i].param);
+		if (unlikely(ret < 0))
+			break;
+	}
+
+	if (unlikely(ret < 0)) {
+		/* tell user-space how many commands went through */
+		if (copy_to_user(&((struct omx_cmd_send_batch __user *) uparam)->submitted_nr,
+				 &i, sizeof(i)) != 0)
+			printk(KERN_ERR "Open-MX: Failed to write send batch cmd result\n");
+	}
+
+ out:
+	return ret;
+}
+
 /*
  * Main ioctl switch where all application ioctls arrive
  */
@@ -730,6 +829,22 @@ omx_miscdev_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 		break;
 	}
 
+	case OMX_CMD_SEND_BATCH: {
+		struct omx_endpoint * endpoint = file->private_data;
+
+		/*
+		 * the endpoint is already acquired by the file,
+		 * just check its status
+		 */
+		ret = -EINVAL;
+		if (unlikely(endpoint->status != OMX_ENDPOINT_STATUS_OK))
+			break;
+
+		ret = omx_ioctl_send_batch(endpoint, (void __user *) arg);
+
+		break;
+	}
+
 	case OMX_CMD_BENCH:
 	case OMX_CMD_SEND_TINY:
 	case OMX_CMD_SEND_SMALL:
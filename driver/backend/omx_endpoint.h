@@ -50,11 +50,24 @@ enum omx_endpoint_status {
 	OMX_ENDPOINT_STATUS_CLOSING,
 };
 
+/* guest event queue mapped page by page, NULL pages if not granted */
+struct omx_xen_eventq_map {
+	struct vm_struct *vm;
+	uint32_t gref_size;
+	uint32_t *list;
+	uint32_t handle;
+	struct page **pages;
+	uint32_t *handles;
+};
+
 struct omx_endpoint {
 	uint8_t board_index;
 	uint8_t endpoint_index;
 	uint32_t session_id;
 	uint8_t special_status;
+	/* set by the backend after writing into our event queues,
+	 * lives in the padding so that both sides keep the same layout */
+	uint8_t xen_event_pending;
 
 	pid_t opener_pid;
 	char opener_comm[TASK_COMM_LEN];
@@ -120,6 +133,8 @@ struct omx_endpoint {
 	/* to be removed soon */
 
 	struct backend_info *be;
+	/* ring pair of the guest carrying our events, set at open */
+	struct omx_xenif_st *xenif;
 	struct omx_xen_user_region *region;
 	uint8_t xen:1;
 
@@ -144,6 +159,9 @@ struct omx_endpoint {
 	uint32_t xen_recvq_handle;
 	uint32_t *xen_recvq_handles;
 
+	struct omx_xen_eventq_map xen_exp_eventq;
+	struct omx_xen_eventq_map xen_unexp_eventq;
+
 	omx_eventq_index_t xen_next_recvq_index;
 	omx_eventq_index_t xen_nextfree_unexp_eventq_index;
 	omx_eventq_index_t xen_nextreserved_unexp_eventq_index;
@@ -201,6 +201,57 @@ omx_endpoint_queues_init(struct omx_endpoint *endpoint)
 	dprintk_out();
 }
 
+/*
+ * User-space publishes the index of the next event it will consume in the
+ * endpoint descriptor instead of releasing slots with an ioctl, so only look
+ * at it when a queue looks full. It may only move forward, and never past
+ * the slots that were actually given to user-space.
+ */
+static void
+omx_update_released_exp_slots(struct omx_endpoint *endpoint)
+{
+	omx_eventq_index_t consumed;
+
+	spin_lock_bh(&endpoint->release_exp_lock);
+	consumed = ACCESS_ONCE(endpoint->userdesc->exp_eventq_consumed_index);
+	if (consumed - endpoint->nextreleased_exp_eventq_index
+	    <= endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index)
+		endpoint->nextreleased_exp_eventq_index = consumed;
+	spin_unlock_bh(&endpoint->release_exp_lock);
+}
+
+static void
+omx_update_released_unexp_slots(struct omx_endpoint *endpoint)
+{
+	omx_eventq_index_t consumed;
+
+	spin_lock_bh(&endpoint->release_unexp_lock);
+	consumed = ACCESS_ONCE(endpoint->userdesc->unexp_eventq_consumed_index);
+	if (consumed - endpoint->nextreleased_unexp_eventq_index
+	    <= ACCESS_ONCE(endpoint->nextreserved_unexp_eventq_index) - endpoint->nextreleased_unexp_eventq_index)
+		endpoint->nextreleased_unexp_eventq_index = consumed;
+	spin_unlock_bh(&endpoint->release_unexp_lock);
+}
+
+/* check whether the queue overflows once its free index is 'free' */
+static INLINE int
+omx_exp_eventq_full(struct omx_endpoint *endpoint, omx_eventq_index_t free)
+{
+	if (likely(free - endpoint->nextreleased_exp_eventq_index <= OMX_EXP_EVENTQ_ENTRY_NR))
+		return 0;
+	omx_update_released_exp_slots(endpoint);
+	return free - endpoint->nextreleased_exp_eventq_index > OMX_EXP_EVENTQ_ENTRY_NR;
+}
+
+static INLINE int
+omx_unexp_eventq_full(struct omx_endpoint *endpoint, omx_eventq_index_t free)
+{
+	if (likely(free - endpoint->nextreleased_unexp_eventq_index <= OMX_UNEXP_EVENTQ_ENTRY_NR))
+		return 0;
+	omx_update_released_unexp_slots(endpoint);
+	return free - endpoint->nextreleased_unexp_eventq_index > OMX_UNEXP_EVENTQ_ENTRY_NR;
+}
+
 /******************************************
  * Report an expected event to users-space
  */
@@ -216,8 +267,7 @@ omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int lengt
 	/* take the next slot and update the queue */
 	index = atomic_inc_return((atomic_t *) &endpoint->nextfree_exp_eventq_index) - 1;
 
-	if (unlikely(endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
-		     > OMX_EXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_exp_eventq_full(endpoint, endpoint->nextfree_exp_eventq_index))) {
 		/* we went too far, rollback */
 		atomic_dec((atomic_t *) &endpoint->nextfree_exp_eventq_index);
 		/* the application sucks, it did not check
@@ -270,8 +320,7 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 	index = endpoint->nextreserved_unexp_eventq_index++;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_full(endpoint, endpoint->nextfree_unexp_eventq_index))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index--;
@@ -327,27 +376,12 @@ omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 
 	dprintk_in();
 	if (endpoint->xen) {
-		spin_lock_bh(&endpoint->unexp_lock);
-		/* reserve the next slot and update the queue */
-		//endpoint->nextfree_unexp_eventq_index++;
-		rmb();
-		frontend_endpoint->nextfree_unexp_eventq_index++;
-		wmb();
-		/* take the next recvq slot and return it now */
-		//recvq_index = endpoint->next_recvq_index++;
-		rmb();
-		recvq_index = frontend_endpoint->next_recvq_index++;
-		wmb();
-		spin_unlock_bh(&endpoint->unexp_lock);
-
-		if (unlikely(frontend_endpoint->nextfree_unexp_eventq_index - frontend_endpoint->nextreleased_unexp_eventq_index > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+		/* reserve the next slot and update the queue, the guest updates
+		 * these indexes concurrently so we may only use atomics on them */
+		if (unlikely(atomic_inc_return((atomic_t *) &frontend_endpoint->nextfree_unexp_eventq_index)
+			     - frontend_endpoint->nextreleased_unexp_eventq_index > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
 			/* we went too far, rollback */
-			spin_lock_bh(&endpoint->unexp_lock);
-			rmb();
-			frontend_endpoint->nextfree_unexp_eventq_index--;
-			recvq_index = frontend_endpoint->next_recvq_index--;
-			wmb();
-			spin_unlock_bh(&endpoint->unexp_lock);
+			atomic_dec((atomic_t *) &frontend_endpoint->nextfree_unexp_eventq_index);
 			/* the application did not process the unexpected queue and release slots fast enough */
 			dprintk(EVENT,
 				"Open-MX: Unexpected event queue full, no event slot available for endpoint %d\n",
@@ -359,6 +393,8 @@ omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 			goto out;
 		}
 
+		/* take the next recvq slot and return it now */
+		recvq_index = atomic_inc_return((atomic_t *) &frontend_endpoint->next_recvq_index) - 1;
 		*recvq_offset_p = (recvq_index % OMX_RECVQ_ENTRY_NR) * OMX_RECVQ_ENTRY_SIZE;
 	}
 out:
@@ -382,8 +418,7 @@ omx_prepare_notify_unexp_events_with_recvq(struct omx_endpoint *endpoint,
 	endpoint->next_recvq_index += nr;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_full(endpoint, endpoint->nextfree_unexp_eventq_index))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index -= nr;
@@ -482,6 +517,175 @@ omx_cancel_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint)
 	dprintk_out();
 }
 
+/*****************************************************
+ * Report events straight into the guest event queues
+ */
+
+/*
+ * The event queues of the guest are mapped page by page, since we cannot
+ * vmap grant-mapped pages. Events never cross a page boundary.
+ */
+static INLINE union omx_evt *
+omx_xen_eventq_slot(struct page **pages, unsigned long offset)
+{
+	return page_address(pages[offset >> PAGE_SHIFT]) + (offset & ~PAGE_MASK);
+}
+
+static INLINE void
+omx_xen_write_event(union omx_evt *slot, omx_eventq_index_t index,
+		    const void *event, int length)
+{
+	/* store the event without setting the id first */
+	memcpy(slot, event, length);
+	wmb();
+	/* write the actual id now that the whole event has been written to memory */
+	((struct omx_evt_generic *) slot)->id = 1 + (index % OMX_EVENT_ID_MAX);
+}
+
+/* Tell the guest to wake up its waiters, unless it has not seen the previous kick yet */
+static INLINE void
+omx_xen_kick_frontend(struct omx_endpoint *endpoint)
+{
+	wmb();
+	if (!xchg(&endpoint->fe_endpoint->xen_event_pending, 1))
+		omx_xen_kick_domU(endpoint->xenif);
+}
+
+/*
+ * Returns -ENODEV when the guest did not grant its event queues,
+ * and -EBUSY when the queue is full. The caller then forwards the event
+ * through the ring so that the guest handles the overflow itself.
+ */
+int
+omx_xen_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int length)
+{
+	struct omx_endpoint *frontend_endpoint = endpoint->fe_endpoint;
+	struct page **pages = ACCESS_ONCE(endpoint->xen_exp_eventq.pages);
+	omx_eventq_index_t index;
+	int ret = 0;
+
+	dprintk_in();
+	if (unlikely(!pages)) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	/* take the next slot and update the queue */
+	index = atomic_inc_return((atomic_t *) &frontend_endpoint->nextfree_exp_eventq_index) - 1;
+
+	if (unlikely(index + 1 - frontend_endpoint->nextreleased_exp_eventq_index
+		     > OMX_EXP_EVENTQ_ENTRY_NR)) {
+		/* we went too far, rollback */
+		atomic_dec((atomic_t *) &frontend_endpoint->nextfree_exp_eventq_index);
+		ret = -EBUSY;
+		goto out;
+	}
+
+	omx_xen_write_event(omx_xen_eventq_slot(pages, (index % OMX_EXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE),
+			    index, event, length);
+	omx_xen_kick_frontend(endpoint);
+
+out:
+	dprintk_out();
+	return ret;
+}
+
+int
+omx_xen_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int length)
+{
+	struct omx_endpoint *frontend_endpoint = endpoint->fe_endpoint;
+	struct page **pages = ACCESS_ONCE(endpoint->xen_unexp_eventq.pages);
+	omx_eventq_index_t index;
+	int ret = 0;
+
+	dprintk_in();
+	if (unlikely(!pages)) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	/* only take the reserved index once we know we won't have to roll back */
+	if (unlikely(atomic_inc_return((atomic_t *) &frontend_endpoint->nextfree_unexp_eventq_index)
+		     - frontend_endpoint->nextreleased_unexp_eventq_index > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+		/* we went too far, rollback */
+		atomic_dec((atomic_t *) &frontend_endpoint->nextfree_unexp_eventq_index);
+		ret = -EBUSY;
+		goto out;
+	}
+	index = atomic_inc_return((atomic_t *) &frontend_endpoint->nextreserved_unexp_eventq_index) - 1;
+
+	omx_xen_write_event(omx_xen_eventq_slot(pages, (index % OMX_UNEXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE),
+			    index, event, length);
+	omx_xen_kick_frontend(endpoint);
+
+out:
+	dprintk_out();
+	return ret;
+}
+
+/*
+ * Commit an event whose recvq slot was reserved by
+ * omx_prepare_notify_unexp_event_with_recvq() earlier.
+ */
+int
+omx_xen_commit_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
+					     const void *event, int length)
+{
+	struct omx_endpoint *frontend_endpoint = endpoint->fe_endpoint;
+	struct page **pages = ACCESS_ONCE(endpoint->xen_unexp_eventq.pages);
+	omx_eventq_index_t index;
+	int ret = 0;
+
+	dprintk_in();
+	if (unlikely(!pages)) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	index = atomic_inc_return((atomic_t *) &frontend_endpoint->nextreserved_unexp_eventq_index) - 1;
+
+	omx_xen_write_event(omx_xen_eventq_slot(pages, (index % OMX_UNEXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE),
+			    index, event, length);
+	omx_xen_kick_frontend(endpoint);
+
+out:
+	dprintk_out();
+	return ret;
+}
+
+/*
+ * Release a slot reserved by omx_prepare_notify_unexp_event_with_recvq()
+ * when the event cannot be committed. If the guest eventq is mapped, store
+ * an ignored event as omx_cancel_notify_unexp_event_with_recvq() does.
+ * Otherwise nothing was written yet, give the reservation back, the recvq
+ * slot is just skipped.
+ */
+void
+omx_xen_cancel_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint)
+{
+	struct omx_endpoint *frontend_endpoint = endpoint->fe_endpoint;
+	struct page **pages = ACCESS_ONCE(endpoint->xen_unexp_eventq.pages);
+	struct omx_evt_generic event;
+	omx_eventq_index_t index;
+
+	dprintk_in();
+	if (unlikely(!pages)) {
+		atomic_dec((atomic_t *) &frontend_endpoint->nextfree_unexp_eventq_index);
+		goto out;
+	}
+
+	index = atomic_inc_return((atomic_t *) &frontend_endpoint->nextreserved_unexp_eventq_index) - 1;
+
+	memset(&event, 0, sizeof(event));
+	event.type = OMX_EVT_IGNORE;
+	omx_xen_write_event(omx_xen_eventq_slot(pages, (index % OMX_UNEXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE),
+			    index, &event, sizeof(event));
+	/* no need to wake up the guest */
+
+out:
+	dprintk_out();
+}
+
 /***********
  * Sleeping
  */
@@ -646,13 +850,13 @@ omx_ioctl_release_exp_slots(struct omx_endpoint *endpoint, void __user *uparam)
 {
 	int err = 0;
 	dprintk_in();
-	spin_lock(&endpoint->release_exp_lock);
+	spin_lock_bh(&endpoint->release_exp_lock);
 	if (endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
 	    < OMX_EXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_exp_eventq_index += OMX_EXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_exp_lock);
+	spin_unlock_bh(&endpoint->release_exp_lock);
 	dprintk_out();
 	return err;
 }
@@ -662,13 +866,13 @@ omx_ioctl_release_unexp_slots(struct omx_endpoint *endpoint, void __user *uparam
 {
 	int err = 0;
 	dprintk_in();
-	spin_lock(&endpoint->release_unexp_lock);
+	spin_lock_bh(&endpoint->release_unexp_lock);
 	if (endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
 	    < OMX_UNEXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_unexp_eventq_index += OMX_UNEXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_unexp_lock);
+	spin_unlock_bh(&endpoint->release_unexp_lock);
 	dprintk_out();
 	return err;
 }
@@ -678,13 +882,13 @@ omx_ioctl_xen_release_unexp_slots(struct omx_endpoint *endpoint, void __user *up
 {
 	int err = 0;
 	dprintk_in();
-	spin_lock(&endpoint->release_unexp_lock);
+	spin_lock_bh(&endpoint->release_unexp_lock);
 	if (endpoint->xen_nextreserved_unexp_eventq_index - endpoint->xen_nextreleased_unexp_eventq_index
 	    < OMX_UNEXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->xen_nextreleased_unexp_eventq_index += OMX_UNEXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_unexp_lock);
+	spin_unlock_bh(&endpoint->release_unexp_lock);
 	dprintk_out();
 	return err;
 }
@@ -113,6 +113,26 @@ unsigned long omx_user_rights = 0;
 module_param_named(userrights, omx_user_rights, ulong, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(userrights, "Mask of privileged operation rights that are granted regular users");
 
+int omx_xen_queues = OMX_XEN_MAX_QUEUES;
+module_param_named(xen_queues, omx_xen_queues, uint, S_IRUGO);
+MODULE_PARM_DESC(xen_queues, "Maximal number of ring pairs offered to each guest");
+
+int omx_xen_poll_usecs = 20;
+module_param_named(xen_poll_usecs, omx_xen_poll_usecs, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(xen_poll_usecs, "Default maximal time (us) the Xen request workers of a new guest busy-poll an idle ring before re-enabling notifications (0 = interrupt only); tune a running guest through its open-mx/poll_usecs sysfs attribute");
+
+int omx_xen_pgrant_pages = 16384;
+module_param_named(xen_pgrant_pages, omx_xen_pgrant_pages, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(xen_pgrant_pages, "Number of guest pages kept mapped by the persistent grant cache of each guest (0 = disabled)");
+
+int omx_xen_indirect_parts = OMX_XEN_GRANT_PAGES_MAX;
+module_param_named(xen_indirect_parts, omx_xen_indirect_parts, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(xen_indirect_parts, "Maximal number of indirect gref pages per registered segment (0 = disabled)");
+
+int omx_xen_shared_host = 1;
+module_param_named(xen_shared_host, omx_xen_shared_host, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(xen_shared_host, "Let guests of this host communicate through dom0 instead of the network");
+
 #ifdef OMX_HAVE_DMA_ENGINE
 int omx_dmaengine = 0; /* disabled by default for now */
 module_param_named(dmaengine, omx_dmaengine, uint, S_IRUGO|S_IWUSR);
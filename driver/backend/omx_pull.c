@@ -127,6 +127,7 @@ struct omx_pull_handle {
 	struct omx_xen_user_region * xregion;
 	uint32_t total_length;
 	uint32_t pulled_rdma_offset;
+	uint32_t puller_rdma_offset;
 
 	/* current status */
 	spinlock_t lock;
@@ -674,6 +675,7 @@ omx_pull_handle_create(struct omx_endpoint * endpoint,
 	}
 	handle->total_length = cmd->length;
 	handle->pulled_rdma_offset = cmd->pulled_rdma_offset;
+	handle->puller_rdma_offset = cmd->puller_rdma_offset;
 
 	/* initialize variable stuff */
 	handle->status = OMX_PULL_HANDLE_STATUS_OK;
@@ -794,10 +796,15 @@ omx_pull_handle_notify(struct omx_pull_handle * handle)
 
 	dprintk_in();
 	if (endpoint->xen) {
-		omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
+		omx_xenif_t * omx_xenif = endpoint->xenif;
 		struct omx_xenif_response *ring_resp;
 		dprintk(PULL, "XEN ENDPOINT! PULL DONE!@%#lx\n", (unsigned long) omx_xenif);
 
+		/* write the event straight into the guest eventq if we can */
+		if (!omx_xen_notify_exp_event(endpoint, &handle->done_event,
+					      sizeof(handle->done_event)))
+			goto xen_out;
+
                 ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
 		ring_resp->func = OMX_CMD_XEN_RECV_PULL_DONE;
 		ring_resp->board_index = endpoint->board_index;
@@ -822,6 +829,7 @@ omx_pull_handle_notify(struct omx_pull_handle * handle)
 		/* release the handle */
 		omx_pull_handle_release(handle);
 	}
+xen_out:
 	omx_endpoint_release(endpoint);
 
 	/*
@@ -2131,7 +2139,9 @@ omx_recv_pull_reply(struct omx_iface * iface,
 	if (omx_dmaengine
 	    && frame_length >= omx_dma_async_frag_min
 	    && handle->total_length >= omx_dma_async_min) {
-		remaining_copy = omx_pull_handle_reply_try_dma_copy(iface, handle, skb, msg_offset, frame_length);
+		remaining_copy = omx_pull_handle_reply_try_dma_copy(iface, handle, skb,
+								    handle->puller_rdma_offset + msg_offset,
+								    frame_length);
 		if (likely(remaining_copy != frame_length))
 			free_skb = 0;
 	}
@@ -2151,9 +2161,9 @@ omx_recv_pull_reply(struct omx_iface * iface,
 		dprintk(PULL, "copying PULL_REPLY %ld bytes for msg_offset %ld at region offset %ld\n",
 		       (unsigned long) frame_length,
 		       (unsigned long) msg_offset,
-		       (unsigned long) msg_offset);
+		       (unsigned long) (handle->puller_rdma_offset + msg_offset));
 		err = omx_user_region_fill_pages(handle->region, handle->xregion,
-						 msg_offset,
+						 handle->puller_rdma_offset + msg_offset,
 						 skb,
 						 frame_length);
 		if (unlikely(err < 0)) {
@@ -116,17 +116,13 @@ omx_recv_connect(struct omx_iface * iface,
 	}
 
 	if (endpoint->xen) {
-		omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
+		omx_xenif_t * omx_xenif = endpoint->xenif;
 		struct omx_xenif_response *ring_resp;
 		dprintk_deb("XEN ENDPOINT! fw to the relevant domU via xenif@%#lx\n", (unsigned long) omx_xenif);
 
-		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
 		if (!is_reply) {
 			struct omx_evt_recv_connect_request request_event;
 
-			ring_resp->func = OMX_CMD_RECV_CONNECT_REQUEST;
-			ring_resp->board_index = endpoint->board_index;
-			ring_resp->eid = endpoint->endpoint_index;
 			request_event.id = 0;
 			request_event.type = OMX_EVT_RECV_CONNECT_REQUEST;
 			request_event.peer_index = peer_index;
@@ -138,6 +134,13 @@ omx_recv_connect(struct omx_iface * iface,
 			request_event.target_recv_seqnum_start = OMX_NTOH_16(connect_n->request.target_recv_seqnum_start);
 			request_event.connect_seqnum = OMX_NTOH_8(connect_n->request.connect_seqnum);
 
+			if (!omx_xen_notify_unexp_event(endpoint, &request_event, sizeof(request_event)))
+				goto xen_out;
+
+			ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+			ring_resp->func = OMX_CMD_RECV_CONNECT_REQUEST;
+			ring_resp->board_index = endpoint->board_index;
+			ring_resp->eid = endpoint->endpoint_index;
 			memcpy(&ring_resp->data.recv_connect_request.request, &request_event, sizeof(request_event));
 			dump_xen_recv_connect_request(&ring_resp->data.recv_connect_request);
 			omx_poke_domU(omx_xenif, ring_resp);
@@ -145,9 +148,6 @@ omx_recv_connect(struct omx_iface * iface,
 		} else {
 			struct omx_evt_recv_connect_reply reply_event;
 
-			ring_resp->func = OMX_CMD_RECV_CONNECT_REPLY;
-			ring_resp->board_index = endpoint->board_index;
-			ring_resp->eid = endpoint->endpoint_index;
 			reply_event.id = 0;
 			reply_event.type = OMX_EVT_RECV_CONNECT_REPLY;
 			reply_event.peer_index = peer_index;
@@ -162,6 +162,13 @@ omx_recv_connect(struct omx_iface * iface,
 			BUILD_BUG_ON(OMX_CONNECT_STATUS_SUCCESS != OMX_PKT_CONNECT_STATUS_SUCCESS);
 			BUILD_BUG_ON(OMX_CONNECT_STATUS_BAD_KEY != OMX_PKT_CONNECT_STATUS_BAD_KEY);
 
+			if (!omx_xen_notify_unexp_event(endpoint, &reply_event, sizeof(reply_event)))
+				goto xen_out;
+
+			ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+			ring_resp->func = OMX_CMD_RECV_CONNECT_REPLY;
+			ring_resp->board_index = endpoint->board_index;
+			ring_resp->eid = endpoint->endpoint_index;
 			memcpy(&ring_resp->data.recv_connect_reply.reply, &reply_event, sizeof(reply_event));
 			dump_xen_recv_connect_reply(&ring_resp->data.recv_connect_reply);
 			omx_poke_domU(omx_xenif, ring_resp);
@@ -313,50 +320,6 @@ omx_recv_tiny(struct omx_iface * iface,
 
 	omx_recv_dprintk(eh, "TINY length %ld", (unsigned long) length);
 
-	if (endpoint->xen) {
-		struct omx_evt_recv_msg *event;
-		omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
-		struct omx_xenif_response *ring_resp;
-		dprintk_deb("XEN ENDPOINT! fw to the relevant domU via xenif@%#lx\n", (unsigned long) omx_xenif);
-
-		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
-		ring_resp->func = OMX_CMD_RECV_TINY;
-		ring_resp->board_index = endpoint->board_index;
-		ring_resp->eid = endpoint->endpoint_index;
-		event = &ring_resp->data.recv_msg.msg;
-
-		/* fill event */
-		event->id = 0;
-		event->type = OMX_EVT_RECV_TINY;
-		event->peer_index = peer_index;
-		event->src_endpoint = src_endpoint;
-		event->match_info = OMX_NTOH_MATCH_INFO(tiny_n);
-		event->seqnum = lib_seqnum;
-		event->piggyack = lib_piggyack;
-		event->specific.tiny.length = length;
-		event->specific.tiny.checksum = OMX_NTOH_16(tiny_n->checksum);
-
-		/* FIXME: is this correct ? we copy directly into the ring structure.
-		 * What about concurrency ?????, how do we make sure that the ring won't overflow ?
-		 */
-
-		//memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
-		//memcpy(&ring_resp->data.recv_msg.msg.specific.tiny, &event.specific.tiny, sizeof(event.specific.tiny));
-		//ring_resp->data.recv_msg.msg.specific.tiny.length = event.specific.tiny.length;
-		//ring_resp->data.recv_msg.msg.specific.tiny.checksum = event.specific.tiny.checksum;
-#if 0
-		err = skb_copy_bits(skb, hdr_len, event.specific.tiny.data, length);
-		BUG_ON(err < 0);
-#endif
-		err = skb_copy_bits(skb, hdr_len, ring_resp->data.recv_msg.msg.specific.tiny.data, length);
-		BUG_ON(err < 0);
-		//memcpy(ring_resp->data.recv_msg.msg.specific.tiny.data, event.specific.tiny.data, length);
-
-		//dump_xen_recv_tiny(&ring_resp->data.recv_msg);
-		TIMER_START(&endpoint->fe_endpoint->otherway);
-		omx_poke_domU(omx_xenif, ring_resp);
-		goto xen_out;
-	}
 	/* fill event */
 	event.id = 0;
 	event.type = OMX_EVT_RECV_TINY;
@@ -375,6 +338,29 @@ omx_recv_tiny(struct omx_iface * iface,
 	BUG_ON(err < 0);
 #endif
 
+	if (endpoint->xen) {
+		omx_xenif_t * omx_xenif = endpoint->xenif;
+		struct omx_xenif_response *ring_resp;
+
+		/* write the event straight into the guest eventq if we can */
+		if (!omx_xen_notify_unexp_event(endpoint, &event, sizeof(event)))
+			goto xen_out;
+
+		dprintk_deb("XEN ENDPOINT! fw to the relevant domU via xenif@%#lx\n", (unsigned long) omx_xenif);
+
+		/* FIXME: what about concurrency ?????, how do we make sure that the ring won't overflow ? */
+		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+		ring_resp->func = OMX_CMD_RECV_TINY;
+		ring_resp->board_index = endpoint->board_index;
+		ring_resp->eid = endpoint->endpoint_index;
+		memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
+
+		//dump_xen_recv_tiny(&ring_resp->data.recv_msg);
+		TIMER_START(&endpoint->fe_endpoint->otherway);
+		omx_poke_domU(omx_xenif, ring_resp);
+		goto xen_out;
+	}
+
 	/* notify the event */
 	err = omx_notify_unexp_event(endpoint, &event, sizeof(event));
 	if (unlikely(err < 0)) {
@@ -476,7 +462,7 @@ omx_recv_small(struct omx_iface * iface,
 	}
 
         if (endpoint->xen) {
-                omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
+                omx_xenif_t * omx_xenif = endpoint->xenif;
                 struct omx_xenif_response *ring_resp;
 		uint16_t offset;
                 dprintk_deb("XEN ENDPOINT! have to get a recvq offset and poke the frontend via xenif@%#lx\n", (unsigned long) omx_xenif);
@@ -494,11 +480,6 @@ omx_recv_small(struct omx_iface * iface,
 			goto out_with_endpoint;
 		}
 
-		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
-		ring_resp->func = OMX_CMD_RECV_SMALL;
-		ring_resp->board_index = endpoint->board_index;
-		ring_resp->eid = endpoint->endpoint_index;
-
 		/* fill event */
 		event.id = 0;
 		event.type = OMX_EVT_RECV_SMALL;
@@ -508,18 +489,12 @@ omx_recv_small(struct omx_iface * iface,
 		event.seqnum = lib_seqnum;
 		event.piggyack = lib_piggyack;
 		event.specific.small.length = length;
-
+		event.specific.small.recvq_offset = recvq_offset;
 		event.specific.small.checksum = OMX_NTOH_16(small_n->checksum);
+		dprintk_deb("%s: recvq_offset = %#x\n", __func__, recvq_offset);
 
 		omx_recv_dprintk(eh, "SMALL length %ld", (unsigned long) length);
 
-		memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
-
-		event.specific.small.recvq_offset = recvq_offset;
-		dprintk_deb("%s: recvq_offset = %#x\n", __func__, recvq_offset);
-
-		memcpy(&ring_resp->data.recv_msg.msg.specific.small, &event.specific.small, sizeof(event.specific.small));
-#if 1
 		offset = recvq_offset &~PAGE_MASK;
 		if (offset)
 			printk_inf("offset = %#x\n", offset);
@@ -527,7 +502,16 @@ omx_recv_small(struct omx_iface * iface,
 		err = skb_copy_bits(skb, hdr_len, pfn_to_kaddr(page_to_pfn((endpoint->xen_recvq_pages[recvq_offset>>PAGE_SHIFT]))) + offset, length);
 		/* cannot fail since pages are allocated by us */
 		BUG_ON(err < 0);
-#endif
+
+		/* write the event straight into the guest eventq if we can */
+		if (!omx_xen_commit_notify_unexp_event_with_recvq(endpoint, &event, sizeof(event)))
+			goto xen_out;
+
+		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+		ring_resp->func = OMX_CMD_RECV_SMALL;
+		ring_resp->board_index = endpoint->board_index;
+		ring_resp->eid = endpoint->endpoint_index;
+		memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
 
                 omx_poke_domU(omx_xenif, ring_resp);
                 goto xen_out;
@@ -672,7 +656,7 @@ omx_recv_medium_frag(struct omx_iface * iface,
 	}
 
         if (endpoint->xen) {
-                omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
+                omx_xenif_t * omx_xenif = endpoint->xenif;
                 struct omx_xenif_response *ring_resp;
                 dprintk_deb("XEN ENDPOINT! have to get a recvq offset and poke the frontend via xenif@%#lx\n", (unsigned long) omx_xenif);
 
@@ -689,11 +673,6 @@ omx_recv_medium_frag(struct omx_iface * iface,
 			goto out_with_endpoint;
 		}
 
-		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
-		ring_resp->func = OMX_CMD_RECV_MEDIUM_FRAG;
-		ring_resp->board_index = endpoint->board_index;
-		ring_resp->eid = endpoint->endpoint_index;
-
 		/* fill event */
 		event.id = 0;
 		event.type = OMX_EVT_RECV_MEDIUM_FRAG;
@@ -711,13 +690,13 @@ omx_recv_medium_frag(struct omx_iface * iface,
 		event.specific.medium_frag.frag_length = frag_length;
 		event.specific.medium_frag.frag_seqnum = OMX_NTOH_8(medium_n->frag_seqnum);
 		event.specific.medium_frag.checksum = OMX_NTOH_16(medium_n->checksum);
+		event.specific.medium_frag.exp_slot = 0;
+		event.specific.medium_frag.exp_flags = 0;
 
 		event.specific.medium_frag.recvq_offset = recvq_offset;
 
 		//dprintk_inf("%s: recvq_offset = %#x\n", __func__, recvq_offset);
 		omx_recv_dprintk(eh, "MEDIUM_FRAG length %ld", (unsigned long) frag_length);
-		memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
-		memcpy(&ring_resp->data.recv_msg.msg.specific.medium_frag, &event.specific.medium_frag, sizeof(event.specific.medium_frag));
 
 #if 1
 		/* copy what's remaining */
@@ -745,6 +724,16 @@ omx_recv_medium_frag(struct omx_iface * iface,
 		}
 		kfree(staging);
 #endif
+
+		/* write the event straight into the guest eventq if we can */
+		if (!omx_xen_commit_notify_unexp_event_with_recvq(endpoint, &event, sizeof(event)))
+			goto xen_out;
+
+		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+		ring_resp->func = OMX_CMD_RECV_MEDIUM_FRAG;
+		ring_resp->board_index = endpoint->board_index;
+		ring_resp->eid = endpoint->endpoint_index;
+		memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
                 omx_poke_domU(omx_xenif, ring_resp);
 		goto xen_out;
 
@@ -804,6 +793,8 @@ omx_recv_medium_frag(struct omx_iface * iface,
 	event.specific.medium_frag.frag_length = frag_length;
 	event.specific.medium_frag.frag_seqnum = OMX_NTOH_8(medium_n->frag_seqnum);
 	event.specific.medium_frag.checksum = OMX_NTOH_16(medium_n->checksum);
+	event.specific.medium_frag.exp_slot = 0;
+	event.specific.medium_frag.exp_flags = 0;
 	event.specific.medium_frag.recvq_offset = recvq_offset;
 
 	omx_recv_dprintk(eh, "MEDIUM_FRAG length %ld", (unsigned long) frag_length);
@@ -914,15 +905,10 @@ omx_recv_rndv(struct omx_iface * iface,
 
 	if (endpoint->xen) {
 		struct omx_evt_recv_msg event;
-		omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
+		omx_xenif_t * omx_xenif = endpoint->xenif;
 		struct omx_xenif_response *ring_resp;
 		dprintk_deb("XEN ENDPOINT! fw to the relevant domU via xenif@%#lx\n", (unsigned long) omx_xenif);
 
-		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
-		ring_resp->func = OMX_CMD_RECV_RNDV;
-		ring_resp->board_index = endpoint->board_index;
-		ring_resp->eid = endpoint->endpoint_index;
-
 		event.id = 0;
 		event.type = OMX_EVT_RECV_RNDV;
 		event.peer_index = peer_index;
@@ -936,8 +922,15 @@ omx_recv_rndv(struct omx_iface * iface,
 		event.specific.rndv.pulled_rdma_offset = OMX_NTOH_16(rndv_n->pulled_rdma_offset);
 		event.specific.rndv.checksum = OMX_NTOH_16(rndv_n->msg.checksum);
 
+		/* write the event straight into the guest eventq if we can */
+		if (!omx_xen_notify_unexp_event(endpoint, &event, sizeof(event)))
+			goto xen_out;
+
+		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+		ring_resp->func = OMX_CMD_RECV_RNDV;
+		ring_resp->board_index = endpoint->board_index;
+		ring_resp->eid = endpoint->endpoint_index;
 		memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
-		memcpy(&ring_resp->data.recv_msg.msg.specific.rndv, &event.specific.rndv, sizeof(event.specific.rndv));
 
 		dump_xen_recv_msg(&ring_resp->data.recv_msg);
 		omx_poke_domU(omx_xenif, ring_resp);
@@ -1039,15 +1032,10 @@ omx_recv_notify(struct omx_iface * iface,
 
 	if (endpoint->xen) {
 		struct omx_evt_recv_msg event;
-		omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
+		omx_xenif_t * omx_xenif = endpoint->xenif;
 		struct omx_xenif_response *ring_resp;
 		dprintk_deb("XEN ENDPOINT! fw to the relevant domU via xenif@%#lx\n", (unsigned long) omx_xenif);
 
-		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
-		ring_resp->func = OMX_CMD_RECV_NOTIFY;
-		ring_resp->board_index = endpoint->board_index;
-		ring_resp->eid = endpoint->endpoint_index;
-
 		/* fill event */
 		event.id = 0;
 		event.type = OMX_EVT_RECV_NOTIFY;
@@ -1059,8 +1047,15 @@ omx_recv_notify(struct omx_iface * iface,
 		event.specific.notify.pulled_rdma_id = OMX_NTOH_8(notify_n->pulled_rdma_id);
 		event.specific.notify.pulled_rdma_seqnum = OMX_NTOH_8(notify_n->pulled_rdma_seqnum);
 
+		/* write the event straight into the guest eventq if we can */
+		if (!omx_xen_notify_unexp_event(endpoint, &event, sizeof(event)))
+			goto xen_out;
+
+		ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+		ring_resp->func = OMX_CMD_RECV_NOTIFY;
+		ring_resp->board_index = endpoint->board_index;
+		ring_resp->eid = endpoint->endpoint_index;
 		memcpy(&ring_resp->data.recv_msg.msg, &event, sizeof(event));
-		memcpy(&ring_resp->data.recv_msg.msg.specific.notify, &event.specific.notify, sizeof(event.specific.notify));
 
 		dump_xen_recv_notify(&ring_resp->data.recv_msg);
 		omx_poke_domU(omx_xenif, ring_resp);
@@ -1183,10 +1178,14 @@ omx_recv_truc(struct omx_iface * iface,
 		liback_event.resent = OMX_NTOH_8(truc_n->liback.resent);
 
 		if (endpoint->xen) {
-			omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
+			omx_xenif_t * omx_xenif = endpoint->xenif;
 			struct omx_xenif_response *ring_resp;
 			dprintk_deb("XEN ENDPOINT! fw to the relevant domU via xenif@%#lx\n", (unsigned long) omx_xenif);
 
+			/* write the event straight into the guest eventq if we can */
+			if (!omx_xen_notify_unexp_event(endpoint, &liback_event, sizeof(liback_event)))
+				break;
+
 			ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
 			ring_resp->func = OMX_CMD_RECV_LIBACK;
 			ring_resp->board_index = endpoint->board_index;
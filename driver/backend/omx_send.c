@@ -119,17 +119,20 @@ omx_medium_frag_skb_destructor(struct sk_buff *skb)
 	/* report the event to user-space */
 	dprintk_in();
 	if (endpoint->xen) {
-			omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
+			omx_xenif_t * omx_xenif = endpoint->xenif;
 			struct omx_xenif_response *ring_resp;
 			dprintk(PULL, "XEN ENDPOINT! Linear MEDIUMSQ DONE!@%#lx\n", (unsigned long) omx_xenif);
 
-			ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
-			ring_resp->func = OMX_CMD_XEN_SEND_MEDIUMSQ_DONE;
-			ring_resp->board_index = endpoint->board_index;
-			ring_resp->eid = endpoint->endpoint_index;
-			memcpy(&ring_resp->data.send_mediumsq_frag_done.sq_frag_done, &defevent->evt, sizeof(defevent->evt));
+			/* write the event straight into the guest eventq if we can */
+			if (omx_xen_notify_exp_event(endpoint, &defevent->evt, sizeof(defevent->evt))) {
+				ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+				ring_resp->func = OMX_CMD_XEN_SEND_MEDIUMSQ_DONE;
+				ring_resp->board_index = endpoint->board_index;
+				ring_resp->eid = endpoint->endpoint_index;
+				memcpy(&ring_resp->data.send_mediumsq_frag_done.sq_frag_done, &defevent->evt, sizeof(defevent->evt));
 
-			omx_poke_domU(omx_xenif, ring_resp);
+				omx_poke_domU(omx_xenif, ring_resp);
+			}
 	}
 	else {
 		omx_notify_exp_event(endpoint,
@@ -743,17 +746,20 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 		evt.sendq_offset = cmd.sendq_offset;
 
 		if (endpoint->xen) {
-			omx_xenif_t * omx_xenif = endpoint->be->omx_xenif;
+			omx_xenif_t * omx_xenif = endpoint->xenif;
 			struct omx_xenif_response *ring_resp;
 			dprintk(PULL, "XEN ENDPOINT! Linear MEDIUMSQ DONE!@%#lx\n", (unsigned long) omx_xenif);
 
-			ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
-			ring_resp->func = OMX_CMD_XEN_SEND_MEDIUMSQ_DONE;
-			ring_resp->board_index = endpoint->board_index;
-			ring_resp->eid = endpoint->endpoint_index;
-			memcpy(&ring_resp->data.send_mediumsq_frag_done.sq_frag_done, &evt, sizeof(evt));
+			/* write the event straight into the guest eventq if we can */
+			if (omx_xen_notify_exp_event(endpoint, &evt, sizeof(evt))) {
+				ring_resp = RING_GET_RESPONSE(&(omx_xenif->recv_ring), omx_xenif->recv_ring.rsp_prod_pvt++);
+				ring_resp->func = OMX_CMD_XEN_SEND_MEDIUMSQ_DONE;
+				ring_resp->board_index = endpoint->board_index;
+				ring_resp->eid = endpoint->endpoint_index;
+				memcpy(&ring_resp->data.send_mediumsq_frag_done.sq_frag_done, &evt, sizeof(evt));
 
-			omx_poke_domU(omx_xenif, ring_resp);
+				omx_poke_domU(omx_xenif, ring_resp);
+			}
 
 		} else {
 			omx_notify_exp_event(endpoint,
@@ -1106,7 +1112,7 @@ omx_ioctl_send_rndv(struct omx_endpoint * endpoint,
 	OMX_HTON_8(rndv_n->pulled_rdma_id, cmd.pulled_rdma_id);
 	OMX_HTON_8(rndv_n->pulled_rdma_seqnum, cmd.pulled_rdma_seqnum);
 	OMX_HTON_16(rndv_n->msg.checksum, cmd.checksum);
-	OMX_HTON_16(rndv_n->pulled_rdma_offset, 0); /* not needed for Open-MX */
+	OMX_HTON_16(rndv_n->pulled_rdma_offset, cmd.pulled_rdma_offset);
 
 	omx_queue_xmit(iface, skb, RNDV);
 
@@ -22,6 +22,8 @@
 #include <linux/ethtool.h>
 #include <linux/device.h>
 #include <linux/slab.h>
+#include <linux/sysfs.h>
+#include <linux/math64.h>
 #include <linux/pci.h>
 #ifdef OMX_HAVE_MUTEX
 #include <linux/mutex.h>
@@ -40,6 +42,81 @@
 #include "omx_xenback.h"
 #include "omx_endpoint.h"
 
+/*
+ * Per-guest tunables and statistics, under
+ * /sys/bus/xen-backend/devices/<dev>/open-mx/
+ */
+static ssize_t omx_xenback_poll_usecs_show(struct device *d,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct backend_info *be = dev_get_drvdata(d);
+
+	return sprintf(buf, "%u\n", ACCESS_ONCE(be->poll_usecs));
+}
+
+static ssize_t omx_xenback_poll_usecs_store(struct device *d,
+					    struct device_attribute *attr,
+					    const char *buf, size_t count)
+{
+	struct backend_info *be = dev_get_drvdata(d);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	/* the workers pick it up on their next budget computation */
+	ACCESS_ONCE(be->poll_usecs) = val;
+	return count;
+}
+
+static ssize_t omx_xenback_poll_stats_show(struct device *d,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct backend_info *be = dev_get_drvdata(d);
+	ssize_t len = 0;
+	unsigned int i;
+
+	/* one line per ring, the counters are read racily */
+	spin_lock(&be->lock);
+	for (i = 0; i < be->nr_queues; i++) {
+		omx_xenif_t *omx_xenif = be->queues[i];
+		struct omx_xenif_poll_stats *stats;
+
+		if (!omx_xenif)
+			continue;
+		stats = &omx_xenif->poll_stats;
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%u: runs %lu batches %lu requests %lu hits %lu misses %lu rearms %lu spin_us %llu\n",
+				 i, stats->runs, stats->batches,
+				 stats->requests, stats->hits, stats->misses,
+				 stats->rearms,
+				 (unsigned long long) div_u64(stats->spin_ns,
+							      NSEC_PER_USEC));
+	}
+	spin_unlock(&be->lock);
+
+	return len;
+}
+
+static DEVICE_ATTR(poll_usecs, S_IRUGO|S_IWUSR,
+		   omx_xenback_poll_usecs_show, omx_xenback_poll_usecs_store);
+static DEVICE_ATTR(poll_stats, S_IRUGO, omx_xenback_poll_stats_show, NULL);
+
+static struct attribute *omx_xenback_attrs[] = {
+	&dev_attr_poll_usecs.attr,
+	&dev_attr_poll_stats.attr,
+	NULL,
+};
+
+static const struct attribute_group omx_xenback_attr_group = {
+	.name = "open-mx",
+	.attrs = omx_xenback_attrs,
+};
+
 static int omx_xenback_probe(struct xenbus_device *dev,
 			     const struct xenbus_device_id *id)
 {
@@ -56,6 +133,12 @@ static int omx_xenback_probe(struct xenbus_device *dev,
 
 	be = dev_get_drvdata(&dev->dev);
 
+	ret = sysfs_create_group(&dev->dev.kobj, &omx_xenback_attr_group);
+	if (ret < 0) {
+		xenbus_dev_fatal(dev, ret, "creating sysfs attributes");
+		goto out;
+	}
+
 	ret = omx_xenback_setup_evtchn(dev, be);
 	if (ret < 0) {
 		xenbus_dev_fatal(dev, ret, "setup event channel");
@@ -85,13 +168,23 @@ static int omx_xenback_remove(struct xenbus_device *dev)
 
 	dprintk_in();
 
+	/* waits for the pending sysfs readers */
+	if (be)
+		sysfs_remove_group(&dev->dev.kobj, &omx_xenback_attr_group);
+
 	if (be->omx_xenif) {
+		unsigned int i;
+
 		kobject_uevent(&dev->dev.kobj, KOBJ_OFFLINE);
-		omx_xenif_disconnect(be->omx_xenif);
+		for (i = 0; i < be->nr_queues; i++) {
+			omx_xenif_disconnect(be->queues[i]);
+			be->queues[i] = NULL;
+		}
 		be->omx_xenif = NULL;
 	}
 
 	if (be) {
+		omx_xen_pgrant_cache_flush(be);
 		kfree(be);
 	}
 
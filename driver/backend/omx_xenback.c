@@ -20,6 +20,7 @@
 #include <linux/scatterlist.h>
 #include <linux/workqueue.h>
 #include <linux/spinlock.h>
+#include <linux/ktime.h>
 #include <linux/cdev.h>
 
 #include <xen/page.h>
@@ -47,6 +48,7 @@
 #include "omx_xenback_reg.h"
 #include "omx_xenback_endpoint.h"
 #include "omx_xenback_event.h"
+#include "omx_xenback_shared.h"
 
 
 //timers_t t1,t2,t3,t4,t5,t6,t7,t8;
@@ -153,7 +155,6 @@ static int omx_xen_setup_and_send_mediumva(struct omx_endpoint *endpoint, struct
 	struct omx_cmd_send_small *cmd_small = &cmd->mediumva;
 #endif
 	grant_ref_t *grefs = cmd->grefs;
-	void *vaddr;
 	unsigned long vaddrs[9], flags;
 	grant_handle_t handles[9];
 #ifdef OMX_XEN_COOKIES
@@ -178,23 +179,25 @@ static int omx_xen_setup_and_send_mediumva(struct omx_endpoint *endpoint, struct
 	}
 
 	for (i = 0; i < nr_pages; i++) {
-		pages[i] = NULL;
-		ret =
-		    omx_xen_map_page(endpoint->be, grefs[i], &vaddr,
-				     &handles[i], &page,
 #ifdef OMX_XEN_COOKIES
-				     &cookies[i]);
+		cookies[i] = omx_xen_page_get_cookie(endpoint->be->omx_xenif);
+		page = cookies[i] ? cookies[i]->page : NULL;
 #else
-				     NULL);
+		page = alloc_page(GFP_ATOMIC);
 #endif
-		if (ret) {
-			printk_err("cannot map page ret = %d\n", ret);
+		if (!page) {
+			printk_err("cannot get a page for the medium\n");
+			ret = -ENOMEM;
 			goto out;
 		}
-		dprintk_deb("vaddr=%p, handle[%d] = %#x, page=%#x\n", vaddr, i,
-			    handles[i], page);
-		vaddrs[i] = (unsigned long)vaddr;
 		pages[i] = page;
+		vaddrs[i] = (unsigned long)page_address(page);
+	}
+
+	ret = omx_xen_map_pages(endpoint->be, grefs, pages, handles, nr_pages);
+	if (ret) {
+		printk_err("cannot map pages ret = %d\n", ret);
+		goto out;
 	}
 
 #if 0
@@ -257,17 +260,15 @@ static int omx_xen_setup_and_send_mediumva(struct omx_endpoint *endpoint, struct
 #if 0
 	vunmap(vaddr);
 #endif
-	for (i = 0; i < nr_pages; i++) {
-		dprintk_deb("gref[%d] = %#x\n", i, grefs[i]);
-		ret = omx_xen_unmap_page(handles[i], pages[i]);
-		if (ret) {
-			printk_err("cannot unmap page ret = %d\n", ret);
-			goto out;
-		}
+	ret = omx_xen_unmap_pages(handles, pages, nr_pages);
+	if (ret) {
+		printk_err("cannot unmap pages ret = %d\n", ret);
+		goto out;
+	}
 #ifdef OMX_XEN_COOKIES
+	for (i = 0; i < nr_pages; i++)
 		omx_xen_page_put_cookie(endpoint->be->omx_xenif, cookies[i]);
 #endif
-	}
 
 	kfree(pages);
 
@@ -276,6 +277,24 @@ out:
 	return ret;
 }
 
+/* Function to poke the guest without any response,
+ * when the event was written directly into its event queues */
+int omx_xen_kick_domU(omx_xenif_t * omx_xenif)
+{
+	int err = 0;
+	struct evtchn_send event;
+
+	dprintk_in();
+
+	event.port = omx_xenif->evtchn;
+	err = HYPERVISOR_event_channel_op(EVTCHNOP_send, &event);
+	if (err)
+		printk_err("Failed to send event, err = %d", err);
+
+	dprintk_out();
+	return err;
+}
+
 /* Function to poke the guest with a filled response.
  * We only use recv_ring, as this is the only ring
  * we can use to notify the guest */
@@ -306,7 +325,7 @@ int omx_poke_domU(omx_xenif_t * omx_xenif, struct omx_xenif_response *ring_resp)
 
 	RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(ring, notify);
 	if (notify) {
-		event.port = omx_xenif->be->evtchn.port;
+		event.port = omx_xenif->evtchn;
 		err = HYPERVISOR_event_channel_op(EVTCHNOP_send, &event);
 		if (err) {
 			printk_err("Failed to send event, err = %d", err);
@@ -404,6 +423,37 @@ out:
 
 }
 
+/*
+ * Spin budget (in ns) for the request worker once the ring runs dry.
+ *
+ * We keep an EWMA of the gap between request arrivals on this ring and
+ * only poll when the next request is expected within the guest's
+ * poll_usecs (sysfs, defaults to xen_poll_usecs); an idle guest thus goes back to notifications at once,
+ * while a busy one is served without paying for an event channel upcall.
+ */
+static inline u64 omx_xenif_poll_budget(omx_xenif_t * omx_xenif)
+{
+	u64 max = (u64) ACCESS_ONCE(omx_xenif->be->poll_usecs) * NSEC_PER_USEC;
+	u64 avg = omx_xenif->poll_avg_gap;
+
+	if (!max || avg > max)
+		return 0;
+	return min(max, avg << 1);
+}
+
+static inline void omx_xenif_poll_account(omx_xenif_t * omx_xenif,
+					  unsigned int nr, u64 now)
+{
+	if (omx_xenif->poll_last_arrival) {
+		s64 gap = now - omx_xenif->poll_last_arrival;
+		s64 avg = omx_xenif->poll_avg_gap;
+		omx_xenif->poll_avg_gap = avg + ((div_s64(gap, nr) - avg) >> 3);
+	}
+	omx_xenif->poll_last_arrival = now;
+	omx_xenif->poll_stats.batches++;
+	omx_xenif->poll_stats.requests += nr;
+}
+
 /* something like the "bottom half" for requests (ring) */
 void msg_workq_handler(struct work_struct *work)
 {
@@ -415,7 +465,8 @@ void msg_workq_handler(struct work_struct *work)
 	int ret = 0;
 	struct omx_xenif_back_ring *ring;
 	int notify;
-	int i = 0;
+	RING_IDX cons;
+	u64 budget, start, now;
 
 	dprintk_in();
 
@@ -434,43 +485,53 @@ void msg_workq_handler(struct work_struct *work)
 	}
 
 	spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
+	omx_xenif->poll_stats.runs++;
+	ring = &omx_xenif->ring;
 
 again:
-	while (1) {
-		//spin_lock_irqrestore(&omx_xenif->omx_ring_lock, flags);
-		ring = &omx_xenif->ring;
-		if (RING_HAS_UNCONSUMED_REQUESTS(ring)) {
-			/* FIXME: We have to find a way to properly lock
-			 * when calling process_incoming_response */
-			//spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
-			ret = omx_xen_process_message(omx_xenif, ring);
-			//spin_lock_irqsave(&omx_xenif->omx_ring_lock, flags);
-
-			RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(ring, notify);
-			if (notify) {
-				event.port = omx_xenif->be->evtchn.port;
-				if (HYPERVISOR_event_channel_op(EVTCHNOP_send, &event) != 0) {
-					printk_err("error sending response\n");
-				}
-			}
-		} else {
-			//spin_unlock_irqsave(&omx_xenif->omx_ring_lock, flags);
-			i++;
-			if (i> 10000) {
-				break;
+	/*
+	 * The frontend only notifies us when req_event allows it, and the
+	 * latter is only re-armed by RING_FINAL_CHECK_FOR_REQUESTS below:
+	 * the event channel thus stays quiet while we drain and poll.
+	 */
+	while (RING_HAS_UNCONSUMED_REQUESTS(ring)) {
+		cons = ring->req_cons;
+		ret = omx_xen_process_message(omx_xenif, ring);
+		omx_xenif_poll_account(omx_xenif, ring->req_cons - cons ? : 1,
+				       ktime_to_ns(ktime_get()));
+
+		RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(ring, notify);
+		if (notify) {
+			event.port = omx_xenif->evtchn;
+			if (HYPERVISOR_event_channel_op(EVTCHNOP_send, &event) != 0) {
+				printk_err("error sending response\n");
 			}
-			//cpu_relax();
 		}
+	}
 
+	budget = omx_xenif_poll_budget(omx_xenif);
+	if (budget) {
+		start = now = ktime_to_ns(ktime_get());
+		while (!RING_HAS_UNCONSUMED_REQUESTS(ring)
+		       && now - start < budget) {
+			cpu_relax();
+			now = ktime_to_ns(ktime_get());
+		}
+		omx_xenif->poll_stats.spin_ns += now - start;
+		if (RING_HAS_UNCONSUMED_REQUESTS(ring)) {
+			omx_xenif->poll_stats.hits++;
+			goto again;
+		}
+		omx_xenif->poll_stats.misses++;
 	}
 
+	omx_xenif->poll_stats.rearms++;
 	RING_FINAL_CHECK_FOR_REQUESTS(ring, more_to_do);
 	if (more_to_do) {
 		goto again;
 	}
 
 out:
-	//spin_unlock_irqrestore(&omx_xenif->omx_ring_lock, flags);
 	dprintk_out();
 
 }
@@ -1007,6 +1068,14 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			dprintk_deb
 			    ("received frontend request: OMX_CMD_PULL, param=%lx\n",
 			     sizeof(struct omx_cmd_xen_pull));
+			if (req->data.pull.pull.shared) {
+				ret = omx_xen_shared_pull(endpoint,
+							  &req->data.pull.pull);
+				if (ret <= 0)
+					break;
+				/* not one of our guests, use the network */
+				req->data.pull.pull.shared = 0;
+			}
 			ret = omx_ioctl_pull(endpoint, &req->data.pull.pull);
 
 			break;
@@ -1025,6 +1094,13 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			//ret = omx_ioctl_send_rndv(endpoint, &req->data.send_rndv.rndv);
 			spin_unlock_irqrestore
 			    (&omx_xenif->omx_ring_lock, flags);
+			if (send_rndv.shared) {
+				ret = omx_xen_shared_send_rndv(endpoint,
+							       &send_rndv);
+				if (ret <= 0)
+					break;
+				send_rndv.shared = 0;
+			}
 			ret = omx_ioctl_send_rndv(endpoint, &send_rndv);
 
 			//memset(&resp->data.send_rndv, 0, sizeof(resp->data.send_rndv));
@@ -1044,12 +1120,32 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			memcpy(&xen_send_mediumsq_frag.mediumsq_frag,
 			       &req->data.send_mediumsq_frag.mediumsq_frag,
 			       sizeof(send_mediumsq_frag));
+			if (xen_send_mediumsq_frag.mediumsq_frag.shared) {
+				ret =
+				    omx_xen_shared_send_mediumsq_frag
+				    (endpoint, &xen_send_mediumsq_frag.mediumsq_frag);
+				if (ret <= 0)
+					break;
+				xen_send_mediumsq_frag.mediumsq_frag.shared = 0;
+			}
 			ret =
 			    omx_xen_setup_and_send_mediumsq_frag
 			    (endpoint, &xen_send_mediumsq_frag);
 
 			if (ret) {
 				printk_err("Medium SQ_FRAG error\n");
+				/* nobody waits for the response, release the sendq
+				 * slot and let the library resend the frag as if lost */
+				if (req->flags & OMX_XEN_REQUEST_FLAG_ASYNC) {
+					struct omx_evt_send_mediumsq_frag_done evt;
+
+					evt.id = 0;
+					evt.type = OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE;
+					evt.sendq_offset =
+					    xen_send_mediumsq_frag.mediumsq_frag.sendq_offset;
+					omx_notify_exp_event(endpoint, &evt,
+							     sizeof(evt));
+				}
 			}
 			//memset(&resp->data.send_small, 0, sizeof(resp->data.send_small));
 
@@ -1069,6 +1165,8 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			memcpy(&xen_send_mediumva.mediumva,
 			       &req->data.send_mediumva.mediumva,
 			       sizeof(send_mediumva));
+			/* the shared path does not handle guest vectors */
+			xen_send_mediumva.mediumva.shared = 0;
 			ret =
 			    omx_xen_setup_and_send_mediumva(endpoint,
 							    &xen_send_mediumva);
@@ -1099,6 +1197,15 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			    (uint64_t) req->data.send_small.data;
 			spin_unlock_irqrestore
 			    (&omx_xenif->omx_ring_lock, flags);
+			if (req->data.send_small.small.shared) {
+				ret =
+				    omx_xen_shared_send_small(endpoint,
+							      &req->data.send_small.small,
+							      req->data.send_small.data);
+				if (ret <= 0)
+					break;
+				req->data.send_small.small.shared = 0;
+			}
 			//dump_xen_send_small(&req->data.send_small);
 			ret =
 			    omx_ioctl_send_small(endpoint,
@@ -1110,6 +1217,14 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			dprintk_deb
 			    ("received frontend request: OMX_CMD_SEND_TINY, param=%lx\n",
 			     sizeof(struct omx_cmd_xen_send_tiny));
+			if (req->data.send_tiny.tiny.hdr.shared) {
+				ret =
+				    omx_xen_shared_send_tiny(endpoint,
+							     &req->data.send_tiny.tiny);
+				if (ret <= 0)
+					break;
+				req->data.send_tiny.tiny.hdr.shared = 0;
+			}
 			ret = omx_ioctl_send_tiny(endpoint, &req->data.send_tiny.tiny);	//&tiny.tiny);
 			//memset(&resp->data.send_tiny, 0, sizeof(resp->data.send_tiny));
 			break;
@@ -1120,6 +1235,15 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			     sizeof(struct omx_cmd_xen_send_notify));
 
 			//dprintk(SEND, "Sending Notifies\n");
+			if (req->data.send_notify.notify.shared) {
+				ret =
+				    omx_xen_shared_send_notify(endpoint,
+							       &req->data.send_notify.
+							       notify);
+				if (ret <= 0)
+					break;
+				req->data.send_notify.notify.shared = 0;
+			}
 			ret =
 			    omx_ioctl_send_notify(endpoint,
 						  &req->data.send_notify.
@@ -1135,6 +1259,15 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			     sizeof(struct omx_cmd_xen_send_liback));
 
 			//dump_xen_send_liback(&req->data.send_liback);
+			if (req->data.send_liback.liback.shared) {
+				ret =
+				    omx_xen_shared_send_liback(endpoint,
+							       &req->data.send_liback.
+							       liback);
+				if (ret <= 0)
+					break;
+				req->data.send_liback.liback.shared = 0;
+			}
 			ret =
 			    omx_ioctl_send_liback(endpoint,
 						  &req->data.send_liback.
@@ -1157,6 +1290,15 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			       sizeof(connect));
 			spin_unlock_irqrestore(&omx_xenif->omx_ring_lock,
 					       flags);
+			if (!connect.shared_disabled) {
+				ret =
+				    omx_xen_shared_try_send_connect_request
+				    (endpoint, &connect);
+				if (ret <= 0)
+					break;
+			}
+			/* the generic shared path cannot notify guest endpoints */
+			connect.shared_disabled = 1;
 			ret =
 			    omx_ioctl_send_connect_request(endpoint, &connect);
 			//memset(&resp->data.send_connect_request, 0, sizeof(resp->data.send_connect_request));
@@ -1175,6 +1317,14 @@ int omx_xenback_process_specific(omx_xenif_t * omx_xenif, uint32_t func, struct
 			       sizeof(reply));
 			spin_unlock_irqrestore
 			    (&omx_xenif->omx_ring_lock, flags);
+			if (!reply.shared_disabled) {
+				ret =
+				    omx_xen_shared_try_send_connect_reply
+				    (endpoint, &reply);
+				if (ret <= 0)
+					break;
+			}
+			reply.shared_disabled = 1;
 			ret = omx_ioctl_send_connect_reply(endpoint, &reply);
 			break;
 		}
@@ -1289,9 +1439,13 @@ int omx_xen_process_message(omx_xenif_t * omx_xenif,
 			printk_err("Failed, ret = %d\n", ret);
 		}
 
+		/* let the frontend match the response with its request */
+		resp->id = req->id;
+		resp->flags = req->flags;
+
 		dprintk_deb("response ready (%#llx), id=%#x sending to %u\n",
 			    (unsigned long long)resp, resp->func,
-			    omx_xenif->be->evtchn.port);
+			    omx_xenif->evtchn);
 
 	}
 	ring->req_cons = cons;
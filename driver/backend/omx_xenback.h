@@ -22,6 +22,7 @@
 #include <linux/scatterlist.h>
 #include <linux/workqueue.h>
 #include <linux/spinlock.h>
+#include <linux/mutex.h>
 #include <xen/interface/io/xenbus.h>
 #include <xen/interface/io/ring.h>
 #include <linux/cdev.h>
@@ -43,7 +44,9 @@ typedef struct omx_xenif_st {
 	domid_t domid;
 	unsigned int handle;
 	unsigned int irq;
+	/* port allocated for this ring pair */
 	unsigned int evtchn;
+	unsigned int queue_index;
 	/* Back pointer to the backend_info. */
 	struct backend_info *be;
 	/* Private fields. */
@@ -82,6 +85,18 @@ typedef struct omx_xenif_st {
 	uint32_t recvq_offset;
 	uint32_t sendq_offset;
 
+	/* adaptive polling of the request ring (msg_workq_handler) */
+	u64 poll_last_arrival;	/* ns, last time a request was seen */
+	u64 poll_avg_gap;	/* ns, EWMA of the inter-arrival gap */
+	struct omx_xenif_poll_stats {
+		unsigned long runs;	/* worker invocations */
+		unsigned long batches;	/* non-empty ring drains */
+		unsigned long requests;	/* requests consumed */
+		unsigned long hits;	/* spins ended by a new request */
+		unsigned long misses;	/* spins that expired */
+		unsigned long rearms;	/* returns to interrupt mode */
+		u64 spin_ns;		/* total time spent spinning */
+	} poll_stats;
 
 #ifdef OMX_XEN_COOKIES
         struct list_head page_cookies_free;
@@ -124,7 +139,10 @@ struct omx_xen_user_region {
 		unsigned long all_handle[OMX_XEN_GRANT_PAGES_MAX];
 		struct vm_struct *vm_gref[OMX_XEN_GRANT_PAGES_MAX];
 		grant_handle_t *handles;
-		uint8_t nr_parts;
+		uint16_t nr_parts;
+		/* gref list pages, when mapped through indirect pages */
+		struct page **list_pages;
+		grant_handle_t *list_handles;
 		//struct gnttab_map_grant_ref **map;
 		//struct gnttab_unmap_grant_ref **unmap;
 		uint32_t **gref_list;
@@ -133,9 +151,43 @@ struct omx_xen_user_region {
 #endif
 		uint16_t gref_offset;
 		struct page **pages;
+		/* set when the frontend granted the pages persistently */
+		struct omx_xen_pgrant **pgrants;
 	} segments[0];
 };
 
+/*
+ * Persistent grant mappings of guest user pages.
+ *
+ * Frontends that negotiated feature-persistent-grants keep the grants of
+ * registered pages alive across region destruction, so we keep the
+ * mappings too and find them again by gref on the next registration.
+ * Unused mappings sit on an LRU and get unmapped once we go above the
+ * xen_pgrant_pages budget.
+ */
+#define OMX_XEN_PGRANT_HASH_BITS 10
+
+struct omx_xen_pgrant {
+	struct hlist_node node;		/* hashed by gref */
+	struct list_head lru;		/* on the cache LRU while unused */
+	grant_ref_t gref;
+	grant_handle_t handle;
+	struct page *page;
+	unsigned int refcount;
+	uint8_t mapped;
+};
+
+struct omx_xen_pgrant_cache {
+	struct mutex lock;
+	struct hlist_head hash[1 << OMX_XEN_PGRANT_HASH_BITS];
+	struct list_head lru;
+	unsigned int nr_mapped;
+
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+};
+
 struct omxback_dev {
 	uint8_t id;
 	struct omx_endpoint *endpoints[OMX_XEN_MAX_ENDPOINTS];
@@ -149,25 +201,50 @@ struct backend_info {
 	struct xenbus_watch backend_watch;
 	struct xenbus_watch watch;
 	struct omxback_dev *omxdev;
+	/* queue 0, which also owns the page cookies */
 	omx_xenif_t *omx_xenif;
+	omx_xenif_t *queues[OMX_XEN_MAX_QUEUES];
+	unsigned int nr_queues;
+	/* protects queues[]/nr_queues against the sysfs readers */
 	spinlock_t lock;
+	/* busy-poll budget of the request workers, see sysfs poll_usecs */
+	unsigned int poll_usecs;
 
 	int remoteDomain;
 	int gref;
 	unsigned long all_gref;
 	int irq;
+	/* event channel of queue 0 */
 	struct evtchn_alloc_unbound evtchn;
 	//struct omx_xenif_back_ring ring;
 	char *frontpath;
+	struct omx_xen_pgrant_cache pgrants;
 };
 
 int omx_xenback_init(void);
 void omx_xenback_exit(void);
 
+extern int omx_xen_queues;
+extern int omx_xen_poll_usecs;
+extern int omx_xen_pgrant_pages;
+extern int omx_xen_indirect_parts;
+extern int omx_xen_shared_host;
+
 void msg_workq_handler(struct work_struct *work);
 void response_workq_handler(struct work_struct *work);
 
 int omx_poke_domU(omx_xenif_t *omx_xenif, struct omx_xenif_response *ring_resp);
+int omx_xen_kick_domU(omx_xenif_t *omx_xenif);
+
+void omx_xen_pgrant_cache_init(struct omx_xen_pgrant_cache *cache);
+void omx_xen_pgrant_cache_flush(struct backend_info *be);
+
+struct omx_endpoint;
+int omx_xen_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int length);
+int omx_xen_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int length);
+int omx_xen_commit_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
+						 const void *event, int length);
+void omx_xen_cancel_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint);
 
 irqreturn_t omx_xenif_be_int(int irq, void *data);
 
@@ -240,10 +240,189 @@ out:
 	return ret;
 }
 
+/* unmap a page hosting a gref list, mapped by omx_xen_accept_queue_grefs() */
+static int omx_xen_release_queue_grefs(struct vm_struct *vm_area,
+				       uint32_t handle)
+{
+	int ret = 0;
+	unsigned int level;
+	struct gnttab_unmap_grant_ref ops;
+
+	dprintk_in();
+
+	gnttab_set_unmap_op(&ops, (unsigned long)vm_area->addr,
+			    GNTMAP_host_map | GNTMAP_contains_pte, handle);
+	ops.host_addr =
+	    arbitrary_virt_to_machine(lookup_address
+				      ((unsigned long)vm_area->addr,
+				       &level)).maddr;
+
+	if (HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref, &ops, 1))
+		printk_err("hypervisor command failed:S\n");
+	if (ops.status) {
+		printk_err("HYPERVISOR unmap grant ref failed status = %d",
+			   ops.status);
+		ret = ops.status;
+	}
+	free_vm_area(vm_area);
+
+	dprintk_out();
+	return ret;
+}
+
+static void omx_xen_release_eventq_pages(struct omx_xen_eventq_map *map,
+					 struct page **pages, int nr)
+{
+	int i;
+
+	/* leak the pages if some may still be mapped */
+	if (omx_xen_unmap_pages(map->handles, pages, nr)) {
+		printk_err("eventq pages unmap failed\n");
+		return;
+	}
+	for (i = 0; i < nr; i++)
+		__free_page(pages[i]);
+}
+
+/* Back the pages of a guest queue with pages of ours and map them */
+static int omx_xen_endpoint_map_queue(struct backend_info *be,
+				      const uint32_t * grefs,
+				      struct page **pages, uint32_t * handles,
+				      uint32_t nr)
+{
+	uint32_t i;
+	int ret;
+
+	for (i = 0; i < nr; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out_with_pages;
+		}
+	}
+
+	ret = omx_xen_map_pages(be, grefs, pages, handles, nr);
+	if (!ret)
+		return 0;
+
+out_with_pages:
+	while (i--)
+		__free_page(pages[i]);
+	return ret;
+}
+
+/* Undo omx_xen_endpoint_map_queue() */
+static void omx_xen_endpoint_unmap_queue(struct page **pages,
+					 uint32_t * handles, uint32_t nr)
+{
+	uint32_t i;
+
+	/* leak the pages if some may still be mapped */
+	if (omx_xen_unmap_pages(handles, pages, nr)) {
+		printk_err("queue pages unmap failed\n");
+		return;
+	}
+	for (i = 0; i < nr; i++)
+		__free_page(pages[i]);
+}
+
+/*
+ * Map the event queues of the guest so that the receive path
+ * may write events into them directly. The receive path indexes
+ * slots over the whole queue, so the guest must grant all of it.
+ */
+static int omx_xen_accept_eventq(struct omx_endpoint *endpoint,
+				 struct omx_xen_eventq_map *map,
+				 grant_ref_t gref, uint16_t offset,
+				 uint32_t gref_size, uint32_t queue_size)
+{
+	struct backend_info *be = endpoint->be;
+	struct page **pages;
+	void *vaddr;
+	int ret = 0;
+
+	dprintk_in();
+
+	map->pages = NULL;
+	map->gref_size = 0;
+	if (gref_size != queue_size / PAGE_SIZE) {
+		printk_err("eventq gref size %u does not match %lu pages\n",
+			   gref_size, (unsigned long)(queue_size / PAGE_SIZE));
+		ret = -EINVAL;
+		goto out;
+	}
+
+	map->handles = kmalloc(sizeof(uint32_t) * gref_size, GFP_KERNEL);
+	if (!map->handles) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	pages = kmalloc(sizeof(struct page *) * gref_size, GFP_KERNEL);
+	if (!pages) {
+		ret = -ENOMEM;
+		goto out_with_handles;
+	}
+
+	ret = omx_xen_accept_queue_grefs(be->omx_xenif, endpoint, gref,
+					 &map->vm, &vaddr, &map->handle,
+					 offset);
+	if (ret < 0) {
+		printk_err("Failed to accept eventq grefs ret = %d\n", ret);
+		goto out_with_pages;
+	}
+	map->list = (uint32_t *) vaddr;
+
+	ret = omx_xen_endpoint_map_queue(be, map->list, pages, map->handles,
+					 gref_size);
+	if (ret) {
+		printk_err("map eventq pages failed!, ret = %d\n", ret);
+		omx_xen_release_queue_grefs(map->vm, map->handle);
+		goto out_with_pages;
+	}
+
+	map->gref_size = gref_size;
+	/* publish the pages last, the receive path only checks for them */
+	wmb();
+	map->pages = pages;
+	goto out;
+
+out_with_pages:
+	kfree(pages);
+out_with_handles:
+	kfree(map->handles);
+out:
+	dprintk_out();
+	return ret;
+}
+
+static void omx_xen_release_eventq(struct omx_xen_eventq_map *map)
+{
+	struct page **pages = map->pages;
+
+	dprintk_in();
+
+	if (!pages)
+		goto out;
+
+	/* stop the receive path from writing into the queue,
+	 * and wait for the packets being processed to be done with it */
+	map->pages = NULL;
+	synchronize_net();
+
+	omx_xen_release_eventq_pages(map, pages, map->gref_size);
+	omx_xen_release_queue_grefs(map->vm, map->handle);
+	kfree(pages);
+	kfree(map->handles);
+	map->gref_size = 0;
+
+out:
+	dprintk_out();
+}
+
 int omx_xen_endpoint_accept_resources(struct omx_endpoint *endpoint,
 				      struct omx_xenif_request *req)
 {
-	int ret = 0, i;
+	int ret = 0;
 	struct backend_info *be = endpoint->be;
 	omx_xenif_t *omx_xenif = be->omx_xenif;
 	uint32_t sendq_gref_size;
@@ -294,7 +473,7 @@ int omx_xen_endpoint_accept_resources(struct omx_endpoint *endpoint,
 	if (!sendq_page_list) {
 		ret = -ENOMEM;
 		printk_err(" page list is NULL, ENOMEM!!!\n");
-		goto out;
+		goto out_with_endpoint;
 	}
 
 	recvq_page_list =
@@ -302,7 +481,7 @@ int omx_xen_endpoint_accept_resources(struct omx_endpoint *endpoint,
 	if (!recvq_page_list) {
 		ret = -ENOMEM;
 		printk_err(" page list is NULL, ENOMEM!!!\n");
-		goto out;
+		goto out_with_sendq_page_list;
 	}
 
 	xen_sendq_handles =
@@ -310,14 +489,14 @@ int omx_xen_endpoint_accept_resources(struct omx_endpoint *endpoint,
 	if (!xen_sendq_handles) {
 		ret = -ENOMEM;
 		printk_err(" page list is NULL, ENOMEM!!!\n");
-		goto out;
+		goto out_with_recvq_page_list;
 	}
 	xen_recvq_handles =
 	    kmalloc(sizeof(uint32_t) * recvq_gref_size, GFP_KERNEL);
 	if (!xen_recvq_handles) {
 		ret = -ENOMEM;
 		printk_err(" page list is NULL, ENOMEM!!!\n");
-		goto out;
+		goto out_with_sendq_handles;
 	}
 
 	ret =
@@ -328,7 +507,7 @@ int omx_xen_endpoint_accept_resources(struct omx_endpoint *endpoint,
 				       egref_sendq_offset);
 	if (ret < 0) {
 		printk_err("Failed to accept send queue grefs ret = %d\n", ret);
-		goto out;
+		goto out_with_recvq_handles;
 	}
 	sendq_gref_list = (uint32_t *) void_vaddr;
 	endpoint->xen_sendq_list = sendq_gref_list;
@@ -342,44 +521,17 @@ int omx_xen_endpoint_accept_resources(struct omx_endpoint *endpoint,
 	if (ret < 0) {
 		printk_err("Failed to accept recvq queue grefs ret = %d\n",
 			   ret);
-		goto out;
+		goto out_with_sendq_grefs;
 	}
 
 	recvq_gref_list = (uint32_t *) void_vaddr;
 	endpoint->xen_recvq_list = recvq_gref_list;
 
-	i = 0;
-	while (i < sendq_gref_size) {
-		void *tmp_vaddr;
-		struct page *page = NULL;
-		grant_ref_t gref;
-		grant_handle_t handle;
-
-		gref = sendq_gref_list[i];
-		dprintk_deb("gref[%d] = %#x\n", i, gref);
-		ret =
-		    omx_xen_map_page(be, gref, &tmp_vaddr, &handle, NULL, NULL);
-		if (ret) {
-			printk_err("map page failed!, ret = %d\n", ret);
-			goto out;
-		}
-		xen_sendq_handles[i] = handle;
-		dprintk_deb("handle[%d] = %#x\n", i, handle);
-		if (!virt_addr_valid(tmp_vaddr)) {
-			ret = -EINVAL;
-			printk_err("Virt addr invalid:(\n");
-			//goto out;
-		} else {
-			page = virt_to_page(tmp_vaddr);
-		}
-		if (!page)
-			printk_err("No page found:(\n");
-		else {
-			sendq_page_list[i] = page;
-		}
-		dprintk_deb("page[%d] = %#lx\n", i, (unsigned long)page);
-
-		i++;
+	ret = omx_xen_endpoint_map_queue(be, sendq_gref_list, sendq_page_list,
+					 xen_sendq_handles, sendq_gref_size);
+	if (ret) {
+		printk_err("map sendq pages failed!, ret = %d\n", ret);
+		goto out_with_recvq_grefs;
 	}
 	endpoint->xen_sendq_pages = sendq_page_list;
 	endpoint->xen_sendq_handles = xen_sendq_handles;
@@ -394,32 +546,11 @@ int omx_xen_endpoint_accept_resources(struct omx_endpoint *endpoint,
 	    vmap(sendq_page_list, sendq_gref_size, VM_MAP, PAGE_KERNEL);
 #endif
 
-	i = 0;
-	while (i < recvq_gref_size) {
-		void *tmp_vaddr;
-		struct page *page = NULL;
-
-		ret =
-		    omx_xen_map_page(be, recvq_gref_list[i], &tmp_vaddr,
-				     &xen_recvq_handles[i], NULL, NULL);
-		if (ret) {
-			printk_err("map page failed!, ret = %d\n", ret);
-			goto out;
-		}
-		if (!virt_addr_valid(tmp_vaddr)) {
-			ret = -EINVAL;
-			printk_err("Virt addr invalid:(\n");
-			//goto out;
-		} else {
-			page = virt_to_page(tmp_vaddr);
-		}
-		if (!page)
-			printk_err("No page found:(\n");
-		else {
-			recvq_page_list[i] = page;
-		}
-
-		i++;
+	ret = omx_xen_endpoint_map_queue(be, recvq_gref_list, recvq_page_list,
+					 xen_recvq_handles, recvq_gref_size);
+	if (ret) {
+		printk_err("map recvq pages failed!, ret = %d\n", ret);
+		goto out_with_sendq_pages;
 	}
 	endpoint->xen_recvq_pages = recvq_page_list;
 	endpoint->xen_recvq_handles = xen_recvq_handles;
@@ -434,6 +565,65 @@ int omx_xen_endpoint_accept_resources(struct omx_endpoint *endpoint,
 	    vmap(recvq_page_list, recvq_gref_size, VM_MAP, PAGE_KERNEL);
 #endif
 
+	ret = omx_xen_accept_eventq(endpoint, &endpoint->xen_exp_eventq,
+				    req->data.endpoint.exp_eventq_gref,
+				    req->data.endpoint.egref_exp_eventq_offset,
+				    req->data.endpoint.exp_eventq_gref_size,
+				    OMX_EXP_EVENTQ_SIZE);
+	if (ret < 0)
+		goto out_with_recvq_pages;
+
+	ret = omx_xen_accept_eventq(endpoint, &endpoint->xen_unexp_eventq,
+				    req->data.endpoint.unexp_eventq_gref,
+				    req->data.endpoint.egref_unexp_eventq_offset,
+				    req->data.endpoint.unexp_eventq_gref_size,
+				    OMX_UNEXP_EVENTQ_SIZE);
+	if (ret < 0)
+		goto out_with_exp_eventq;
+
+	goto out;
+
+out_with_exp_eventq:
+	omx_xen_release_eventq(&endpoint->xen_exp_eventq);
+out_with_recvq_pages:
+#if 0
+	vunmap(endpoint->xen_recvq);
+#endif
+	omx_xen_endpoint_unmap_queue(recvq_page_list, xen_recvq_handles,
+				     recvq_gref_size);
+	endpoint->xen_recvq_pages = NULL;
+	endpoint->xen_recvq_handles = NULL;
+out_with_sendq_pages:
+#if 0
+	vunmap(endpoint->xen_sendq);
+#endif
+	omx_xen_endpoint_unmap_queue(sendq_page_list, xen_sendq_handles,
+				     sendq_gref_size);
+	endpoint->xen_sendq_pages = NULL;
+	endpoint->xen_sendq_handles = NULL;
+out_with_recvq_grefs:
+	omx_xen_release_queue_grefs(endpoint->xen_recvq_vm,
+				    endpoint->xen_recvq_handle);
+	endpoint->xen_recvq_vm = NULL;
+	endpoint->xen_recvq_list = NULL;
+out_with_sendq_grefs:
+	omx_xen_release_queue_grefs(endpoint->xen_sendq_vm,
+				    endpoint->xen_sendq_handle);
+	endpoint->xen_sendq_vm = NULL;
+	endpoint->xen_sendq_list = NULL;
+out_with_recvq_handles:
+	kfree(xen_recvq_handles);
+out_with_sendq_handles:
+	kfree(xen_sendq_handles);
+out_with_recvq_page_list:
+	kfree(recvq_page_list);
+out_with_sendq_page_list:
+	kfree(sendq_page_list);
+out_with_endpoint:
+	omx_xen_release_queue_grefs(endpoint->endpoint_vm,
+				    endpoint->endpoint_handle);
+	endpoint->endpoint_vm = NULL;
+	endpoint->fe_endpoint = NULL;
 out:
 	dprintk_out();
 	return ret;
@@ -442,7 +632,7 @@ out:
 int omx_xen_endpoint_release_resources(struct omx_endpoint *endpoint,
 				       struct omx_xenif_request *req)
 {
-	int ret = 0, i;
+	int ret = 0;
 	struct gnttab_unmap_grant_ref ops;
 
 	//struct backend_info *be = endpoint->be;
@@ -460,6 +650,9 @@ int omx_xen_endpoint_release_resources(struct omx_endpoint *endpoint,
 		ret = -EINVAL;
 		goto out;
 	}
+
+	omx_xen_release_eventq(&endpoint->xen_exp_eventq);
+	omx_xen_release_eventq(&endpoint->xen_unexp_eventq);
 #if 0
 	if (!endpoint->xen_sendq) {
 		printk_err("vmap'd space is NULL\n");
@@ -469,25 +662,12 @@ int omx_xen_endpoint_release_resources(struct omx_endpoint *endpoint,
 	vunmap(endpoint->xen_sendq);
 #endif
 
-	for (i = 0; i < sendq_gref_size; i++) {
-		struct page *page;
-		grant_handle_t handle;
-		page = endpoint->xen_sendq_pages[i];
-		if (!page) {
-			printk_err("sendq_page[%d] is NULL\n", i);
-			ret = -EINVAL;
-			goto out;
-		}
-		handle = endpoint->xen_sendq_handles[i];
-
-		dprintk_deb("putting page %#lx, addr=%#lx\n",
-			    (unsigned long)page, page_address(page));
-		ret = omx_xen_unmap_page(handle, page);
-		if (ret) {
-			printk_err("sendq_page[%d] is NULL\n", i);
-			ret = -EINVAL;
-			goto out;
-		}
+	ret = omx_xen_unmap_pages(endpoint->xen_sendq_handles,
+				  endpoint->xen_sendq_pages, sendq_gref_size);
+	if (ret) {
+		printk_err("unmap of sendq pages failed\n");
+		ret = -EINVAL;
+		goto out;
 	}
 	gnttab_set_unmap_op(&ops, (unsigned long)endpoint->xen_sendq_vm->addr,
 			    GNTMAP_host_map | GNTMAP_contains_pte,
@@ -518,25 +698,12 @@ int omx_xen_endpoint_release_resources(struct omx_endpoint *endpoint,
 	}
 	vunmap(endpoint->xen_recvq);
 #endif
-	for (i = 0; i < recvq_gref_size; i++) {
-		struct page *page;
-		grant_handle_t handle;
-		page = endpoint->xen_recvq_pages[i];
-		if (!page) {
-			printk_err("recvq_page[%d] is NULL\n", i);
-			ret = -EINVAL;
-			goto out;
-		}
-		handle = endpoint->xen_recvq_handles[i];
-
-		dprintk_deb("putting page %#lx, addr=%#lx\n",
-			    (unsigned long)page, page_address(page));
-		ret = omx_xen_unmap_page(handle, page);
-		if (ret) {
-			printk_err("sendq_page[%d] is NULL\n", i);
-			ret = -EINVAL;
-			goto out;
-		}
+	ret = omx_xen_unmap_pages(endpoint->xen_recvq_handles,
+				  endpoint->xen_recvq_pages, recvq_gref_size);
+	if (ret) {
+		printk_err("unmap of recvq pages failed\n");
+		ret = -EINVAL;
+		goto out;
 	}
 	gnttab_set_unmap_op(&ops, (unsigned long)endpoint->xen_recvq_vm->addr,
 			    GNTMAP_host_map | GNTMAP_contains_pte,
@@ -657,6 +824,8 @@ int omx_xen_endpoint_open(struct backend_info *be,
 	endpoint->board_index = bidx;
 	endpoint->endpoint_index = idx;
 	endpoint->session_id = session_id;
+	/* the frontend hashes its endpoints onto the rings the same way */
+	endpoint->xenif = be->queues[omx_xen_queue_index(idx, be->nr_queues)];
 	spin_lock_irq(&endpoint->status_lock);
 	ret = omx_iface_attach_endpoint(endpoint);
 	if (ret < 0) {
@@ -37,6 +37,7 @@ int omx_xen_page_alloc(omx_xenif_t * omx_xenif, uint32_t count)
 	struct omx_xen_page_cookie *cookie;
 	struct page *page;
 	int err = 0, i;
+	unsigned long flags;
 
 #ifdef OMX_XEN_COOKIES
 	dprintk_in();
@@ -59,9 +60,10 @@ int omx_xen_page_alloc(omx_xenif_t * omx_xenif, uint32_t count)
 
 		cookie->page = page;
 
-		//      write_lock(&omx_xenif->page_cookies_freelock);
+		write_lock_irqsave(&omx_xenif->page_cookies_freelock, flags);
 		list_add_tail(&cookie->node, &omx_xenif->page_cookies_free);
-		//      write_unlock(&omx_xenif->page_cookies_freelock);
+		write_unlock_irqrestore(&omx_xenif->page_cookies_freelock,
+					flags);
 
 		dprintk_deb
 		    ("allocated, and appended to list, %#lx, page = %#lx\n",
@@ -78,11 +80,14 @@ out:
 void omx_xen_page_put_cookie(omx_xenif_t * omx_xenif,
 			     struct omx_xen_page_cookie *cookie)
 {
+	unsigned long flags;
+
 	dprintk_in();
 #ifdef OMX_XEN_COOKIES
-	//write_lock(&omx_xenif->page_cookies_freelock);
+	/* regions of all the queues of a guest share these lists */
+	write_lock_irqsave(&omx_xenif->page_cookies_freelock, flags);
 	list_move_tail(&cookie->node, &omx_xenif->page_cookies_free);
-	//write_unlock(&omx_xenif->page_cookies_freelock);
+	write_unlock_irqrestore(&omx_xenif->page_cookies_freelock, flags);
 #endif
 	dprintk_out();
 }
@@ -90,26 +95,31 @@ void omx_xen_page_put_cookie(omx_xenif_t * omx_xenif,
 struct omx_xen_page_cookie *omx_xen_page_get_cookie(omx_xenif_t * omx_xenif)
 {
 	struct omx_xen_page_cookie *cookie;
+	unsigned long flags;
 
 	dprintk_in();
 
 #ifdef OMX_XEN_COOKIES
 	dprintk_deb("want an event cookie!\n");
 
-	if ((volatile int)(list_empty(&omx_xenif->page_cookies_free))) {
-		omx_xen_page_alloc(omx_xenif, 20);
+	write_lock_irqsave(&omx_xenif->page_cookies_freelock, flags);
+	while ((volatile int)(list_empty(&omx_xenif->page_cookies_free))) {
+		/* allocating sleeps, and adds to the list under the lock */
+		write_unlock_irqrestore(&omx_xenif->page_cookies_freelock,
+					flags);
+		if (omx_xen_page_alloc(omx_xenif, 20)) {
+			printk_err("Error\n");
+			cookie = NULL;
+			goto out;
+		}
+		write_lock_irqsave(&omx_xenif->page_cookies_freelock, flags);
 	}
-	// write_lock(&omx_xenif->page_cookies_freelock);
 
 	cookie = list_first_entry(&omx_xenif->page_cookies_free,
 				  struct omx_xen_page_cookie, node);
-	if (!cookie) {
-		printk_err("Error\n");
-		goto out;
-	}
 
 	list_move_tail(&cookie->node, &omx_xenif->page_cookies_inuse);
-	//  write_unlock(&omx_xenif->page_cookies_freelock);
+	write_unlock_irqrestore(&omx_xenif->page_cookies_freelock, flags);
 
 	dprintk_deb("got it, %#010lx\n", (unsigned long)cookie);
 
@@ -124,6 +124,7 @@ static void backend_create_omx(struct backend_info *be)
 		e->status = OMX_ENDPOINT_STATUS_FREE;
 		e->xen = 1;
 		e->be = be;
+		e->xenif = be->omx_xenif;
 	}
 	kobject_uevent(&dev->dev.kobj, KOBJ_ONLINE);
 	dprintk_out();
@@ -185,6 +186,13 @@ void omx_xenif_disconnect(omx_xenif_t * omx_xenif)
 	dprintk_deb("%s: rspvt = %d, rc = %d, rp = %d\n", __func__,
 		    omx_xenif->ring.rsp_prod_pvt, omx_xenif->ring.req_cons,
 		    omx_xenif->ring.sring->req_prod);
+	printk_inf("Xen ring %d.%u poll stats: %lu runs, %lu batches, %lu requests, "
+		   "%lu hits, %lu misses, %lu rearms, %llu us spinning\n",
+		   omx_xenif->domid, omx_xenif->queue_index,
+		   omx_xenif->poll_stats.runs, omx_xenif->poll_stats.batches,
+		   omx_xenif->poll_stats.requests, omx_xenif->poll_stats.hits,
+		   omx_xenif->poll_stats.misses, omx_xenif->poll_stats.rearms,
+		   (unsigned long long) div_u64(omx_xenif->poll_stats.spin_ns, NSEC_PER_USEC));
 	if (omx_xenif->irq) {
 		unbind_from_irqhandler(omx_xenif->irq, omx_xenif);
 		omx_xenif->irq = 0;
@@ -218,29 +226,41 @@ void omx_xenif_free(omx_xenif_t * omx_xenif)
 	dprintk_out();
 }
 
-static int connect_ring(struct backend_info *be)
+static int connect_queue(struct backend_info *be, omx_xenif_t * omx_xenif)
 {
 	struct xenbus_device *dev = be->dev;
-	omx_xenif_t *omx_xenif = be->omx_xenif;
 	unsigned int evtchn;
+	unsigned int index = omx_xenif->queue_index;
 	int err;
 	char omx_xenif_backend_name[20];
+	char ring_node[OMX_XEN_QUEUE_NODE_MAX];
+	char evtchn_node[OMX_XEN_QUEUE_NODE_MAX];
+	char recv_ring_node[OMX_XEN_QUEUE_NODE_MAX];
 
 	dprintk_in();
 
+	/* Already connected through? */
+	if (omx_xenif->irq) {
+		err = 0;
+		goto out;
+	}
+
+	omx_xen_queue_node(ring_node, index, "ring-ref");
+	omx_xen_queue_node(evtchn_node, index, "event-channel");
+	omx_xen_queue_node(recv_ring_node, index, "recv-ring-ref");
 	err =
-	    xenbus_gather(XBT_NIL, dev->otherend, "ring-ref", "%lu",
-			  &omx_xenif->shmem_ref, "event-channel", "%u", &evtchn,
-			  "recv-ring-ref", "%lu", &omx_xenif->recv_ref, NULL);
+	    xenbus_gather(XBT_NIL, dev->otherend, ring_node, "%lu",
+			  &omx_xenif->shmem_ref, evtchn_node, "%u", &evtchn,
+			  recv_ring_node, "%lu", &omx_xenif->recv_ref, NULL);
 	if (err) {
 		xenbus_dev_fatal(dev, err,
-				 "reading %s/ring-ref and event-channel",
-				 dev->otherend);
+				 "reading %s/%s and %s",
+				 dev->otherend, ring_node, evtchn_node);
 		goto out;
 	}
 
-	dprintk_deb("ring-ref %ld, event-channel %d, recv_ring_ref %lu\n",
-		    omx_xenif->shmem_ref, evtchn, omx_xenif->recv_ref);
+	dprintk_deb("queue %u: ring-ref %ld, event-channel %d, recv_ring_ref %lu\n",
+		    index, omx_xenif->shmem_ref, evtchn, omx_xenif->recv_ref);
 
 	/* Map the shared frame */
 	err =
@@ -270,20 +290,71 @@ static int connect_ring(struct backend_info *be)
 
 	/* end grant */
 	dprintk_inf("Will bind otherend_id = %u port = %#lx\n",
-		    dev->otherend_id, (unsigned long)be->evtchn.port);
+		    dev->otherend_id, (unsigned long)omx_xenif->evtchn);
 	sprintf(omx_xenif_backend_name, "xenifbe%x_%lu",
-		omx_xenif->shmem_handle, (unsigned long)be->evtchn.port);
+		omx_xenif->shmem_handle, (unsigned long)omx_xenif->evtchn);
 
 	err =
-	    bind_evtchn_to_irqhandler(be->evtchn.port, omx_xenif_be_int,
+	    bind_evtchn_to_irqhandler(omx_xenif->evtchn, omx_xenif_be_int,
 				      IRQF_SHARED,
 				      omx_xenif_backend_name, omx_xenif);
-	be->irq = err;
 	if (err < 0) {
 		printk_err("failed binding evtchn to irqhandler!, err = %d\n",
 			   err);
 		goto out;
 	}
+	omx_xenif->irq = err;
+	if (!index)
+		be->irq = err;
+	err = 0;
+
+out:
+	dprintk_out();
+	return err;
+}
+
+static int connect_ring(struct backend_info *be)
+{
+	struct xenbus_device *dev = be->dev;
+	omx_xenif_t *omx_xenif = be->omx_xenif;
+	unsigned int nr_queues, i;
+	int err;
+
+	dprintk_in();
+
+	/* frontends that don't know about multiple queues only use queue 0 */
+	err = xenbus_scanf(XBT_NIL, dev->otherend, "multi-queue-num-queues",
+			   "%u", &nr_queues);
+	if (err != 1)
+		nr_queues = 1;
+	if (nr_queues < 1 || nr_queues > be->nr_queues) {
+		xenbus_dev_fatal(dev, -EINVAL,
+				 "frontend asked for %u queues, we offer %u",
+				 nr_queues, be->nr_queues);
+		err = -EINVAL;
+		goto out;
+	}
+
+	/* release the queues the frontend did not pick */
+	for (i = nr_queues; i < be->nr_queues; i++) {
+		omx_xenif_t *unused = be->queues[i];
+
+		spin_lock(&be->lock);
+		be->queues[i] = NULL;
+		spin_unlock(&be->lock);
+		omx_xenif_disconnect(unused);
+	}
+	spin_lock(&be->lock);
+	be->nr_queues = nr_queues;
+	spin_unlock(&be->lock);
+
+	for (i = 0; i < be->nr_queues; i++) {
+		err = connect_queue(be, be->queues[i]);
+		if (err)
+			goto out;
+	}
+	dprintk_inf("connected %u queue(s) to domain %u\n", be->nr_queues,
+		    dev->otherend_id);
 
 #ifdef OMX_XEN_COOKIES
 	INIT_LIST_HEAD(&omx_xenif->page_cookies_free);
@@ -302,7 +373,7 @@ out:
 	return err;
 }
 
-omx_xenif_t *omx_xenif_alloc(domid_t domid)
+omx_xenif_t *omx_xenif_alloc(domid_t domid, unsigned int index)
 {
 	omx_xenif_t *omx_xenif;
 	int err;
@@ -316,8 +387,9 @@ omx_xenif_t *omx_xenif_alloc(domid_t domid)
 
 	dprintk_deb("omx_xenif is @ %#llx\n", (unsigned long long)omx_xenif);
 	omx_xenif->domid = domid;
-	sprintf(omx_xenback_workqueue_name, "ReqWQ-%d", domid);
-	sprintf(omx_xenback_workqueue_name_2, "RespWQ-%d", domid);
+	omx_xenif->queue_index = index;
+	sprintf(omx_xenback_workqueue_name, "ReqWQ-%d.%u", domid, index);
+	sprintf(omx_xenback_workqueue_name_2, "RespWQ-%d.%u", domid, index);
 	spin_lock_init(&omx_xenif->omx_resp_lock);
 	spin_lock_init(&omx_xenif->omx_ring_lock);
 	spin_lock_init(&omx_xenif->omx_be_lock);
@@ -329,7 +401,7 @@ omx_xenif_t *omx_xenif_alloc(domid_t domid)
 	if (unlikely(!omx_xenif->msg_workq)) {
 		printk_err("Couldn't create msg_workq!\n");
 		err = -ENOMEM;
-		return (void *)0;
+		return ERR_PTR(err);
 	}
 
 	INIT_WORK(&omx_xenif->msg_workq_task, msg_workq_handler);
@@ -339,7 +411,7 @@ omx_xenif_t *omx_xenif_alloc(domid_t domid)
 	if (unlikely(!omx_xenif->response_msg_workq)) {
 		printk_err("Couldn't create msg_workq!\n");
 		err = -ENOMEM;
-		return (void *)0;
+		return ERR_PTR(err);
 	}
 
 	INIT_WORK(&omx_xenif->response_workq_task, response_workq_handler);
@@ -352,6 +424,7 @@ static int omx_xenback_allocate_basic_structures(struct xenbus_device *dev, cons
 						 *id)
 {
 	struct backend_info *be;
+	unsigned int i;
 	int ret = 0;
 
 	dprintk_in();
@@ -365,16 +438,26 @@ static int omx_xenback_allocate_basic_structures(struct xenbus_device *dev, cons
 
 	be->dev = dev;
 	dev_set_drvdata(&dev->dev, be);
-	be->omx_xenif = omx_xenif_alloc(dev->otherend_id);
 	spin_lock_init(&be->lock);
-	if (IS_ERR(be->omx_xenif)) {
-		ret = PTR_ERR(be->omx_xenif);
-		be->omx_xenif = NULL;
-		xenbus_dev_fatal(dev, ret, "creating omx Xen interface");
-		goto out;
+	be->poll_usecs = omx_xen_poll_usecs;
+	omx_xen_pgrant_cache_init(&be->pgrants);
+
+	/* the frontend picks how many of these it actually uses */
+	be->nr_queues = clamp(omx_xen_queues, 1, OMX_XEN_MAX_QUEUES);
+	for (i = 0; i < be->nr_queues; i++) {
+		omx_xenif_t *omx_xenif = omx_xenif_alloc(dev->otherend_id, i);
+		if (IS_ERR(omx_xenif)) {
+			ret = PTR_ERR(omx_xenif);
+			be->nr_queues = i;
+			xenbus_dev_fatal(dev, ret,
+					 "creating omx Xen interface %u", i);
+			goto out;
+		}
+		be->queues[i] = omx_xenif;
+		dprintk_deb("OMX xen Interface %u is @%#lx\n", i,
+			    (unsigned long)omx_xenif);
 	}
-	dprintk_deb("OMX xen Interface is @%#lx\n",
-		    (unsigned long)be->omx_xenif);
+	be->omx_xenif = be->queues[0];
 out:
 	dprintk_out();
 	return ret;
@@ -385,21 +468,31 @@ static int omx_xenback_setup_evtchn(struct xenbus_device *dev,
 {
 
 	int ret = 0;
+	unsigned int i;
 	dprintk_in();
 
 	be->remoteDomain = dev->otherend_id;
-	be->omx_xenif->be = be;
-	dprintk_deb("be is @ %#lx\n", (unsigned long)be);
-	dprintk_deb("omx_xenif->be is @ %#lx\n",
-		    (unsigned long)be->omx_xenif->be);
-	be->evtchn.dom = 0;
-	be->evtchn.remote_dom = dev->otherend_id;
-	ret = HYPERVISOR_event_channel_op(EVTCHNOP_alloc_unbound, &be->evtchn);
-	if (ret) {
-		printk_err("Failed to allocate evtchn!\n");
-		goto out;
+	for (i = 0; i < be->nr_queues; i++) {
+		omx_xenif_t *omx_xenif = be->queues[i];
+		struct evtchn_alloc_unbound evtchn;
+
+		omx_xenif->be = be;
+		evtchn.dom = 0;
+		evtchn.remote_dom = dev->otherend_id;
+		ret = HYPERVISOR_event_channel_op(EVTCHNOP_alloc_unbound,
+						  &evtchn);
+		if (ret) {
+			printk_err("Failed to allocate evtchn for queue %u!\n",
+				   i);
+			goto out;
+		}
+		omx_xenif->evtchn = evtchn.port;
+		if (!i)
+			be->evtchn = evtchn;
 	}
-	dprintk_deb("Allocated Event Channel to %d\n", dev->otherend_id);
+	dprintk_deb("be is @ %#lx\n", (unsigned long)be);
+	dprintk_deb("Allocated %u Event Channel(s) to %d\n", be->nr_queues,
+		    dev->otherend_id);
 out:
 	dprintk_out();
 	return ret;
@@ -409,7 +502,9 @@ static int omx_xenback_setup_xenbus(struct xenbus_device *dev,
 				    struct backend_info *be)
 {
 	int ret = 0;
+	unsigned int i;
 	const char *message;
+	char node[OMX_XEN_QUEUE_NODE_MAX];
 	struct xenbus_transaction xbt;
 	dprintk_in();
 
@@ -427,18 +522,66 @@ static int omx_xenback_setup_xenbus(struct xenbus_device *dev,
 		}
 
 		ret =
-		    xenbus_printf(xbt, dev->otherend, "port", "%d",
-				  be->evtchn.port);
+		    xenbus_printf(xbt, dev->otherend, "multi-queue-max-queues",
+				  "%u", be->nr_queues);
 		if (ret) {
-			message = "writing port";
+			message = "writing multi-queue-max-queues";
 			goto abort_transaction;
 		}
 
+		/* our budget, the frontend keeps a few more grants than that */
+		if (omx_xen_pgrant_pages) {
+			ret =
+			    xenbus_printf(xbt, dev->otherend,
+					  "feature-persistent-grants", "%u",
+					  omx_xen_pgrant_pages);
+			if (ret) {
+				message = "writing feature-persistent-grants";
+				goto abort_transaction;
+			}
+		}
+
+		/* indirect pages we accept in a single segment registration */
+		if (omx_xen_indirect_parts) {
+			ret =
+			    xenbus_printf(xbt, dev->otherend,
+					  "feature-indirect-grefs", "%u",
+					  min_t(unsigned int,
+						omx_xen_indirect_parts,
+						OMX_XEN_GRANT_PAGES_MAX));
+			if (ret) {
+				message = "writing feature-indirect-grefs";
+				goto abort_transaction;
+			}
+		}
+
+		/* we deliver shared messages between guests of this host */
+		if (omx_xen_shared_host) {
+			ret =
+			    xenbus_printf(xbt, dev->otherend,
+					  "feature-shared-host", "%u", 1);
+			if (ret) {
+				message = "writing feature-shared-host";
+				goto abort_transaction;
+			}
+		}
+
+		for (i = 0; i < be->nr_queues; i++) {
+			omx_xen_queue_node(node, i, "port");
+			ret =
+			    xenbus_printf(xbt, dev->otherend, node, "%d",
+					  be->queues[i]->evtchn);
+			if (ret) {
+				message = "writing port";
+				goto abort_transaction;
+			}
+		}
+
 		ret = xenbus_transaction_end(xbt, 0);
 	} while (ret == -EAGAIN);
 
-	dprintk_deb("Wrote port %d to %s/%s\n", be->evtchn.port,
-		    dev->nodename, "port");
+	dprintk_deb("Wrote %u port(s) to %s\n", be->nr_queues,
+		    dev->otherend);
 	if (ret) {
 		xenbus_dev_fatal(dev, ret, "completing transaction");
 		goto out;
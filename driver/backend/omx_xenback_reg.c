@@ -20,6 +20,8 @@
 #include <linux/scatterlist.h>
 #include <linux/workqueue.h>
 #include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/hash.h>
 #include <linux/cdev.h>
 
 #include <asm/xen/hypervisor.h>
@@ -59,6 +61,30 @@
 
 timers_t t_reg_seg, t_create_reg, t_dereg_seg, t_destroy_reg;
 
+/* Drop the gref list pages mapped by omx_xen_accept_indirect_gref_list */
+static void omx_xen_release_indirect_gref_list(struct
+					       omx_xen_user_region_segment
+					       *seg)
+{
+	int k;
+
+	if (omx_xen_unmap_pages(seg->list_handles, seg->list_pages,
+				seg->nr_parts)) {
+		/* the guest may still own some of them, leak the pages */
+		printk_err("Cannot unmap the gref list of segment %u\n",
+			   seg->sid);
+	} else {
+		for (k = 0; k < seg->nr_parts; k++)
+			__free_page(seg->list_pages[k]);
+	}
+
+	kfree(seg->list_handles);
+	kfree(seg->list_pages);
+	seg->list_handles = NULL;
+	seg->list_pages = NULL;
+	seg->nr_parts = 0;
+}
+
 int omx_xen_deregister_user_segment(omx_xenif_t * omx_xenif, uint32_t id,
 				    uint32_t sid, uint8_t eid)
 {
@@ -90,19 +116,20 @@ int omx_xen_deregister_user_segment(omx_xenif_t * omx_xenif, uint32_t id,
 		goto out;
 	}
 	seg = &region->segments[sid];
-	for (i = 0; i < seg->nr_pages; i++) {
-		struct page *page = seg->pages[i];
-		grant_handle_t handle = seg->handles[i];
-
-		//dprintk_deb("putting page %#lx, addr=%#lx\n", (unsigned long)page, page_address(page));
-
-		omx_xen_unmap_page(handle, page);
+	if (seg->pgrants) {
+		/* keep the mappings around for the next registration */
+		omx_xen_pgrant_put_segment(omx_xenif, seg);
+	} else {
+		omx_xen_unmap_pages(seg->handles, seg->pages, seg->nr_pages);
 #ifdef OMX_XEN_COOKIES
-		omx_xen_page_put_cookie(omx_xenif, seg->cookies[i]);
+		for (i = 0; i < seg->nr_pages; i++)
+			omx_xen_page_put_cookie(omx_xenif, seg->cookies[i]);
 #endif
-
 	}
 
+	if (seg->list_pages)
+		omx_xen_release_indirect_gref_list(seg);
+
 	for (k = 0; k < seg->nr_parts; k++) {
 #ifdef EXTRA_DEBUG_OMX
 		if (!seg->vm_gref) {
@@ -273,6 +300,103 @@ out:
 	return ret;
 }
 
+/*
+ * Map the whole gref list of a segment through its indirect pages: a
+ * batch for the indirect pages, then batches of the seg->nr_parts gref
+ * list pages they reference. The indirect pages are dropped right away,
+ * the list pages stay until the segment is deregistered.
+ */
+static int omx_xen_accept_indirect_gref_list(omx_xenif_t * omx_xenif,
+					     struct omx_xen_user_region_segment
+					     *seg, uint32_t * indirect_gref,
+					     uint8_t nr_indirect,
+					     uint32_t ** gref_list)
+{
+	struct backend_info *be = omx_xenif->be;
+	struct page *indirect_pages[OMX_XEN_GRANT_PAGES_MAX];
+	uint32_t indirect_handles[OMX_XEN_GRANT_PAGES_MAX];
+	unsigned long first;
+	int ret = 0, k = 0, i;
+
+	dprintk_in();
+
+	for (i = 0; i < nr_indirect; i++) {
+		indirect_pages[i] = alloc_page(GFP_KERNEL);
+		if (!indirect_pages[i]) {
+			ret = -ENOMEM;
+			goto out_with_indirect_pages;
+		}
+	}
+
+	ret =
+	    omx_xen_map_pages(be, indirect_gref, indirect_pages,
+			      indirect_handles, nr_indirect);
+	if (ret) {
+		printk_err("Cannot map %u indirect gref pages, ret = %d\n",
+			   nr_indirect, ret);
+		goto out_with_indirect_pages;
+	}
+
+	seg->list_pages =
+	    kzalloc(sizeof(struct page *) * seg->nr_parts, GFP_KERNEL);
+	seg->list_handles =
+	    kzalloc(sizeof(grant_handle_t) * seg->nr_parts, GFP_KERNEL);
+	if (!seg->list_pages || !seg->list_handles) {
+		ret = -ENOMEM;
+		goto out_with_list;
+	}
+
+	for (k = 0; k < seg->nr_parts; k++) {
+		seg->list_pages[k] = alloc_page(GFP_KERNEL);
+		if (!seg->list_pages[k]) {
+			ret = -ENOMEM;
+			goto out_with_list;
+		}
+	}
+
+	for (first = 0; first < seg->nr_parts;
+	     first += OMX_XEN_GREFS_PER_PAGE) {
+		uint32_t *grefs =
+		    page_address(indirect_pages[first /
+						OMX_XEN_GREFS_PER_PAGE]);
+
+		ret =
+		    omx_xen_map_pages(be, grefs, &seg->list_pages[first],
+				      &seg->list_handles[first],
+				      min_t(unsigned long,
+					    OMX_XEN_GREFS_PER_PAGE,
+					    seg->nr_parts - first));
+		if (ret) {
+			printk_err("Cannot map the gref list, ret = %d\n",
+				   ret);
+			omx_xen_unmap_pages(seg->list_handles,
+					    seg->list_pages, first);
+			goto out_with_list;
+		}
+	}
+
+	for (k = 0; k < seg->nr_parts; k++)
+		gref_list[k] =
+		    (uint32_t *) (page_address(seg->list_pages[k]) +
+				  seg->gref_offset);
+	goto out_with_indirect_map;
+
+out_with_list:
+	while (k--)
+		__free_page(seg->list_pages[k]);
+	kfree(seg->list_handles);
+	kfree(seg->list_pages);
+	seg->list_handles = NULL;
+	seg->list_pages = NULL;
+out_with_indirect_map:
+	omx_xen_unmap_pages(indirect_handles, indirect_pages, nr_indirect);
+out_with_indirect_pages:
+	while (i--)
+		__free_page(indirect_pages[i]);
+	dprintk_out();
+	return ret;
+}
+
 int omx_xen_unmap_page(uint32_t handle, struct page *page)
 {
 	int ret = 0;
@@ -339,20 +463,50 @@ out:
 	return ret;
 }
 
+/* Map a guest gref onto a backing page we own */
+static int __omx_xen_map_page(struct backend_info *be, uint32_t gref,
+			      struct page *page, uint32_t * handle)
+{
+	int ret = 0;
+	uint32_t mfn;
+	struct gnttab_map_grant_ref ops;
+
+	gnttab_set_map_op(&ops, (unsigned long)pfn_to_kaddr(page_to_pfn(page)),
+			  GNTMAP_host_map, gref, be->remoteDomain);
+
+	if (HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, &ops, 1)) {
+		printk_err("HYPERVISOR map grant ref failed");
+		ret = -ENOSYS;
+		goto out;
+	}
+	if (ops.status) {
+		printk_err("HYPERVISOR map grant ref failed status = %d",
+			   ops.status);
+
+		ret = ops.status;
+		goto out;
+	}
+	mfn = ops.dev_bus_addr >> PAGE_SHIFT;
+
+	ret = m2p_add_override(mfn, page, NULL);
+	if (ret) {
+		printk_err("m2p failed!, ret = %d\n", ret);
+		goto out;
+	}
+	*handle = ops.handle;
+
+out:
+	return ret;
+}
+
 int omx_xen_map_page(struct backend_info *be, uint32_t gref, void **vaddr,
 		     uint32_t * handle, struct page **retpage,
 		     struct omx_xen_page_cookie **cookie)
 {
 	int ret = 0;
 	struct page *page;
-	uint32_t mfn;
-	struct gnttab_map_grant_ref ops;
 	struct omx_xen_page_cookie *page_cookie;
 
-	ops.flags = GNTMAP_host_map;
-	ops.ref = gref;
-	ops.dom = be->remoteDomain;
-
 	*vaddr = NULL;
 
 	if (!cookie) {
@@ -373,40 +527,437 @@ int omx_xen_map_page(struct backend_info *be, uint32_t gref, void **vaddr,
 		goto out;
 	}
 
-	ops.host_addr = (unsigned long)pfn_to_kaddr(page_to_pfn(page));
-
-	if (HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, &ops, 1)) {
-		printk_err("HYPERVISOR map grant ref failed");
-		ret = -ENOSYS;
+	ret = __omx_xen_map_page(be, gref, page, handle);
+	if (ret)
 		goto out;
+
+	if (retpage)
+		*retpage = page;
+	*vaddr = page_address(page);
+
+out:
+	return ret;
+}
+
+/* Undo a successful map operation that we could not complete */
+static void omx_xen_unmap_grant(uint32_t handle, struct page *page)
+{
+	struct gnttab_unmap_grant_ref ops;
+
+	gnttab_set_unmap_op(&ops, (unsigned long)pfn_to_kaddr(page_to_pfn(page)),
+			    GNTMAP_host_map, handle);
+	if (HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref, &ops, 1)
+	    || ops.status)
+		printk_err("Cannot undo grant mapping, handle %#x\n", handle);
+}
+
+/*
+ * Map nr guest grefs onto the given backing pages, with one grant table
+ * hypercall per OMX_XEN_GRANT_BATCH pages instead of one per page.
+ *
+ * Entries of a batch that failed are retried one at a time (the frame may
+ * just have been paged out), and if one still fails everything this call
+ * mapped is unmapped again, so the caller only has to deal with its pages.
+ */
+int omx_xen_map_pages(struct backend_info *be, const uint32_t * grefs,
+		      struct page **pages, uint32_t * handles, unsigned int nr)
+{
+	struct gnttab_map_grant_ref ops[OMX_XEN_GRANT_BATCH];
+	unsigned int done, i, n;
+	int ret = 0;
+
+	for (done = 0; done < nr; done += n) {
+		n = min_t(unsigned int, nr - done, OMX_XEN_GRANT_BATCH);
+
+		for (i = 0; i < n; i++)
+			gnttab_set_map_op(&ops[i],
+					  (unsigned long)pfn_to_kaddr(page_to_pfn(pages[done + i])),
+					  GNTMAP_host_map, grefs[done + i],
+					  be->remoteDomain);
+
+		if (HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, ops, n)) {
+			/* nothing got mapped, take the slow path for the whole batch */
+			for (i = 0; i < n; i++)
+				ops[i].status = GNTST_general_error;
+		}
+
+		for (i = 0; i < n; i++) {
+			unsigned int idx = done + i;
+
+			if (ops[i].status == GNTST_okay) {
+				handles[idx] = ops[i].handle;
+				ret = m2p_add_override(ops[i].dev_bus_addr >> PAGE_SHIFT,
+						       pages[idx], NULL);
+				if (ret) {
+					printk_err("m2p failed!, ret = %d\n", ret);
+					omx_xen_unmap_grant(handles[idx], pages[idx]);
+				}
+			} else {
+				ret = __omx_xen_map_page(be, grefs[idx], pages[idx],
+							 &handles[idx]);
+			}
+
+			if (ret) {
+				/* drop the rest of this batch, then what we mapped before */
+				for (i++; i < n; i++)
+					if (ops[i].status == GNTST_okay)
+						omx_xen_unmap_grant(ops[i].handle,
+								    pages[done + i]);
+				omx_xen_unmap_pages(handles, pages, idx);
+				goto out;
+			}
+		}
 	}
-	if (ops.status) {
-		printk_err("HYPERVISOR map grant ref failed status = %d",
-			   ops.status);
 
-		ret = ops.status;
-		goto out;
+out:
+	return ret;
+}
+
+/*
+ * Unmap nr pages mapped by omx_xen_map_pages(), batching the hypercalls
+ * as well. Failed entries are retried one at a time; we keep going and
+ * report the last error.
+ */
+int omx_xen_unmap_pages(const uint32_t * handles, struct page **pages,
+			unsigned int nr)
+{
+	struct gnttab_unmap_grant_ref ops[OMX_XEN_GRANT_BATCH];
+	unsigned int done, i, n;
+	int ret = 0, err;
+
+	for (done = 0; done < nr; done += n) {
+		n = min_t(unsigned int, nr - done, OMX_XEN_GRANT_BATCH);
+
+		for (i = 0; i < n; i++)
+			gnttab_set_unmap_op(&ops[i],
+					    (unsigned long)pfn_to_kaddr(page_to_pfn(pages[done + i])),
+					    GNTMAP_host_map, handles[done + i]);
+
+		if (HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref, ops, n)) {
+			for (i = 0; i < n; i++)
+				ops[i].status = GNTST_general_error;
+		}
+
+		for (i = 0; i < n; i++) {
+			unsigned int idx = done + i;
+
+			if (ops[i].status == GNTST_okay)
+				err = m2p_remove_override(pages[idx], false) ?
+				    -EFAULT : 0;
+			else
+				err = omx_xen_unmap_page(handles[idx], pages[idx]);
+			if (err) {
+				printk_err("unmap of page %u failed, err = %d\n",
+					   idx, err);
+				ret = err;
+			}
+		}
 	}
-	mfn = ops.dev_bus_addr >> PAGE_SHIFT;
-	//mfn = PFN_DOWN(ops->dev_bus_addr);
-	//}
 
-#if 1
-	ret = m2p_add_override(mfn, page, NULL);
+	return ret;
+}
+
+/*
+ * Persistent grant cache.
+ *
+ * Mappings are looked up by gref; the frontend only tags a segment as
+ * persistent when it keeps each of its grefs granted to the same page
+ * until the device goes away, so a cached mapping stays valid for as
+ * long as we keep it.
+ */
+
+void omx_xen_pgrant_cache_init(struct omx_xen_pgrant_cache *cache)
+{
+	int i;
+
+	mutex_init(&cache->lock);
+	for (i = 0; i < (1 << OMX_XEN_PGRANT_HASH_BITS); i++)
+		INIT_HLIST_HEAD(&cache->hash[i]);
+	INIT_LIST_HEAD(&cache->lru);
+	cache->nr_mapped = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->evictions = 0;
+}
+
+static inline struct hlist_head *
+omx_xen_pgrant_bucket(struct omx_xen_pgrant_cache *cache, grant_ref_t gref)
+{
+	return &cache->hash[hash_32(gref, OMX_XEN_PGRANT_HASH_BITS)];
+}
+
+static struct omx_xen_pgrant *
+omx_xen_pgrant_lookup(struct omx_xen_pgrant_cache *cache, grant_ref_t gref)
+{
+	struct hlist_node *pos;
+
+	hlist_for_each(pos, omx_xen_pgrant_bucket(cache, gref)) {
+		struct omx_xen_pgrant *pgrant =
+		    hlist_entry(pos, struct omx_xen_pgrant, node);
+		if (pgrant->gref == gref)
+			return pgrant;
+	}
+	return NULL;
+}
+
+/* Called with the cache lock held, on an unused pgrant */
+static void omx_xen_pgrant_free(struct omx_xen_pgrant_cache *cache,
+				struct omx_xen_pgrant *pgrant)
+{
+	hlist_del(&pgrant->node);
+	list_del(&pgrant->lru);
+
+	if (pgrant->mapped) {
+		cache->nr_mapped--;
+		if (omx_xen_unmap_page(pgrant->handle, pgrant->page)) {
+			/* the page may still be mapped, leak it */
+			printk_err("Cannot unmap persistent gref %u\n",
+				   pgrant->gref);
+			pgrant->page = NULL;
+		}
+	}
+	if (pgrant->page)
+		__free_page(pgrant->page);
+	kfree(pgrant);
+}
+
+/* Called with the cache lock held */
+static void omx_xen_pgrant_put(struct omx_xen_pgrant_cache *cache,
+			       struct omx_xen_pgrant *pgrant)
+{
+	if (--pgrant->refcount)
+		return;
+
+	if (!pgrant->mapped)
+		omx_xen_pgrant_free(cache, pgrant);
+	else
+		list_add_tail(&pgrant->lru, &cache->lru);
+}
+
+/* Called with the cache lock held, unmaps unused pgrants above the budget */
+static void omx_xen_pgrant_trim(struct omx_xen_pgrant_cache *cache)
+{
+	unsigned int budget = ACCESS_ONCE(omx_xen_pgrant_pages);
+
+	while (cache->nr_mapped > budget && !list_empty(&cache->lru)) {
+		struct omx_xen_pgrant *pgrant =
+		    list_first_entry(&cache->lru, struct omx_xen_pgrant, lru);
+		omx_xen_pgrant_free(cache, pgrant);
+		cache->evictions++;
+	}
+}
+
+/*
+ * Map a batch of missed grefs at once.
+ * On failure none of them is mapped and they are left with mapped == 0.
+ */
+static int omx_xen_pgrant_map_batch(struct backend_info *be,
+				    struct omx_xen_pgrant **batch,
+				    unsigned int nr)
+{
+	struct omx_xen_pgrant_cache *cache = &be->pgrants;
+	uint32_t grefs[OMX_XEN_GRANT_BATCH];
+	uint32_t handles[OMX_XEN_GRANT_BATCH];
+	struct page *pages[OMX_XEN_GRANT_BATCH];
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < nr; i++) {
+		grefs[i] = batch[i]->gref;
+		pages[i] = batch[i]->page;
+	}
+
+	ret = omx_xen_map_pages(be, grefs, pages, handles, nr);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < nr; i++) {
+		batch[i]->handle = handles[i];
+		batch[i]->mapped = 1;
+	}
+	cache->nr_mapped += nr;
+	return 0;
+}
+
+/*
+ * Map all pages of a persistent segment, reusing the cached mappings and
+ * mapping the missing ones in batches.
+ */
+static int omx_xen_pgrant_get_segment(omx_xenif_t * omx_xenif,
+				      struct omx_endpoint *endpoint,
+				      struct omx_xen_user_region_segment *seg,
+				      uint32_t ** gref_list, uint32_t nr_grefs,
+				      struct page **page_list)
+{
+	struct backend_info *be = omx_xenif->be;
+	struct omx_xen_pgrant_cache *cache = &be->pgrants;
+	struct omx_xen_pgrant *batch[OMX_XEN_GRANT_BATCH];
+	unsigned int nr = 0;
+	unsigned long i;
+	int ret = 0;
+
+	dprintk_in();
+
+	mutex_lock(&cache->lock);
+	for (i = 0; i < seg->nr_pages; i++) {
+		grant_ref_t gref = gref_list[i / nr_grefs][i % nr_grefs];
+		struct omx_xen_pgrant *pgrant;
+
+		pgrant = omx_xen_pgrant_lookup(cache, gref);
+		if (pgrant) {
+			if (!pgrant->refcount++)
+				list_del_init(&pgrant->lru);
+			seg->pgrants[i] = pgrant;
+			cache->hits++;
+			omx_counter_inc(endpoint->iface, XEN_PGRANT_HIT);
+			continue;
+		}
+
+		cache->misses++;
+		omx_counter_inc(endpoint->iface, XEN_PGRANT_MISS);
+		pgrant = kzalloc(sizeof(*pgrant), GFP_KERNEL);
+		if (!pgrant) {
+			ret = -ENOMEM;
+			break;
+		}
+		pgrant->page = alloc_page(GFP_KERNEL);
+		if (!pgrant->page) {
+			kfree(pgrant);
+			ret = -ENOMEM;
+			break;
+		}
+		pgrant->gref = gref;
+		pgrant->refcount = 1;
+		INIT_LIST_HEAD(&pgrant->lru);
+		/* hashed right away in case the gref shows up again in this segment */
+		hlist_add_head(&pgrant->node, omx_xen_pgrant_bucket(cache, gref));
+		seg->pgrants[i] = pgrant;
+
+		batch[nr++] = pgrant;
+		if (nr == OMX_XEN_GRANT_BATCH) {
+			ret = omx_xen_pgrant_map_batch(be, batch, nr);
+			nr = 0;
+			if (ret)
+				break;
+		}
+	}
+	if (nr && !ret)
+		ret = omx_xen_pgrant_map_batch(be, batch, nr);
+
 	if (ret) {
-		printk_err("m2p failed!, ret = %d\n", ret);
-		goto out;
+		for (i = 0; i < seg->nr_pages; i++)
+			if (seg->pgrants[i]) {
+				omx_xen_pgrant_put(cache, seg->pgrants[i]);
+				seg->pgrants[i] = NULL;
+			}
+		goto out_with_lock;
+	}
+
+	for (i = 0; i < seg->nr_pages; i++) {
+		page_list[i] = seg->pgrants[i]->page;
+		seg->handles[i] = seg->pgrants[i]->handle;
 	}
+	omx_xen_pgrant_trim(cache);
+
+out_with_lock:
+	mutex_unlock(&cache->lock);
+	dprintk_out();
+	return ret;
+}
+
+static void omx_xen_pgrant_put_segment(omx_xenif_t * omx_xenif,
+				       struct omx_xen_user_region_segment *seg)
+{
+	struct omx_xen_pgrant_cache *cache = &omx_xenif->be->pgrants;
+	unsigned long i;
+
+	mutex_lock(&cache->lock);
+	for (i = 0; i < seg->nr_pages; i++)
+		if (seg->pgrants[i])
+			omx_xen_pgrant_put(cache, seg->pgrants[i]);
+	omx_xen_pgrant_trim(cache);
+	mutex_unlock(&cache->lock);
+
+	kfree(seg->pgrants);
+	seg->pgrants = NULL;
+}
+
+/* Unmap everything when the guest goes away */
+void omx_xen_pgrant_cache_flush(struct backend_info *be)
+{
+	struct omx_xen_pgrant_cache *cache = &be->pgrants;
+	int i;
+
+	dprintk_in();
+
+	mutex_lock(&cache->lock);
+	for (i = 0; i < (1 << OMX_XEN_PGRANT_HASH_BITS); i++) {
+		while (!hlist_empty(&cache->hash[i])) {
+			struct omx_xen_pgrant *pgrant =
+			    hlist_entry(cache->hash[i].first,
+					struct omx_xen_pgrant, node);
+			if (pgrant->refcount)
+				printk_err("Persistent gref %u still used by %u segment(s)\n",
+					   pgrant->gref, pgrant->refcount);
+			omx_xen_pgrant_free(cache, pgrant);
+		}
+	}
+	mutex_unlock(&cache->lock);
+
+	printk_inf("Persistent grants of domain %d: %lu hits, %lu misses, %lu evictions\n",
+		   be->remoteDomain, cache->hits, cache->misses,
+		   cache->evictions);
+	dprintk_out();
+}
+
+/* Back each page of a segment and map it, one gref list part at a time */
+static int omx_xen_map_segment_pages(omx_xenif_t * omx_xenif,
+				     struct omx_xen_user_region_segment *seg,
+				     uint32_t ** gref_list, uint32_t nr_grefs,
+				     struct page **page_list)
+{
+	unsigned long i, first;
+	int ret = 0;
+
+	for (i = 0; i < seg->nr_pages; i++) {
+#ifdef OMX_XEN_COOKIES
+		seg->cookies[i] = omx_xen_page_get_cookie(omx_xenif);
+		if (!seg->cookies[i]) {
+			printk_err("Not a valid cookie\n");
+			ret = -EINVAL;
+			goto out_with_pages;
+		}
+		page_list[i] = seg->cookies[i]->page;
+#else
+		page_list[i] = alloc_page(GFP_KERNEL);
+		if (!page_list[i]) {
+			ret = -ENOMEM;
+			goto out_with_pages;
+		}
 #endif
-	if (retpage)
-		*retpage = page;
-	*vaddr = page_address(page);
-	*handle = ops.handle;
+	}
 
-	//kfree(ops);
+	for (first = 0; first < seg->nr_pages; first += nr_grefs) {
+		ret =
+		    omx_xen_map_pages(omx_xenif->be, gref_list[first / nr_grefs],
+				      &page_list[first], &seg->handles[first],
+				      min_t(unsigned long, nr_grefs,
+					    seg->nr_pages - first));
+		if (ret) {
+			omx_xen_unmap_pages(seg->handles, page_list, first);
+			goto out_with_pages;
+		}
+	}
+	return 0;
 
-out:
-	//dprintk_out();
+out_with_pages:
+	while (i--) {
+#ifdef OMX_XEN_COOKIES
+		omx_xen_page_put_cookie(omx_xenif, seg->cookies[i]);
+#else
+		__free_page(page_list[i]);
+#endif
+	}
 	return ret;
 }
 
@@ -425,11 +976,10 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 	int ret = 0;
 	int i = 0, k = 0;
 	uint8_t eid, nr_parts;
-	uint16_t first_page_offset, gref_offset;
+	uint16_t first_page_offset, gref_offset, nr_list_parts;
 	uint32_t sid, id, nr_grefs, nr_pages, length,
 	    gref[OMX_XEN_GRANT_PAGES_MAX];
 	uint64_t domU_vaddr;
-	int idx = 0, sidx = 0;
 
 	dprintk_in();
 
@@ -443,6 +993,11 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 	nr_parts = req->nr_parts;
 	length = req->length;
 	dprintk_deb("nr_parts = %#x\n", nr_parts);
+	if (unlikely(nr_parts > OMX_XEN_GRANT_PAGES_MAX)) {
+		printk_err("Too many gref list parts (%u)\n", nr_parts);
+		ret = -EINVAL;
+		goto out;
+	}
 	for (k = 0; k < nr_parts; k++) {
 		gref[k] = req->gref[k];
 		dprintk_deb("printing gref = %lu\n", gref[k]);
@@ -478,10 +1033,26 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 		dprintk_deb("grant reference for list of grefs = %#x\n",
 			    gref[k]);
 	}
-	seg->nr_parts = nr_parts;
-	dprintk_deb("parts of gref list = %#x\n", nr_parts);
 
-	gref_list = kzalloc(sizeof(uint32_t *) * nr_parts, GFP_ATOMIC);
+	/* gref[] may reference indirect pages holding the list grefs */
+	nr_list_parts = nr_parts;
+	if (req->flags & OMX_XEN_SEGMENT_INDIRECT) {
+		nr_list_parts = req->nr_list_parts;
+		if (unlikely
+		    (!nr_parts || nr_parts > omx_xen_indirect_parts
+		     || nr_list_parts > nr_parts * OMX_XEN_GREFS_PER_PAGE
+		     || (unsigned long)nr_list_parts * OMX_XEN_GREFS_PER_PAGE <
+		     nr_pages)) {
+			printk_err("Invalid indirect gref list (%u pages in %u parts)\n",
+				   nr_list_parts, nr_parts);
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+	seg->nr_parts = nr_list_parts;
+	dprintk_deb("parts of gref list = %#x\n", nr_list_parts);
+
+	gref_list = kzalloc(sizeof(uint32_t *) * nr_list_parts, GFP_ATOMIC);
 	if (!gref_list) {
 		ret = -ENOMEM;
 		printk_err("gref list is cannot be allocated, ENOMEM!!!\n");
@@ -512,7 +1083,29 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 		goto out;
 	}
 
-	for (k = 0; k < nr_parts; k++) {
+	if (req->flags & OMX_XEN_SEGMENT_PERSISTENT) {
+		seg->pgrants =
+		    kzalloc(sizeof(struct omx_xen_pgrant *) * nr_pages,
+			    GFP_ATOMIC);
+		if (!seg->pgrants) {
+			ret = -ENOMEM;
+			printk_err(" pgrant list is NULL, ENOMEM!!!\n");
+			goto out;
+		}
+	}
+
+	if (req->flags & OMX_XEN_SEGMENT_INDIRECT) {
+		ret =
+		    omx_xen_accept_indirect_gref_list(omx_xenif, seg, gref,
+						      nr_parts, gref_list);
+		if (ret) {
+			printk_err("Cannot accept indirect gref list, = %d\n",
+				   ret);
+			goto out;
+		}
+	}
+
+	for (k = 0; !seg->list_pages && k < nr_parts; k++) {
 		ret =
 		    omx_xen_accept_gref_list(omx_xenif, seg, gref[k], &vaddr,
 					     k);
@@ -533,58 +1126,20 @@ int omx_xen_register_user_segment(omx_xenif_t * omx_xenif,
 	seg->nr_pages = nr_pages;
 	seg->first_page_offset = first_page_offset;
 
-	i = 0;
-	idx = 0;
-	sidx = 0;
-	while (i < nr_pages) {
-		void *tmp_vaddr;
-		struct page *page;
-		if (sidx % 256 == 0)
-			dprintk_deb("gref_list[%d][%d] = %#x\n", idx, sidx,
-				    gref_list[idx][sidx]);
-
+	if (seg->pgrants)
 		ret =
-		    omx_xen_map_page(omx_xenif->be, gref_list[idx][sidx],
-				     &tmp_vaddr, &seg->handles[i], NULL,
-#ifdef OMX_XEN_COOKIES
-				     &seg->cookies[i]);
-#else
-				     NULL);
-#endif
-		if (ret) {
-			printk_err("map page failed!, ret = %d\n", ret);
-			goto out;
-		}
-
-#ifdef EXTRA_DEBUG_OMX
-		if (sidx % 256 == 0)
-			dprintk_deb("%#lx\n", tmp_vaddr);
-		if (!virt_addr_valid(tmp_vaddr)) {
-			ret = -EINVAL;
-			goto out;
-		} else {
-#endif
-			page = virt_to_page(tmp_vaddr);
-#ifdef EXTRA_DEBUG_OMX
-		}
-		if (!page)
-			printk_err("No page found:(\n");
-		else {
-			if (sidx % 256 == 0)
-				dprintk_deb("page=%#lx\n", (unsigned long)page);
-#endif
-			page_list[i] = page;
-#ifdef EXTRA_DEBUG_OMX
-		}
-#endif
-		i++;
-		if ((unlikely(i % nr_grefs == 0))) {
-			idx++;
-			sidx = 0;
-		} else {
-			sidx++;
-		}
+		    omx_xen_pgrant_get_segment(omx_xenif, endpoint, seg,
+					       gref_list, nr_grefs, page_list);
+	else
+		ret =
+		    omx_xen_map_segment_pages(omx_xenif, seg, gref_list,
+					      nr_grefs, page_list);
+	if (ret) {
+		printk_err("map pages failed!, ret = %d\n", ret);
+		goto out;
 	}
+	i = nr_pages;
+
 	seg->pages = page_list;
 	seg->nr_pages = i;
 	seg->length = length;
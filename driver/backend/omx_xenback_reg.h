@@ -66,6 +66,14 @@ int omx_xen_map_page(struct backend_info *be, uint32_t gref, void **vaddr,
 		     struct omx_xen_page_cookie **cookie);
 int omx_xen_unmap_page(uint32_t handle, struct page *page);
 
+/* grant table operations submitted per hypercall by the batched helpers */
+#define OMX_XEN_GRANT_BATCH 16
+
+int omx_xen_map_pages(struct backend_info *be, const uint32_t * grefs,
+		      struct page **pages, uint32_t * handles, unsigned int nr);
+int omx_xen_unmap_pages(const uint32_t * handles, struct page **pages,
+			unsigned int nr);
+
 void omx_xen_user_region_release(struct omx_xen_user_region *region);
 struct omx_xen_user_region *omx_xen_user_region_acquire(const struct
 							omx_endpoint *endpoint,
@@ -0,0 +1,724 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Guests of the same host talk to each other through dom0 without
+ * touching the wire: both endpoints have their queues grant-mapped here,
+ * and so are the pages of their registered regions, so we just copy
+ * between those mappings and write the events straight into the guest
+ * event queues. This mirrors the Open-MX shared paths in omx_shared.c,
+ * which cannot be used as is since they rely on the native endpoint
+ * queues.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/cdev.h>
+
+#include <xen/page.h>
+#include <xen/xenbus.h>
+#include <xen/events.h>
+#include <xen/interface/io/ring.h>
+
+#include "omx_reg.h"
+#include "omx_common.h"
+#include "omx_iface.h"
+#include "omx_endpoint.h"
+#include "omx_peer.h"
+#include "omx_misc.h"
+#include "omx_shared.h"
+
+//#define EXTRA_DEBUG_OMX
+#include "omx_xen_debug.h"
+#include "omx_xen.h"
+#include "omx_xenback.h"
+#include "omx_xenback_reg.h"
+#include "omx_xenback_shared.h"
+
+/********************
+ * Endpoint checking
+ */
+
+/*
+ * We can only deliver to guests whose event queues and recvq are mapped
+ * in dom0, the others keep using the network.
+ */
+static INLINE int
+omx_xen_shared_capable(struct omx_endpoint *endpoint)
+{
+	return endpoint->xen
+	    && endpoint->fe_endpoint
+	    && endpoint->xen_sendq_pages && endpoint->xen_recvq_pages
+	    && ACCESS_ONCE(endpoint->xen_exp_eventq.pages)
+	    && ACCESS_ONCE(endpoint->xen_unexp_eventq.pages);
+}
+
+/*
+ * Acquire the destination endpoint if it is a guest endpoint of this host.
+ * Returns NULL if the caller should use the network, an ERR_PTR if the
+ * endpoint is local but invalid.
+ */
+static struct omx_endpoint *
+omx_xen_shared_acquire_endpoint(struct omx_endpoint *src_endpoint,
+				uint16_t dst_peer_index, uint8_t dst_endpoint_index)
+{
+	struct omx_endpoint *dst_endpoint;
+
+	if (!omx_xen_shared_host || !omx_xen_shared_capable(src_endpoint))
+		return NULL;
+
+	dst_endpoint = omx_local_peer_acquire_endpoint(dst_peer_index, dst_endpoint_index);
+	if (!dst_endpoint || IS_ERR(dst_endpoint))
+		return dst_endpoint;
+
+	if (unlikely(!omx_xen_shared_capable(dst_endpoint))) {
+		/* a dom0 endpoint, or a guest without direct event queues */
+		omx_endpoint_release(dst_endpoint);
+		return NULL;
+	}
+
+	return dst_endpoint;
+}
+
+static INLINE struct omx_endpoint *
+omx_xen_shared_get_endpoint_or_nack_type(struct omx_endpoint *src_endpoint,
+					 uint16_t dst_peer_index, uint8_t dst_endpoint_index,
+					 uint32_t session_id,
+					 enum omx_nack_type *nack_type)
+{
+	struct omx_endpoint *dst_endpoint;
+
+	*nack_type = OMX_NACK_TYPE_NONE;
+
+	dst_endpoint = omx_xen_shared_acquire_endpoint(src_endpoint, dst_peer_index, dst_endpoint_index);
+	if (unlikely(!dst_endpoint))
+		/* the peer isn't one of our guests */
+		return NULL;
+
+	if (unlikely(IS_ERR(dst_endpoint))) {
+		*nack_type = omx_endpoint_acquire_by_iface_index_error_to_nack_type(dst_endpoint);
+		return NULL;
+	}
+
+	if (unlikely(session_id != dst_endpoint->session_id)) {
+		*nack_type = OMX_NACK_TYPE_BAD_SESSION;
+		omx_endpoint_release(dst_endpoint);
+		return NULL;
+	}
+
+	return dst_endpoint;
+}
+
+static INLINE void
+omx_xen_shared_notify_nack(struct omx_endpoint *src_endpoint,
+			   uint16_t dst_peer_index, uint8_t dst_endpoint_index, uint16_t seqnum,
+			   enum omx_nack_type nack_type)
+{
+	struct omx_evt_recv_nack_lib event;
+
+	event.id = 0;
+	event.type = OMX_EVT_RECV_NACK_LIB;
+	event.peer_index = dst_peer_index;
+	event.src_endpoint = dst_endpoint_index;
+	event.seqnum = seqnum;
+	event.nack_type = nack_type;
+
+	/* ignore errors, the packet will be resent anyway */
+	omx_xen_notify_unexp_event(src_endpoint, &event, sizeof(event));
+}
+
+/*
+ * Returns the acquired destination endpoint, NULL if the caller should
+ * use the network, or an ERR_PTR once a nack was notified to the sender.
+ */
+static INLINE struct omx_endpoint *
+omx_xen_shared_get_endpoint_or_notify_nack(struct omx_endpoint *src_endpoint,
+					   uint16_t dst_peer_index, uint8_t dst_endpoint_index,
+					   uint32_t session_id, uint16_t seqnum)
+{
+	struct omx_endpoint *dst_endpoint;
+	enum omx_nack_type nack_type;
+
+	dst_endpoint = omx_xen_shared_get_endpoint_or_nack_type(src_endpoint,
+								dst_peer_index, dst_endpoint_index,
+								session_id, &nack_type);
+	if (likely(dst_endpoint != NULL) || nack_type == OMX_NACK_TYPE_NONE)
+		return dst_endpoint;
+
+	omx_xen_shared_notify_nack(src_endpoint, dst_peer_index, dst_endpoint_index, seqnum, nack_type);
+	return ERR_PTR(-ENOENT);
+}
+
+/****************
+ * Data movement
+ */
+
+/* guest queues are mapped page by page */
+static INLINE void *
+omx_xen_shared_queue_addr(struct page **pages, unsigned long offset)
+{
+	return pfn_to_kaddr(page_to_pfn(pages[offset >> PAGE_SHIFT])) + (offset & ~PAGE_MASK);
+}
+
+static void
+omx_xen_shared_copy_to_queue(struct page **pages, unsigned long offset,
+			     const void *buffer, unsigned long length)
+{
+	while (length) {
+		unsigned long chunk = min_t(unsigned long, length,
+					    PAGE_SIZE - (offset & ~PAGE_MASK));
+
+		memcpy(omx_xen_shared_queue_addr(pages, offset), buffer, chunk);
+		buffer += chunk;
+		offset += chunk;
+		length -= chunk;
+	}
+}
+
+/*
+ * Find the dom0 mapping of a region offset, and how many bytes are
+ * contiguous there.
+ */
+static void *
+omx_xen_shared_region_addr(struct omx_xen_user_region *region,
+			   unsigned long offset, unsigned long *contig)
+{
+	unsigned i;
+
+	for (i = 0; i < region->nr_segments; i++) {
+		struct omx_xen_user_region_segment *seg = &region->segments[i];
+		unsigned long pos;
+
+		if (offset >= seg->length) {
+			offset -= seg->length;
+			continue;
+		}
+
+		if (unlikely(!seg->pages))
+			/* segment not registered yet */
+			return NULL;
+
+		pos = offset + seg->first_page_offset;
+		*contig = min_t(unsigned long, seg->length - offset,
+				PAGE_SIZE - (pos & ~PAGE_MASK));
+		return pfn_to_kaddr(page_to_pfn(seg->pages[pos >> PAGE_SHIFT]))
+		    + (pos & ~PAGE_MASK);
+	}
+
+	return NULL;
+}
+
+static int
+omx_xen_shared_copy_between_regions(struct omx_xen_user_region *src_region,
+				    unsigned long src_offset,
+				    struct omx_xen_user_region *dst_region,
+				    unsigned long dst_offset,
+				    unsigned long length)
+{
+	while (length) {
+		unsigned long src_contig, dst_contig, chunk;
+		void *src, *dst;
+
+		src = omx_xen_shared_region_addr(src_region, src_offset, &src_contig);
+		dst = omx_xen_shared_region_addr(dst_region, dst_offset, &dst_contig);
+		if (unlikely(!src || !dst))
+			return -EINVAL;
+
+		chunk = min3(length, src_contig, dst_contig);
+		memcpy(dst, src, chunk);
+		src_offset += chunk;
+		dst_offset += chunk;
+		length -= chunk;
+	}
+
+	return 0;
+}
+
+/***********************
+ * Main Shared Routines
+ */
+
+int
+omx_xen_shared_try_send_connect_request(struct omx_endpoint *src_endpoint,
+					const struct omx_cmd_send_connect_request *hdr)
+{
+	struct omx_endpoint *dst_endpoint;
+	struct omx_evt_recv_connect_request event;
+	int err;
+
+	dprintk_in();
+	dst_endpoint = omx_xen_shared_acquire_endpoint(src_endpoint, hdr->peer_index, hdr->dest_endpoint);
+	if (!dst_endpoint) {
+		err = 1;
+		goto out;
+	}
+
+	if (unlikely(IS_ERR(dst_endpoint))) {
+		enum omx_nack_type nack_type = omx_endpoint_acquire_by_iface_index_error_to_nack_type(dst_endpoint);
+		omx_xen_shared_notify_nack(src_endpoint, hdr->peer_index, hdr->dest_endpoint, hdr->seqnum, nack_type);
+		err = 0;
+		goto out;
+	}
+
+	event.id = 0;
+	event.type = OMX_EVT_RECV_CONNECT_REQUEST;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
+	event.src_endpoint = src_endpoint->endpoint_index;
+	event.shared = 1;
+	event.seqnum = hdr->seqnum;
+	event.src_session_id = hdr->src_session_id;
+	event.app_key = hdr->app_key;
+	event.target_recv_seqnum_start = hdr->target_recv_seqnum_start;
+	event.connect_seqnum = hdr->connect_seqnum;
+
+	/* if the unexpected eventq is full, drop it, it will be resent anyway */
+	if (!omx_xen_notify_unexp_event(dst_endpoint, &event, sizeof(event)))
+		omx_counter_inc(omx_shared_fake_iface, SHARED_CONNECT_REQUEST);
+
+	omx_endpoint_release(dst_endpoint);
+	err = 0;
+
+out:
+	dprintk_out();
+	return err;
+}
+
+int
+omx_xen_shared_try_send_connect_reply(struct omx_endpoint *src_endpoint,
+				      const struct omx_cmd_send_connect_reply *hdr)
+{
+	struct omx_endpoint *dst_endpoint;
+	struct omx_evt_recv_connect_reply event;
+	int err;
+
+	dprintk_in();
+	dst_endpoint = omx_xen_shared_acquire_endpoint(src_endpoint, hdr->peer_index, hdr->dest_endpoint);
+	if (!dst_endpoint) {
+		err = 1;
+		goto out;
+	}
+
+	if (unlikely(IS_ERR(dst_endpoint))) {
+		enum omx_nack_type nack_type = omx_endpoint_acquire_by_iface_index_error_to_nack_type(dst_endpoint);
+		omx_xen_shared_notify_nack(src_endpoint, hdr->peer_index, hdr->dest_endpoint, hdr->seqnum, nack_type);
+		err = 0;
+		goto out;
+	}
+
+	event.id = 0;
+	event.type = OMX_EVT_RECV_CONNECT_REPLY;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
+	event.src_endpoint = src_endpoint->endpoint_index;
+	event.shared = 1;
+	event.seqnum = hdr->seqnum;
+	event.src_session_id = hdr->src_session_id;
+	event.target_session_id = hdr->target_session_id;
+	event.target_recv_seqnum_start = hdr->target_recv_seqnum_start;
+	event.connect_seqnum = hdr->connect_seqnum;
+	event.connect_status_code = hdr->connect_status_code;
+
+	if (!omx_xen_notify_unexp_event(dst_endpoint, &event, sizeof(event)))
+		omx_counter_inc(omx_shared_fake_iface, SHARED_CONNECT_REPLY);
+
+	omx_endpoint_release(dst_endpoint);
+	err = 0;
+
+out:
+	dprintk_out();
+	return err;
+}
+
+int
+omx_xen_shared_send_tiny(struct omx_endpoint *src_endpoint,
+			 const struct omx_cmd_send_tiny *cmd)
+{
+	const struct omx_cmd_send_tiny_hdr *hdr = &cmd->hdr;
+	struct omx_endpoint *dst_endpoint;
+	struct omx_evt_recv_msg event;
+	int err = 0;
+
+	dprintk_in();
+	if (unlikely(hdr->length > OMX_TINY_MSG_LENGTH_MAX)) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	dst_endpoint = omx_xen_shared_get_endpoint_or_notify_nack(src_endpoint, hdr->peer_index,
+								  hdr->dest_endpoint, hdr->session_id,
+								  hdr->seqnum);
+	if (!dst_endpoint) {
+		err = 1;
+		goto out;
+	}
+	if (IS_ERR(dst_endpoint))
+		goto out;
+
+	event.id = 0;
+	event.type = OMX_EVT_RECV_TINY;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
+	event.src_endpoint = src_endpoint->endpoint_index;
+	event.match_info = hdr->match_info;
+	event.seqnum = hdr->seqnum;
+	event.piggyack = hdr->piggyack;
+	event.specific.tiny.length = hdr->length;
+	event.specific.tiny.checksum = hdr->checksum;
+	memcpy(&event.specific.tiny.data, cmd->data, hdr->length);
+
+	if (!omx_xen_notify_unexp_event(dst_endpoint, &event, sizeof(event)))
+		omx_counter_inc(omx_shared_fake_iface, SHARED_TINY);
+
+	omx_endpoint_release(dst_endpoint);
+
+out:
+	dprintk_out();
+	return err;
+}
+
+int
+omx_xen_shared_send_small(struct omx_endpoint *src_endpoint,
+			  const struct omx_cmd_send_small *hdr,
+			  const void *data)
+{
+	struct omx_endpoint *dst_endpoint;
+	struct omx_evt_recv_msg event;
+	unsigned long recvq_offset;
+	int err = 0;
+
+	dprintk_in();
+	if (unlikely(hdr->length > OMX_SMALL_MSG_LENGTH_MAX)) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	dst_endpoint = omx_xen_shared_get_endpoint_or_notify_nack(src_endpoint, hdr->peer_index,
+								  hdr->dest_endpoint, hdr->session_id,
+								  hdr->seqnum);
+	if (!dst_endpoint) {
+		err = 1;
+		goto out;
+	}
+	if (IS_ERR(dst_endpoint))
+		goto out;
+
+	/* no more unexpected eventq slot? just drop it, it will be resent anyway */
+	if (omx_prepare_notify_unexp_event_with_recvq(dst_endpoint, &recvq_offset) < 0)
+		goto out_with_endpoint;
+
+	omx_xen_shared_copy_to_queue(dst_endpoint->xen_recvq_pages, recvq_offset,
+				     data, hdr->length);
+
+	event.id = 0;
+	event.type = OMX_EVT_RECV_SMALL;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
+	event.src_endpoint = src_endpoint->endpoint_index;
+	event.match_info = hdr->match_info;
+	event.seqnum = hdr->seqnum;
+	event.piggyack = hdr->piggyack;
+	event.specific.small.length = hdr->length;
+	event.specific.small.recvq_offset = recvq_offset;
+	event.specific.small.checksum = hdr->checksum;
+	if (unlikely(omx_xen_commit_notify_unexp_event_with_recvq(dst_endpoint, &event, sizeof(event)) < 0)) {
+		/* the guest eventq went away, drop it, it will be resent anyway */
+		omx_xen_cancel_notify_unexp_event_with_recvq(dst_endpoint);
+		dprintk_deb("dropping shared small, cannot commit the event\n");
+		goto out_with_endpoint;
+	}
+
+	omx_counter_inc(omx_shared_fake_iface, SHARED_SMALL);
+
+out_with_endpoint:
+	omx_endpoint_release(dst_endpoint);
+out:
+	dprintk_out();
+	return err;
+}
+
+int
+omx_xen_shared_send_mediumsq_frag(struct omx_endpoint *src_endpoint,
+				  const struct omx_cmd_send_mediumsq_frag *hdr)
+{
+	struct omx_endpoint *dst_endpoint;
+	struct omx_evt_recv_msg dst_event;
+	struct omx_evt_send_mediumsq_frag_done src_event;
+	unsigned long recvq_offset, sendq_offset = hdr->sendq_offset;
+	unsigned long remaining = hdr->frag_length;
+	int err = 0;
+
+	dprintk_in();
+	if (unlikely(remaining > OMX_RECVQ_ENTRY_SIZE
+		     || sendq_offset + remaining > OMX_SENDQ_SIZE)) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	dst_endpoint = omx_xen_shared_get_endpoint_or_notify_nack(src_endpoint, hdr->peer_index,
+								  hdr->dest_endpoint, hdr->session_id,
+								  hdr->seqnum);
+	if (!dst_endpoint) {
+		err = 1;
+		goto out;
+	}
+	if (IS_ERR(dst_endpoint))
+		goto out_notify_src;
+
+	/* no more unexpected eventq slot? just drop it, it will be resent anyway */
+	if (omx_prepare_notify_unexp_event_with_recvq(dst_endpoint, &recvq_offset) < 0)
+		goto out_with_endpoint;
+
+	/* both queues are mapped page by page, copy from one to the other */
+	while (remaining) {
+		unsigned long chunk = min3(remaining,
+					   PAGE_SIZE - (sendq_offset & ~PAGE_MASK),
+					   PAGE_SIZE - (recvq_offset & ~PAGE_MASK));
+
+		memcpy(omx_xen_shared_queue_addr(dst_endpoint->xen_recvq_pages, recvq_offset),
+		       omx_xen_shared_queue_addr(src_endpoint->xen_sendq_pages, sendq_offset),
+		       chunk);
+		sendq_offset += chunk;
+		recvq_offset += chunk;
+		remaining -= chunk;
+	}
+
+	dst_event.id = 0;
+	dst_event.type = OMX_EVT_RECV_MEDIUM_FRAG;
+	dst_event.peer_index = omx_shared_peer_index(src_endpoint);
+	dst_event.src_endpoint = src_endpoint->endpoint_index;
+	dst_event.match_info = hdr->match_info;
+	dst_event.seqnum = hdr->seqnum;
+	dst_event.piggyack = hdr->piggyack;
+	dst_event.specific.medium_frag.msg_length = hdr->msg_length;
+	dst_event.specific.medium_frag.frag_length = hdr->frag_length;
+	dst_event.specific.medium_frag.frag_seqnum = hdr->frag_seqnum;
+	dst_event.specific.medium_frag.frag_pipeline = hdr->frag_pipeline;
+	dst_event.specific.medium_frag.checksum = hdr->checksum;
+	dst_event.specific.medium_frag.exp_slot = 0;
+	dst_event.specific.medium_frag.exp_flags = 0;
+	dst_event.specific.medium_frag.recvq_offset = recvq_offset - hdr->frag_length;
+	if (unlikely(omx_xen_commit_notify_unexp_event_with_recvq(dst_endpoint, &dst_event, sizeof(dst_event)) < 0)) {
+		/* the guest eventq went away, drop it, it will be resent anyway */
+		omx_xen_cancel_notify_unexp_event_with_recvq(dst_endpoint);
+		dprintk_deb("dropping shared mediumsq frag, cannot commit the event\n");
+		goto out_with_endpoint;
+	}
+
+	omx_counter_inc(omx_shared_fake_iface, SHARED_MEDIUMSQ_FRAG);
+
+out_with_endpoint:
+	omx_endpoint_release(dst_endpoint);
+out_notify_src:
+	/* notify the sender in any case, so that it doesn't leak sendq slots */
+	src_event.id = 0;
+	src_event.type = OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE;
+	src_event.sendq_offset = hdr->sendq_offset;
+	omx_xen_notify_exp_event(src_endpoint, &src_event, sizeof(src_event));
+out:
+	dprintk_out();
+	return err;
+}
+
+int
+omx_xen_shared_send_rndv(struct omx_endpoint *src_endpoint,
+			 const struct omx_cmd_send_rndv *hdr)
+{
+	struct omx_endpoint *dst_endpoint;
+	struct omx_evt_recv_msg event;
+	int err = 0;
+
+	dprintk_in();
+	dst_endpoint = omx_xen_shared_get_endpoint_or_notify_nack(src_endpoint, hdr->peer_index,
+								  hdr->dest_endpoint, hdr->session_id,
+								  hdr->seqnum);
+	if (!dst_endpoint) {
+		err = 1;
+		goto out;
+	}
+	if (IS_ERR(dst_endpoint))
+		goto out;
+
+	/* guest regions are fully mapped at registration, nothing to pin here */
+	event.id = 0;
+	event.type = OMX_EVT_RECV_RNDV;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
+	event.src_endpoint = src_endpoint->endpoint_index;
+	event.match_info = hdr->match_info;
+	event.seqnum = hdr->seqnum;
+	event.piggyack = hdr->piggyack;
+	event.specific.rndv.msg_length = hdr->msg_length;
+	event.specific.rndv.pulled_rdma_id = hdr->pulled_rdma_id;
+	event.specific.rndv.pulled_rdma_seqnum = hdr->pulled_rdma_seqnum;
+	event.specific.rndv.pulled_rdma_offset = hdr->pulled_rdma_offset;
+	event.specific.rndv.checksum = hdr->checksum;
+
+	if (!omx_xen_notify_unexp_event(dst_endpoint, &event, sizeof(event)))
+		omx_counter_inc(omx_shared_fake_iface, SHARED_RNDV);
+
+	omx_endpoint_release(dst_endpoint);
+
+out:
+	dprintk_out();
+	return err;
+}
+
+int
+omx_xen_shared_pull(struct omx_endpoint *src_endpoint,
+		    const struct omx_cmd_pull *hdr)
+{
+	struct omx_endpoint *dst_endpoint;
+	struct omx_evt_pull_done event;
+	struct omx_xen_user_region *src_region, *dst_region;
+	enum omx_nack_type nack_type;
+	int err = 0;
+
+	dprintk_in();
+	src_region = omx_xen_user_region_acquire(src_endpoint, hdr->puller_rdma_id);
+	if (unlikely(!src_region)) {
+		/* source region is invalid, return an immediate error */
+		err = -EINVAL;
+		goto out;
+	}
+
+	dst_endpoint = omx_xen_shared_get_endpoint_or_nack_type(src_endpoint,
+								hdr->peer_index, hdr->dest_endpoint,
+								hdr->session_id, &nack_type);
+	if (unlikely(!dst_endpoint)) {
+		if (nack_type == OMX_NACK_TYPE_NONE) {
+			/* not one of our guests, let the network pull it */
+			omx_xen_user_region_release(src_region);
+			err = 1;
+			goto out;
+		}
+		/* dest endpoint invalid, return a pull done status error */
+		event.status = nack_type;
+		goto out_notify;
+	}
+
+	dst_region = omx_xen_user_region_acquire(dst_endpoint, hdr->pulled_rdma_id);
+	if (unlikely(!dst_region)) {
+		event.status = OMX_EVT_PULL_DONE_BAD_RDMAWIN;
+		goto out_notify_with_endpoint;
+	}
+
+	/* pull from the dst region into the src region */
+	err = omx_xen_shared_copy_between_regions(dst_region, hdr->pulled_rdma_offset,
+						  src_region, hdr->puller_rdma_offset,
+						  hdr->length);
+	event.status = err < 0 ? OMX_EVT_PULL_DONE_ABORTED : OMX_EVT_PULL_DONE_SUCCESS;
+	err = 0;
+
+	omx_xen_user_region_release(dst_region);
+	omx_counter_inc(omx_shared_fake_iface, SHARED_PULL);
+
+out_notify_with_endpoint:
+	omx_endpoint_release(dst_endpoint);
+out_notify:
+	omx_xen_user_region_release(src_region);
+
+	event.id = 0;
+	event.type = OMX_EVT_PULL_DONE;
+	event.lib_cookie = hdr->lib_cookie;
+	event.puller_rdma_id = hdr->puller_rdma_id;
+	omx_xen_notify_exp_event(src_endpoint, &event, sizeof(event));
+out:
+	dprintk_out();
+	return err;
+}
+
+int
+omx_xen_shared_send_notify(struct omx_endpoint *src_endpoint,
+			   const struct omx_cmd_send_notify *hdr)
+{
+	struct omx_endpoint *dst_endpoint;
+	struct omx_evt_recv_msg event;
+	int err = 0;
+
+	dprintk_in();
+	dst_endpoint = omx_xen_shared_get_endpoint_or_notify_nack(src_endpoint, hdr->peer_index,
+								  hdr->dest_endpoint, hdr->session_id,
+								  hdr->seqnum);
+	if (!dst_endpoint) {
+		err = 1;
+		goto out;
+	}
+	if (IS_ERR(dst_endpoint))
+		goto out;
+
+	event.id = 0;
+	event.type = OMX_EVT_RECV_NOTIFY;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
+	event.src_endpoint = src_endpoint->endpoint_index;
+	event.seqnum = hdr->seqnum;
+	event.piggyack = hdr->piggyack;
+	event.specific.notify.length = hdr->total_length;
+	event.specific.notify.pulled_rdma_id = hdr->pulled_rdma_id;
+	event.specific.notify.pulled_rdma_seqnum = hdr->pulled_rdma_seqnum;
+
+	if (!omx_xen_notify_unexp_event(dst_endpoint, &event, sizeof(event)))
+		omx_counter_inc(omx_shared_fake_iface, SHARED_NOTIFY);
+
+	omx_endpoint_release(dst_endpoint);
+
+out:
+	dprintk_out();
+	return err;
+}
+
+int
+omx_xen_shared_send_liback(struct omx_endpoint *src_endpoint,
+			   const struct omx_cmd_send_liback *hdr)
+{
+	struct omx_endpoint *dst_endpoint;
+	struct omx_evt_recv_liback event;
+	enum omx_nack_type nack_type;
+	int err = 0;
+
+	dprintk_in();
+	/* don't notify a nack if the endpoint is invalid */
+	dst_endpoint = omx_xen_shared_get_endpoint_or_nack_type(src_endpoint,
+								hdr->peer_index, hdr->dest_endpoint,
+								hdr->session_id, &nack_type);
+	if (!dst_endpoint) {
+		if (nack_type == OMX_NACK_TYPE_NONE)
+			err = 1;
+		goto out;
+	}
+
+	event.id = 0;
+	event.type = OMX_EVT_RECV_LIBACK;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
+	event.src_endpoint = src_endpoint->endpoint_index;
+	event.acknum = hdr->acknum;
+	event.lib_seqnum = hdr->lib_seqnum;
+	event.send_seq = hdr->send_seq;
+	event.resent = hdr->resent;
+
+	if (!omx_xen_notify_unexp_event(dst_endpoint, &event, sizeof(event)))
+		omx_counter_inc(omx_shared_fake_iface, SHARED_LIBACK);
+
+	omx_endpoint_release(dst_endpoint);
+
+out:
+	dprintk_out();
+	return err;
+}
+
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  c-basic-offset: 8
+ *  c-indent-level: 8
+ * End:
+ */
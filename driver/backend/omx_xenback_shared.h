@@ -0,0 +1,60 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+#ifndef __omx_xenback_shared_h__
+#define __omx_xenback_shared_h__
+
+#include "omx_io.h"
+
+struct omx_endpoint;
+
+/*
+ * Communication between guests of this host, through dom0.
+ *
+ * All these return 1 when the destination is not a guest endpoint of
+ * this host (the caller has to use the network), 0 once the message was
+ * delivered, dropped or nacked, and <0 on real error.
+ */
+int omx_xen_shared_try_send_connect_request(struct omx_endpoint *src_endpoint,
+					    const struct omx_cmd_send_connect_request *hdr);
+int omx_xen_shared_try_send_connect_reply(struct omx_endpoint *src_endpoint,
+					  const struct omx_cmd_send_connect_reply *hdr);
+int omx_xen_shared_send_tiny(struct omx_endpoint *src_endpoint,
+			     const struct omx_cmd_send_tiny *cmd);
+int omx_xen_shared_send_small(struct omx_endpoint *src_endpoint,
+			      const struct omx_cmd_send_small *hdr,
+			      const void *data);
+int omx_xen_shared_send_mediumsq_frag(struct omx_endpoint *src_endpoint,
+				      const struct omx_cmd_send_mediumsq_frag *hdr);
+int omx_xen_shared_send_rndv(struct omx_endpoint *src_endpoint,
+			     const struct omx_cmd_send_rndv *hdr);
+int omx_xen_shared_pull(struct omx_endpoint *src_endpoint,
+			const struct omx_cmd_pull *hdr);
+int omx_xen_shared_send_notify(struct omx_endpoint *src_endpoint,
+			       const struct omx_cmd_send_notify *hdr);
+int omx_xen_shared_send_liback(struct omx_endpoint *src_endpoint,
+			       const struct omx_cmd_send_liback *hdr);
+
+#endif				/* __omx_xenback_shared_h__ */
+
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  c-basic-offset: 8
+ *  c-indent-level: 8
+ * End:
+ */
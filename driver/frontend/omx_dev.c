@@ -40,6 +40,7 @@
 #include "omx_peer.h"
 #include "omx_endpoint.h"
 #include "omx_reg.h"
+#include "omx_shared.h"
 #include "omx_xenfront.h"
 #include "omx_xenfront_endpoint.h"
 #include "omx_xenfront_send.h"
@@ -51,6 +52,7 @@
 static int omx_endpoint_alloc_resources(struct omx_endpoint *endpoint)
 {
 	struct page **sendq_pages, **recvq_pages;
+	struct page **exp_eventq_pages, **unexp_eventq_pages;
 	struct omx_endpoint_desc *userdesc;
 	int i;
 	int ret;
@@ -69,6 +71,8 @@ static int omx_endpoint_alloc_resources(struct omx_endpoint *endpoint)
 	}
 	userdesc->status = 0;
 	userdesc->session_id = endpoint->session_id;
+	userdesc->exp_eventq_consumed_index = 0;
+	userdesc->unexp_eventq_consumed_index = 0;
 	endpoint->userdesc = userdesc;
 
 	/* alloc and init user queues */
@@ -126,6 +130,39 @@ static int omx_endpoint_alloc_resources(struct omx_endpoint *endpoint)
 	}
 	endpoint->recvq_pages = recvq_pages;
 
+	/* event queue pages are granted to the backend which fills them */
+	exp_eventq_pages =
+	    kmalloc(OMX_EXP_EVENTQ_SIZE / PAGE_SIZE * sizeof(struct page *),
+		    GFP_KERNEL);
+	if (!exp_eventq_pages) {
+		printk(KERN_ERR
+		       "Open-MX: failed to allocate exp eventq pages array\n");
+		goto out_with_recvq_pages;
+	}
+	for (i = 0; i < OMX_EXP_EVENTQ_SIZE / PAGE_SIZE; i++) {
+		struct page *page;
+		page = vmalloc_to_page(endpoint->exp_eventq + (i << PAGE_SHIFT));
+		BUG_ON(!page);
+		exp_eventq_pages[i] = page;
+	}
+	endpoint->exp_eventq_pages = exp_eventq_pages;
+
+	unexp_eventq_pages =
+	    kmalloc(OMX_UNEXP_EVENTQ_SIZE / PAGE_SIZE * sizeof(struct page *),
+		    GFP_KERNEL);
+	if (!unexp_eventq_pages) {
+		printk(KERN_ERR
+		       "Open-MX: failed to allocate unexp eventq pages array\n");
+		goto out_with_exp_eventq_pages;
+	}
+	for (i = 0; i < OMX_UNEXP_EVENTQ_SIZE / PAGE_SIZE; i++) {
+		struct page *page;
+		page = vmalloc_to_page(endpoint->unexp_eventq + (i << PAGE_SHIFT));
+		BUG_ON(!page);
+		unexp_eventq_pages[i] = page;
+	}
+	endpoint->unexp_eventq_pages = unexp_eventq_pages;
+
 	/* finish initializing queues */
 	omx_endpoint_queues_init(endpoint);
 
@@ -143,6 +180,10 @@ static int omx_endpoint_alloc_resources(struct omx_endpoint *endpoint)
 	ret = 0;
 	goto out;
 
+out_with_exp_eventq_pages:
+	kfree(endpoint->exp_eventq_pages);
+out_with_recvq_pages:
+	kfree(endpoint->recvq_pages);
 out_with_sendq_pages:
 	kfree(endpoint->sendq_pages);
 out_with_unexp_eventq:
@@ -169,6 +210,8 @@ void omx_endpoint_free_resources(struct omx_endpoint *endpoint)
 
 	omx_endpoint_user_regions_exit(endpoint);
 
+	kfree(endpoint->unexp_eventq_pages);
+	kfree(endpoint->exp_eventq_pages);
 	kfree(endpoint->recvq_pages);
 	kfree(endpoint->sendq_pages);
 	vfree(endpoint->unexp_eventq);
@@ -262,6 +305,9 @@ omx_endpoint_open(struct omx_endpoint *endpoint, const void __user * uparam)
 	if (ret < 0)
 		goto out_with_init;
 
+	/* record the owner binding before incoming packets may look at it */
+	endpoint->recv_cpu = raw_smp_processor_id();
+
 	/* attach the endpoint to the iface */
 	endpoint->board_index = param.board_index;
 	endpoint->endpoint_index = param.endpoint_index;
@@ -411,6 +457,26 @@ out_with_rcu_lock:
 	return ERR_PTR(err);
 }
 
+/* shared communication hooks, Xen endpoints only reach the ones of this guest */
+struct omx_endpoint *omx_shared_acquire_endpoint(struct omx_endpoint
+						 *src_endpoint,
+						 uint16_t peer_index,
+						 uint8_t endpoint_index)
+{
+	if (src_endpoint->xen)
+		return omx_xenfront_acquire_local_endpoint(src_endpoint->fe,
+							   peer_index,
+							   endpoint_index);
+	return omx_local_peer_acquire_endpoint(peer_index, endpoint_index);
+}
+
+uint32_t omx_shared_peer_index(const struct omx_endpoint *endpoint)
+{
+	if (endpoint->xen)
+		return endpoint->fe->board_peer_index;
+	return endpoint->iface->peer.index;
+}
+
 /******************************
  * File operations
  */
@@ -430,10 +496,18 @@ static int omx_miscdev_open(struct inode *inode, struct file *file)
 	kref_init(&endpoint->refcount);
 	spin_lock_init(&endpoint->status_lock);
 	endpoint->status = OMX_ENDPOINT_STATUS_FREE;
+	spin_lock_init(&endpoint->recv_steer_lock);
+	endpoint->recv_steer_cpu = -1;
+	endpoint->recv_steer_pending = 0;
 
 	file->private_data = endpoint;
 	endpoint->fe = __omx_xen_frontend;
 	endpoint->xen = 0;
+	endpoint->xen_queue = NULL;
+	atomic_set(&endpoint->xen_inflight, 0);
+	endpoint->xen_event_pending = 0;
+	endpoint->egref_exp_eventq_list = NULL;
+	endpoint->egref_unexp_eventq_list = NULL;
 out:
 	dprintk_out();
 	return ret;
@@ -502,6 +576,88 @@ static int (*omx_ioctl_with_endpoint_handlers[])(struct omx_endpoint * endpoint,
        [OMX_EPCMD_XEN_SEND_MEDIUMSQ_FRAG]           = omx_ioctl_xen_send_mediumsq_frag,
 };
 
+
+/* the commands that may be submitted within a batch */
+#define OMX_SEND_BATCH_EPCMDS ((1ULL << OMX_EPCMD_SEND_TINY)			\
+			       | (1ULL << OMX_EPCMD_SEND_SMALL)			\
+			       | (1ULL << OMX_EPCMD_SEND_MEDIUMSQ_FRAG)		\
+			       | (1ULL << OMX_EPCMD_SEND_MEDIUMVA)		\
+			       | (1ULL << OMX_EPCMD_SEND_RNDV)			\
+			       | (1ULL << OMX_EPCMD_SEND_NOTIFY)		\
+			       | (1ULL << OMX_EPCMD_SEND_LIBACK)		\
+			       | (1ULL << OMX_EPCMD_XEN_SEND_TINY)		\
+			       | (1ULL << OMX_EPCMD_XEN_SEND_SMALL)		\
+			       | (1ULL << OMX_EPCMD_XEN_SEND_MEDIUMSQ_FRAG)	\
+			       | (1ULL << OMX_EPCMD_XEN_SEND_MEDIUMVA)		\
+			       | (1ULL << OMX_EPCMD_XEN_SEND_RNDV)		\
+			       | (1ULL << OMX_EPCMD_XEN_SEND_NOTIFY)		\
+			       | (1ULL << OMX_EPCMD_XEN_SEND_LIBACK))
+
+/*
+ * Submit a batch of send commands within a single ioctl.
+ * All entries are read and checked first, so that a malformed batch
+ * is rejected before anything goes on the wire.
+ */
+static int
+omx_ioctl_send_batch(struct omx_endpoint * endpoint, void __user * uparam)
+{
+	struct omx_cmd_send_batch cmd;
+	struct omx_cmd_send_batch_entry entries[OMX_SEND_BATCH_NR_MAX];
+	uint32_t i;
+	int ret;
+
+	dprintk_in();
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send batch cmd hdr\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = -EINVAL;
+	if (unlikely(cmd.nr > OMX_SEND_BATCH_NR_MAX)) {
+		printk(KERN_ERR "Open-MX: Cannot send a batch of %ld commands (max %ld)\n",
+		       (unsigned long) cmd.nr, (unsigned long) OMX_SEND_BATCH_NR_MAX);
+		goto out;
+	}
+
+	ret = copy_from_user(entries, (void __user *)(unsigned long) cmd.entries,
+			     cmd.nr * sizeof(entries[0]));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send batch cmd entries\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for(i=0; i<cmd.nr; i++)
+		if (unlikely(entries[i].type >= 64
+			     || !(OMX_SEND_BATCH_EPCMDS & (1ULL << entries[i].type)))) {
+			printk(KERN_ERR "Open-MX: Cannot send command %ld in a batch\n",
+			       (unsigned long) entries[i].type);
+			ret = -EINVAL;
+			goto out;
+		}
+
+	ret = 0;
+	for(i=0; i<cmd.nr; i++) {
+		ret = omx_ioctl_with_endpoint_handlers[entries[i].type](endpoint,
+									(void __user *)(unsigned long) entries[i].param);
+		if (unlikely(ret < 0))
+			break;
+	}
+
+	if (unlikely(ret < 0)) {
+		/* tell user-space how many commands went through */
+		if (copy_to_user(&((struct omx_cmd_send_batch __user *) uparam)->submitted_nr,
+				 &i, sizeof(i)) != 0)
+			printk(KERN_ERR "Open-MX: Failed to write send batch cmd result\n");
+	}
+
+ out:
+	dprintk_out();
+	return ret;
+}
+
 /*
  * Main ioctl switch where all application ioctls arrive
  */
@@ -540,6 +696,8 @@ omx_miscdev_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 			//goto out;
 		}
 
+		omx_endpoint_update_recv_cpu(endpoint);
+
 		/* omx_dev_init() takes care fo checking that the handler isn't NULL */
 		dprintk_deb("will call the relevant handler\n");
 		ret =
@@ -1023,6 +1181,16 @@ omx_miscdev_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 			break;
 		}
 
+	case OMX_CMD_SEND_BATCH:{
+			struct omx_endpoint *endpoint = file->private_data;
+			BUG_ON(!endpoint);
+
+			omx_endpoint_update_recv_cpu(endpoint);
+			ret = omx_ioctl_send_batch(endpoint, (void __user *)arg);
+
+			break;
+		}
+
 	case OMX_CMD_BENCH:
 	case OMX_CMD_SEND_TINY:
 	case OMX_CMD_SEND_SMALL:
@@ -40,6 +40,7 @@
 
 struct omx_iface;
 struct page;
+struct sk_buff;
 
 enum omx_endpoint_status {
 	/* endpoint is free and may be open */
@@ -61,6 +62,9 @@ struct omx_endpoint {
 	uint8_t endpoint_index;
 	uint32_t session_id;
 	uint8_t special_status;
+	/* set by the backend after writing into our event queues,
+	 * lives in the padding so that both sides keep the same layout */
+	uint8_t xen_event_pending;
 
 	pid_t opener_pid;
 	char opener_comm[TASK_COMM_LEN];
@@ -73,6 +77,13 @@ struct omx_endpoint {
 
 	struct omx_iface * iface;
 
+	/* core where the owner runs, incoming packets are steered near it */
+	int recv_cpu;
+	/* packets steered to a core but not processed yet, later ones must follow them */
+	spinlock_t recv_steer_lock;
+	int recv_steer_cpu;
+	unsigned recv_steer_pending;
+
 	/* send queue stuff */
 	void * sendq;
 	struct page ** sendq_pages;
@@ -128,6 +139,11 @@ struct omx_endpoint {
 	struct omx_endpoint_info endpoint_info;
 	enum omx_endpoint_status info_status;
 	struct omx_xenfront_info *fe;
+	/* ring pair carrying our requests and events, set at open */
+	struct omx_xenfront_queue *xen_queue;
+
+	/* asynchronous requests not acked by the backend yet, drained at close */
+	atomic_t xen_inflight;
 
 	grant_ref_t endpoint_gref;
 	struct page *endpoint_page;
@@ -145,6 +161,19 @@ struct omx_endpoint {
 	uint16_t egref_recvq_offset;
 	grant_ref_t recvq_gref;
 
+	/* event queues, granted so that the backend writes events directly */
+	struct page **exp_eventq_pages;
+	grant_ref_t *egref_exp_eventq_list;
+	uint32_t exp_eventq_gref_size;
+	uint16_t egref_exp_eventq_offset;
+	grant_ref_t exp_eventq_gref;
+
+	struct page **unexp_eventq_pages;
+	grant_ref_t *egref_unexp_eventq_list;
+	uint32_t unexp_eventq_gref_size;
+	uint16_t egref_unexp_eventq_offset;
+	grant_ref_t unexp_eventq_gref;
+
 };
 
 extern int omx_iface_attach_endpoint(struct omx_endpoint * endpoint);
@@ -166,8 +195,29 @@ omx_endpoint_release(struct omx_endpoint * endpoint)
 	kref_put(&endpoint->refcount, __omx_endpoint_last_release);
 }
 
+/*
+ * called from the owner's ioctls, so that incoming packets are steered
+ * where it runs now, even if it was bound to another core after open
+ */
+static inline void
+omx_endpoint_update_recv_cpu(struct omx_endpoint * endpoint)
+{
+	int cpu = raw_smp_processor_id();
+
+	if (unlikely(ACCESS_ONCE(endpoint->recv_cpu) != cpu))
+		ACCESS_ONCE(endpoint->recv_cpu) = cpu;
+}
+
 extern int omx_ioctl_bench(struct omx_endpoint * endpoint, void __user * uparam);
 
+/* expected medium slots are not supported by the frontend, everything goes through the recvq */
+static inline int
+omx_recv_medium_frag_exp(struct omx_endpoint * endpoint, struct omx_evt_recv_msg * event,
+			 const struct sk_buff * skb, unsigned long skb_offset)
+{
+	return 0;
+}
+
 void omx_endpoint_free_resources(struct omx_endpoint * endpoint);
 
 #endif /* __omx_endpoint_h__ */
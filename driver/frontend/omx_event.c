@@ -124,6 +124,18 @@ omx_wakeup_waiter_list(struct omx_endpoint *endpoint,
 	dprintk_out();
 }
 
+/*
+ * Wake up the waiters of an endpoint whose event queues
+ * were filled by the backend behind our back.
+ */
+void
+omx_wakeup_endpoint_waiters(struct omx_endpoint *endpoint)
+{
+	dprintk_in();
+	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	dprintk_out();
+}
+
 static void
 omx_wakeup_on_timeout_handler(unsigned long data)
 {
@@ -199,6 +211,57 @@ omx_endpoint_queues_init(struct omx_endpoint *endpoint)
 	dprintk_out();
 }
 
+/*
+ * User-space publishes the index of the next event it will consume in the
+ * endpoint descriptor instead of releasing slots with an ioctl, so only look
+ * at it when a queue looks full. It may only move forward, and never past
+ * the slots that were actually given to user-space.
+ */
+static void
+omx_update_released_exp_slots(struct omx_endpoint *endpoint)
+{
+	omx_eventq_index_t consumed;
+
+	spin_lock_bh(&endpoint->release_exp_lock);
+	consumed = ACCESS_ONCE(endpoint->userdesc->exp_eventq_consumed_index);
+	if (consumed - endpoint->nextreleased_exp_eventq_index
+	    <= endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index)
+		endpoint->nextreleased_exp_eventq_index = consumed;
+	spin_unlock_bh(&endpoint->release_exp_lock);
+}
+
+static void
+omx_update_released_unexp_slots(struct omx_endpoint *endpoint)
+{
+	omx_eventq_index_t consumed;
+
+	spin_lock_bh(&endpoint->release_unexp_lock);
+	consumed = ACCESS_ONCE(endpoint->userdesc->unexp_eventq_consumed_index);
+	if (consumed - endpoint->nextreleased_unexp_eventq_index
+	    <= ACCESS_ONCE(endpoint->nextreserved_unexp_eventq_index) - endpoint->nextreleased_unexp_eventq_index)
+		endpoint->nextreleased_unexp_eventq_index = consumed;
+	spin_unlock_bh(&endpoint->release_unexp_lock);
+}
+
+/* check whether the queue overflows once its free index is 'free' */
+static INLINE int
+omx_exp_eventq_full(struct omx_endpoint *endpoint, omx_eventq_index_t free)
+{
+	if (likely(free - endpoint->nextreleased_exp_eventq_index <= OMX_EXP_EVENTQ_ENTRY_NR))
+		return 0;
+	omx_update_released_exp_slots(endpoint);
+	return free - endpoint->nextreleased_exp_eventq_index > OMX_EXP_EVENTQ_ENTRY_NR;
+}
+
+static INLINE int
+omx_unexp_eventq_full(struct omx_endpoint *endpoint, omx_eventq_index_t free)
+{
+	if (likely(free - endpoint->nextreleased_unexp_eventq_index <= OMX_UNEXP_EVENTQ_ENTRY_NR))
+		return 0;
+	omx_update_released_unexp_slots(endpoint);
+	return free - endpoint->nextreleased_unexp_eventq_index > OMX_UNEXP_EVENTQ_ENTRY_NR;
+}
+
 /******************************************
  * Report an expected event to users-space
  */
@@ -214,8 +277,7 @@ omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int lengt
 	/* take the next slot and update the queue */
 	index = atomic_inc_return((atomic_t *) &endpoint->nextfree_exp_eventq_index) - 1;
 
-	if (unlikely(endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
-		     > OMX_EXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_exp_eventq_full(endpoint, endpoint->nextfree_exp_eventq_index))) {
 		/* we went too far, rollback */
 		atomic_dec((atomic_t *) &endpoint->nextfree_exp_eventq_index);
 		/* the application sucks, it did not check
@@ -262,20 +324,13 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 	int ret = 0;
 
 	dprintk_in();
-	/* take the next slot and update the queue */
-	/* FIXME:ananos what are you doing ????? */
-	//spin_lock_bh(&endpoint->unexp_lock);
-	endpoint->nextfree_unexp_eventq_index++;
-	index = endpoint->nextreserved_unexp_eventq_index++;
-	//spin_unlock_bh(&endpoint->unexp_lock);
-
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	/* take the next slot and update the queue, with atomics since the backend
+	 * updates these indexes too, and only take the reserved index once we know
+	 * we won't have to roll back */
+	if (unlikely(omx_unexp_eventq_full(endpoint,
+					   atomic_inc_return((atomic_t *) &endpoint->nextfree_unexp_eventq_index)))) {
 		/* we went too far, rollback */
-		spin_lock_bh(&endpoint->unexp_lock);
-		endpoint->nextfree_unexp_eventq_index--;
-		index = endpoint->nextreserved_unexp_eventq_index--;
-		spin_unlock_bh(&endpoint->unexp_lock);
+		atomic_dec((atomic_t *) &endpoint->nextfree_unexp_eventq_index);
 		/* the application did not process the unexpected queue and release slots fast enough */
 		dprintk(EVENT,
 			"Open-MX: Unexpected event queue full, no event slot available for endpoint %d\n",
@@ -285,6 +340,7 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 		ret = -EBUSY;
 		goto out;
 	}
+	index = atomic_inc_return((atomic_t *) &endpoint->nextreserved_unexp_eventq_index) - 1;
 
 	slot = endpoint->unexp_eventq + (index % OMX_UNEXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE;
 	/* store the event without setting the id first */
@@ -324,20 +380,11 @@ omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 	int ret = 0;
 
 	dprintk_in();
-	spin_lock_bh(&endpoint->unexp_lock);
 	/* reserve the next slot and update the queue */
-	endpoint->nextfree_unexp_eventq_index++;
-	/* take the next recvq slot and return it now */
-	recvq_index = endpoint->next_recvq_index++;
-	spin_unlock_bh(&endpoint->unexp_lock);
-
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_full(endpoint,
+					   atomic_inc_return((atomic_t *) &endpoint->nextfree_unexp_eventq_index)))) {
 		/* we went too far, rollback */
-		spin_lock_bh(&endpoint->unexp_lock);
-		endpoint->nextfree_unexp_eventq_index--;
-		recvq_index = endpoint->next_recvq_index--;
-		spin_unlock_bh(&endpoint->unexp_lock);
+		atomic_dec((atomic_t *) &endpoint->nextfree_unexp_eventq_index);
 		/* the application did not process the unexpected queue and release slots fast enough */
 		dprintk(EVENT,
 			"Open-MX: Unexpected event queue full, no event slot available for endpoint %d\n",
@@ -348,6 +395,8 @@ omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 		goto out;
 	}
 
+	/* take the next recvq slot and return it now */
+	recvq_index = atomic_inc_return((atomic_t *) &endpoint->next_recvq_index) - 1;
 	*recvq_offset_p = (recvq_index % OMX_RECVQ_ENTRY_NR) * OMX_RECVQ_ENTRY_SIZE;
 out:
 	dprintk_out();
@@ -364,20 +413,11 @@ omx_prepare_notify_unexp_events_with_recvq(struct omx_endpoint *endpoint,
 	int i, ret = 0;
 
 	dprintk_in();
-//	spin_lock_bh(&endpoint->unexp_lock);
-	endpoint->nextfree_unexp_eventq_index += nr;
-	first_recvq_index = endpoint->next_recvq_index;
-	endpoint->next_recvq_index += nr;
-//	spin_unlock_bh(&endpoint->unexp_lock);
-
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_full(endpoint,
+					   atomic_add_return(nr, (atomic_t *) &endpoint->nextfree_unexp_eventq_index)))) {
 		/* we went too far, rollback */
 		printk_err("Event queue FULL, no slot available\n");
-		spin_lock_bh(&endpoint->unexp_lock);
-		endpoint->nextfree_unexp_eventq_index -= nr;
-		endpoint->next_recvq_index -= nr;
-		spin_unlock_bh(&endpoint->unexp_lock);
+		atomic_sub(nr, (atomic_t *) &endpoint->nextfree_unexp_eventq_index);
 		/* the application did not process the unexpected queue and release slots fast enough */
 		dprintk(EVENT,
 			"Open-MX: Unexpected event queue full, no event slot available for endpoint %d\n",
@@ -388,6 +428,7 @@ omx_prepare_notify_unexp_events_with_recvq(struct omx_endpoint *endpoint,
 		goto out;
 	}
 
+	first_recvq_index = atomic_add_return(nr, (atomic_t *) &endpoint->next_recvq_index) - nr;
 	for(i=0; i<nr; i++)
 		recvq_offset_p[i] = ((first_recvq_index+i) % OMX_RECVQ_ENTRY_NR) * OMX_RECVQ_ENTRY_SIZE;
 out:
@@ -395,6 +436,22 @@ out:
 	return ret;
 }
 
+/*
+ * The backend may reserve slots concurrently, always bumping the free index
+ * before the reserved one, so read them in the opposite order.
+ */
+static INLINE void
+omx_check_unexp_event_reserved(struct omx_endpoint *endpoint)
+{
+	omx_eventq_index_t reserved, free, released;
+
+	released = endpoint->nextreleased_unexp_eventq_index;
+	reserved = ACCESS_ONCE(endpoint->nextreserved_unexp_eventq_index);
+	rmb();
+	free = ACCESS_ONCE(endpoint->nextfree_unexp_eventq_index);
+	BUG_ON(reserved - released >= free - released);
+}
+
 /*
  * Store the event in the next reserved slot
  * (not always the one reserved during omx_commit_notify_unexp_event()
@@ -409,16 +466,11 @@ omx_commit_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 
 	dprintk_in();
 
-	//spin_lock_bh(&endpoint->unexp_lock);
-
 	/* the caller should have called prepare() earlier */
-	BUG_ON(endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-	       >= endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index);
+	omx_check_unexp_event_reserved(endpoint);
 
 	/* update the next reserved slot in the queue */
-	index = endpoint->nextreserved_unexp_eventq_index++;
-
-	//spin_unlock_bh(&endpoint->unexp_lock);
+	index = atomic_inc_return((atomic_t *) &endpoint->nextreserved_unexp_eventq_index) - 1;
 
 	slot = endpoint->unexp_eventq + (index % OMX_UNEXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE;
 	/* store the event without setting the id first */
@@ -448,16 +500,12 @@ omx_cancel_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint)
 	omx_eventq_index_t index;
 
 	dprintk_in();
-	spin_lock_bh(&endpoint->unexp_lock);
 
 	/* the caller should have called prepare() earlier */
-	BUG_ON(endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-	       >= endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index);
+	omx_check_unexp_event_reserved(endpoint);
 
 	/* update the next reserved slot in the queue */
-	index = endpoint->nextreserved_unexp_eventq_index++;
-
-	spin_unlock_bh(&endpoint->unexp_lock);
+	index = atomic_inc_return((atomic_t *) &endpoint->nextreserved_unexp_eventq_index) - 1;
 
 	slot = endpoint->unexp_eventq + (index % OMX_UNEXP_EVENTQ_ENTRY_NR) * OMX_EVENTQ_ENTRY_SIZE;
 	/* store the event without setting the id first */
@@ -635,13 +683,13 @@ omx_ioctl_release_exp_slots(struct omx_endpoint *endpoint, void __user *uparam)
 {
 	int err = 0;
 	dprintk_in();
-	spin_lock(&endpoint->release_exp_lock);
+	spin_lock_bh(&endpoint->release_exp_lock);
 	if (endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
 	    < OMX_EXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_exp_eventq_index += OMX_EXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_exp_lock);
+	spin_unlock_bh(&endpoint->release_exp_lock);
 	dprintk_out();
 	return err;
 }
@@ -651,13 +699,13 @@ omx_ioctl_release_unexp_slots(struct omx_endpoint *endpoint, void __user *uparam
 {
 	int err = 0;
 	dprintk_in();
-	spin_lock(&endpoint->release_unexp_lock);
+	spin_lock_bh(&endpoint->release_unexp_lock);
 	if (endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
 	    < OMX_UNEXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_unexp_eventq_index += OMX_UNEXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_unexp_lock);
+	spin_unlock_bh(&endpoint->release_unexp_lock);
 	dprintk_out();
 	return err;
 }
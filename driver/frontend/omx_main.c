@@ -86,6 +86,14 @@ int omx_skb_copy_max = 0;
 module_param_named(skbcopy, omx_skb_copy_max, uint, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(skbcopy, "Maximum length of data to copy in linear skb instead of attaching pages");
 
+int omx_tx_batch = 1;
+module_param_named(txbatch, omx_tx_batch, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(txbatch, "Batch pull reply and medium fragment transmission (0=off, 1=on)");
+
+int omx_recv_steer_enabled = 0;
+module_param_named(recvsteer, omx_recv_steer_enabled, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(recvsteer, "Process incoming packets in the package where the destination endpoint owner runs");
+
 int omx_pin_synchronous = 1;
 module_param_named(pinsync, omx_pin_synchronous, uint, S_IRUGO); /* not writable to simplify things */
 MODULE_PARM_DESC(pinsync, "Pin user regions synchronously on register");
@@ -110,6 +118,14 @@ unsigned long omx_user_rights = 0;
 module_param_named(userrights, omx_user_rights, ulong, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(userrights, "Mask of privileged operation rights that are granted regular users");
 
+int omx_xen_nowait = 0;
+module_param_named(xen_nowait, omx_xen_nowait, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(xen_nowait, "Do not wait for the backend to ACK send requests that the library retransmits");
+
+int omx_xen_queues = OMX_XEN_MAX_QUEUES;
+module_param_named(xen_queues, omx_xen_queues, uint, S_IRUGO);
+MODULE_PARM_DESC(xen_queues, "Maximal number of ring pairs to negotiate with the backend, capped by the number of CPUs");
+
 #ifdef OMX_HAVE_DMA_ENGINE
 int omx_dmaengine = 0; /* disabled by default for now */
 module_param_named(dmaengine, omx_dmaengine, uint, S_IRUGO|S_IWUSR);
@@ -463,9 +479,11 @@ omx_init(void)
 	if (ret < 0)
 		goto out_with_dma;
 
+	omx_recv_steer_init();
+
 	ret = omx_net_init();
 	if (ret < 0)
-		goto out_with_peers;
+		goto out_with_steer;
 
 	ret = omx_raw_init();
 	if (ret < 0)
@@ -488,6 +506,8 @@ omx_init(void)
 	omx_raw_exit();
  out_with_net:
 	omx_net_exit();
+ out_with_steer:
+	omx_recv_steer_exit();
  out_with_peers:
 	omx_peers_init();
  out_with_dma:
@@ -510,6 +530,7 @@ omx_exit(void)
 	omx_dev_exit();
 	omx_raw_exit();
 	omx_net_exit();
+	omx_recv_steer_exit();
 	omx_peers_exit();
 	omx_dma_exit();
 	del_timer_sync(&omx_driver_userdesc_update_timer);
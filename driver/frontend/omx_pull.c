@@ -117,6 +117,7 @@ struct omx_pull_handle {
 	struct omx_user_region * region;
 	uint32_t total_length;
 	uint32_t pulled_rdma_offset;
+	uint32_t puller_rdma_offset;
 
 	/* current status */
 	spinlock_t lock;
@@ -643,6 +644,7 @@ omx_pull_handle_create(struct omx_endpoint * endpoint,
 	handle->region = (struct omx_user_region *) region;
 	handle->total_length = cmd->length;
 	handle->pulled_rdma_offset = cmd->pulled_rdma_offset;
+	handle->puller_rdma_offset = cmd->puller_rdma_offset;
 
 	/* initialize variable stuff */
 	handle->status = OMX_PULL_HANDLE_STATUS_OK;
@@ -1889,7 +1891,9 @@ omx_recv_pull_reply(struct omx_iface * iface,
 	if (omx_dmaengine
 	    && frame_length >= omx_dma_async_frag_min
 	    && handle->total_length >= omx_dma_async_min) {
-		remaining_copy = omx_pull_handle_reply_try_dma_copy(iface, handle, skb, msg_offset, frame_length);
+		remaining_copy = omx_pull_handle_reply_try_dma_copy(iface, handle, skb,
+								    handle->puller_rdma_offset + msg_offset,
+								    frame_length);
 		if (likely(remaining_copy != frame_length))
 			free_skb = 0;
 	}
@@ -1909,9 +1913,9 @@ omx_recv_pull_reply(struct omx_iface * iface,
 		dprintk(PULL, "copying PULL_REPLY %ld bytes for msg_offset %ld at region offset %ld\n",
 		       (unsigned long) frame_length,
 		       (unsigned long) msg_offset,
-		       (unsigned long) msg_offset);
+		       (unsigned long) (handle->puller_rdma_offset + msg_offset));
 		err = omx_user_region_fill_pages(handle->region,
-						 msg_offset,
+						 handle->puller_rdma_offset + msg_offset,
 						 skb,
 						 frame_length);
 		if (unlikely(err < 0)) {
@@ -77,7 +77,13 @@ struct omx_user_region {
 		unsigned first_page_offset;
 		unsigned long length;
 		unsigned long nr_pages;
-		uint8_t nr_parts;
+		uint16_t nr_parts;
+		/* page grants come from the persistent grant cache */
+		uint8_t persistent;
+		/* all_gref[] grants the indirect pages listing the
+		 * grants of the gref_list pages, if any */
+		uint8_t nr_indirect;
+		uint32_t *indirect;
 		uint32_t all_gref[OMX_XEN_GRANT_PAGES_MAX];
 		uint32_t *gref_list;
 		unsigned long pinned_pages;
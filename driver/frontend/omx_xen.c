@@ -49,7 +49,7 @@ static int omx_xenfront_probe(struct xenbus_device *dev,
 			      const struct xenbus_device_id *id)
 {
 	struct omx_xenfront_info *fe;
-	struct omx_xenif_sring *sring, *recv_sring;
+	unsigned int i;
 	int err = 0;
 
 	dprintk_in();
@@ -65,6 +65,9 @@ static int omx_xenfront_probe(struct xenbus_device *dev,
 	__omx_xen_frontend = fe;
 
         spin_lock_init(&fe->status_lock);
+	spin_lock_init(&fe->endpoints_lock);
+	fe->board_peer_index = OMX_XENFRONT_UNKNOWN_PEER_INDEX;
+	omx_xenfront_pgrant_cache_init(&fe->pgrants);
 
 	fe->xbdev = dev;
 	fe->connected = OMXIF_STATE_DISCONNECTED;
@@ -78,50 +81,14 @@ static int omx_xenfront_probe(struct xenbus_device *dev,
                 goto out;
         }
 
-        INIT_WORK(&fe->msg_workq_task, omx_xenif_interrupt);
+	for (i = 0; i < OMX_XEN_MAX_QUEUES; i++)
+		omx_xenfront_init_queue(fe, i);
 
-
-	spin_lock_init(&fe->lock);
-	dprintk_deb("Setting up shared ring\n");
-
-	sring =
-	    (struct omx_xenif_sring *)get_zeroed_page(GFP_NOIO | __GFP_HIGH);
-	if (!sring) {
-		xenbus_dev_fatal(dev, -ENOMEM, "allocating shared ring");
-		err = -ENOMEM;
-		goto out;
-	}
-	SHARED_RING_INIT(sring);
-	FRONT_RING_INIT(&fe->ring, sring, PAGE_SIZE);
-
-	err = xenbus_grant_ring(dev, virt_to_mfn(fe->ring.sring));
-	if (err < 0) {
-		free_page((unsigned long)sring);
-		fe->ring.sring = NULL;
-		printk_err("Failed to grant ring\n");
-		goto out;
-	}
-	fe->ring_ref = err;
-
-
-	recv_sring =
-	    (struct omx_xenif_sring *)get_zeroed_page(GFP_NOIO | __GFP_HIGH);
-	if (!sring) {
-		xenbus_dev_fatal(dev, -ENOMEM, "allocating shared ring");
-		err = -ENOMEM;
+	/* more queues are set up once the backend told us how many it has */
+	err = omx_xenfront_alloc_queue(dev, &fe->queues[0]);
+	if (err)
 		goto out;
-	}
-	SHARED_RING_INIT(recv_sring);
-	FRONT_RING_INIT(&fe->recv_ring, recv_sring, PAGE_SIZE);
-
-	err = xenbus_grant_ring(dev, virt_to_mfn(fe->recv_ring.sring));
-	if (err < 0) {
-		free_page((unsigned long)recv_sring);
-		fe->recv_ring.sring = NULL;
-		printk_err("Failed to grant recv_ring\n");
-		goto out;
-	}
-	fe->recv_ring_ref = err;
+	fe->nr_queues = 1;
 
 	fe->handle = simple_strtoul(strrchr(dev->nodename, '/') + 1, NULL, 0);
 	dprintk_deb("setting handle = %u\n", fe->handle);
@@ -140,16 +107,12 @@ out:
 static int omx_xenfront_remove(struct xenbus_device *dev)
 {
 	struct omx_xenfront_info *fe = dev_get_drvdata(&dev->dev);
+	unsigned int i;
 
 	dprintk_in();
 	dprintk_deb("frontend_remove: %s removed\n", dev->nodename);
-        /* This frees the page as a side-effect */
-        if (fe->ring_ref)
-                gnttab_end_foreign_access(fe->ring_ref, 0, (unsigned long)fe->ring.sring);
-
-        /* This frees the page as a side-effect */
-        if (fe->recv_ring_ref)
-                gnttab_end_foreign_access(fe->recv_ring_ref, 0, (unsigned long)fe->recv_ring.sring);
+	for (i = 0; i < fe->nr_queues; i++)
+		omx_xenfront_free_queue(&fe->queues[i]);
 
 	omx_xenif_free(fe, 0);
 
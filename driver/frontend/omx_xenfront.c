@@ -111,9 +111,36 @@ out:
 	return ret;
 }
 
+/*
+ * Wait for the backend to complete the asynchronous requests of an endpoint,
+ * their responses must not find it released.
+ */
+int omx_xenfront_wait_inflight(struct omx_endpoint *endpoint)
+{
+	unsigned long i = 0;
+	int ret = 0;
+
+	dprintk_in();
+
+	while (atomic_read(&endpoint->xen_inflight)) {
+		if (++i > OMX_XEN_POLL_HARD_LIMIT) {
+			printk_err("%d asynchronous requests still pending after %lu polls\n",
+				   atomic_read(&endpoint->xen_inflight), i);
+			ret = -EBUSY;
+			goto out;
+		}
+		cond_resched();
+	}
+
+out:
+	dprintk_out();
+	return ret;
+}
+
 /* Xen related stuff */
 int
-omx_poke_dom0(struct omx_xenfront_info *fe, struct omx_xenif_request *ring_req)
+omx_poke_dom0(struct omx_xenfront_queue *queue,
+	      struct omx_xenif_request *ring_req)
 {
 
 	int notify;
@@ -125,7 +152,7 @@ omx_poke_dom0(struct omx_xenfront_info *fe, struct omx_xenif_request *ring_req)
 	dprintk_in();
 
 	TIMER_START(&t_poke_dom0);
-	spin_lock_irqsave(&fe->lock, flags);
+	spin_lock_irqsave(&queue->lock, flags);
 	if (unlikely(!ring_req)) {
 		/* If our ring buffer is null, then we fail ungracefully */
 		printk_err("Null ring_resp\n");
@@ -144,15 +171,15 @@ omx_poke_dom0(struct omx_xenfront_info *fe, struct omx_xenif_request *ring_req)
 	case OMX_CMD_RECV_MEDIUM_FRAG:
 	case OMX_CMD_RECV_SMALL:
 	case OMX_CMD_RECV_TINY:{
-			ring = &fe->recv_ring;
+			ring = &queue->recv_ring;
 			break;
 		}
 	default:{
-			ring = &fe->ring;
+			ring = &queue->ring;
 			break;
 		}
 	}
-	//RING_PUSH_REQUESTS(&(fe->recv_ring));
+	//RING_PUSH_REQUESTS(&(queue->recv_ring));
 	RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(ring, notify);
 	dprintk_deb
 	    ("after push: Poke dom0 with func = %#x, requests_produced_private= %d, "
@@ -160,19 +187,76 @@ omx_poke_dom0(struct omx_xenfront_info *fe, struct omx_xenif_request *ring_req)
 	     ring_req->func, ring->req_prod_pvt, ring->sring->req_prod);
 
 	if (notify) {
-		event.port = fe->evtchn.local_port;
+		event.port = queue->evtchn.local_port;
 		if (HYPERVISOR_event_channel_op(EVTCHNOP_send, &event) != 0) {
 			dprintk_deb("Failed to send event!\n");
 			goto out;
 		}
 	}
 out:
-	spin_unlock_irqrestore(&fe->lock, flags);
+	spin_unlock_irqrestore(&queue->lock, flags);
 	TIMER_STOP(&t_poke_dom0);
 	dprintk_out();
 	return err;
 }
 
+/*
+ * Reserve a slot on the command ring of a queue. The ring stays held until
+ * the request is pushed, so that slots are published in order even if
+ * filling them sleeps. Returns NULL if the backend does not free any slot.
+ */
+struct omx_xenif_request *omx_xenfront_get_request(struct omx_xenfront_queue
+						   *queue)
+{
+	struct omx_xenif_request *ring_req = NULL;
+	unsigned long i = 0;
+
+	dprintk_in();
+
+	mutex_lock(&queue->submit_mutex);
+	/* slots are released when omx_xenif_interrupt() consumes responses */
+	while (RING_FULL(&queue->ring)) {
+		if (++i > OMX_XEN_POLL_HARD_LIMIT) {
+			printk_err("ring %u still full after %lu polls\n",
+				   queue->index, i);
+			mutex_unlock(&queue->submit_mutex);
+			goto out;
+		}
+		cond_resched();
+	}
+
+	ring_req = RING_GET_REQUEST(&queue->ring, queue->ring.req_prod_pvt++);
+	ring_req->id = queue->next_request_id++;
+	ring_req->flags = 0;
+
+out:
+	dprintk_out();
+	return ring_req;
+}
+
+/*
+ * Make a reserved request visible to the backend. The event channel is only
+ * kicked when the backend asked for it, so requests pushed while it is still
+ * processing the ring are coalesced under a single notification.
+ */
+int omx_xenfront_push_request(struct omx_xenfront_queue *queue,
+			      struct omx_xenif_request *ring_req)
+{
+	return omx_poke_dom0(queue, ring_req);
+}
+
+void omx_xenfront_put_request(struct omx_xenfront_queue *queue)
+{
+	mutex_unlock(&queue->submit_mutex);
+}
+
+/* Give back a reserved slot that was not pushed */
+void omx_xenfront_cancel_request(struct omx_xenfront_queue *queue)
+{
+	queue->ring.req_prod_pvt--;
+	mutex_unlock(&queue->submit_mutex);
+}
+
 static struct omx_endpoint *omx_xenfront_get_endpoint(struct omx_xenfront_info *fe,
 						     struct omx_xenif_response
 						     *resp)
@@ -194,8 +278,8 @@ static struct omx_endpoint *omx_xenfront_get_endpoint(struct omx_xenfront_info *
 
 static void omx_xenfront_ack(struct omx_endpoint *endpoint, uint32_t func)
 {
-	struct omx_xenfront_info *fe = endpoint->fe;
-	struct omx_xenif_front_ring *ring = &fe->recv_ring;
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
+	struct omx_xenif_front_ring *ring = &queue->recv_ring;
 	struct omx_xenif_request *ring_req;
 	dprintk_in();
 
@@ -203,14 +287,68 @@ static void omx_xenfront_ack(struct omx_endpoint *endpoint, uint32_t func)
 	    RING_GET_REQUEST(ring,
 			     ring->req_prod_pvt++);
 	ring_req->func = func;
-	omx_poke_dom0(endpoint->fe, ring_req);
+	omx_poke_dom0(queue, ring_req);
 
 	dprintk_out();
 
 }
 
+/*
+ * Complete a send request. Synchronous submitters poll the status word of
+ * their queue, asynchronous ones only need to be accounted.
+ */
+static void omx_xenfront_complete_send(struct omx_xenfront_queue *queue,
+				       struct omx_endpoint *endpoint,
+				       struct omx_xenif_response *resp)
+{
+	dprintk_in();
+
+	if (resp->flags & OMX_XEN_REQUEST_FLAG_ASYNC) {
+		if (unlikely(resp->ret)) {
+			printk_err("Backend failed request %u (%#x), ret = %d\n",
+				   resp->id, resp->func, resp->ret);
+		}
+		atomic_dec(&endpoint->xen_inflight);
+		goto out;
+	}
+
+	spin_lock(&queue->status_lock);
+	if (!resp->ret)
+		queue->status = OMX_XEN_FRONTEND_STATUS_DONE;
+	else
+		queue->status = OMX_XEN_FRONTEND_STATUS_FAILED;
+	spin_unlock(&queue->status_lock);
+
+out:
+	dprintk_out();
+}
+
+/*
+ * The backend writes most receive events straight into the event queues
+ * and only kicks the event channel, wake up whoever is sleeping on them.
+ */
+void omx_xenfront_wakeup_queue(struct omx_xenfront_queue *queue)
+{
+	struct omx_xenfront_info *fe = queue->fe;
+	struct omx_endpoint *endpoint;
+	int i;
+
+	dprintk_in();
+
+	for (i = 0; i < OMX_XEN_MAX_ENDPOINTS; i++) {
+		endpoint = fe->endpoints[i];
+		if (!endpoint || endpoint->xen_queue != queue)
+			continue;
+		if (xchg(&endpoint->xen_event_pending, 0))
+			omx_wakeup_endpoint_waiters(endpoint);
+	}
+
+	dprintk_out();
+}
+
 void omx_xenif_interrupt_recv(struct work_struct *work)
 {
+	struct omx_xenfront_queue *queue;
 	struct omx_xenfront_info *fe;
 	struct omx_xenif_response *resp;
 	struct omx_xenif_request *ring_req;
@@ -222,39 +360,40 @@ void omx_xenif_interrupt_recv(struct work_struct *work)
 	struct omx_xenif_front_ring *ring;
 
 	dprintk_in();
-	fe = container_of(work, struct omx_xenfront_info, msg_workq_task);
+	queue = container_of(work, struct omx_xenfront_queue, msg_workq_task);
+	fe = queue->fe;
 
 	/* dprintk_deb("ev_id %#lx omxbe=%#lx\n", (unsigned long)data, (unsigned long)fe); */
-	if (RING_HAS_UNCONSUMED_RESPONSES(&fe->recv_ring)) {
+	if (RING_HAS_UNCONSUMED_RESPONSES(&queue->recv_ring)) {
 again_recv:
 		dprintk_deb("responses_produced= %d, requests_produced = %d\n",
-			    fe->recv_ring.sring->rsp_prod,
-			    fe->recv_ring.sring->req_prod);
+			    queue->recv_ring.sring->rsp_prod,
+			    queue->recv_ring.sring->req_prod);
 		dprintk_deb("RING_FREE_REQUESTS() = %#x, RING_FULL=%#x \n",
-			    RING_FREE_REQUESTS((&fe->recv_ring)),
-			    RING_FULL(&fe->recv_ring));
-		ring = &fe->recv_ring;
-		cons = fe->recv_ring.rsp_cons;
-		prod = fe->recv_ring.sring->rsp_prod;
+			    RING_FREE_REQUESTS((&queue->recv_ring)),
+			    RING_FULL(&queue->recv_ring));
+		ring = &queue->recv_ring;
+		cons = queue->recv_ring.rsp_cons;
+		prod = queue->recv_ring.sring->rsp_prod;
 	} else
 		goto out;
 
 	rmb(); /* Ensure we see queued responses up to 'rp'. */
 	while (cons != prod) {
 		dprintk_deb("omx_xenif->ring.req_cons=%d, i=%d, rp=%d\n",
-			    fe->ring.rsp_cons, fe->ring.rsp_cons,
-			    fe->ring.sring->rsp_prod);
+			    queue->ring.rsp_cons, queue->ring.rsp_cons,
+			    queue->ring.sring->rsp_prod);
 		dprintk_deb("omx_xenif->recv_ring.req_cons=%d, i=%d, rp=%d\n",
-			    fe->recv_ring.rsp_cons, fe->recv_ring.rsp_cons,
-			    fe->recv_ring.sring->rsp_prod);
+			    queue->recv_ring.rsp_cons, queue->recv_ring.rsp_cons,
+			    queue->recv_ring.sring->rsp_prod);
 
 		resp = RING_GET_RESPONSE(ring, cons++);
 
 		id = resp->func;
 		dprintk_deb
 		    ("func =%#x, responses_produced= %d, requests_produced = %d\n",
-		     resp->func, fe->ring.sring->rsp_prod,
-		     fe->ring.sring->req_prod);
+		     resp->func, queue->ring.sring->rsp_prod,
+		     queue->ring.sring->req_prod);
 
 		switch (resp->func) {
 		case OMX_CMD_XEN_RECV_PULL_DONE:{
@@ -572,20 +711,20 @@ again_recv:
 			printk_err("Unknown event came in, %d\n", resp->func);
 			dprintk_inf
 			    ("resp_consumed=%d, responses_produced= %d, requests_produced = %d\n",
-			     cons, fe->ring.sring->rsp_prod,
-			     fe->ring.sring->req_prod);
+			     cons, queue->ring.sring->rsp_prod,
+			     queue->ring.sring->req_prod);
 			break;
 		}
 	}
 	ring->rsp_cons = cons;
 	wmb();
 
-	RING_FINAL_CHECK_FOR_RESPONSES(&fe->recv_ring, more_to_do);
+	RING_FINAL_CHECK_FOR_RESPONSES(&queue->recv_ring, more_to_do);
 	if (more_to_do)
 		goto again_recv;
 
 #ifdef EXTRA_DEBUG_OMX
-	if (RING_HAS_UNCONSUMED_RESPONSES(&fe->recv_ring))
+	if (RING_HAS_UNCONSUMED_RESPONSES(&queue->recv_ring))
 		printk_err
 		    ("exiting, recv_although we have unconsumed responses, are you SURE?\n");
 #endif
@@ -596,6 +735,7 @@ out:
 
 void omx_xenif_interrupt(struct work_struct *work)
 {
+	struct omx_xenfront_queue *queue;
 	struct omx_xenfront_info *fe;
 	struct omx_xenif_response *resp;
 	//struct omx_xenif_request *ring_req;
@@ -607,7 +747,8 @@ void omx_xenif_interrupt(struct work_struct *work)
 	struct omx_xenif_front_ring *ring;
 
 	dprintk_in();
-	fe = container_of(work, struct omx_xenfront_info, msg_workq_task);
+	queue = container_of(work, struct omx_xenfront_queue, msg_workq_task);
+	fe = queue->fe;
 
 	//spin_lock_irqsave(&fe->msg_handler_lock, flags);
 	if (unlikely(fe->connected != OMXIF_STATE_CONNECTED)) {
@@ -616,35 +757,35 @@ void omx_xenif_interrupt(struct work_struct *work)
 	}
 	/* dprintk_deb("ev_id %#lx omxbe=%#lx\n", (unsigned long)data, (unsigned long)fe); */
 
-	if (RING_HAS_UNCONSUMED_RESPONSES(&fe->ring)) {
+	if (RING_HAS_UNCONSUMED_RESPONSES(&queue->ring)) {
 again_send:
 		dprintk_deb("responses_produced= %d, requests_produced = %d\n",
-			    fe->ring.sring->rsp_prod, fe->ring.sring->req_prod);
+			    queue->ring.sring->rsp_prod, queue->ring.sring->req_prod);
 		dprintk_deb("RING_FREE_REQUESTS() = %#x, RING_FULL=%#x \n",
-			    RING_FREE_REQUESTS((&fe->ring)),
-			    RING_FULL(&fe->ring));
-		ring = &fe->ring;
-		cons = fe->ring.rsp_cons;
-		prod = fe->ring.sring->rsp_prod;
+			    RING_FREE_REQUESTS((&queue->ring)),
+			    RING_FULL(&queue->ring));
+		ring = &queue->ring;
+		cons = queue->ring.rsp_cons;
+		prod = queue->ring.sring->rsp_prod;
 	} else
 		goto out;
 
 	rmb(); /* Ensure we see queued responses up to 'rp'. */
 	while (cons != prod) {
 		dprintk_deb("omx_xenif->ring.req_cons=%d, i=%d, rp=%d\n",
-			    fe->ring.rsp_cons, fe->ring.rsp_cons,
-			    fe->ring.sring->rsp_prod);
+			    queue->ring.rsp_cons, queue->ring.rsp_cons,
+			    queue->ring.sring->rsp_prod);
 		dprintk_deb("omx_xenif->recv_ring.req_cons=%d, i=%d, rp=%d\n",
-			    fe->recv_ring.rsp_cons, fe->recv_ring.rsp_cons,
-			    fe->recv_ring.sring->rsp_prod);
+			    queue->recv_ring.rsp_cons, queue->recv_ring.rsp_cons,
+			    queue->recv_ring.sring->rsp_prod);
 
 		resp = RING_GET_RESPONSE(ring, cons++);
 
 		id = resp->func;
 		dprintk_deb
 		    ("func =%#x, responses_produced= %d, requests_produced = %d\n",
-		     resp->func, fe->ring.sring->rsp_prod,
-		     fe->ring.sring->req_prod);
+		     resp->func, queue->ring.sring->rsp_prod,
+		     queue->ring.sring->req_prod);
 
 		switch (resp->func) {
 		case OMX_CMD_SEND_MEDIUMSQ_FRAG:{
@@ -666,14 +807,7 @@ again_send:
 					break;
 				}
 
-				spin_lock(&fe->status_lock);
-				if (!ret)
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
-				spin_unlock(&fe->status_lock);
+				omx_xenfront_complete_send(queue, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -697,14 +831,7 @@ again_send:
 				}
 
 				//      dump_xen_send_mediumva(&resp->data.send_mediumva);
-				spin_lock(&fe->status_lock);
-				if (!ret)
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
-				spin_unlock(&fe->status_lock);
+				omx_xenfront_complete_send(queue, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -728,14 +855,7 @@ again_send:
 				}
 
 				//      dump_xen_send_small(&resp->data.send_small);
-				spin_lock(&fe->status_lock);
-				if (!ret)
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
-				spin_unlock(&fe->status_lock);
+				omx_xenfront_complete_send(queue, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -759,14 +879,7 @@ again_send:
 					break;
 				}
 				//      dump_xen_send_tiny(&resp->data.send_tiny);
-				spin_lock(&fe->status_lock);
-				if (!ret)
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
-				spin_unlock(&fe->status_lock);
+				omx_xenfront_complete_send(queue, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -795,14 +908,7 @@ again_send:
 				memcpy(&pull, &resp->data.pull.pull,
 				       sizeof(pull));
 
-				spin_lock(&fe->status_lock);
-				if (!ret)
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
-				spin_unlock(&fe->status_lock);
+				omx_xenfront_complete_send(queue, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -826,14 +932,7 @@ again_send:
 				}
 
 				//dump_xen_send_notify(&resp->data.send_notify);
-				spin_lock(&fe->status_lock);
-				if (!ret)
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
-				spin_unlock(&fe->status_lock);
+				omx_xenfront_complete_send(queue, endpoint, resp);
 				dprintk_deb("%s: ret = %d\n", __func__, ret);
 
 				break;
@@ -857,14 +956,7 @@ again_send:
 				}
 				dump_xen_send_rndv(&resp->data.send_rndv);
 
-				spin_lock(&fe->status_lock);
-				if (!ret)
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
-				spin_unlock(&fe->status_lock);
+				omx_xenfront_complete_send(queue, endpoint, resp);
 
 				break;
 			}
@@ -885,14 +977,7 @@ again_send:
 					break;
 				}
 				dump_xen_send_liback(&resp->data.send_liback);
-				spin_lock(&fe->status_lock);
-				if (!ret)
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
-				spin_unlock(&fe->status_lock);
+				omx_xenfront_complete_send(queue, endpoint, resp);
 
 				break;
 			}
@@ -915,14 +1000,7 @@ again_send:
 				}
 				dump_xen_send_connect_request(&resp->
 							      data.send_connect_request);
-				spin_lock(&fe->status_lock);
-				if (!ret)
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
-				spin_unlock(&fe->status_lock);
+				omx_xenfront_complete_send(queue, endpoint, resp);
 
 				break;
 			}
@@ -945,14 +1023,7 @@ again_send:
 				}
 				dump_xen_send_connect_reply(&resp->
 							    data.send_connect_reply);
-				spin_lock(&fe->status_lock);
-				if (!ret)
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_DONE;
-				else
-					fe->status =
-					    OMX_XEN_FRONTEND_STATUS_FAILED;
-				spin_unlock(&fe->status_lock);
+				omx_xenfront_complete_send(queue, endpoint, resp);
 
 				break;
 			}
@@ -1291,8 +1362,8 @@ again_send:
 			printk_err("Unknown event came in, %d\n", resp->func);
 			dprintk_inf
 			    ("resp_consumed=%d, responses_produced= %d, requests_produced = %d\n",
-			     cons, fe->ring.sring->rsp_prod,
-			     fe->ring.sring->req_prod);
+			     cons, queue->ring.sring->rsp_prod,
+			     queue->ring.sring->req_prod);
 			break;
 		}
 	}
@@ -1300,24 +1371,24 @@ again_send:
 	wmb();
 
 #if 0
-	RING_FINAL_CHECK_FOR_RESPONSES(&fe->recv_ring, more_to_do);
+	RING_FINAL_CHECK_FOR_RESPONSES(&queue->recv_ring, more_to_do);
 	if (more_to_do)
 		goto again_recv;
 #endif
 
-	RING_FINAL_CHECK_FOR_RESPONSES(&fe->ring, more_to_do);
+	RING_FINAL_CHECK_FOR_RESPONSES(&queue->ring, more_to_do);
 	if (more_to_do)
 		goto again_send;
 
 #ifdef EXTRA_DEBUG_OMX
-	if (RING_HAS_UNCONSUMED_RESPONSES(&fe->ring))
+	if (RING_HAS_UNCONSUMED_RESPONSES(&queue->ring))
 		printk_err
 		    ("exiting, although we have unconsumed responses, are you SURE?\n");
 #endif
 
 
 #if 0
-	if (RING_HAS_UNCONSUMED_RESPONSES(&fe->recv_ring))
+	if (RING_HAS_UNCONSUMED_RESPONSES(&queue->recv_ring))
 		printk_err
 		    ("exiting, recv_although we have unconsumed responses, are you SURE?\n");
 #endif
@@ -1362,20 +1433,26 @@ int omx_xen_ifaces_get_count(uint32_t * count)
 
 	dprintk_in();
 
+	ring_req = omx_xenfront_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	spin_lock(&fe->status_lock);
 	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
 	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
 	ring_req->func = OMX_CMD_XEN_GET_BOARD_COUNT;
-	omx_poke_dom0(fe, ring_req);
+	omx_xenfront_push_request(&fe->queues[0], ring_req);
 
 	/* dprintk_deb("waiting to become %u\n", OMX_ENDPOINT_STATUS_FREE); */
 	if (wait_for_backend_response
 	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
 		printk_err("Failed to wait\n");
+		omx_xenfront_put_request(&fe->queues[0]);
 		ret = -EINVAL;
 		goto out;
 	}
+	omx_xenfront_put_request(&fe->queues[0]);
 
 	if (fe->status == OMX_XEN_FRONTEND_STATUS_FAILED) {
 		ret = -EINVAL;
@@ -1397,20 +1474,26 @@ int omx_xen_peer_table_get_state(struct omx_cmd_peer_table_state *state)
 
 	dprintk_in();
 
+	ring_req = omx_xenfront_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	spin_lock(&fe->status_lock);
 	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
 	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
 	ring_req->func = OMX_CMD_XEN_PEER_TABLE_GET_STATE;
 	ring_req->board_index = 0;
-	omx_poke_dom0(fe, ring_req);
+	omx_xenfront_push_request(&fe->queues[0], ring_req);
 
 	if (wait_for_backend_response
 	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
 		printk_err("Failed to wait\n");
+		omx_xenfront_put_request(&fe->queues[0]);
 		ret = -EINVAL;
 		goto out;
 	}
+	omx_xenfront_put_request(&fe->queues[0]);
 
 	if (fe->status == OMX_XEN_FRONTEND_STATUS_FAILED) {
 		ret = -EINVAL;
@@ -1431,21 +1514,27 @@ int omx_xen_peer_table_set_state(struct omx_cmd_peer_table_state *state)
 
 	dprintk_in();
 
+	ring_req = omx_xenfront_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	spin_lock(&fe->status_lock);
 	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
 	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
 	ring_req->func = OMX_CMD_XEN_PEER_TABLE_SET_STATE;
 	ring_req->board_index = 0;
 	memcpy(&ring_req->data.pts.state, &fe->state, sizeof(*state));
-	omx_poke_dom0(fe, ring_req);
+	omx_xenfront_push_request(&fe->queues[0], ring_req);
 
 	if (wait_for_backend_response
 	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
 		printk_err("Failed to wait\n");
+		omx_xenfront_put_request(&fe->queues[0]);
 		ret = -EINVAL;
 		goto out;
 	}
+	omx_xenfront_put_request(&fe->queues[0]);
 
 	if (fe->status == OMX_XEN_FRONTEND_STATUS_FAILED) {
 		ret = -EINVAL;
@@ -1465,22 +1554,28 @@ int omx_xen_set_hostname(uint32_t board_index, const char *hostname)
 
 	dprintk_in();
 
+	ring_req = omx_xenfront_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	spin_lock(&fe->status_lock);
 	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
 	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
 	ring_req->func = OMX_CMD_XEN_SET_HOSTNAME;
 	ring_req->board_index = board_index;
 	memcpy(ring_req->data.sh.hostname, hostname, OMX_HOSTNAMELEN_MAX);
 
-	omx_poke_dom0(fe, ring_req);
+	omx_xenfront_push_request(&fe->queues[0], ring_req);
 
 	if (wait_for_backend_response
 	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
 		printk_err("Failed to wait\n");
+		omx_xenfront_put_request(&fe->queues[0]);
 		ret = -EINVAL;
 		goto out;
 	}
+	omx_xenfront_put_request(&fe->queues[0]);
 
 	if (fe->status == OMX_XEN_FRONTEND_STATUS_FAILED) {
 		ret = -EINVAL;
@@ -1527,22 +1622,28 @@ int omx_ioctl_xen_get_board_info(struct omx_endpoint *endpoint,
 //      get_board_info.board_index = 0;
 	fe = endpoint->fe;
 
+	ring_req = omx_xenfront_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	spin_lock(&fe->status_lock);
 	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
 	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
 	ring_req->func = OMX_CMD_GET_BOARD_INFO;
 	ring_req->board_index = endpoint->board_index;
 	ring_req->eid = endpoint->endpoint_index;
 	dump_xen_get_board_info(&ring_req->data.gbi);
-	omx_poke_dom0(endpoint->fe, ring_req);
+	omx_xenfront_push_request(&fe->queues[0], ring_req);
 	/* dprintk_deb("waiting to become %u\n", OMX_ENDPOINT_STATUS_FREE); */
 	if (wait_for_backend_response
 	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
 		printk_err("Failed to wait\n");
+		omx_xenfront_put_request(&fe->queues[0]);
 		ret = -EINVAL;
 		goto out;
 	}
+	omx_xenfront_put_request(&fe->queues[0]);
 
 	memcpy(&get_board_info.info, &fe->board_info,
 	       sizeof(struct omx_board_info));
@@ -1551,6 +1652,17 @@ int omx_ioctl_xen_get_board_info(struct omx_endpoint *endpoint,
 		ret = -EINVAL;
 		goto out;
 	}
+
+	/* resolve our own peer index once, the intra-guest shared paths need it */
+	if (fe->board_peer_index == OMX_XENFRONT_UNKNOWN_PEER_INDEX) {
+		uint64_t board_addr = get_board_info.info.addr;
+		uint32_t index;
+
+		if (!omx_xen_peer_lookup(&index, &board_addr, NULL,
+					 OMX_CMD_PEER_FROM_ADDR))
+			fe->board_peer_index = index;
+	}
+
 	dprintk_deb("ret =%d\n", ret);
 	dprintk_deb("board_addr = %#llx, ret = %d\n", get_board_info.info.addr,
 		    ret);
@@ -1589,23 +1701,29 @@ omx_xen_endpoint_get_info(uint32_t board_index, uint32_t endpoint_index,
 	endpoint = fe->endpoints[endpoint_index];
 	BUG_ON(!endpoint);
 
+	ring_req = omx_xenfront_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	spin_lock(&endpoint->status_lock);
 	endpoint->info_status = OMX_ENDPOINT_STATUS_DOING;
 	spin_unlock(&endpoint->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
 	ring_req->func = OMX_CMD_GET_ENDPOINT_INFO;
 	ring_req->board_index = endpoint->board_index;
 	ring_req->eid = endpoint->endpoint_index;
 	dump_xen_get_endpoint_info(&ring_req->data.gei);
-	omx_poke_dom0(endpoint->fe, ring_req);
+	omx_xenfront_push_request(&fe->queues[0], ring_req);
 	/* dprintk_deb("waiting to become %u\n", OMX_ENDPOINT_STATUS_DONE); */
 	if (wait_for_backend_response
 	    (&endpoint->info_status, OMX_ENDPOINT_STATUS_DOING,
 	     &endpoint->status_lock)) {
 		printk_err("Failed to wait\n");
+		omx_xenfront_put_request(&fe->queues[0]);
 		ret = -EINVAL;
 		goto out;
 	}
+	omx_xenfront_put_request(&fe->queues[0]);
 
 	memcpy(info, &endpoint->endpoint_info,
 	       sizeof(struct omx_endpoint_info));
@@ -1632,10 +1750,14 @@ omx_xen_peer_lookup(uint32_t * index,
 
 	dprintk_in();
 	BUG_ON(!fe);
+	ring_req = omx_xenfront_get_request(&fe->queues[0]);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	spin_lock(&fe->status_lock);
 	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
 	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
 	ring_req->func = cmd;
 	if (cmd == OMX_CMD_PEER_FROM_INDEX) {
 		if (index)
@@ -1658,13 +1780,15 @@ omx_xen_peer_lookup(uint32_t * index,
 	}
 
 	dump_xen_misc_peer_info(&ring_req->data.mpi);
-	omx_poke_dom0(fe, ring_req);
+	omx_xenfront_push_request(&fe->queues[0], ring_req);
 	if (wait_for_backend_response
 	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
 		printk_err("Failed to wait\n");
+		omx_xenfront_put_request(&fe->queues[0]);
 		ret = -EINVAL;
 		goto out;
 	}
+	omx_xenfront_put_request(&fe->queues[0]);
 
 	if (cmd == OMX_CMD_PEER_FROM_INDEX) {
 		if (board_addr)
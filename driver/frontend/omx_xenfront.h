@@ -22,6 +22,7 @@
 #include <linux/scatterlist.h>
 #include <linux/workqueue.h>
 #include <linux/spinlock.h>
+#include <linux/mutex.h>
 #include <xen/interface/io/xenbus.h>
 #include <xen/interface/io/ring.h>
 #include <linux/cdev.h>
@@ -36,26 +37,50 @@ enum frontend_status {
 	OMX_XEN_FRONTEND_STATUS_DOING,
 	OMX_XEN_FRONTEND_STATUS_FAILED,
 };
-struct omx_xenfront_info {
-	struct list_head list;
-	uint16_t handle;
-	struct xenbus_device *xbdev;
+
+/* One command/event ring pair, with its own event channel */
+struct omx_xenfront_queue {
+	struct omx_xenfront_info *fe;
+	unsigned int index;
 	struct omx_xenif_front_ring ring;
 	struct omx_xenif_front_ring recv_ring;
-	grant_ref_t gref;
 	int ring_ref;
 	int recv_ring_ref;
 	struct evtchn_bind_interdomain evtchn;
-	unsigned int evtchn2, irq;
+	unsigned int irq;
+	spinlock_t lock;
+
+	/* serializes request slot reservation, filling and pushing on ring */
+	struct mutex submit_mutex;
+	uint32_t next_request_id;
+
+	/* completion of synchronous sends issued on this queue */
+	enum frontend_status status;
+	spinlock_t status_lock;
+
+	struct work_struct msg_workq_task;
+};
+
+struct omx_xenfront_info {
+	struct list_head list;
+	uint16_t handle;
+	struct xenbus_device *xbdev;
+	struct omx_xenfront_queue queues[OMX_XEN_MAX_QUEUES];
+	unsigned int nr_queues;
+	grant_ref_t gref;
 	enum omx_xenif_state connected;
 	uint8_t is_ready;
-	spinlock_t lock;
 	spinlock_t msg_handler_lock;
 	struct omx_endpoint *endpoints[OMX_XEN_MAX_ENDPOINTS];
+	/* protects endpoints[] against the lookups of the shared paths */
+	spinlock_t endpoints_lock;
 	uint32_t board_count;
 	struct omx_cmd_peer_table_state state;
 	struct omx_board_info board_info;
+	/* index of our board in the backend peer table, once resolved */
+	uint32_t board_peer_index;
 	struct omx_cmd_misc_peer_info peer_info;
+	/* completion of the misc commands, which all go through queue 0 */
 	enum frontend_status status;
 	spinlock_t status_lock;
 	wait_queue_head_t wq;
@@ -69,10 +94,23 @@ struct omx_xenfront_info {
 
 	struct task_struct *task;
 	struct workqueue_struct *msg_workq;
-	struct work_struct msg_workq_task;
 
+	struct omx_xenfront_pgrant_cache pgrants;
+	/* indirect pages the backend accepts per segment */
+	unsigned int indirect_max;
+	/* the backend delivers shared messages to other guests of its host */
+	unsigned int shared_host;
 };
 
+#define OMX_XENFRONT_UNKNOWN_PEER_INDEX ((uint32_t)-1)
+
+/* The queue carrying the requests and events of an endpoint */
+static inline struct omx_xenfront_queue *
+omx_xenfront_endpoint_queue(struct omx_xenfront_info *fe, uint32_t eid)
+{
+	return &fe->queues[omx_xen_queue_index(eid, fe->nr_queues)];
+}
+
 struct omx_xenfront_dev {
 	struct cdev cdev;
 	spinlock_t endpoint_lock;
@@ -110,10 +148,51 @@ int omx_xen_user_region_release(struct omx_endpoint *endpoint,
 int omx_ioctl_xen_get_board_info(struct omx_endpoint *endpoint,
 				 void __user * uparam);
 
-int omx_poke_dom0(struct omx_xenfront_info *fe, struct omx_xenif_request *ring_req);
+int omx_poke_dom0(struct omx_xenfront_queue *queue,
+		  struct omx_xenif_request *ring_req);
+
+struct omx_xenif_request *omx_xenfront_get_request(struct omx_xenfront_queue
+						   *queue);
+int omx_xenfront_push_request(struct omx_xenfront_queue *queue,
+			      struct omx_xenif_request *ring_req);
+void omx_xenfront_put_request(struct omx_xenfront_queue *queue);
+void omx_xenfront_cancel_request(struct omx_xenfront_queue *queue);
+
+/*
+ * Grants of user pages kept alive across region registrations when the
+ * backend supports feature-persistent-grants, so that it can keep them
+ * mapped as well. We hold a reference on each granted page, and only
+ * recycle an unused grant once the backend has unmapped it.
+ */
+#define OMX_XENFRONT_PGRANT_HASH_BITS 10
+
+struct omx_xenfront_pgrant {
+	struct hlist_node node;		/* hashed by pfn */
+	struct list_head lru;		/* on the cache LRU while unused */
+	unsigned long pfn;
+	struct page *page;
+	grant_ref_t gref;
+	unsigned int refcount;
+};
+
+struct omx_xenfront_pgrant_cache {
+	spinlock_t lock;
+	struct hlist_head hash[1 << OMX_XENFRONT_PGRANT_HASH_BITS];
+	struct list_head lru;
+	unsigned int nr;
+	unsigned int max;		/* 0 if the backend doesn't support it */
+
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long overflows;
+};
+
+extern int omx_xen_nowait;
+extern int omx_xen_queues;
 
 int wait_for_backend_response(unsigned int *poll_var, unsigned int status,
 			      spinlock_t * spin);
+int omx_xenfront_wait_inflight(struct omx_endpoint *endpoint);
 
 int omx_xen_endpoint_get_info(uint32_t board_index, uint32_t endpoint_index,
 			      struct omx_endpoint_info *info);
@@ -125,6 +204,17 @@ extern struct omx_xenfront_info *__omx_xen_frontend;
 
 void omx_xenif_interrupt(struct work_struct *work);
 void omx_xenif_interrupt_recv(struct work_struct *work);
+void omx_xenfront_wakeup_queue(struct omx_xenfront_queue *queue);
+void omx_wakeup_endpoint_waiters(struct omx_endpoint *endpoint);
+
+struct omx_endpoint *omx_xenfront_acquire_local_endpoint(struct
+							 omx_xenfront_info *fe,
+							 uint16_t peer_index,
+							 uint8_t
+							 endpoint_index);
+
+void omx_xenfront_pgrant_cache_init(struct omx_xenfront_pgrant_cache *cache);
+void omx_xenfront_pgrant_cache_destroy(struct omx_xenfront_pgrant_cache *cache);
 
 int omx_xen_peer_table_get_state(struct omx_cmd_peer_table_state *state);
 int omx_xen_peer_table_set_state(struct omx_cmd_peer_table_state *state);
@@ -132,6 +132,86 @@ static void printk_timers(void)
 
 
 
+/* Grant the pages of an event queue, as well as the page hosting their list */
+static int omx_xen_endpoint_grant_eventq(struct omx_endpoint *endpoint,
+					 struct page **pages,
+					 uint32_t gref_size,
+					 grant_ref_t ** list_p,
+					 uint16_t * list_offset_p,
+					 grant_ref_t * list_gref_p)
+{
+	int ret = 0, i;
+	grant_ref_t *list;
+	grant_ref_t list_gref;
+
+	dprintk_in();
+
+	list = kmalloc(gref_size * sizeof(grant_ref_t), GFP_KERNEL);
+	if (!list) {
+		printk_err("failed to allocate gref_list for eventq\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < gref_size; i++) {
+		unsigned long mfn;
+		grant_ref_t gref;
+
+		gref = gnttab_claim_grant_reference(&endpoint->gref_head);
+		mfn = pfn_to_mfn(page_to_pfn(pages[i]));
+		gnttab_grant_foreign_access_ref(gref, 0, mfn, 0);
+		list[i] = gref;
+	}
+
+	list_gref = gnttab_claim_grant_reference(&endpoint->gref_head);
+	gnttab_grant_foreign_access_ref(list_gref, 0, virt_to_mfn(list), 0);
+
+	*list_p = list;
+	*list_offset_p = (unsigned long)list & ~PAGE_MASK;
+	*list_gref_p = list_gref;
+
+	dprintk_deb("eventq: %u pages, list gref=%#x\n", gref_size, list_gref);
+
+out:
+	dprintk_out();
+	return ret;
+}
+
+static void omx_xen_endpoint_ungrant_eventq(struct omx_endpoint *endpoint,
+					    uint32_t gref_size,
+					    grant_ref_t * list,
+					    grant_ref_t list_gref)
+{
+	int i;
+
+	dprintk_in();
+
+	if (!list)
+		goto out;
+
+	for (i = 0; i < gref_size; i++) {
+		if (gnttab_query_foreign_access(list[i]))
+			printk_inf
+			    ("eventq gref_list[%d] = %u is still in use by the backend!\n",
+			     i, list[i]);
+		if (!gnttab_end_foreign_access_ref(list[i], 0))
+			printk_inf
+			    ("Can't end foreign access for eventq gref_list[%d] = %u\n",
+			     i, list[i]);
+		gnttab_release_grant_reference(&endpoint->gref_head, list[i]);
+	}
+
+	if (!gnttab_end_foreign_access_ref(list_gref, 0))
+		printk_inf("Can't end foreign access for eventq list gref = %u\n",
+			   list_gref);
+	gnttab_release_grant_reference(&endpoint->gref_head, list_gref);
+
+	kfree(list);
+
+out:
+	dprintk_out();
+}
+
 /* Grant send/recv queue space as long as the endpoint itself
  * FIXME: Lots of local vars, needs major cleanup! */
 int omx_xen_endpoint_grant_resources(struct omx_endpoint *endpoint)
@@ -141,6 +221,9 @@ int omx_xen_endpoint_grant_resources(struct omx_endpoint *endpoint)
 	grant_ref_t *egref_recvq_list;
 	uint32_t sendq_gref_size = OMX_SENDQ_SIZE / PAGE_SIZE;
 	uint32_t recvq_gref_size = OMX_RECVQ_SIZE / PAGE_SIZE;
+	uint32_t exp_eventq_gref_size = OMX_EXP_EVENTQ_SIZE / PAGE_SIZE;
+	uint32_t unexp_eventq_gref_size = OMX_UNEXP_EVENTQ_SIZE / PAGE_SIZE;
+	uint32_t nr_grefs;
 	grant_ref_t recvq_list, sendq_list, endpoint_gref;
 	uint16_t sendq_list_offset, recvq_list_offset, endpoint_offset;
 	struct page *sendq_page, *recvq_page, *endpoint_page;
@@ -177,14 +260,14 @@ int omx_xen_endpoint_grant_resources(struct omx_endpoint *endpoint)
 	endpoint->egref_sendq_offset = sendq_list_offset;
 	endpoint->egref_recvq_offset = recvq_list_offset;
 
-	/* FIXME: sendq, recvq + 2 for the pages that host the relevant lists, and one more for the endpoint ;-) */
-	ret =
-	    gnttab_alloc_grant_references(sendq_gref_size + recvq_gref_size + 3,
-					  &endpoint->gref_head);
+	/* FIXME: sendq, recvq, both eventqs + 4 for the pages that host the relevant lists, and one more for the endpoint ;-) */
+	nr_grefs = sendq_gref_size + recvq_gref_size
+	    + exp_eventq_gref_size + unexp_eventq_gref_size + 5;
+	ret = gnttab_alloc_grant_references(nr_grefs, &endpoint->gref_head);
 	if (ret) {
 		printk_err
-		    ("Cannot allocate %d grant references for sendq/recvq lists\n",
-		     sendq_gref_size + recvq_gref_size + 2);
+		    ("Cannot allocate %d grant references for sendq/recvq/eventq lists\n",
+		     nr_grefs);
 		goto out;
 	}
 
@@ -255,6 +338,27 @@ int omx_xen_endpoint_grant_resources(struct omx_endpoint *endpoint)
 		egref_recvq_list[i] = gref;
 	}
 
+	/* Event queues */
+	ret = omx_xen_endpoint_grant_eventq(endpoint,
+					    endpoint->exp_eventq_pages,
+					    exp_eventq_gref_size,
+					    &endpoint->egref_exp_eventq_list,
+					    &endpoint->egref_exp_eventq_offset,
+					    &endpoint->exp_eventq_gref);
+	if (ret)
+		goto out;
+	endpoint->exp_eventq_gref_size = exp_eventq_gref_size;
+
+	ret = omx_xen_endpoint_grant_eventq(endpoint,
+					    endpoint->unexp_eventq_pages,
+					    unexp_eventq_gref_size,
+					    &endpoint->egref_unexp_eventq_list,
+					    &endpoint->egref_unexp_eventq_offset,
+					    &endpoint->unexp_eventq_gref);
+	if (ret)
+		goto out;
+	endpoint->unexp_eventq_gref_size = unexp_eventq_gref_size;
+
 out:
 	dprintk_out();
 	return ret;
@@ -375,6 +479,17 @@ int omx_xen_endpoint_ungrant_resources(struct omx_endpoint *endpoint)
 	gnttab_release_grant_reference(&endpoint->gref_head,
 				       endpoint->recvq_gref);
 
+	omx_xen_endpoint_ungrant_eventq(endpoint,
+					endpoint->exp_eventq_gref_size,
+					endpoint->egref_exp_eventq_list,
+					endpoint->exp_eventq_gref);
+	endpoint->egref_exp_eventq_list = NULL;
+	omx_xen_endpoint_ungrant_eventq(endpoint,
+					endpoint->unexp_eventq_gref_size,
+					endpoint->egref_unexp_eventq_list,
+					endpoint->unexp_eventq_gref);
+	endpoint->egref_unexp_eventq_list = NULL;
+
 	gnttab_free_grant_references(endpoint->gref_head);
 
 	kfree(endpoint->egref_sendq_list);
@@ -434,11 +549,17 @@ omx_ioctl_xen_open_endpoint(struct omx_endpoint *endpoint, void __user * uparam)
 
 	endpoint->board_index = param.board_index;
 	endpoint->endpoint_index = param.endpoint_index;
+	endpoint->xen_queue =
+	    omx_xenfront_endpoint_queue(fe, param.endpoint_index);
 
 	/* Prepare the message to the backend */
 
 	/* FIXME: maybe create a static inline function for this stuff ? */
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(endpoint->xen_queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out_with_alloc;
+	}
 	ring_req->func = OMX_CMD_XEN_OPEN_ENDPOINT;
 	ring_req->board_index = param.board_index;
 	ring_req->eid = param.endpoint_index;
@@ -454,14 +575,27 @@ omx_ioctl_xen_open_endpoint(struct omx_endpoint *endpoint, void __user * uparam)
 	ring_req->data.endpoint.recvq_gref_size = endpoint->recvq_gref_size;
 	ring_req->data.endpoint.endpoint_gref = endpoint->endpoint_gref;
 	ring_req->data.endpoint.endpoint_offset = endpoint->endpoint_offset;
-
+	ring_req->data.endpoint.exp_eventq_gref = endpoint->exp_eventq_gref;
+	ring_req->data.endpoint.unexp_eventq_gref = endpoint->unexp_eventq_gref;
+	ring_req->data.endpoint.egref_exp_eventq_offset =
+	    endpoint->egref_exp_eventq_offset;
+	ring_req->data.endpoint.egref_unexp_eventq_offset =
+	    endpoint->egref_unexp_eventq_offset;
+	ring_req->data.endpoint.exp_eventq_gref_size =
+	    endpoint->exp_eventq_gref_size;
+	ring_req->data.endpoint.unexp_eventq_gref_size =
+	    endpoint->unexp_eventq_gref_size;
+
+	spin_lock(&fe->endpoints_lock);
 	fe->endpoints[param.endpoint_index] = endpoint;
+	spin_unlock(&fe->endpoints_lock);
 
 	endpoint->xen = 1;
 
 	dump_xen_ring_msg_endpoint(&ring_req->data.endpoint);
 
-	omx_poke_dom0(endpoint->fe, ring_req);
+	omx_xenfront_push_request(endpoint->xen_queue, ring_req);
+	omx_xenfront_put_request(endpoint->xen_queue);
 	/* FIXME: find a better way to get notified that a backend response has come */
 	if (wait_for_backend_response
 	    (&endpoint->status, OMX_ENDPOINT_STATUS_INITIALIZING,
@@ -507,6 +641,8 @@ void omx_xen_endpoint_free_resources(struct omx_endpoint *endpoint)
 
 	omx_endpoint_user_regions_exit(endpoint);
 
+	kfree(endpoint->unexp_eventq_pages);
+	kfree(endpoint->exp_eventq_pages);
 	kfree(endpoint->recvq_pages);
 	kfree(endpoint->sendq_pages);
 	vfree(endpoint->unexp_eventq);
@@ -532,6 +668,39 @@ static void __omx_xen_endpoint_last_release(struct kref *kref)
 	kfree(endpoint);
 }
 
+/*
+ * Acquire an endpoint of this guest for the shared communication paths.
+ * Returns NULL if the peer isn't our board or if the endpoint isn't open
+ * in this guest, the caller then has to go through the backend.
+ */
+struct omx_endpoint *
+omx_xenfront_acquire_local_endpoint(struct omx_xenfront_info *fe,
+				    uint16_t peer_index, uint8_t endpoint_index)
+{
+	struct omx_endpoint *endpoint;
+
+	if (peer_index != fe->board_peer_index
+	    || endpoint_index >= OMX_XEN_MAX_ENDPOINTS)
+		return NULL;
+
+	spin_lock(&fe->endpoints_lock);
+	endpoint = fe->endpoints[endpoint_index];
+	if (!endpoint) {
+		spin_unlock(&fe->endpoints_lock);
+		return NULL;
+	}
+	kref_get(&endpoint->refcount);
+	spin_unlock(&fe->endpoints_lock);
+
+	/* same ordering as omx_endpoint_acquire_by_iface_index() */
+	if (unlikely(endpoint->status != OMX_ENDPOINT_STATUS_OK)) {
+		omx_endpoint_release(endpoint);
+		return ERR_PTR(-ENOENT);
+	}
+
+	return endpoint;
+}
+
 int
 omx_ioctl_xen_close_endpoint(struct omx_endpoint *endpoint,
 			     void __user * uparam)
@@ -540,6 +709,7 @@ omx_ioctl_xen_close_endpoint(struct omx_endpoint *endpoint,
 	struct omx_cmd_open_endpoint param;
 	struct omx_xenif_request *ring_req;
 	struct omx_xenfront_info *fe = __omx_xen_frontend;
+	struct omx_xenfront_queue *queue;
 	dprintk_in();
 
 	might_sleep();
@@ -573,10 +743,19 @@ omx_ioctl_xen_close_endpoint(struct omx_endpoint *endpoint,
 
 	spin_unlock(&endpoint->status_lock);
 
+	ret = omx_xenfront_wait_inflight(endpoint);
+	if (ret)
+		goto out;
+
 	/* Prepare the message to the backend */
+	queue = omx_xenfront_endpoint_queue(fe, param.endpoint_index);
 
 	/* FIXME: maybe create a static inline function for this stuff ? */
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_XEN_CLOSE_ENDPOINT;
 	ring_req->board_index = param.board_index;
 	ring_req->eid = param.endpoint_index;
@@ -591,7 +770,8 @@ omx_ioctl_xen_close_endpoint(struct omx_endpoint *endpoint,
 	ring_req->data.endpoint.recvq_gref_size = endpoint->recvq_gref_size;
 	fe->endpoints[param.endpoint_index] = endpoint;
 	//dump_xen_ring_msg_endpoint(&ring_req->data.endpoint);
-	omx_poke_dom0(endpoint->fe, ring_req);
+	omx_xenfront_push_request(queue, ring_req);
+	omx_xenfront_put_request(queue);
 
 	/* FIXME: find a better way to get notified that a backend response has come */
 	if (wait_for_backend_response
@@ -607,7 +787,9 @@ omx_ioctl_xen_close_endpoint(struct omx_endpoint *endpoint,
 	//omx_endpoint_close(endpoint, 0);
 
 	omx_xen_endpoint_ungrant_resources(endpoint);
+	spin_lock(&fe->endpoints_lock);
 	fe->endpoints[param.endpoint_index] = NULL;
+	spin_unlock(&fe->endpoints_lock);
 	/* Just trying! */
 	kref_put(&endpoint->refcount, __omx_xen_endpoint_last_release);
 	ret = 0;
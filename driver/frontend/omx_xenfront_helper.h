@@ -37,23 +37,24 @@
 
 irqreturn_t omx_xenif_fe_int(int irq, void *data)
 {
-	struct omx_xenfront_info *fe = (struct omx_xenfront_info *)data;
+	struct omx_xenfront_queue *queue = (struct omx_xenfront_queue *)data;
 	unsigned long flags;
 
 
 	dprintk_in();
 
-	//spin_lock_irqsave(&fe->lock, flags);
-	//queue_work(fe->msg_workq, &fe->msg_workq_task);
-	/* dprintk_deb("ev_id %#lx omxbe=%#lx\n", (unsigned long)data, (unsigned long)fe); */
-	if (RING_HAS_UNCONSUMED_RESPONSES(&fe->recv_ring)) {
-		omx_xenif_interrupt_recv(&fe->msg_workq_task);
+	//spin_lock_irqsave(&queue->lock, flags);
+	//queue_work(fe->msg_workq, &queue->msg_workq_task);
+	/* dprintk_deb("ev_id %#lx omxbe=%#lx\n", (unsigned long)data, (unsigned long)queue); */
+	if (RING_HAS_UNCONSUMED_RESPONSES(&queue->recv_ring)) {
+		omx_xenif_interrupt_recv(&queue->msg_workq_task);
 	}
-	if (RING_HAS_UNCONSUMED_RESPONSES(&fe->ring)) {
-		omx_xenif_interrupt(&fe->msg_workq_task);
+	if (RING_HAS_UNCONSUMED_RESPONSES(&queue->ring)) {
+		omx_xenif_interrupt(&queue->msg_workq_task);
 	}
+	omx_xenfront_wakeup_queue(queue);
 
-	//spin_unlock_irqrestore(&fe->lock, flags);
+	//spin_unlock_irqrestore(&queue->lock, flags);
 	dprintk_out();
 	return IRQ_HANDLED;
 }
@@ -63,43 +64,135 @@ static void omx_xenif_free(struct omx_xenfront_info *fe, int suspend)
 	dprintk_in();
 
 	destroy_workqueue(fe->msg_workq);
+	omx_xenfront_pgrant_cache_destroy(&fe->pgrants);
 	kfree(fe);
 
 	dprintk_out();
 	return;
 }
 
-static int setup_ring(struct xenbus_device *dev, struct omx_xenfront_info *fe)
+static void omx_xenfront_init_queue(struct omx_xenfront_info *fe,
+				    unsigned int index)
+{
+	struct omx_xenfront_queue *queue = &fe->queues[index];
+
+	queue->fe = fe;
+	queue->index = index;
+	spin_lock_init(&queue->lock);
+	mutex_init(&queue->submit_mutex);
+	spin_lock_init(&queue->status_lock);
+	INIT_WORK(&queue->msg_workq_task, omx_xenif_interrupt);
+}
+
+/* Allocate and grant the two shared rings of a queue */
+static int omx_xenfront_alloc_queue(struct xenbus_device *dev,
+				    struct omx_xenfront_queue *queue)
+{
+	struct omx_xenif_sring *sring, *recv_sring;
+	int err = 0;
+
+	dprintk_in();
+	dprintk_deb("Setting up shared rings of queue %u\n", queue->index);
+
+	sring =
+	    (struct omx_xenif_sring *)get_zeroed_page(GFP_NOIO | __GFP_HIGH);
+	if (!sring) {
+		xenbus_dev_fatal(dev, -ENOMEM, "allocating shared ring");
+		err = -ENOMEM;
+		goto out;
+	}
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&queue->ring, sring, PAGE_SIZE);
+
+	err = xenbus_grant_ring(dev, virt_to_mfn(queue->ring.sring));
+	if (err < 0) {
+		free_page((unsigned long)sring);
+		queue->ring.sring = NULL;
+		printk_err("Failed to grant ring\n");
+		goto out;
+	}
+	queue->ring_ref = err;
+
+	recv_sring =
+	    (struct omx_xenif_sring *)get_zeroed_page(GFP_NOIO | __GFP_HIGH);
+	if (!recv_sring) {
+		xenbus_dev_fatal(dev, -ENOMEM, "allocating shared ring");
+		err = -ENOMEM;
+		goto out;
+	}
+	SHARED_RING_INIT(recv_sring);
+	FRONT_RING_INIT(&queue->recv_ring, recv_sring, PAGE_SIZE);
+
+	err = xenbus_grant_ring(dev, virt_to_mfn(queue->recv_ring.sring));
+	if (err < 0) {
+		free_page((unsigned long)recv_sring);
+		queue->recv_ring.sring = NULL;
+		printk_err("Failed to grant recv_ring\n");
+		goto out;
+	}
+	queue->recv_ring_ref = err;
+	err = 0;
+
+out:
+	dprintk_out();
+	return err;
+}
+
+static void omx_xenfront_free_queue(struct omx_xenfront_queue *queue)
+{
+	dprintk_in();
+
+	if (queue->irq) {
+		unbind_from_irqhandler(queue->irq, queue);
+		queue->irq = 0;
+	}
+
+	/* This frees the page as a side-effect */
+	if (queue->ring_ref)
+		gnttab_end_foreign_access(queue->ring_ref, 0,
+					  (unsigned long)queue->ring.sring);
+
+	/* This frees the page as a side-effect */
+	if (queue->recv_ring_ref)
+		gnttab_end_foreign_access(queue->recv_ring_ref, 0,
+					  (unsigned long)queue->recv_ring.sring);
+
+	dprintk_out();
+}
+
+static int setup_ring(struct xenbus_device *dev,
+		      struct omx_xenfront_queue *queue)
 {
 	int err = 0;
 
 	dprintk_in();
-	// fe->ring_ref = 0;
+	// queue->ring_ref = 0;
 
-	fe->evtchn.remote_dom = 0;	/* DOM0_ID */
+	queue->evtchn.remote_dom = 0;	/* DOM0_ID */
 	if ((err =
 	     HYPERVISOR_event_channel_op(EVTCHNOP_bind_interdomain,
-					 &fe->evtchn))) {
+					 &queue->evtchn))) {
 		printk("failed to setup evtchn ! err = %d\n", err);
 		goto out;
 	}
 
-	err = bind_evtchn_to_irqhandler(fe->evtchn.local_port,
+	err = bind_evtchn_to_irqhandler(queue->evtchn.local_port,
 					omx_xenif_fe_int, IRQF_SHARED,
-					"domU", fe);
+					"domU", queue);
 
 	if (err < 0) {
 		dprintk_deb("failed to bind irqhandler! err = %d\n", err);
 		goto out;
 	}
-	fe->irq = err;
+	queue->irq = err;
 	dprintk_deb
-	    ("ring-ref = %u, fe->recv_ring_ref = %u, irq = %u, port = %u\n",
-	     fe->ring_ref, fe->recv_ring_ref, fe->irq, fe->evtchn.remote_port);
+	    ("queue %u: ring-ref = %u, recv_ring_ref = %u, irq = %u, port = %u\n",
+	     queue->index, queue->ring_ref, queue->recv_ring_ref, queue->irq,
+	     queue->evtchn.remote_port);
 	dprintk_out();
 	return 0;
 out:
-	omx_xenif_free(fe, 0);
+	omx_xenif_free(queue->fe, 0);
 	dprintk_out();
 	return err;
 }
@@ -130,16 +223,117 @@ static void omx_xenfront_connect(struct omx_xenfront_info *fe)
 	dprintk_out();
 }
 
+/*
+ * Pick the number of queues: as many as the backend offers, the module
+ * parameter allows and we have vCPUs to drive them. Backends that don't
+ * advertise multi-queue support get the single legacy queue.
+ */
+static unsigned int omx_xenfront_negotiate_queues(struct xenbus_device *dev)
+{
+	unsigned int max_queues, nr_queues;
+	int err;
+
+	err = xenbus_scanf(XBT_NIL, dev->nodename, "multi-queue-max-queues",
+			   "%u", &max_queues);
+	if (err != 1)
+		max_queues = 1;
+
+	nr_queues = min_t(unsigned int, max_queues, omx_xen_queues);
+	nr_queues = min_t(unsigned int, nr_queues, num_online_cpus());
+	nr_queues = clamp_t(unsigned int, nr_queues, 1, OMX_XEN_MAX_QUEUES);
+
+	return nr_queues;
+}
+
+/*
+ * The backend advertises how many persistent grants it keeps mapped. We
+ * keep some more than that, so that its LRU evictions let us recycle
+ * grants instead of just hitting the limit.
+ */
+static void omx_xenfront_negotiate_pgrants(struct xenbus_device *dev,
+					   struct omx_xenfront_info *fe)
+{
+	unsigned int budget;
+	int err;
+
+	err = xenbus_scanf(XBT_NIL, dev->nodename, "feature-persistent-grants",
+			   "%u", &budget);
+	if (err != 1)
+		budget = 0;
+
+	fe->pgrants.max = budget + budget / 2;
+	dprintk_inf("keeping up to %u persistent grants\n", fe->pgrants.max);
+}
+
+/*
+ * Large segments describe their gref list with indirect pages, as long as
+ * the backend knows about them.
+ */
+static void omx_xenfront_negotiate_indirect(struct xenbus_device *dev,
+					    struct omx_xenfront_info *fe)
+{
+	unsigned int max;
+	int err;
+
+	err = xenbus_scanf(XBT_NIL, dev->nodename, "feature-indirect-grefs",
+			   "%u", &max);
+	if (err != 1)
+		max = 0;
+
+	fe->indirect_max = min_t(unsigned int, max, OMX_XEN_GRANT_PAGES_MAX);
+	dprintk_inf("using up to %u indirect gref pages per segment\n",
+		    fe->indirect_max);
+}
+
+/*
+ * Peers living in other guests of the same host may be reached through
+ * dom0 rather than the network, if the backend supports it.
+ */
+static void omx_xenfront_negotiate_shared_host(struct xenbus_device *dev,
+					       struct omx_xenfront_info *fe)
+{
+	unsigned int shared_host;
+	int err;
+
+	err = xenbus_scanf(XBT_NIL, dev->nodename, "feature-shared-host",
+			   "%u", &shared_host);
+	if (err != 1)
+		shared_host = 0;
+
+	fe->shared_host = !!shared_host;
+	dprintk_inf("same-host shared communication %s\n",
+		    fe->shared_host ? "enabled" : "disabled");
+}
+
 static int talk_to_backend(struct xenbus_device *dev,
 			   struct omx_xenfront_info *fe)
 {
 	const char *message = NULL;
 	struct xenbus_transaction xbt;
+	char node[OMX_XEN_QUEUE_NODE_MAX];
+	unsigned int nr_queues, i;
 	int err;
 
 	dprintk_in();
 
 	dprintk_inf("nodename is %s\n", dev->nodename);
+
+	/* queue 0 was set up at probe time */
+	nr_queues = omx_xenfront_negotiate_queues(dev);
+	for (i = 1; i < nr_queues; i++) {
+		err = omx_xenfront_alloc_queue(dev, &fe->queues[i]);
+		if (err) {
+			/* the failed queue may be partially set up too */
+			fe->nr_queues = i + 1;
+			goto destroy_ring;
+		}
+	}
+	fe->nr_queues = nr_queues;
+	dprintk_inf("using %u queue(s)\n", nr_queues);
+	omx_xenfront_negotiate_pgrants(dev, fe);
+	omx_xenfront_negotiate_indirect(dev, fe);
+	omx_xenfront_negotiate_shared_host(dev, fe);
+
 again:
 	err = xenbus_transaction_start(&xbt);
 	if (err) {
@@ -156,30 +350,48 @@ again:
 	dprintk_deb("xenbus handle written: %u\n", fe->handle);
 #endif
 
-	xenbus_scanf(XBT_NIL, dev->nodename, "port", "%d",
-		     &fe->evtchn.remote_port);
-	if (!(fe->evtchn.remote_port)) {
-		printk_err("error, port = 0\n");
-		goto abort_transaction;
+	/* only advertised to backends that offered several queues */
+	if (nr_queues > 1) {
+		err = xenbus_printf(xbt, dev->nodename,
+				    "multi-queue-num-queues", "%u", nr_queues);
+		if (err) {
+			message = "writing multi-queue-num-queues";
+			goto abort_transaction;
+		}
 	}
 
-	err = xenbus_printf(xbt, dev->nodename, "ring-ref", "%u", fe->ring_ref);
-	if (err) {
-		message = "writing ring-ref";
-		goto abort_transaction;
-	}
-	err =
-	    xenbus_printf(xbt, dev->nodename, "recv-ring-ref", "%u",
-			  fe->recv_ring_ref);
-	if (err) {
-		message = "writing recv-ring-ref";
-		goto abort_transaction;
-	}
-	err = xenbus_printf(xbt, dev->nodename,
-			    "event-channel", "%u", fe->evtchn.local_port);
-	if (err) {
-		message = "writing event-channel";
-		goto abort_transaction;
+	for (i = 0; i < nr_queues; i++) {
+		struct omx_xenfront_queue *queue = &fe->queues[i];
+
+		omx_xen_queue_node(node, i, "port");
+		xenbus_scanf(XBT_NIL, dev->nodename, node, "%d",
+			     &queue->evtchn.remote_port);
+		if (!(queue->evtchn.remote_port)) {
+			printk_err("error, port of queue %u = 0\n", i);
+			goto abort_transaction;
+		}
+
+		omx_xen_queue_node(node, i, "ring-ref");
+		err = xenbus_printf(xbt, dev->nodename, node, "%u",
+				    queue->ring_ref);
+		if (err) {
+			message = "writing ring-ref";
+			goto abort_transaction;
+		}
+		omx_xen_queue_node(node, i, "recv-ring-ref");
+		err = xenbus_printf(xbt, dev->nodename, node, "%u",
+				    queue->recv_ring_ref);
+		if (err) {
+			message = "writing recv-ring-ref";
+			goto abort_transaction;
+		}
+		omx_xen_queue_node(node, i, "event-channel");
+		err = xenbus_printf(xbt, dev->nodename, node, "%u",
+				    queue->evtchn.local_port);
+		if (err) {
+			message = "writing event-channel";
+			goto abort_transaction;
+		}
 	}
 #if 0
 	err = xenbus_printf(xbt, dev->nodename, "protocol", "%s",
@@ -199,7 +411,11 @@ again:
 		goto destroy_ring;
 	}
 
-	err = setup_ring(dev, fe);
+	for (i = 0; i < nr_queues; i++) {
+		err = setup_ring(dev, &fe->queues[i]);
+		if (err)
+			break;
+	}
 	xenbus_switch_state(dev, XenbusStateInitialised);
 	if (err) {
 		printk_err("error setup ring\n");
@@ -216,6 +432,8 @@ abort_transaction:
 		printk_err("%s\n", message);
 	}
 destroy_ring:
+	for (i = 0; i < fe->nr_queues; i++)
+		omx_xenfront_free_queue(&fe->queues[i]);
 	omx_xenif_free(fe, 0);
 out:
 	dprintk_out();
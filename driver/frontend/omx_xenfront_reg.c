@@ -26,6 +26,7 @@
 #include <linux/pci.h>
 #ifdef OMX_HAVE_MUTEX
 #include <linux/mutex.h>
+#include <linux/hash.h>
 #endif
 
 #include <stdarg.h>
@@ -629,7 +630,243 @@ out:
 }
 
 #endif
+
+/* Persistent grant cache */
+
+#define OMX_XENFRONT_PGRANT_RECLAIM_SCAN 32
+
+void omx_xenfront_pgrant_cache_init(struct omx_xenfront_pgrant_cache *cache)
+{
+	int i;
+
+	spin_lock_init(&cache->lock);
+	for (i = 0; i < (1 << OMX_XENFRONT_PGRANT_HASH_BITS); i++)
+		INIT_HLIST_HEAD(&cache->hash[i]);
+	INIT_LIST_HEAD(&cache->lru);
+	cache->nr = 0;
+	cache->max = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->overflows = 0;
+}
+
+static inline struct hlist_head *
+omx_xenfront_pgrant_bucket(struct omx_xenfront_pgrant_cache *cache,
+			   unsigned long pfn)
+{
+	return &cache->hash[hash_long(pfn, OMX_XENFRONT_PGRANT_HASH_BITS)];
+}
+
+static struct omx_xenfront_pgrant *
+omx_xenfront_pgrant_lookup(struct omx_xenfront_pgrant_cache *cache,
+			   unsigned long pfn)
+{
+	struct hlist_node *pos;
+
+	hlist_for_each(pos, omx_xenfront_pgrant_bucket(cache, pfn)) {
+		struct omx_xenfront_pgrant *pgrant =
+		    hlist_entry(pos, struct omx_xenfront_pgrant, node);
+		if (pgrant->pfn == pfn)
+			return pgrant;
+	}
+	return NULL;
+}
+
+/*
+ * Find an unused grant the backend no longer maps and end it, so that
+ * its gref can be given to another page. Called with the cache lock held.
+ */
+static struct omx_xenfront_pgrant *
+omx_xenfront_pgrant_reclaim(struct omx_xenfront_pgrant_cache *cache)
+{
+	struct omx_xenfront_pgrant *pgrant;
+	int scanned = 0;
+
+	list_for_each_entry(pgrant, &cache->lru, lru) {
+		if (scanned++ == OMX_XENFRONT_PGRANT_RECLAIM_SCAN)
+			break;
+		if (gnttab_query_foreign_access(pgrant->gref))
+			continue;
+		if (!gnttab_end_foreign_access_ref(pgrant->gref, 0))
+			continue;
+
+		list_del_init(&pgrant->lru);
+		hlist_del(&pgrant->node);
+		put_page(pgrant->page);
+		return pgrant;
+	}
+	return NULL;
+}
+
+static void omx_xenfront_pgrant_put(struct omx_xenfront_pgrant_cache *cache,
+				    unsigned long pfn)
+{
+	struct omx_xenfront_pgrant *pgrant;
+
+	pgrant = omx_xenfront_pgrant_lookup(cache, pfn);
+	if (unlikely(!pgrant)) {
+		printk_err("No persistent grant for pfn %#lx\n", pfn);
+		return;
+	}
+	if (!--pgrant->refcount)
+		list_add_tail(&pgrant->lru, &cache->lru);
+}
+
+static void omx_xenfront_pgrant_put_segment(struct omx_xenfront_info *fe,
+					    struct omx_user_region_segment *seg)
+{
+	struct omx_xenfront_pgrant_cache *cache = &fe->pgrants;
+	unsigned long flags;
+	int j;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	for (j = 0; j < seg->nr_pages; j++)
+		omx_xenfront_pgrant_put(cache, page_to_pfn(seg->pages[j]));
+	spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+/*
+ * Fill the segment gref list from the persistent grant cache, granting
+ * the pages we don't know yet. Fails with -ENOSPC when the cache is full,
+ * the caller then falls back to regular one-shot grants.
+ */
+static int omx_xenfront_pgrant_get_segment(struct omx_xenfront_info *fe,
+					   struct omx_user_region_segment *seg)
+{
+	struct omx_xenfront_pgrant_cache *cache = &fe->pgrants;
+	unsigned long flags;
+	int ret = 0;
+	int j;
+
+	if (!cache->max)
+		return -ENOSYS;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	for (j = 0; j < seg->nr_pages; j++) {
+		struct page *page = seg->pages[j];
+		unsigned long pfn = page_to_pfn(page);
+		struct omx_xenfront_pgrant *pgrant;
+
+		pgrant = omx_xenfront_pgrant_lookup(cache, pfn);
+		if (pgrant) {
+			if (!pgrant->refcount++)
+				list_del_init(&pgrant->lru);
+			seg->gref_list[j] = pgrant->gref;
+			cache->hits++;
+			continue;
+		}
+
+		cache->misses++;
+		if (cache->nr < cache->max) {
+			int gref;
+
+			pgrant = kmalloc(sizeof(*pgrant), GFP_ATOMIC);
+			if (!pgrant) {
+				ret = -ENOMEM;
+				goto out_with_partial;
+			}
+			gref = gnttab_grant_foreign_access(0, pfn_to_mfn(pfn), 0);
+			if (gref < 0) {
+				kfree(pgrant);
+				ret = gref;
+				goto out_with_partial;
+			}
+			pgrant->gref = gref;
+			INIT_LIST_HEAD(&pgrant->lru);
+			cache->nr++;
+		} else {
+			pgrant = omx_xenfront_pgrant_reclaim(cache);
+			if (!pgrant) {
+				cache->overflows++;
+				ret = -ENOSPC;
+				goto out_with_partial;
+			}
+			gnttab_grant_foreign_access_ref(pgrant->gref, 0,
+							pfn_to_mfn(pfn), 0);
+		}
+
+		get_page(page);
+		pgrant->page = page;
+		pgrant->pfn = pfn;
+		pgrant->refcount = 1;
+		hlist_add_head(&pgrant->node,
+			       omx_xenfront_pgrant_bucket(cache, pfn));
+		seg->gref_list[j] = pgrant->gref;
+	}
+	spin_unlock_irqrestore(&cache->lock, flags);
+	return 0;
+
+out_with_partial:
+	while (j--)
+		omx_xenfront_pgrant_put(cache, page_to_pfn(seg->pages[j]));
+	spin_unlock_irqrestore(&cache->lock, flags);
+	return ret;
+}
+
+/* The backend is gone, end all grants for good */
+void omx_xenfront_pgrant_cache_destroy(struct omx_xenfront_pgrant_cache *cache)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	for (i = 0; i < (1 << OMX_XENFRONT_PGRANT_HASH_BITS); i++) {
+		while (!hlist_empty(&cache->hash[i])) {
+			struct omx_xenfront_pgrant *pgrant =
+			    hlist_entry(cache->hash[i].first,
+					struct omx_xenfront_pgrant, node);
+
+			hlist_del(&pgrant->node);
+			list_del(&pgrant->lru);
+			if (gnttab_end_foreign_access_ref(pgrant->gref, 0)) {
+				gnttab_free_grant_reference(pgrant->gref);
+				put_page(pgrant->page);
+			} else {
+				/* still mapped, leak the page rather than reuse it */
+				printk_err("Cannot end persistent grant %u\n",
+					   pgrant->gref);
+			}
+			kfree(pgrant);
+		}
+	}
+	cache->nr = 0;
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	printk_inf("Persistent grants: %lu hits, %lu misses, %lu overflows\n",
+		   cache->hits, cache->misses, cache->overflows);
+}
+
 /* This is where Xen2MX specific functions begin */
+/* Grant of a gref_list page, listed in an indirect page if there are some */
+static inline grant_ref_t
+omx_xenfront_list_gref(struct omx_user_region_segment *seg, int part)
+{
+	return seg->indirect ? seg->indirect[part] : seg->all_gref[part];
+}
+
+/* Revoke and free the indirect pages, once the gref_list is released */
+static void omx_xenfront_release_indirect(struct omx_user_region_segment *seg)
+{
+	int k;
+
+	if (!seg->indirect)
+		return;
+
+	for (k = 0; k < seg->nr_indirect; k++) {
+		if (!gnttab_end_foreign_access_ref(seg->all_gref[k], 0))
+			printk_inf
+			    ("Can't end foreign access for indirect gref[%d] = %u\n",
+			     k, seg->all_gref[k]);
+		gnttab_release_grant_reference(&seg->gref_head,
+					       seg->all_gref[k]);
+	}
+
+	free_pages((unsigned long)seg->indirect,
+		   get_order(seg->nr_indirect * PAGE_SIZE));
+	seg->indirect = NULL;
+	seg->nr_indirect = 0;
+}
+
 int
 omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 				 void __user * uparam)
@@ -694,7 +931,11 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 	endpoint->special_status = OMX_USER_REGION_STATUS_REGISTERING;
 	spin_unlock(&region->status_lock);
 
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(endpoint->xen_queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_XEN_CREATE_USER_REGION;
 	/* Ultra safe */
 	//memset(&ring_req->data.cur, 0, sizeof(ring_req->data.cur));
@@ -706,7 +947,7 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 	for (i = 0, seg = &region->segments[0]; i < cmd.nr_segments; i++) {
 		int j;
 		int k;
-		uint8_t nr_parts;
+		unsigned long nr_parts, nr_indirect;
 		uint32_t gref_size;
 		grant_ref_t gref;
 		unsigned long mfn;
@@ -714,14 +955,28 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 		uint16_t gref_offset;
 		struct page *gref_page;
 
-		if (!seg) {printk_err ("seg is NULL\n"); ret = -EINVAL; goto out;}
+		if (!seg) {printk_err ("seg is NULL\n"); ret = -EINVAL; goto out_with_request;}
 
 		gref_size = (seg->nr_pages);
 		nr_parts =
 		    (seg->nr_pages * sizeof(uint32_t) + PAGE_SIZE -
 		     1) / PAGE_SIZE + 1;
 
+		/* Large gref lists are described by indirect pages */
+		nr_indirect = 0;
+		if (nr_parts > 1 && fe->indirect_max)
+			nr_indirect =
+			    DIV_ROUND_UP(nr_parts, OMX_XEN_GREFS_PER_PAGE);
+		if (unlikely(nr_indirect ? nr_indirect > fe->indirect_max :
+			     nr_parts > OMX_XEN_GRANT_PAGES_MAX)) {
+			printk_err("Segment %d is too large (%lu pages)\n", i,
+				   seg->nr_pages);
+			ret = -EINVAL;
+			goto out_with_request;
+		}
+
 		seg->nr_parts = nr_parts;
+		seg->nr_indirect = nr_indirect;
 #ifdef EXTRA_DEBUG_OMX
 		/* Let the user know */
 		if (nr_parts > 1) {
@@ -739,14 +994,36 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 
 		seg->gref_list = (uint32_t *) gref_vaddr;
 
+		seg->indirect = NULL;
+		if (nr_indirect) {
+			seg->indirect =
+			    (uint32_t *) __get_free_pages(GFP_KERNEL,
+							  get_order(nr_indirect *
+								    PAGE_SIZE));
+			if (!seg->indirect) {
+				free_pages((unsigned long)gref_vaddr,
+					   get_order(nr_parts * PAGE_SIZE));
+				ret = -ENOMEM;
+				goto out_with_request;
+			}
+		}
+
+		/* Page grants may come from the persistent grant cache */
+		seg->persistent = seg->length &&
+		    !omx_xenfront_pgrant_get_segment(fe, seg);
+		if (seg->persistent)
+			gref_size = 0;
 
 		/* Allocate a set of grant references */
 		if ((ret =
-		     omx_xen_gnttab_alloc_grant_references(fe, gref_size + nr_parts,
+		     omx_xen_gnttab_alloc_grant_references(fe,
+						   gref_size + nr_parts + nr_indirect,
 						   &seg->gref_head, &seg->gref_cookie))) {
-			printk_err("Cannot allocate %d grant references\n",
-				   gref_size + nr_parts);
-			goto out;
+			printk_err("Cannot allocate %lu grant references\n",
+				   gref_size + nr_parts + nr_indirect);
+			if (seg->persistent)
+				omx_xenfront_pgrant_put_segment(fe, seg);
+			goto out_with_request;
 		}
 		spin_lock_init(&seg->status_lock);
 
@@ -770,21 +1047,42 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 
 			gnttab_grant_foreign_access_ref(gref, 0, mfn, 0);
 
-			seg->all_gref[k] = gref;
-			dprintk_deb("gref[%d] = %#x\n", k, seg->all_gref[k]);
+			if (seg->indirect)
+				seg->indirect[k] = gref;
+			else
+				seg->all_gref[k] = gref;
+			dprintk_deb("gref[%d] = %#x\n", k, gref);
 			dprintk_deb
 			    ("gref= %d, gref_list is @%#lx, tmp_vaddr = %#lx, page=%p, mfn=%#lx\n",
 			     gref, (unsigned long)seg->gref_list, tmp_vaddr,
 			     (void *)gref_page, mfn);
 		}
 
+		/* Grant each indirect page, the backend maps the whole
+		 * gref_list through them at once */
+		for (k = 0; k < nr_indirect; k++) {
+			unsigned long tmp_vaddr =
+			    (unsigned long)seg->indirect + k * PAGE_SIZE;
+
+			gref_page = virt_to_page(tmp_vaddr);
+
+			gref =
+			    gnttab_claim_grant_reference(&seg->gref_head);
+			mfn = pfn_to_mfn(page_to_pfn(gref_page));
+
+			gnttab_grant_foreign_access_ref(gref, 0, mfn, 0);
+
+			seg->all_gref[k] = gref;
+			dprintk_deb("indirect gref[%d] = %#x\n", k, gref);
+		}
+
 		/* Skip empty segments */
 		if (!seg->length)
 			continue;
 
 		/* Grant each segment page. Remember, these pages are pinned by the standard
 		 * region_create call */
-		for (j = 0; j < seg->nr_pages; j++) {
+		for (j = 0; !seg->persistent && j < seg->nr_pages; j++) {
 			struct page *single_page;
 			unsigned long mfn, pfn;
 			single_page = seg->pages[j];
@@ -817,14 +1115,20 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 		ring_seg->nr_pages = seg->nr_pages;
 
 		/* FIXME: is memcpy better ? */
-		for (k = 0; k < seg->nr_parts; k++) {
+		nr_parts = seg->nr_indirect ? seg->nr_indirect : seg->nr_parts;
+		for (k = 0; k < nr_parts; k++) {
 			ring_seg->gref[k] = seg->all_gref[k];
 			dprintk_deb("ring_gref[%d] = %#x\n", k,
 				    ring_seg->gref[k]);
 			dprintk_deb("gref[%d] = %#x\n", k, seg->all_gref[k]);
 		}
 		ring_seg->gref_offset = gref_offset;
-		ring_seg->nr_parts = seg->nr_parts;
+		ring_seg->nr_parts = nr_parts;
+		ring_seg->nr_list_parts = seg->nr_parts;
+		ring_seg->flags =
+		    seg->persistent ? OMX_XEN_SEGMENT_PERSISTENT : 0;
+		if (seg->nr_indirect)
+			ring_seg->flags |= OMX_XEN_SEGMENT_INDIRECT;
 		ring_seg->nr_grefs = 1024;
 		ring_seg->length = seg->length;
 
@@ -832,7 +1136,8 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 	}
 
 	//dump_xen_ring_msg_create_user_region(&ring_req->data.cur);
-	omx_poke_dom0(fe, ring_req);
+	omx_xenfront_push_request(endpoint->xen_queue, ring_req);
+	omx_xenfront_put_request(endpoint->xen_queue);
 	rmb();
 	//ndelay(1000);
 	/* FIXME: find a better way to get notified that a backend response has come */
@@ -854,6 +1159,10 @@ omx_ioctl_xen_user_region_create(struct omx_endpoint *endpoint,
 
 
 	ret = 0;
+	goto out;
+
+out_with_request:
+	omx_xenfront_cancel_request(endpoint->xen_queue);
 out:
 	dprintk_out();
 	return ret;
@@ -905,8 +1214,12 @@ omx_xen_user_region_release(struct omx_endpoint *endpoint, uint32_t region_id)
 		redo = kzalloc(sizeof(uint8_t) * seg->nr_pages, GFP_KERNEL);
 #endif
 
+		/* Persistent grants go back to the cache */
+		if (seg->persistent)
+			omx_xenfront_pgrant_put_segment(endpoint->fe, seg);
+
 		/* Release each page reference separately */
-		for (j = 0; j < seg->nr_pages; j++) {
+		for (j = 0; !seg->persistent && j < seg->nr_pages; j++) {
 			struct page *single_page;
 			unsigned long mfn, pfn;
 
@@ -983,28 +1296,29 @@ omx_xen_user_region_release(struct omx_endpoint *endpoint, uint32_t region_id)
 
 		/* Release all gref_list pages */
 		for (k = 0; k < seg->nr_parts; k++) {
+			grant_ref_t gref = omx_xenfront_list_gref(seg, k);
+
 			dprintk_deb
 			    ("ending foreign access for part = %d, gref=%#x\n",
-			     k, seg->all_gref[k]);
-			ret = gnttab_query_foreign_access(seg->all_gref[k]);
+			     k, gref);
+			ret = gnttab_query_foreign_access(gref);
 			if (ret) {
 				printk_inf
 				    ("gref_list[%d] = %u, is still in use by the backend!\n",
-				     k, seg->all_gref[k]);
+				     k, gref);
 			}
-			ret =
-			    gnttab_end_foreign_access_ref(seg->all_gref[k], 0);
+			ret = gnttab_end_foreign_access_ref(gref, 0);
 			if (!ret) {
 				printk_inf
 				    ("Can't end foreign access for gref_list[%d] = %u, is still in use by the backend!\n",
-				     k, seg->all_gref[k]);
+				     k, gref);
 				/* FIXME: Do we really need to fail with -EBUSY ? */
 				ret = -EBUSY;
 				goto out;
 			}
-			gnttab_release_grant_reference(&seg->gref_head,
-						       seg->all_gref[k]);
+			gnttab_release_grant_reference(&seg->gref_head, gref);
 		}
+		omx_xenfront_release_indirect(seg);
 		omx_xen_gnttab_free_grant_references(endpoint->fe, &seg->gref_head, &seg->gref_cookie);
 
 		/* Since we use __get_free_pages, we call free_pages here */
@@ -1063,8 +1377,12 @@ __omx_xen_user_region_last_release(struct kref * kref)
 		redo = kzalloc(sizeof(uint8_t) * seg->nr_pages, GFP_KERNEL);
 #endif
 
+		/* Persistent grants go back to the cache */
+		if (seg->persistent)
+			omx_xenfront_pgrant_put_segment(endpoint->fe, seg);
+
 		/* Release each page reference separately */
-		for (j = 0; j < seg->nr_pages; j++) {
+		for (j = 0; !seg->persistent && j < seg->nr_pages; j++) {
 			struct page *single_page;
 			unsigned long mfn, pfn;
 
@@ -1133,25 +1451,26 @@ __omx_xen_user_region_last_release(struct kref * kref)
 
 		/* Release all gref_list pages */
 		for (k = 0; k < seg->nr_parts; k++) {
+			grant_ref_t gref = omx_xenfront_list_gref(seg, k);
+
 			dprintk_deb
 			    ("ending foreign access for part = %d, gref=%#x\n",
-			     k, seg->all_gref[k]);
-			ret = gnttab_query_foreign_access(seg->all_gref[k]);
+			     k, gref);
+			ret = gnttab_query_foreign_access(gref);
 			if (ret) {
 				printk_inf
 				    ("gref_list[%d] = %u, is still in use by the backend!\n",
-				     k, seg->all_gref[k]);
+				     k, gref);
 			}
-			ret =
-			    gnttab_end_foreign_access_ref(seg->all_gref[k], 0);
+			ret = gnttab_end_foreign_access_ref(gref, 0);
 			if (!ret) {
 				printk_inf
 				    ("Can't end foreign access for gref_list[%d] = %u, is still in use by the backend!\n",
-				     k, seg->all_gref[k]);
+				     k, gref);
 			}
-			gnttab_release_grant_reference(&seg->gref_head,
-						       seg->all_gref[k]);
+			gnttab_release_grant_reference(&seg->gref_head, gref);
 		}
+		omx_xenfront_release_indirect(seg);
 		omx_xen_gnttab_free_grant_references(endpoint->fe, &seg->gref_head, &seg->gref_cookie);
 
 		/* Since we use __get_free_pages, we call free_pages here */
@@ -1227,7 +1546,11 @@ omx_ioctl_xen_user_region_destroy(struct omx_endpoint *endpoint,
 	spin_unlock(&region->status_lock);
 
 	/* FIXME: maybe create a static inline function for this stuff ? */
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(endpoint->xen_queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_XEN_DESTROY_USER_REGION;
 	/* Ultra safe */
 	//memset(&ring_req->data.dur, 0, sizeof(ring_req->data.dur));
@@ -1251,7 +1574,8 @@ omx_ioctl_xen_user_region_destroy(struct omx_endpoint *endpoint,
 	dprintk_deb("send request to de-register region id=%d\n", cmd.id);
 	//dump_xen_ring_msg_destroy_user_region(&ring_req->data.dur);
 
-	omx_poke_dom0(fe, ring_req);
+	omx_xenfront_push_request(endpoint->xen_queue, ring_req);
+	omx_xenfront_put_request(endpoint->xen_queue);
 
 	call_rcu(&region->xen_rcu_head, __omx_xen_user_region_rcu_release_callback);
 
@@ -39,8 +39,8 @@
 #include "omx_common.h"
 #include "omx_reg.h"
 #include "omx_endpoint.h"
+#include "omx_shared.h"
 
-//#define OMX_XEN_NOWAIT
 //#define EXTRA_DEBUG_OMX
 #include "omx_xen_debug.h"
 #include "omx_xen.h"
@@ -56,6 +56,75 @@ timers_t t_send_tiny, t_send_small, t_send_mediumva, t_send_mediumsq_frag,
     t_send_connect_request, t_send_notify, t_send_connect_reply, t_send_rndv,
     t_send_liback;
 
+/*
+ * Push a send request to the backend and release the ring.
+ *
+ * In nowait mode, asynchronous requests are completed by omx_xenif_interrupt().
+ * Only requests that the library retransmits anyway may be asynchronous:
+ * a backend failure is then just like a lost packet, except for mediumsq
+ * frags whose sendq slot is released by a done event from the backend.
+ * Otherwise we wait for the backend to ACK the request.
+ */
+static int
+omx_xenfront_submit_send(struct omx_endpoint *endpoint,
+			 struct omx_xenif_request *ring_req, int async)
+{
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
+	uint32_t func = ring_req->func;
+	int ret = 0;
+
+	if (async && omx_xen_nowait) {
+		ring_req->flags |= OMX_XEN_REQUEST_FLAG_ASYNC;
+		atomic_inc(&endpoint->xen_inflight);
+		omx_xenfront_push_request(queue, ring_req);
+		omx_xenfront_put_request(queue);
+		return 0;
+	}
+
+	/* the ring is still held, nobody else may use the status word */
+	spin_lock(&queue->status_lock);
+	queue->status = OMX_XEN_FRONTEND_STATUS_DOING;
+	spin_unlock(&queue->status_lock);
+
+	omx_xenfront_push_request(queue, ring_req);
+	/* the slot now belongs to the backend, don't touch ring_req anymore */
+	if (wait_for_backend_response
+	    (&queue->status, OMX_XEN_FRONTEND_STATUS_DOING,
+	     &queue->status_lock)) {
+		printk_err("Failed to wait\n");
+		ret = -EINVAL;
+	} else if (queue->status != OMX_XEN_FRONTEND_STATUS_DONE) {
+		printk_err("Backend failed to ACK request %#x\n", func);
+		ret = -EFAULT;
+	}
+
+	omx_xenfront_put_request(queue);
+	return ret;
+}
+
+/*
+ * Intra-guest communication: returns 1 if the destination endpoint
+ * belongs to this guest, the shared paths then deliver the message
+ * without going through the backend.
+ */
+static inline int
+omx_xenfront_shared_local(struct omx_endpoint *endpoint,
+			  uint16_t peer_index, uint8_t dest_endpoint)
+{
+	struct omx_endpoint *dst_endpoint;
+
+	dst_endpoint = omx_xenfront_acquire_local_endpoint(endpoint->fe,
+							   peer_index,
+							   dest_endpoint);
+	if (!dst_endpoint)
+		return 0;
+
+	/* an invalid local endpoint is nacked by the shared paths */
+	if (!IS_ERR(dst_endpoint))
+		omx_endpoint_release(dst_endpoint);
+	return 1;
+}
+
 /* In this set of functions, we copy user data directly to the ring structure.
  * FIXME: There's a lot of testing to be done, to make sure that there are no
  * corruption or concurrency issues
@@ -63,7 +132,7 @@ timers_t t_send_tiny, t_send_small, t_send_mediumva, t_send_mediumsq_frag,
 int omx_ioctl_xen_send_tiny(struct omx_endpoint *endpoint, void __user * uparam)
 {
 	struct omx_cmd_xen_send_tiny *cmd;
-	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
 	struct omx_xenif_request *ring_req;
 	uint32_t length = 0;
 	int ret = 0;
@@ -71,10 +140,11 @@ int omx_ioctl_xen_send_tiny(struct omx_endpoint *endpoint, void __user * uparam)
 	dprintk_in();
 
 	TIMER_START(&t_send_tiny);
-	spin_lock(&fe->status_lock);
-	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
-	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_SEND_TINY;
 	cmd = &ring_req->data.send_tiny;
 	ring_req->board_index = endpoint->board_index;
@@ -87,7 +157,7 @@ int omx_ioctl_xen_send_tiny(struct omx_endpoint *endpoint, void __user * uparam)
 	if (unlikely(ret != 0)) {
 		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd hdr\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
 	length = cmd->tiny.hdr.length;
@@ -96,7 +166,7 @@ int omx_ioctl_xen_send_tiny(struct omx_endpoint *endpoint, void __user * uparam)
 		       "Open-MX: Cannot send more than %d as a tiny (tried %d)\n",
 		       OMX_TINY_MSG_LENGTH_MAX, length);
 		ret = -EINVAL;
-		goto out;
+		goto out_with_request;
 	}
 
 	ret =
@@ -106,31 +176,32 @@ int omx_ioctl_xen_send_tiny(struct omx_endpoint *endpoint, void __user * uparam)
 	if (unlikely(ret != 0)) {
 		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd data\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
 	if (cmd->tiny.hdr.shared) {
-		/* FIXME: handle the intra-node/VM case */
-		cmd->tiny.hdr.shared = 0;
+		if (omx_xenfront_shared_local(endpoint, cmd->tiny.hdr.peer_index,
+					      cmd->tiny.hdr.dest_endpoint)) {
+			struct omx_cmd_send_tiny_hdr hdr = cmd->tiny.hdr;
+
+			omx_xenfront_cancel_request(queue);
+			ret = omx_shared_send_tiny(endpoint, &hdr,
+						   &((struct omx_cmd_send_tiny __user *)
+						     uparam)->data);
+			goto out;
+		}
+		/* another domain, the backend may still find it on this host */
+		cmd->tiny.hdr.shared = endpoint->fe->shared_host;
 	}
 	//dump_xen_send_tiny(cmd);
 	TIMER_START(&endpoint->oneway);
-	omx_poke_dom0(endpoint->fe, ring_req);
-#ifndef OMX_XEN_NOWAIT
-	if (wait_for_backend_response
-	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
+	ret = omx_xenfront_submit_send(endpoint, ring_req, 1);
+	TIMER_STOP(&t_send_tiny);
+	dprintk_out();
+	return ret;
 
-	if (fe->status == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EINVAL;
-		printk_err("Backend failed to ACK send tiny \n");
-	}
-#endif
+out_with_request:
+	omx_xenfront_cancel_request(queue);
 out:
 	TIMER_STOP(&t_send_tiny);
 	dprintk_out();
@@ -141,7 +212,7 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 				void __user * uparam)
 {
 	struct omx_cmd_xen_send_mediumva *cmd;
-	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
 	struct omx_xenif_request *ring_req;
 	struct omx_cmd_user_segment *usegs, *cur_useg;
 	uint32_t msg_length, remaining, cur_useg_remaining;
@@ -160,10 +231,11 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 	dprintk_in();
 
 	TIMER_START(&t_send_mediumva);
-	spin_lock(&fe->status_lock);
-	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
-	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_SEND_MEDIUMVA;
 	cmd = &ring_req->data.send_mediumva;
 	ring_req->board_index = endpoint->board_index;
@@ -177,7 +249,7 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 		printk(KERN_ERR
 		       "Open-MX: Failed to read send mediumva cmd hdr\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
 	msg_length = cmd->mediumva.length;
@@ -188,7 +260,7 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 		       (unsigned long)OMX__MX_MEDIUM_MSG_LENGTH_MAX,
 		       (unsigned long)msg_length);
 		ret = -EINVAL;
-		goto out;
+		goto out_with_request;
 	}
 #endif
 	frags_nr =
@@ -201,11 +273,19 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 	if (nseg > 1) {
 		printk_err("Does not support > 1 segments yet, sorry:S\n");
 		ret = -EINVAL;
-		goto out;
+		goto out_with_request;
 	}
 
 	if (cmd->mediumva.shared) {
-		/* FIXME: handle the intra-node/VM case */
+		if (omx_xenfront_shared_local(endpoint, cmd->mediumva.peer_index,
+					      cmd->mediumva.dest_endpoint)) {
+			struct omx_cmd_send_mediumva hdr = cmd->mediumva;
+
+			omx_xenfront_cancel_request(queue);
+			ret = omx_shared_send_mediumva(endpoint, &hdr);
+			goto out;
+		}
+		/* the peer lives in another domain, go through the backend */
 		cmd->mediumva.shared = 0;
 	}
 
@@ -215,7 +295,7 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 		printk(KERN_ERR
 		       "Open-MX: Cannot allocate segments for mediumva\n");
 		ret = -ENOMEM;
-		goto out;
+		goto out_with_request;
 	}
 	ret =
 	    copy_from_user(usegs,
@@ -225,7 +305,7 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 		printk(KERN_ERR
 		       "Open-MX: Failed to read mediumva segments cmd\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
 	/* compute the segments length */
@@ -236,7 +316,7 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 		       "Open-MX: Cannot send mediumva without enough data in segments (%ld instead of %ld)\n",
 		       (unsigned long)remaining, (unsigned long)msg_length);
 		ret = -EINVAL;
-		goto out;
+		goto out_with_request;
 	}
 
 	/* initialize position in segments */
@@ -253,7 +333,7 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 	if (!pages) {
 		printk_err("Failed to kmalloc pages\n");
 		ret = -ENOMEM;
-		goto out;
+		goto out_with_request;
 	}
 
 	ret = get_user_pages_fast(aligned_vaddr, nr_pages, 1, pages);
@@ -262,20 +342,20 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 		    ("get_user_pages_fast FAILED!, ret = %d, nr_pages =%d\n",
 		     ret, nr_pages);
 		ret = -ENOMEM;
-		goto out;
+		goto out_with_request;
 	}
 
 	ret = gnttab_alloc_grant_references(nr_pages, &gref_head);
 	if (ret < 0) {
 		printk_err("Cannot allocate grant references\n");
-		goto out;
+		goto out_with_request;
 	}
 
 	grefs = kmalloc(sizeof(grant_ref_t) * nr_pages, GFP_KERNEL);
 	if (!pages) {
 		printk_err("Failed to kmalloc grefs\n");
 		ret = -ENOMEM;
-		goto out;
+		goto out_with_request;
 	}
 	for (i = 0; i < nr_pages; i++) {
 		struct page *single_page;
@@ -288,7 +368,7 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 		if (!gref) {
 			printk_err("cannot claim grant reference\n");
 			ret = -EINVAL;
-			goto out;
+			goto out_with_request;
 		}
 		gnttab_grant_foreign_access_ref(gref, 0, mfn, 0);
 		grefs[i] = gref;
@@ -331,23 +411,10 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 		printk(KERN_ERR
 		       "Open-MX: Failed to read send small cmd data\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 #endif
-	omx_poke_dom0(endpoint->fe, ring_req);
-	if (wait_for_backend_response
-	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
-
-	if (fe->status == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EFAULT;
-		printk_err("Backend failed to ACK send mediumva\n");
-	}
+	ret = omx_xenfront_submit_send(endpoint, ring_req, 0);
 
 	for (i = 0; i < nr_pages; i++) {
 		struct page *single_page;
@@ -383,6 +450,12 @@ int omx_ioctl_xen_send_mediumva(struct omx_endpoint *endpoint,
 	kfree(pages);
 	kfree(usegs);
 
+	TIMER_STOP(&t_send_mediumva);
+	dprintk_out();
+	return ret;
+
+out_with_request:
+	omx_xenfront_cancel_request(queue);
 out:
 	TIMER_STOP(&t_send_mediumva);
 	dprintk_out();
@@ -393,7 +466,7 @@ int omx_ioctl_xen_send_mediumsq_frag(struct omx_endpoint *endpoint,
 			     void __user * uparam)
 {
 	struct omx_cmd_xen_send_mediumsq_frag *cmd;
-	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
 	struct omx_xenif_request *ring_req;
 	int ret = 0;
         uint32_t sendq_offset;
@@ -403,10 +476,11 @@ int omx_ioctl_xen_send_mediumsq_frag(struct omx_endpoint *endpoint,
 	dprintk_in();
 
 	TIMER_START(&t_send_mediumsq_frag);
-	spin_lock(&fe->status_lock);
-	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
-	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_SEND_MEDIUMSQ_FRAG;
 	cmd = &ring_req->data.send_mediumsq_frag;
 	ring_req->board_index = endpoint->board_index;
@@ -418,7 +492,7 @@ int omx_ioctl_xen_send_mediumsq_frag(struct omx_endpoint *endpoint,
 	if (unlikely(ret != 0)) {
 		printk(KERN_ERR "Open-MX: Failed to read send mediumsq_frag cmd hdr\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
         frag_length = cmd->mediumsq_frag.frag_length;
@@ -426,7 +500,7 @@ int omx_ioctl_xen_send_mediumsq_frag(struct omx_endpoint *endpoint,
                 printk(KERN_ERR "Open-MX: Cannot send more than %ld as a mediumsq frag (tried %ld)\n",
                        OMX_SENDQ_ENTRY_SIZE, (unsigned long) frag_length);
                 ret = -EINVAL;
-                goto out;
+                goto out_with_request;
         }
 
         sendq_offset = cmd->mediumsq_frag.sendq_offset;
@@ -434,31 +508,30 @@ int omx_ioctl_xen_send_mediumsq_frag(struct omx_endpoint *endpoint,
                 printk(KERN_ERR "Open-MX: Cannot send mediumsq fragment from sendq offset %ld (max %ld)\n",
                        (unsigned long) sendq_offset, (unsigned long) OMX_SENDQ_SIZE);
                 ret = -EINVAL;
-                goto out;
+                goto out_with_request;
         }
 
 	if (cmd->mediumsq_frag.shared) {
-		/* FIXME: handle the intra-node/VM case */
-		cmd->mediumsq_frag.shared = 0;
+		if (omx_xenfront_shared_local(endpoint, cmd->mediumsq_frag.peer_index,
+					      cmd->mediumsq_frag.dest_endpoint)) {
+			struct omx_cmd_send_mediumsq_frag hdr = cmd->mediumsq_frag;
+
+			omx_xenfront_cancel_request(queue);
+			ret = omx_shared_send_mediumsq_frag(endpoint, &hdr);
+			goto out;
+		}
+		/* another domain, the backend may still find it on this host */
+		cmd->mediumsq_frag.shared = endpoint->fe->shared_host;
 	}
 
 
-	omx_poke_dom0(endpoint->fe, ring_req);
-#ifndef OMX_XEN_NOWAIT
-	if (wait_for_backend_response
-	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
+	ret = omx_xenfront_submit_send(endpoint, ring_req, 1);
+	TIMER_STOP(&t_send_mediumsq_frag);
+	dprintk_out();
+	return ret;
 
-	if (fe->status == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EFAULT;
-		printk_err("Backend failed to ACK send mediumsq frag\n");
-	}
-#endif
+out_with_request:
+	omx_xenfront_cancel_request(queue);
 out:
 	TIMER_STOP(&t_send_mediumsq_frag);
 	dprintk_out();
@@ -468,7 +541,7 @@ int omx_ioctl_xen_send_small(struct omx_endpoint *endpoint,
 			     void __user * uparam)
 {
 	struct omx_cmd_xen_send_small *cmd;
-	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
 	struct omx_xenif_request *ring_req;
 	uint32_t length = 0;
 	int ret = 0;
@@ -477,10 +550,11 @@ int omx_ioctl_xen_send_small(struct omx_endpoint *endpoint,
 	dprintk_in();
 
 	TIMER_START(&t_send_small);
-	spin_lock(&fe->status_lock);
-	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
-	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_SEND_SMALL;
 	cmd = &ring_req->data.send_small;
 	ring_req->board_index = endpoint->board_index;
@@ -493,7 +567,7 @@ int omx_ioctl_xen_send_small(struct omx_endpoint *endpoint,
 	if (unlikely(ret != 0)) {
 		printk(KERN_ERR "Open-MX: Failed to read send small cmd hdr\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
 	length = cmd->small.length;
@@ -502,12 +576,20 @@ int omx_ioctl_xen_send_small(struct omx_endpoint *endpoint,
 		       "Open-MX: Cannot send more than %d as a small (tried %d)\n",
 		       OMX_SMALL_MSG_LENGTH_MAX, length);
 		ret = -EINVAL;
-		goto out;
+		goto out_with_request;
 	}
 
 	if (cmd->small.shared) {
-		/* FIXME: handle the intra-node/VM case */
-		cmd->small.shared = 0;
+		if (omx_xenfront_shared_local(endpoint, cmd->small.peer_index,
+					      cmd->small.dest_endpoint)) {
+			struct omx_cmd_send_small hdr = cmd->small;
+
+			omx_xenfront_cancel_request(queue);
+			ret = omx_shared_send_small(endpoint, &hdr);
+			goto out;
+		}
+		/* another domain, the backend may still find it on this host */
+		cmd->small.shared = endpoint->fe->shared_host;
 	}
 	//dump_xen_send_small(cmd);
 	/* copy the data right after the header */
@@ -518,25 +600,16 @@ int omx_ioctl_xen_send_small(struct omx_endpoint *endpoint,
 		printk(KERN_ERR
 		       "Open-MX: Failed to read send small cmd data\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
-	omx_poke_dom0(endpoint->fe, ring_req);
-#ifndef OMX_XEN_NOWAIT
-	if (wait_for_backend_response
-	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
+	ret = omx_xenfront_submit_send(endpoint, ring_req, 1);
+	TIMER_STOP(&t_send_small);
+	dprintk_out();
+	return ret;
 
-	if (fe->status == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EFAULT;
-		printk_err("Backend failed to ACK send small\n");
-	}
-#endif
+out_with_request:
+	omx_xenfront_cancel_request(queue);
 out:
 	TIMER_STOP(&t_send_small);
 	dprintk_out();
@@ -547,16 +620,17 @@ int omx_ioctl_xen_send_notify(struct omx_endpoint *endpoint,
 			      void __user * uparam)
 {
 	struct omx_cmd_xen_send_notify *cmd;
-	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
 	struct omx_xenif_request *ring_req;
 	int ret = 0;
 
 	dprintk_in();
 	TIMER_START(&t_send_notify);
-	spin_lock(&fe->status_lock);
-	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
-	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_SEND_NOTIFY;
 	cmd = &ring_req->data.send_notify;
 	ring_req->board_index = endpoint->board_index;
@@ -569,27 +643,30 @@ int omx_ioctl_xen_send_notify(struct omx_endpoint *endpoint,
 		printk(KERN_ERR
 		       "Open-MX: Failed to read send connect request cmd hdr\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
 	if (cmd->notify.shared) {
-		cmd->notify.shared = 0;
-		/* FIXME: handle the intra-node/VM case */
+		if (omx_xenfront_shared_local(endpoint, cmd->notify.peer_index,
+					      cmd->notify.dest_endpoint)) {
+			struct omx_cmd_send_notify hdr = cmd->notify;
+
+			omx_xenfront_cancel_request(queue);
+			ret = omx_shared_send_notify(endpoint, &hdr);
+			goto out;
+		}
+		/* another domain, the backend may still find it on this host */
+		cmd->notify.shared = endpoint->fe->shared_host;
 	}
 
 	dump_xen_send_notify(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-	if (wait_for_backend_response
-	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
+	ret = omx_xenfront_submit_send(endpoint, ring_req, 1);
+	TIMER_STOP(&t_send_notify);
+	dprintk_out();
+	return ret;
 
-	if (fe->status == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else
-		ret = -EFAULT;
+out_with_request:
+	omx_xenfront_cancel_request(queue);
 out:
 	TIMER_STOP(&t_send_notify);
 	dprintk_out();
@@ -600,7 +677,7 @@ int omx_ioctl_xen_send_connect_request(struct omx_endpoint *endpoint,
 				       void __user * uparam)
 {
 	struct omx_cmd_xen_send_connect_request *cmd;
-	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
 	struct omx_xenif_request *ring_req;
 	int ret = 0;
 
@@ -608,10 +685,11 @@ int omx_ioctl_xen_send_connect_request(struct omx_endpoint *endpoint,
 
 	TIMER_START(&t_send_connect_request);
 	/* fill omx header */
-	spin_lock(&fe->status_lock);
-	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
-	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_SEND_CONNECT_REQUEST;
 	cmd = &ring_req->data.send_connect_request;
 
@@ -624,30 +702,33 @@ int omx_ioctl_xen_send_connect_request(struct omx_endpoint *endpoint,
 		printk(KERN_ERR
 		       "Open-MX: Failed to read send connect request cmd hdr\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
 	if (!cmd->request.shared_disabled) {
-		/* FIXME: handle the intra-node/VM case */
-		cmd->request.shared_disabled = 1;
+		if (omx_xenfront_shared_local(endpoint, cmd->request.peer_index,
+					      cmd->request.dest_endpoint)) {
+			struct omx_cmd_send_connect_request hdr = cmd->request;
+
+			omx_xenfront_cancel_request(queue);
+			ret = omx_shared_try_send_connect_request(endpoint, &hdr);
+			if (ret > 0)
+				/* the endpoint went away meanwhile, the lib will resend */
+				ret = 0;
+			goto out;
+		}
+		/* another domain, the backend may still find it on this host */
+		cmd->request.shared_disabled = !endpoint->fe->shared_host;
 	}
 
 	dump_xen_send_connect_request(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-	if (wait_for_backend_response
-	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
-
-	if (fe->status == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EFAULT;
-		printk_err("Backend failed to ACK send connect\n");
-	}
+	ret = omx_xenfront_submit_send(endpoint, ring_req, 0);
+	TIMER_STOP(&t_send_connect_request);
+	dprintk_out();
+	return ret;
 
+out_with_request:
+	omx_xenfront_cancel_request(queue);
 out:
 	TIMER_STOP(&t_send_connect_request);
 	dprintk_out();
@@ -658,17 +739,18 @@ int omx_ioctl_xen_send_connect_reply(struct omx_endpoint *endpoint,
 				     void __user * uparam)
 {
 	struct omx_cmd_xen_send_connect_reply *cmd;
-	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
 	struct omx_xenif_request *ring_req;
 	int ret = 0;
 
 	dprintk_in();
 
 	TIMER_START(&t_send_connect_reply);
-	spin_lock(&fe->status_lock);
-	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
-	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_SEND_CONNECT_REPLY;
 	cmd = &ring_req->data.send_connect_reply;
 	ring_req->board_index = endpoint->board_index;
@@ -681,29 +763,33 @@ int omx_ioctl_xen_send_connect_reply(struct omx_endpoint *endpoint,
 		printk(KERN_ERR
 		       "Open-MX: Failed to read send connect request reply cmd hdr\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
 	if (!cmd->reply.shared_disabled) {
-		/* FIXME: handle the intra-node/VM case */
-		cmd->reply.shared_disabled = 1;
+		if (omx_xenfront_shared_local(endpoint, cmd->reply.peer_index,
+					      cmd->reply.dest_endpoint)) {
+			struct omx_cmd_send_connect_reply hdr = cmd->reply;
+
+			omx_xenfront_cancel_request(queue);
+			ret = omx_shared_try_send_connect_reply(endpoint, &hdr);
+			if (ret > 0)
+				/* the endpoint went away meanwhile, the lib will resend */
+				ret = 0;
+			goto out;
+		}
+		/* another domain, the backend may still find it on this host */
+		cmd->reply.shared_disabled = !endpoint->fe->shared_host;
 	}
 
 	dump_xen_send_connect_reply(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-	if (wait_for_backend_response
-	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
+	ret = omx_xenfront_submit_send(endpoint, ring_req, 0);
+	TIMER_STOP(&t_send_connect_reply);
+	dprintk_out();
+	return ret;
 
-	if (fe->status == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EFAULT;
-		printk_err("Backend failed to ACK send connect reply\n");
-	}
+out_with_request:
+	omx_xenfront_cancel_request(queue);
 out:
 	TIMER_STOP(&t_send_connect_reply);
 	dprintk_out();
@@ -713,16 +799,17 @@ out:
 int omx_ioctl_xen_pull(struct omx_endpoint *endpoint, void __user * uparam)
 {
 	struct omx_cmd_xen_pull *cmd;
-	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
 	struct omx_xenif_request *ring_req;
 	int ret = 0;
 
 	dprintk_in();
 	TIMER_START(&t_pull);
-	spin_lock(&fe->status_lock);
-	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
-	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_PULL;
 	cmd = &ring_req->data.pull;
 	ring_req->board_index = endpoint->board_index;
@@ -732,30 +819,31 @@ int omx_ioctl_xen_pull(struct omx_endpoint *endpoint, void __user * uparam)
 	if (unlikely(ret != 0)) {
 		printk(KERN_ERR "Open-MX: Failed to read send pull cmd\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
 	if (cmd->pull.shared) {
-		/* FIXME: handle the intra-node/VM case */
-		cmd->pull.shared = 0;
-	}
+		if (omx_xenfront_shared_local(endpoint, cmd->pull.peer_index,
+					      cmd->pull.dest_endpoint)) {
+			struct omx_cmd_pull hdr = cmd->pull;
 
-	dump_xen_pull(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-#ifndef OMX_XEN_NOWAIT
-	if (wait_for_backend_response
-	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
+			omx_xenfront_cancel_request(queue);
+			ret = omx_shared_pull(endpoint, &hdr);
+			goto out;
+		}
+		/* another domain, the backend may still find it on this host */
+		cmd->pull.shared = endpoint->fe->shared_host;
 	}
 
-	if (fe->status == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else
-		ret = -EFAULT;
-#endif
+	dump_xen_pull(cmd);
+	/* the library must know whether the pull handle was created */
+	ret = omx_xenfront_submit_send(endpoint, ring_req, 0);
+	TIMER_STOP(&t_pull);
+	dprintk_out();
+	return ret;
 
+out_with_request:
+	omx_xenfront_cancel_request(queue);
 out:
 	TIMER_STOP(&t_pull);
 	dprintk_out();
@@ -765,16 +853,17 @@ out:
 int omx_ioctl_xen_send_rndv(struct omx_endpoint *endpoint, void __user * uparam)
 {
 	struct omx_cmd_xen_send_rndv *cmd;
-	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
 	struct omx_xenif_request *ring_req;
 	int ret = 0;
 
 	dprintk_in();
 	TIMER_START(&t_send_rndv);
-	spin_lock(&fe->status_lock);
-	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
-	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_SEND_RNDV;
 	cmd = &ring_req->data.send_rndv;
 	ring_req->board_index = endpoint->board_index;
@@ -786,39 +875,37 @@ int omx_ioctl_xen_send_rndv(struct omx_endpoint *endpoint, void __user * uparam)
 	if (unlikely(ret != 0)) {
 		printk(KERN_ERR "Open-MX: Failed to read send rndv cmd\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
 	if (cmd->rndv.shared) {
-		/* FIXME: handle the intra-node/VM case */
-		cmd->rndv.shared = 0;
+		if (omx_xenfront_shared_local(endpoint, cmd->rndv.peer_index,
+					      cmd->rndv.dest_endpoint)) {
+			struct omx_cmd_send_rndv hdr = cmd->rndv;
+
+			omx_xenfront_cancel_request(queue);
+			ret = omx_shared_send_rndv(endpoint, &hdr);
+			goto out;
+		}
+		/* another domain, the backend may still find it on this host */
+		cmd->rndv.shared = endpoint->fe->shared_host;
 	}
 
 	/* fill omx header */
 	dump_xen_send_rndv(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-#ifndef OMX_XEN_NOWAIT
-	if (wait_for_backend_response
-	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
-
-	if (fe->status == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EINVAL;
-		printk_err("Backend failed to ACK send rndv \n");
-	}
-#endif
+	ret = omx_xenfront_submit_send(endpoint, ring_req, 1);
 #if 0
 	printk(KERN_INFO
 	       "%s: delaying on purpose to understand what is going on!\n",
 	       __func__);
 	udelay(10000);
 #endif
+	TIMER_STOP(&t_send_rndv);
+	dprintk_out();
+	return ret;
 
+out_with_request:
+	omx_xenfront_cancel_request(queue);
 out:
 	TIMER_STOP(&t_send_rndv);
 	dprintk_out();
@@ -829,16 +916,17 @@ int omx_ioctl_xen_send_liback(struct omx_endpoint *endpoint,
 			      void __user * uparam)
 {
 	struct omx_cmd_xen_send_liback *cmd;
-	struct omx_xenfront_info *fe = endpoint->fe;
+	struct omx_xenfront_queue *queue = endpoint->xen_queue;
 	struct omx_xenif_request *ring_req;
 	int ret = 0;
 
 	dprintk_in();
 	TIMER_START(&t_send_liback);
-	spin_lock(&fe->status_lock);
-	fe->status = OMX_XEN_FRONTEND_STATUS_DOING;
-	spin_unlock(&fe->status_lock);
-	ring_req = RING_GET_REQUEST(&(fe->ring), fe->ring.req_prod_pvt++);
+	ring_req = omx_xenfront_get_request(queue);
+	if (unlikely(!ring_req)) {
+		ret = -EBUSY;
+		goto out;
+	}
 	ring_req->func = OMX_CMD_SEND_LIBACK;
 	cmd = &ring_req->data.send_liback;
 	ring_req->board_index = endpoint->board_index;
@@ -851,31 +939,32 @@ int omx_ioctl_xen_send_liback(struct omx_endpoint *endpoint,
 		printk(KERN_ERR
 		       "Open-MX: Failed to read send connect request cmd hdr\n");
 		ret = -EFAULT;
-		goto out;
+		goto out_with_request;
 	}
 
 	if (cmd->liback.shared) {
-		/* FIXME: handle the intra-node/VM case */
-		cmd->liback.shared = 0;
+		if (omx_xenfront_shared_local(endpoint, cmd->liback.peer_index,
+					      cmd->liback.dest_endpoint)) {
+			struct omx_cmd_send_liback hdr = cmd->liback;
+
+			omx_xenfront_cancel_request(queue);
+			ret = omx_shared_send_liback(endpoint, &hdr);
+			goto out;
+		}
+		/* another domain, the backend may still find it on this host */
+		cmd->liback.shared = endpoint->fe->shared_host;
 	}
 
 	/* fill omx header */
 
 	dump_xen_send_liback(cmd);
-	omx_poke_dom0(endpoint->fe, ring_req);
-	if (wait_for_backend_response
-	    (&fe->status, OMX_XEN_FRONTEND_STATUS_DOING, &fe->status_lock)) {
-		printk_err("Failed to wait\n");
-		ret = -EINVAL;
-		goto out;
-	}
+	ret = omx_xenfront_submit_send(endpoint, ring_req, 1);
+	TIMER_STOP(&t_send_liback);
+	dprintk_out();
+	return ret;
 
-	if (fe->status == OMX_XEN_FRONTEND_STATUS_DONE)
-		ret = 0;
-	else {
-		ret = -EFAULT;
-		printk_err("Backend failed to ACK send liback \n");
-	}
+out_with_request:
+	omx_xenfront_cancel_request(queue);
 out:
 	TIMER_STOP(&t_send_liback);
 	dprintk_out();
@@ -278,6 +278,33 @@ else
   echo no
 fi
 
+# smp_call_function_single_async added in 3.16
+echo -n "  checking (in kernel headers) smp_call_function_single_async availability ... "
+if grep smp_call_function_single_async ${LINUX_HDR}/include/linux/smp.h > /dev/null ; then
+  echo "#define OMX_HAVE_SMP_CALL_FUNCTION_SINGLE_ASYNC 1" >> ${TMP_CHECKS_NAME}
+  echo yes
+else
+  echo no
+fi
+
+# call_single_data_t added in 4.14
+echo -n "  checking (in kernel headers) call_single_data_t availability ... "
+if grep call_single_data_t ${LINUX_HDR}/include/linux/smp.h > /dev/null ; then
+  echo "#define OMX_HAVE_CALL_SINGLE_DATA_T 1" >> ${TMP_CHECKS_NAME}
+  echo yes
+else
+  echo no
+fi
+
+# cpuhp_setup_state_nocalls added in 4.6, replacing hotcpu notifiers
+echo -n "  checking (in kernel headers) cpuhp_setup_state_nocalls availability ... "
+if grep cpuhp_setup_state_nocalls ${LINUX_HDR}/include/linux/cpuhotplug.h > /dev/null 2>&1 ; then
+  echo "#define OMX_HAVE_CPUHP_SETUP_STATE 1" >> ${TMP_CHECKS_NAME}
+  echo yes
+else
+  echo no
+fi
+
 # add the footer
 echo "" >> ${TMP_CHECKS_NAME}
 echo "#endif /* __omx_checks_h__ */" >> ${TMP_CHECKS_NAME}
@@ -26,6 +26,7 @@ struct omx_iface;
 struct omx_iface_raw;
 struct omx_endpoint;
 struct sk_buff;
+struct sk_buff_head;
 
 /* constants */
 #define OMX_PULL_BLOCK_DESCS_NR 4
@@ -45,6 +46,9 @@ extern int omx_pin_progressive;
 extern int omx_pin_chunk_pages_min;
 extern int omx_pin_chunk_pages_max;
 extern int omx_pin_invalidate;
+extern int omx_pull_rails;
+extern int omx_tx_batch;
+extern int omx_recv_steer_enabled;
 extern unsigned long omx_user_rights;
 
 /* events */
@@ -74,11 +78,25 @@ extern int omx_ioctl_send_notify(struct omx_endpoint * endpoint, void __user * u
 extern int omx_ioctl_send_connect_request(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_connect_reply(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_liback(struct omx_endpoint * endpoint, void __user * uparam);
+extern int omx_ioctl_send_push_sack(struct omx_endpoint * endpoint, void __user * uparam);
 extern void omx_send_nack_lib(struct omx_iface * iface, uint32_t peer_index, enum omx_nack_type nack_type, uint8_t src_endpoint, uint8_t dst_endpoint, uint16_t lib_seqnum);
 extern void omx_send_nack_mcp(struct omx_iface * iface, uint32_t peer_index, enum omx_nack_type nack_type, uint8_t src_endpoint, uint32_t src_pull_handle, uint32_t src_magic);
+extern int omx_send_mediumsq_frag(struct omx_endpoint * endpoint, void __user * uparam, struct sk_buff_head * batch);
+extern int omx_send_tiny(struct omx_endpoint * endpoint, const struct omx_cmd_send_tiny * cmd);
+extern int omx_send_notify(struct omx_endpoint * endpoint, const struct omx_cmd_send_notify * cmd);
+extern int omx_send_liback(struct omx_endpoint * endpoint, const struct omx_cmd_send_liback * cmd);
+extern void omx_xmit_batch_flush(struct omx_iface * iface, struct sk_buff_head * batch);
+
+/* submission ring */
+extern void omx_endpoint_submitq_init(struct omx_endpoint * endpoint);
+extern void omx_endpoint_submitq_exit(struct omx_endpoint * endpoint);
+extern int omx_ioctl_submitq_start(struct omx_endpoint * endpoint, void __user * uparam);
+extern int omx_ioctl_submitq_wakeup(struct omx_endpoint * endpoint);
 
 /* receiving */
 extern void omx_pkt_types_init(void);
+extern void omx_recv_steer_init(void);
+extern void omx_recv_steer_exit(void);
 extern struct packet_type omx_pt;
 extern int omx_recv_pull_request(struct omx_iface * iface, struct omx_hdr * mh, struct sk_buff * skb);
 extern int omx_recv_pull_reply(struct omx_iface * iface, struct omx_hdr * mh, struct sk_buff * skb);
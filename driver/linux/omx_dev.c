@@ -27,6 +27,7 @@
 #include <linux/random.h>
 #include <linux/ethtool.h>
 #include <linux/hardirq.h>
+#include <linux/skbuff.h>
 #include <asm/uaccess.h>
 
 #include "omx_hal.h"
@@ -36,6 +37,7 @@
 #include "omx_peer.h"
 #include "omx_endpoint.h"
 #include "omx_reg.h"
+#include "omx_shared.h"
 
 /******************************
  * Alloc/Release internal endpoint fields once everything is setup/locked
@@ -61,6 +63,8 @@ omx_endpoint_alloc_resources(struct omx_endpoint * endpoint)
 	}
 	userdesc->status = 0;
 	userdesc->session_id = endpoint->session_id;
+	userdesc->exp_eventq_consumed_index = 0;
+	userdesc->unexp_eventq_consumed_index = 0;
 	endpoint->userdesc = userdesc;
 
 	/* alloc and init user queues */
@@ -85,11 +89,21 @@ omx_endpoint_alloc_resources(struct omx_endpoint * endpoint)
 		printk(KERN_ERR "Open-MX: failed to allocate unexp eventq\n");
 		goto out_with_exp_eventq;
 	}
+	endpoint->submitq = omx_vmalloc_user(OMX_SUBMITQ_SIZE);
+	if (!endpoint->submitq) {
+		printk(KERN_ERR "Open-MX: failed to allocate submitq\n");
+		goto out_with_unexp_eventq;
+	}
+	endpoint->exp_medium_seqnums = omx_vmalloc_user(OMX_EXP_MEDIUM_SEQNUMS_SIZE(omx_peer_max, omx_endpoint_max));
+	if (!endpoint->exp_medium_seqnums) {
+		printk(KERN_ERR "Open-MX: failed to allocate expected medium seqnums\n");
+		goto out_with_submitq;
+	}
 
 	sendq_pages = kmalloc(OMX_SENDQ_SIZE/PAGE_SIZE * sizeof(struct page *), GFP_KERNEL);
 	if (!sendq_pages) {
 		printk(KERN_ERR "Open-MX: failed to allocate sendq pages array\n");
-		goto out_with_unexp_eventq;
+		goto out_with_exp_medium_seqnums;
 	}
 	for(i=0; i<OMX_SENDQ_SIZE/PAGE_SIZE; i++) {
 		struct page * page;
@@ -114,9 +128,11 @@ omx_endpoint_alloc_resources(struct omx_endpoint * endpoint)
 
 	/* finish initializing queues */
 	omx_endpoint_queues_init(endpoint);
+	omx_endpoint_submitq_init(endpoint);
 
 	/* initialize user regions */
 	omx_endpoint_user_regions_init(endpoint);
+	omx_endpoint_exp_medium_init(endpoint);
 
 	/* initialize pull handles */
 	omx_endpoint_pull_handles_init(endpoint);
@@ -130,6 +146,10 @@ omx_endpoint_alloc_resources(struct omx_endpoint * endpoint)
 
  out_with_sendq_pages:
 	kfree(endpoint->sendq_pages);
+ out_with_exp_medium_seqnums:
+	vfree(endpoint->exp_medium_seqnums);
+ out_with_submitq:
+	vfree(endpoint->submitq);
  out_with_unexp_eventq:
 	vfree(endpoint->unexp_eventq);
  out_with_exp_eventq:
@@ -152,10 +172,13 @@ omx_endpoint_free_resources(struct omx_endpoint * endpoint)
 	/* destroy all pending pull handles */
 	omx_endpoint_pull_handles_exit(endpoint);
 
+	omx_endpoint_exp_medium_exit(endpoint);
 	omx_endpoint_user_regions_exit(endpoint);
 
 	kfree(endpoint->recvq_pages);
 	kfree(endpoint->sendq_pages);
+	vfree(endpoint->exp_medium_seqnums);
+	vfree(endpoint->submitq);
 	vfree(endpoint->unexp_eventq);
 	vfree(endpoint->exp_eventq);
 	vfree(endpoint->recvq);
@@ -240,6 +263,9 @@ omx_endpoint_open(struct omx_endpoint * endpoint, const void __user * uparam)
 	if (ret < 0)
 		goto out_with_init;
 
+	/* record the owner binding before incoming packets may look at it */
+	endpoint->recv_cpu = raw_smp_processor_id();
+
 	/* attach the endpoint to the iface */
 	endpoint->board_index = param.board_index;
 	endpoint->endpoint_index = param.endpoint_index;
@@ -312,6 +338,9 @@ omx_endpoint_close(struct omx_endpoint * endpoint,
 	/* wakeup waiters */
 	omx_wakeup_endpoint_on_close(endpoint);
 
+	/* stop submitting commands from the submission ring */
+	omx_endpoint_submitq_exit(endpoint);
+
 	/* detach from the iface now so that nobody can acquire it */
 	omx_iface_detach_endpoint(endpoint, ifacelocked);
 	/* but keep the endpoint->iface valid until everybody releases the endpoint */
@@ -376,6 +405,20 @@ omx_endpoint_acquire_by_iface_index(const struct omx_iface * iface, uint8_t inde
 	return ERR_PTR(err);
 }
 
+/* shared communication hooks, the destination must be attached to a local iface */
+struct omx_endpoint *
+omx_shared_acquire_endpoint(struct omx_endpoint *src_endpoint,
+			    uint16_t peer_index, uint8_t endpoint_index)
+{
+	return omx_local_peer_acquire_endpoint(peer_index, endpoint_index);
+}
+
+uint32_t
+omx_shared_peer_index(const struct omx_endpoint *endpoint)
+{
+	return endpoint->iface->peer.index;
+}
+
 /******************************
  * File operations
  */
@@ -392,6 +435,9 @@ omx_miscdev_open(struct inode * inode, struct file * file)
 	kref_init(&endpoint->refcount);
 	spin_lock_init(&endpoint->status_lock);
 	endpoint->status = OMX_ENDPOINT_STATUS_FREE;
+	spin_lock_init(&endpoint->recv_steer_lock);
+	endpoint->recv_steer_cpu = -1;
+	endpoint->recv_steer_pending = 0;
 
 	file->private_data = endpoint;
 	return 0;
@@ -444,6 +490,92 @@ static int (*omx_ioctl_with_endpoint_handlers[])(struct omx_endpoint * endpoint,
 	[OMX_EPCMD_RELEASE_UNEXP_SLOTS]		= omx_ioctl_release_unexp_slots,
 };
 
+
+/* the commands that may be submitted within a batch */
+#define OMX_SEND_BATCH_EPCMDS ((1ULL << OMX_EPCMD_SEND_TINY)		\
+			       | (1ULL << OMX_EPCMD_SEND_SMALL)		\
+			       | (1ULL << OMX_EPCMD_SEND_MEDIUMSQ_FRAG)	\
+			       | (1ULL << OMX_EPCMD_SEND_MEDIUMVA)	\
+			       | (1ULL << OMX_EPCMD_SEND_RNDV)		\
+			       | (1ULL << OMX_EPCMD_SEND_NOTIFY)	\
+			       | (1ULL << OMX_EPCMD_SEND_LIBACK))
+
+/*
+ * Submit a batch of send commands within a single ioctl.
+ * All entries are read and checked first, so that a malformed batch
+ * is rejected before anything goes on the wire.
+ */
+static int
+omx_ioctl_send_batch(struct omx_endpoint * endpoint, void __user * uparam)
+{
+	struct omx_cmd_send_batch cmd;
+	struct omx_cmd_send_batch_entry entries[OMX_SEND_BATCH_NR_MAX];
+	struct sk_buff_head batch;
+	uint32_t i;
+	int ret;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send batch cmd hdr\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = -EINVAL;
+	if (unlikely(cmd.nr > OMX_SEND_BATCH_NR_MAX)) {
+		printk(KERN_ERR "Open-MX: Cannot send a batch of %ld commands (max %ld)\n",
+		       (unsigned long) cmd.nr, (unsigned long) OMX_SEND_BATCH_NR_MAX);
+		goto out;
+	}
+
+	ret = copy_from_user(entries, (void __user *)(unsigned long) cmd.entries,
+			     cmd.nr * sizeof(entries[0]));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send batch cmd entries\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for(i=0; i<cmd.nr; i++)
+		if (unlikely(entries[i].type >= 64
+			     || !(OMX_SEND_BATCH_EPCMDS & (1ULL << entries[i].type)))) {
+			printk(KERN_ERR "Open-MX: Cannot send command %ld in a batch\n",
+			       (unsigned long) entries[i].type);
+			ret = -EINVAL;
+			goto out;
+		}
+
+	/*
+	 * consecutive mediumsq frags go to the wire at once,
+	 * flush them before any other command to keep the order
+	 */
+	__skb_queue_head_init(&batch);
+	ret = 0;
+	for(i=0; i<cmd.nr; i++) {
+		void __user * param = (void __user *)(unsigned long) entries[i].param;
+
+		if (entries[i].type == OMX_EPCMD_SEND_MEDIUMSQ_FRAG) {
+			ret = omx_send_mediumsq_frag(endpoint, param, &batch);
+		} else {
+			omx_xmit_batch_flush(endpoint->iface, &batch);
+			ret = omx_ioctl_with_endpoint_handlers[entries[i].type](endpoint, param);
+		}
+		if (unlikely(ret < 0))
+			break;
+	}
+	omx_xmit_batch_flush(endpoint->iface, &batch);
+
+	if (unlikely(ret < 0)) {
+		/* tell user-space how many commands went through */
+		if (copy_to_user(&((struct omx_cmd_send_batch __user *) uparam)->submitted_nr,
+				 &i, sizeof(i)) != 0)
+			printk(KERN_ERR "Open-MX: Failed to write send batch cmd result\n");
+	}
+
+ out:
+	return ret;
+}
+
 /*
  * Main ioctl switch where all application ioctls arrive
  */
@@ -465,6 +597,8 @@ omx_miscdev_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 		if (unlikely(endpoint->status != OMX_ENDPOINT_STATUS_OK))
 			return -EINVAL;
 
+		omx_endpoint_update_recv_cpu(endpoint);
+
 		/* omx_dev_init() takes care fo checking that the handler isn't NULL */
 		return omx_ioctl_with_endpoint_handlers[(unsigned char) handler_offset](endpoint, (void __user *) arg);
 	}
@@ -720,6 +854,79 @@ omx_miscdev_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 		break;
 	}
 
+	case OMX_CMD_SEND_BATCH: {
+		struct omx_endpoint * endpoint = file->private_data;
+
+		/*
+		 * the endpoint is already acquired by the file,
+		 * just check its status
+		 */
+		ret = -EINVAL;
+		if (unlikely(endpoint->status != OMX_ENDPOINT_STATUS_OK))
+			break;
+
+		omx_endpoint_update_recv_cpu(endpoint);
+		ret = omx_ioctl_send_batch(endpoint, (void __user *) arg);
+
+		break;
+	}
+
+	case OMX_CMD_SUBMITQ_START:
+	case OMX_CMD_SUBMITQ_WAKEUP: {
+		struct omx_endpoint * endpoint = file->private_data;
+
+		/*
+		 * the endpoint is already acquired by the file,
+		 * just check its status
+		 */
+		ret = -EINVAL;
+		if (unlikely(endpoint->status != OMX_ENDPOINT_STATUS_OK))
+			break;
+
+		omx_endpoint_update_recv_cpu(endpoint);
+		if (cmd == OMX_CMD_SUBMITQ_START)
+			ret = omx_ioctl_submitq_start(endpoint, (void __user *) arg);
+		else
+			ret = omx_ioctl_submitq_wakeup(endpoint);
+
+		break;
+	}
+
+	case OMX_CMD_POST_EXP_MEDIUM:
+	case OMX_CMD_RELEASE_EXP_MEDIUM: {
+		struct omx_endpoint * endpoint = file->private_data;
+
+		/*
+		 * the endpoint is already acquired by the file,
+		 * just check its status
+		 */
+		ret = -EINVAL;
+		if (unlikely(endpoint->status != OMX_ENDPOINT_STATUS_OK))
+			break;
+
+		if (cmd == OMX_CMD_POST_EXP_MEDIUM)
+			ret = omx_ioctl_post_exp_medium(endpoint, (void __user *) arg);
+		else
+			ret = omx_ioctl_release_exp_medium(endpoint, (void __user *) arg);
+
+		break;
+	}
+
+	case OMX_CMD_SEND_PUSH_SACK: {
+		struct omx_endpoint * endpoint = file->private_data;
+
+		/*
+		 * the endpoint is already acquired by the file,
+		 * just check its status
+		 */
+		ret = -EINVAL;
+		if (unlikely(endpoint->status != OMX_ENDPOINT_STATUS_OK))
+			break;
+
+		ret = omx_ioctl_send_push_sack(endpoint, (void __user *) arg);
+		break;
+	}
+
 	case OMX_CMD_BENCH:
 	case OMX_CMD_SEND_TINY:
 	case OMX_CMD_SEND_SMALL:
@@ -796,6 +1003,13 @@ omx_miscdev_mmap(struct file * file, struct vm_area_struct * vma)
 			return -EPERM;
 		return omx_remap_vmalloc_range(vma, endpoint->unexp_eventq, 0);
 
+	} else if (offset == OMX_SUBMITQ_FILE_OFFSET && size == PAGE_ALIGN(OMX_SUBMITQ_SIZE)) {
+		return omx_remap_vmalloc_range(vma, endpoint->submitq, 0);
+
+	} else if (offset == OMX_EXP_MEDIUM_SEQNUMS_FILE_OFFSET
+		   && size == PAGE_ALIGN(OMX_EXP_MEDIUM_SEQNUMS_SIZE(omx_peer_max, omx_endpoint_max))) {
+		return omx_remap_vmalloc_range(vma, endpoint->exp_medium_seqnums, 0);
+
 	} else {
 		printk(KERN_ERR "Open-MX: Cannot mmap 0x%lx at 0x%lx\n", size, offset);
 		return -EINVAL;
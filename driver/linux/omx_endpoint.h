@@ -35,6 +35,7 @@
 
 struct omx_iface;
 struct page;
+struct sk_buff;
 
 enum omx_endpoint_status {
 	/* endpoint is free and may be open */
@@ -63,6 +64,13 @@ struct omx_endpoint {
 
 	struct omx_iface * iface;
 
+	/* core where the owner runs, incoming packets are steered near it */
+	int recv_cpu;
+	/* packets steered to a core but not processed yet, later ones must follow them */
+	spinlock_t recv_steer_lock;
+	int recv_steer_cpu;
+	unsigned recv_steer_pending;
+
 	/* send queue stuff */
 	void * sendq;
 	struct page ** sendq_pages;
@@ -96,9 +104,38 @@ struct omx_endpoint {
 	omx_eventq_index_t next_recvq_index;
 	struct page ** recvq_pages;
 
+	/* submission ring stuff */
+	void * submitq;
+	uint32_t next_submitq_index;
+	uint32_t submitq_idle_us;
+	struct task_struct * submitq_task; /* protected by the status_lock */
+	wait_queue_head_t submitq_wq;
+
 	spinlock_t user_regions_lock;
 	struct omx_user_region __rcu * user_regions[OMX_USER_REGION_MAX];
 
+	/* expected medium slots, protected by the exp_medium_lock */
+	spinlock_t exp_medium_lock;
+	unsigned exp_medium_slots_nr; /* number of used slots, read without the lock */
+	uint32_t exp_medium_gen; /* arming order */
+	uint32_t * exp_medium_seqnums; /* next matched seqnum of each partner, written by the library */
+	struct omx_exp_medium_slot {
+		struct omx_user_region * region; /* NULL if the slot is free */
+		unsigned long region_offset;
+		uint64_t match_info;
+		uint64_t match_mask;
+		uint32_t length;
+		uint32_t cookie;
+		uint32_t gen;
+		/* claimed by the first matching medium */
+		int claimed;
+		uint16_t peer_index;
+		uint8_t src_endpoint;
+		uint16_t seqnum;
+		uint32_t frags_received_mask[OMX_PUSH_FRAGS_MAX/32];
+		uint32_t accumulated_length;
+	} exp_medium_slots[OMX_EXP_MEDIUM_SLOT_NR];
+
 	struct list_head pull_handles_list;
 	struct list_head pull_handle_slots_free_list;
 	void * pull_handle_slots_array;
@@ -130,8 +167,28 @@ omx_endpoint_release(struct omx_endpoint * endpoint)
 	kref_put(&endpoint->refcount, __omx_endpoint_last_release);
 }
 
+/*
+ * called from the owner's ioctls, so that incoming packets are steered
+ * where it runs now, even if it was bound to another core after open
+ */
+static inline void
+omx_endpoint_update_recv_cpu(struct omx_endpoint * endpoint)
+{
+	int cpu = raw_smp_processor_id();
+
+	if (unlikely(ACCESS_ONCE(endpoint->recv_cpu) != cpu))
+		ACCESS_ONCE(endpoint->recv_cpu) = cpu;
+}
+
 extern int omx_ioctl_bench(struct omx_endpoint * endpoint, void __user * uparam);
 
+/* expected medium slots */
+extern void omx_endpoint_exp_medium_init(struct omx_endpoint * endpoint);
+extern void omx_endpoint_exp_medium_exit(struct omx_endpoint * endpoint);
+extern int omx_ioctl_post_exp_medium(struct omx_endpoint * endpoint, void __user * uparam);
+extern int omx_ioctl_release_exp_medium(struct omx_endpoint * endpoint, void __user * uparam);
+extern int omx_recv_medium_frag_exp(struct omx_endpoint * endpoint, struct omx_evt_recv_msg * event, const struct sk_buff * skb, unsigned long skb_offset);
+
 #endif /* __omx_endpoint_h__ */
 
 /*
@@ -172,6 +172,57 @@ omx_endpoint_queues_init(struct omx_endpoint *endpoint)
 	spin_lock_init(&endpoint->release_unexp_lock);
 }
 
+/*
+ * User-space publishes the index of the next event it will consume in the
+ * endpoint descriptor instead of releasing slots with an ioctl, so only look
+ * at it when a queue looks full. It may only move forward, and never past
+ * the slots that were actually given to user-space.
+ */
+static void
+omx_update_released_exp_slots(struct omx_endpoint *endpoint)
+{
+	omx_eventq_index_t consumed;
+
+	spin_lock_bh(&endpoint->release_exp_lock);
+	consumed = ACCESS_ONCE(endpoint->userdesc->exp_eventq_consumed_index);
+	if (consumed - endpoint->nextreleased_exp_eventq_index
+	    <= endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index)
+		endpoint->nextreleased_exp_eventq_index = consumed;
+	spin_unlock_bh(&endpoint->release_exp_lock);
+}
+
+static void
+omx_update_released_unexp_slots(struct omx_endpoint *endpoint)
+{
+	omx_eventq_index_t consumed;
+
+	spin_lock_bh(&endpoint->release_unexp_lock);
+	consumed = ACCESS_ONCE(endpoint->userdesc->unexp_eventq_consumed_index);
+	if (consumed - endpoint->nextreleased_unexp_eventq_index
+	    <= ACCESS_ONCE(endpoint->nextreserved_unexp_eventq_index) - endpoint->nextreleased_unexp_eventq_index)
+		endpoint->nextreleased_unexp_eventq_index = consumed;
+	spin_unlock_bh(&endpoint->release_unexp_lock);
+}
+
+/* check whether the queue overflows once its free index is 'free' */
+static INLINE int
+omx_exp_eventq_full(struct omx_endpoint *endpoint, omx_eventq_index_t free)
+{
+	if (likely(free - endpoint->nextreleased_exp_eventq_index <= OMX_EXP_EVENTQ_ENTRY_NR))
+		return 0;
+	omx_update_released_exp_slots(endpoint);
+	return free - endpoint->nextreleased_exp_eventq_index > OMX_EXP_EVENTQ_ENTRY_NR;
+}
+
+static INLINE int
+omx_unexp_eventq_full(struct omx_endpoint *endpoint, omx_eventq_index_t free)
+{
+	if (likely(free - endpoint->nextreleased_unexp_eventq_index <= OMX_UNEXP_EVENTQ_ENTRY_NR))
+		return 0;
+	omx_update_released_unexp_slots(endpoint);
+	return free - endpoint->nextreleased_unexp_eventq_index > OMX_UNEXP_EVENTQ_ENTRY_NR;
+}
+
 /******************************************
  * Report an expected event to users-space
  */
@@ -185,8 +236,7 @@ omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int lengt
 	/* take the next slot and update the queue */
 	index = atomic_inc_return((atomic_t *) &endpoint->nextfree_exp_eventq_index) - 1;
 
-	if (unlikely(endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
-		     > OMX_EXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_exp_eventq_full(endpoint, endpoint->nextfree_exp_eventq_index))) {
 		/* we went too far, rollback */
 		atomic_dec((atomic_t *) &endpoint->nextfree_exp_eventq_index);
 		/* the application sucks, it did not check
@@ -232,8 +282,7 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 	index = endpoint->nextreserved_unexp_eventq_index++;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_full(endpoint, endpoint->nextfree_unexp_eventq_index))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index--;
@@ -289,8 +338,7 @@ omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 	recvq_index = endpoint->next_recvq_index++;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_full(endpoint, endpoint->nextfree_unexp_eventq_index))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index--;
@@ -324,8 +372,7 @@ omx_prepare_notify_unexp_events_with_recvq(struct omx_endpoint *endpoint,
 	endpoint->next_recvq_index += nr;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_full(endpoint, endpoint->nextfree_unexp_eventq_index))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index -= nr;
@@ -573,13 +620,13 @@ int
 omx_ioctl_release_exp_slots(struct omx_endpoint *endpoint, void __user *uparam)
 {
 	int err = 0;
-	spin_lock(&endpoint->release_exp_lock);
+	spin_lock_bh(&endpoint->release_exp_lock);
 	if (endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
 	    < OMX_EXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_exp_eventq_index += OMX_EXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_exp_lock);
+	spin_unlock_bh(&endpoint->release_exp_lock);
 	return err;
 }
 
@@ -587,13 +634,13 @@ int
 omx_ioctl_release_unexp_slots(struct omx_endpoint *endpoint, void __user *uparam)
 {
 	int err = 0;
-	spin_lock(&endpoint->release_unexp_lock);
+	spin_lock_bh(&endpoint->release_unexp_lock);
 	if (endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
 	    < OMX_UNEXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_unexp_eventq_index += OMX_UNEXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_unexp_lock);
+	spin_unlock_bh(&endpoint->release_unexp_lock);
 	return err;
 }
 
@@ -0,0 +1,331 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <asm/uaccess.h>
+
+#include "omx_hal.h"
+#include "omx_io.h"
+#include "omx_common.h"
+#include "omx_iface.h"
+#include "omx_endpoint.h"
+#include "omx_reg.h"
+
+/*
+ * Expected medium slots.
+ *
+ * When a receive is posted, the library may arm a slot with its buffer,
+ * registered as a user region. The first medium fragment that matches
+ * the slot claims it for the whole message, and all fragments of this
+ * message are then copied from the skb straight into the posted buffer
+ * instead of the recvq. The event still reserves a recvq slot, it is
+ * just not filled.
+ *
+ * The library decides about the actual matching, the slot only tells where
+ * the data is. If the message gets matched elsewhere, the library copies
+ * from the slot buffer as it would from the recvq, and it releases the
+ * slot if the armed receive gets matched to another message.
+ *
+ * To keep this rare, only the oldest armed slot that matches may be claimed
+ * (the library does not arm a slot behind an unarmed receive that may match
+ * the same messages), and only by a medium whose seqnum the library has not
+ * matched yet. Otherwise a duplicate of a completed message, or a late
+ * fragment of a message matched through the recvq, would overwrite the
+ * buffer of a receive that is still posted.
+ */
+
+void
+omx_endpoint_exp_medium_init(struct omx_endpoint * endpoint)
+{
+	spin_lock_init(&endpoint->exp_medium_lock);
+	endpoint->exp_medium_slots_nr = 0;
+	endpoint->exp_medium_gen = 0;
+	memset(endpoint->exp_medium_slots, 0, sizeof(endpoint->exp_medium_slots));
+}
+
+/* called when the last endpoint reference is released, nobody receives anymore */
+void
+omx_endpoint_exp_medium_exit(struct omx_endpoint * endpoint)
+{
+	int i;
+
+	for(i=0; i<OMX_EXP_MEDIUM_SLOT_NR; i++) {
+		struct omx_exp_medium_slot * slot = &endpoint->exp_medium_slots[i];
+		if (slot->region) {
+			omx_user_region_release(slot->region);
+			slot->region = NULL;
+		}
+	}
+	endpoint->exp_medium_slots_nr = 0;
+}
+
+/* called with the lock held, returns the region to release once unlocked */
+static INLINE struct omx_user_region *
+omx_exp_medium_slot_free(struct omx_endpoint * endpoint, struct omx_exp_medium_slot * slot)
+{
+	struct omx_user_region * region = slot->region;
+
+	if (region) {
+		slot->region = NULL;
+		endpoint->exp_medium_slots_nr--;
+	}
+	return region;
+}
+
+int
+omx_ioctl_post_exp_medium(struct omx_endpoint * endpoint, void __user * uparam)
+{
+	struct omx_cmd_post_exp_medium cmd;
+	struct omx_exp_medium_slot * slot;
+	struct omx_user_region * region, * old_region;
+	int err;
+
+	err = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(err != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read post expected medium cmd\n");
+		err = -EFAULT;
+		goto out;
+	}
+
+	err = -EINVAL;
+	if (unlikely(cmd.slot >= OMX_EXP_MEDIUM_SLOT_NR))
+		goto out;
+
+	region = omx_user_region_acquire(endpoint, cmd.rdma_id);
+	if (unlikely(!region))
+		goto out;
+
+	if (unlikely((unsigned long) cmd.region_offset + cmd.length > region->total_length))
+		goto out_with_region;
+
+	region->dirty = 1;
+
+	if (!omx_pin_synchronous) {
+		/* the bottom half cannot pin, do it now */
+		struct omx_user_region_pin_state pinstate;
+
+		omx_user_region_demand_pin_init(&pinstate, region);
+		pinstate.next_chunk_pages = omx_pin_chunk_pages_max;
+		err = omx_user_region_demand_pin_finish(&pinstate);
+		if (err < 0) {
+			dprintk(REG, "failed to pin user region for expected medium\n");
+			goto out_with_region;
+		}
+	}
+
+	spin_lock_bh(&endpoint->exp_medium_lock);
+	slot = &endpoint->exp_medium_slots[cmd.slot];
+	old_region = omx_exp_medium_slot_free(endpoint, slot);
+	slot->region = region;
+	slot->region_offset = cmd.region_offset;
+	slot->match_mask = cmd.match_mask;
+	slot->match_info = cmd.match_info & cmd.match_mask;
+	slot->length = cmd.length;
+	slot->cookie = cmd.cookie;
+	slot->gen = endpoint->exp_medium_gen++;
+	slot->claimed = 0;
+	endpoint->exp_medium_slots_nr++;
+	spin_unlock_bh(&endpoint->exp_medium_lock);
+
+	if (old_region)
+		omx_user_region_release(old_region);
+
+	return 0;
+
+ out_with_region:
+	omx_user_region_release(region);
+ out:
+	return err;
+}
+
+int
+omx_ioctl_release_exp_medium(struct omx_endpoint * endpoint, void __user * uparam)
+{
+	struct omx_cmd_release_exp_medium cmd;
+	struct omx_user_region * region;
+	int err;
+
+	err = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(err != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read release expected medium cmd\n");
+		err = -EFAULT;
+		goto out;
+	}
+
+	err = -EINVAL;
+	if (unlikely(cmd.slot >= OMX_EXP_MEDIUM_SLOT_NR))
+		goto out;
+
+	/* once unlocked, the bottom half cannot write into the buffer anymore */
+	spin_lock_bh(&endpoint->exp_medium_lock);
+	region = omx_exp_medium_slot_free(endpoint, &endpoint->exp_medium_slots[cmd.slot]);
+	spin_unlock_bh(&endpoint->exp_medium_lock);
+
+	if (region)
+		omx_user_region_release(region);
+
+	return 0;
+
+ out:
+	return err;
+}
+
+/*
+ * Check the seqnum against the next one the library will match for this partner.
+ * The library updates it only while processing events, so it may lag behind,
+ * but duplicates of messages whose events are still pending carry the same data.
+ */
+static INLINE int
+omx_exp_medium_seqnum_expected(struct omx_endpoint * endpoint,
+			       const struct omx_evt_recv_msg * event)
+{
+	uint32_t next;
+
+	if (unlikely(event->peer_index >= omx_peer_max || event->src_endpoint >= omx_endpoint_max))
+		return 0;
+
+	next = ACCESS_ONCE(endpoint->exp_medium_seqnums[event->src_endpoint
+							 + event->peer_index * omx_endpoint_max]);
+	if (!(next & OMX_EXP_MEDIUM_SEQNUM_VALID))
+		/* unknown partner, the library will drop it */
+		return 0;
+
+	if (((uint16_t) (event->seqnum ^ next)) & ~OMX_EXP_MEDIUM_SEQNUM_MASK)
+		/* another session */
+		return 0;
+
+	/* not matched yet, either expected or early */
+	return ((event->seqnum - next) & OMX_EXP_MEDIUM_SEQNUM_MASK) <= OMX_EXP_MEDIUM_SEQNUM_EARLY_MAX;
+}
+
+/*
+ * Called by the medium frag receive bottom half once the event is filled.
+ * Returns 1 and updates the event if the fragment was copied into a slot,
+ * 0 if it should go to the recvq as usual.
+ */
+int
+omx_recv_medium_frag_exp(struct omx_endpoint * endpoint,
+			 struct omx_evt_recv_msg * event,
+			 const struct sk_buff * skb,
+			 unsigned long skb_offset)
+{
+	uint32_t msg_length = event->specific.medium_frag.msg_length;
+	uint16_t frag_length = event->specific.medium_frag.frag_length;
+	uint8_t frag_seqnum = event->specific.medium_frag.frag_seqnum;
+#ifdef OMX_MX_WIRE_COMPAT
+	unsigned long frag_offset = (unsigned long) frag_seqnum << event->specific.medium_frag.frag_pipeline;
+#else
+	unsigned long frag_offset = (unsigned long) frag_seqnum * OMX_MEDIUM_FRAG_LENGTH_MAX;
+#endif
+	struct omx_exp_medium_slot * slot = NULL, * best = NULL;
+	struct omx_user_region * region, * done_region = NULL;
+	int i, ret = 0;
+
+	/* racy, but missing a slot being armed is harmless */
+	if (likely(!ACCESS_ONCE(endpoint->exp_medium_slots_nr)))
+		return 0;
+
+	if (unlikely(frag_offset + frag_length > msg_length))
+		return 0;
+
+	spin_lock(&endpoint->exp_medium_lock);
+
+	for(i=0; i<OMX_EXP_MEDIUM_SLOT_NR; i++) {
+		struct omx_exp_medium_slot * cur = &endpoint->exp_medium_slots[i];
+
+		if (!cur->region)
+			continue;
+
+		if (cur->claimed) {
+			if (cur->peer_index == event->peer_index
+			    && cur->src_endpoint == event->src_endpoint
+			    && cur->seqnum == event->seqnum) {
+				slot = cur;
+				break;
+			}
+			continue;
+		}
+
+		/* the oldest armed slot is the one that was posted first */
+		if ((event->match_info & cur->match_mask) == cur->match_info
+		    && (!best || (int32_t) (cur->gen - best->gen) < 0))
+			best = cur;
+	}
+
+	if (!slot) {
+		/* the library matches the oldest receive, even if the message does not fit */
+		if (!best || msg_length > best->length)
+			goto out_with_lock;
+
+		if (unlikely(!omx_exp_medium_seqnum_expected(endpoint, event))) {
+			omx_counter_inc(endpoint->iface, EXP_MEDIUM_OBSOLETE);
+			goto out_with_lock;
+		}
+
+		slot = best;
+		slot->claimed = 1;
+		slot->peer_index = event->peer_index;
+		slot->src_endpoint = event->src_endpoint;
+		slot->seqnum = event->seqnum;
+		memset(slot->frags_received_mask, 0, sizeof(slot->frags_received_mask));
+		slot->accumulated_length = 0;
+	}
+
+	/* the region may have been invalidated meanwhile */
+	region = slot->region;
+	if (unlikely(region->status != OMX_USER_REGION_STATUS_PINNED
+		     || region->total_registered_length < slot->region_offset + frag_offset + frag_length))
+		goto out_with_lock;
+
+	if (unlikely(omx_user_region_fill_pages(region, slot->region_offset + frag_offset,
+						skb, skb_offset, frag_length) < 0))
+		goto out_with_lock;
+
+	if (likely(!(slot->frags_received_mask[frag_seqnum/32] & (1U << (frag_seqnum%32))))) {
+		slot->frags_received_mask[frag_seqnum/32] |= 1U << (frag_seqnum%32);
+		slot->accumulated_length += frag_length;
+	} else {
+		/* the library will drop it as usual */
+		omx_counter_inc(endpoint->iface, EXP_MEDIUM_DUP);
+	}
+
+	event->specific.medium_frag.exp_slot = (slot - endpoint->exp_medium_slots) + 1;
+	event->specific.medium_frag.exp_cookie = slot->cookie;
+
+	if (slot->accumulated_length == msg_length) {
+		/* the library will not release it, it may arm it again after this event */
+		event->specific.medium_frag.exp_flags |= OMX_EVT_MEDIUM_FRAG_EXP_DONE;
+		done_region = omx_exp_medium_slot_free(endpoint, slot);
+	}
+
+	ret = 1;
+
+ out_with_lock:
+	spin_unlock(&endpoint->exp_medium_lock);
+	if (done_region)
+		omx_user_region_release(done_region);
+	return ret;
+}
+
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  c-basic-offset: 8
+ *  c-indent-level: 8
+ * End:
+ */
@@ -487,6 +487,7 @@ omx_iface_attach(struct net_device * ifp)
 	iface->peer.hostname = hostname;
 	iface->peer.index = OMX_UNKNOWN_REVERSE_PEER_INDEX;
 	iface->peer.board_addr = omx_board_addr_from_netdevice(ifp);
+	omx_peer_pull_init(&iface->peer);
 	/* reverse_peer_indexes will be initialized in omx_peers_notify_iface_attach */
 
 	iface->eth_ifp = ifp;
@@ -121,8 +121,14 @@ extern struct omx_iface * omx_shared_fake_iface;
 do {						\
 	iface->counters[OMX_COUNTER_##index]++;	\
 } while (0)
+/* some counters are gauges reporting the last value instead */
+#  define omx_counter_set(iface, index, value)		\
+do {							\
+	iface->counters[OMX_COUNTER_##index] = (value);	\
+} while (0)
 #else
 #  define omx_counter_inc(iface, index) (void) iface /* to silence unused warning */
+#  define omx_counter_set(iface, index, value) (void) iface /* to silence unused warning */
 #endif /* OMX_DRIVER_COUNTERS */
 
 #endif /* __omx_iface_h__ */
@@ -83,6 +83,14 @@ int omx_skb_copy_max = 0;
 module_param_named(skbcopy, omx_skb_copy_max, uint, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(skbcopy, "Maximum length of data to copy in linear skb instead of attaching pages");
 
+int omx_tx_batch = 1;
+module_param_named(txbatch, omx_tx_batch, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(txbatch, "Batch pull reply and medium fragment transmission (0=off, 1=on)");
+
+int omx_recv_steer_enabled = 0;
+module_param_named(recvsteer, omx_recv_steer_enabled, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(recvsteer, "Process incoming packets in the package where the destination endpoint owner runs");
+
 int omx_pin_synchronous = 1;
 module_param_named(pinsync, omx_pin_synchronous, uint, S_IRUGO); /* not writable to simplify things */
 MODULE_PARM_DESC(pinsync, "Pin user regions synchronously on register");
@@ -103,6 +111,10 @@ int omx_pin_invalidate = 0;
 module_param_named(pininvalidate, omx_pin_invalidate, uint, S_IRUGO); /* not writable to simplify things */
 MODULE_PARM_DESC(pininvalidate, "User region pin invalidating when MMU notifiers are supported");
 
+int omx_pull_rails = 1;
+module_param_named(pullrails, omx_pull_rails, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(pullrails, "Maximum number of interfaces to stripe each large message pull across");
+
 unsigned long omx_user_rights = 0;
 module_param_named(userrights, omx_user_rights, ulong, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(userrights, "Mask of privileged operation rights that are granted regular users");
@@ -286,16 +298,17 @@ omx_get_driver_string(unsigned int *lenp)
 	buflen += len;
 
 	len = snprintf(tmp, OMX_DRIVER_STRING_LEN-buflen,
-		       " LargeMessages: %ld requests in parallel, %ld x %ldB pull replies per request\n",
+		       " LargeMessages: %ld requests in parallel, %ld x %ldB pull replies per request, <=%d rails\n",
 		       (unsigned long) OMX_PULL_BLOCK_DESCS_NR,
 		       (unsigned long) OMX_PULL_REPLY_PER_BLOCK,
-		       (unsigned long) OMX_PULL_REPLY_LENGTH_MAX);
+		       (unsigned long) OMX_PULL_REPLY_LENGTH_MAX,
+		       omx_pull_rails);
 	tmp += len;
 	buflen += len;
 
 	len = snprintf(tmp, OMX_DRIVER_STRING_LEN-buflen,
-		       " SkBuff: <=%d frags%s, ForcedCopy <=%dB\n",
-		       omx_skb_frags, omx_skb_frags ? "" : " (always linear)", omx_skb_copy_max);
+		       " SkBuff: <=%d frags%s, ForcedCopy <=%dB, TxBatch %d\n",
+		       omx_skb_frags, omx_skb_frags ? "" : " (always linear)", omx_skb_copy_max, omx_tx_batch);
 	tmp += len;
 	buflen += len;
 
@@ -424,6 +437,11 @@ omx_init(void)
 #ifdef CONFIG_MMU_NOTIFIER
 	if (omx_pin_invalidate && !omx_pin_synchronous)
 		omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_PIN_INVALIDATE;
+#endif
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_SUBMITQ;
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_EXP_MEDIUM;
+#ifndef OMX_MX_WIRE_COMPAT
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_PUSH;
 #endif
 	omx_driver_userdesc->mtu = OMX_MTU;
 	omx_driver_userdesc->medium_frag_length_max = OMX_MEDIUM_FRAG_LENGTH_MAX;
@@ -460,9 +478,11 @@ omx_init(void)
 	if (ret < 0)
 		goto out_with_dma;
 
+	omx_recv_steer_init();
+
 	ret = omx_net_init();
 	if (ret < 0)
-		goto out_with_peers;
+		goto out_with_steer;
 
 	ret = omx_raw_init();
 	if (ret < 0)
@@ -479,6 +499,8 @@ omx_init(void)
 	omx_raw_exit();
  out_with_net:
 	omx_net_exit();
+ out_with_steer:
+	omx_recv_steer_exit();
  out_with_peers:
 	omx_peers_init();
  out_with_dma:
@@ -500,6 +522,7 @@ omx_exit(void)
 	omx_dev_exit();
 	omx_raw_exit();
 	omx_net_exit();
+	omx_recv_steer_exit();
 	omx_peers_exit();
 	omx_dma_exit();
 	del_timer_sync(&omx_driver_userdesc_update_timer);
@@ -56,10 +56,25 @@ do {						\
 	dev_queue_xmit(skb);			\
 } while (0)
 
+/*
+ * add a skb to a batch that omx_xmit_batch_flush() will send at once,
+ * or send it immediately if batching is disabled
+ */
+#define __omx_queue_xmit_batch(iface, batch, skb, type)	\
+do {							\
+	if (!omx_tx_batch) {				\
+		__omx_queue_xmit(iface, skb, type);	\
+	} else {					\
+		omx_counter_inc(iface, SEND_##type);	\
+		skb->dev = iface->eth_ifp;		\
+		__skb_queue_tail(batch, skb);		\
+	}						\
+} while (0)
+
 #ifdef OMX_DRIVER_DEBUG
 extern unsigned long omx_packet_loss;
 extern unsigned long omx_packet_loss_index;
-#define _omx_queue_xmit(iface, skb, type, counter)				\
+#define _omx_xmit_or_drop(skb, type, xmit)					\
 	do {									\
 	if (omx_packet_loss &&							\
 		   (++omx_packet_loss_index >= omx_packet_loss)) {		\
@@ -70,14 +85,20 @@ extern unsigned long omx_packet_loss_index;
 		dev_kfree_skb(skb);						\
 		omx_##type##_packet_loss_index = 0;				\
 	} else {								\
-		__omx_queue_xmit(iface, skb, counter);				\
+		xmit;								\
 	}									\
 } while (0)
 #else /* !OMX_DRIVER_DEBUG */
-#define _omx_queue_xmit(iface, skb, type, counter) __omx_queue_xmit(iface, skb, counter)
+#define _omx_xmit_or_drop(skb, type, xmit) do { xmit; } while (0)
 #endif /* !OMX_DRIVER_DEBUG */
 
+#define _omx_queue_xmit(iface, skb, type, counter) \
+	_omx_xmit_or_drop(skb, type, __omx_queue_xmit(iface, skb, counter))
+#define _omx_queue_xmit_batch(iface, batch, skb, type, counter) \
+	_omx_xmit_or_drop(skb, type, __omx_queue_xmit_batch(iface, batch, skb, counter))
+
 #define omx_queue_xmit(iface, skb, type) _omx_queue_xmit(iface, skb, type, type)
+#define omx_queue_xmit_batch(iface, batch, skb, type) _omx_queue_xmit_batch(iface, batch, skb, type, type)
 
 /* translate omx_endpoint_acquire_by_iface_index return values into nack type */
 static inline __pure enum omx_nack_type
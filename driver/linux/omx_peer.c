@@ -72,6 +72,21 @@ static int omx_host_query_magic = 0x13052008;
 
 #define OMX_PEER_ADDR_HASH_NR 256
 
+/*
+ * bumped whenever the rails that omx_peer_get_rails() would find may change:
+ * peers added, renamed or removed, ifaces attached or detached,
+ * reverse indexes learnt
+ */
+static atomic_t omx_peer_rails_generation = ATOMIC_INIT(0);
+
+static inline void
+omx_peer_rails_invalidate(void)
+{
+	/* order the table update before the generation change, for lockless readers */
+	smp_wmb();
+	atomic_inc(&omx_peer_rails_generation);
+}
+
 /* forward declaration */
 static void omx_peer_host_query(const struct omx_peer *peer);
 
@@ -123,6 +138,8 @@ omx_init_iface_reverse_indexes(struct omx_iface *iface)
 
 	/* set this iface iface to itself (in case it wasn't in the iface array yet) */
 	iface->reverse_peer_indexes[iface->peer.index] = iface->peer.index;
+
+	omx_peer_rails_invalidate();
 }
 
 /************************
@@ -221,6 +238,8 @@ omx_peers_clear(int local)
 		}
 	}
 
+	omx_peer_rails_invalidate();
+
 	omx_ifaces_peers_unlock();
 }
 
@@ -337,6 +356,7 @@ omx_peer_add(uint64_t board_addr, const char *hostname)
 		peer->board_addr = board_addr;
 		peer->hostname = new_hostname;
 		peer->local_iface = NULL;
+		omx_peer_pull_init(peer);
 
 		if (!new_hostname) {
 			int listwasempty = list_empty(&omx_host_query_peer_list);
@@ -371,6 +391,9 @@ omx_peer_add(uint64_t board_addr, const char *hostname)
 	if (needshostquery)
 		omx_peer_host_query(peer);
 
+	/* new peer or new hostname */
+	omx_peer_rails_invalidate();
+
 	omx_ifaces_peers_unlock();
 
 	return 0;
@@ -508,6 +531,8 @@ omx_peers_notify_iface_detach(struct omx_iface * iface)
 		peer->index = OMX_UNKNOWN_REVERSE_PEER_INDEX;
 		peer->local_iface = NULL;
 
+		omx_peer_rails_invalidate();
+
 		/* release the iface reference now it is not linked in the peer table anymore */
 		omx_iface_release(iface);
 	}
@@ -569,6 +594,7 @@ omx_peer_set_reverse_index(struct omx_peer *peer, struct omx_iface *iface, uint1
 				reverse_index);
 
 		iface->reverse_peer_indexes[peer->index] = reverse_index;
+		omx_peer_rails_invalidate();
 	}
 }
 
@@ -682,6 +708,20 @@ omx_peer_lookup_by_index(uint32_t index,
 	return err;
 }
 
+/*
+ * Fast lookup of the peer structure by index, may be called from the BH.
+ *
+ * Must be called from mutex or RCU-read locked context.
+ */
+struct omx_peer *
+omx_peer_lookup_by_index_locked(uint32_t index)
+{
+	if (index >= omx_peer_max)
+		return NULL;
+
+	return rcu_dereference(omx_peer_array[index]);
+}
+
 /*
  * Fast version of omx_peer_lookup_by_addr where we don't care about
  * the peer hostname and thus may use RCU locking, and thus may be
@@ -778,6 +818,153 @@ omx_peer_lookup_by_hostname(const char *hostname,
 	return -EINVAL;
 }
 
+/*
+ * Find other local ifaces reaching the host behind a peer index,
+ * to stripe large pulls across them.
+ *
+ * Hostnames are "nodename:ifacenumber", so the other ifaces of the remote host
+ * are the peers whose hostname has the same prefix before the last ':'.
+ * A local iface is a rail if it knows its reverse index in the table of
+ * such a peer, meaning that they exchanged packets already.
+ *
+ * Scanning the whole peer table for each iface is expensive, so the result
+ * is cached in the peer until omx_peer_rails_invalidate() is called.
+ *
+ * Fills up to max acquired ifaces (never home) and the corresponding peer
+ * indexes, and returns the number of rails that were found.
+ *
+ * Cannot be called by BH.
+ */
+static int
+omx_peer_get_cached_rails(struct omx_peer *peer, const struct omx_iface *home,
+			  struct omx_iface **ifaces, uint16_t *peer_indexes, int max)
+{
+	int generation = atomic_read(&omx_peer_rails_generation);
+	int nr = -1;
+	int i;
+
+	/* see the table updates that came before this generation */
+	smp_rmb();
+
+	spin_lock(&peer->rails_lock);
+	if (peer->rails_home == home->index && peer->rails_generation == generation) {
+		nr = 0;
+		for(i=0; i<peer->rails_nr && nr<max; i++) {
+			struct omx_iface *iface = rcu_dereference(omx_ifaces[peer->rails_iface_indexes[i]]);
+			if (!iface || iface->status != OMX_IFACE_STATUS_OK)
+				continue;
+
+			omx_iface_reacquire(iface);
+			ifaces[nr] = iface;
+			peer_indexes[nr] = peer->rails_peer_indexes[i];
+			nr++;
+		}
+	}
+	spin_unlock(&peer->rails_lock);
+
+	return nr;
+}
+
+int
+omx_peer_get_rails(uint16_t index, const struct omx_iface *home,
+		   struct omx_iface **ifaces, uint16_t *peer_indexes, int max)
+{
+	uint16_t rails_iface_indexes[OMX_PEER_RAILS_MAX];
+	uint16_t rails_peer_indexes[OMX_PEER_RAILS_MAX];
+	struct omx_peer *peer;
+	const char *colon;
+	size_t prefix_len;
+	int generation;
+	int nr = 0;
+	int i, j, k;
+
+	might_sleep();
+
+	if (index >= omx_peer_max || max <= 0)
+		return 0;
+	if (max > OMX_PEER_RAILS_MAX)
+		max = OMX_PEER_RAILS_MAX;
+
+	/* fast path, the rails of this peer did not change */
+	rcu_read_lock();
+	peer = rcu_dereference(omx_peer_array[index]);
+	if (!peer || peer->local_iface) {
+		rcu_read_unlock();
+		return 0;
+	}
+	nr = omx_peer_get_cached_rails(peer, home, ifaces, peer_indexes, max);
+	rcu_read_unlock();
+	if (nr >= 0)
+		return nr;
+
+	nr = 0;
+	omx_ifaces_peers_lock();
+
+	generation = atomic_read(&omx_peer_rails_generation);
+	smp_rmb();
+
+	peer = rcu_dereference_protected(omx_peer_array[index], 1);
+	if (!peer || peer->local_iface)
+		goto out_with_lock;
+
+	/* no rails until we know the peer hostname */
+	if (!peer->hostname)
+		goto out_with_cache;
+	colon = strrchr(peer->hostname, ':');
+	if (!colon)
+		goto out_with_cache;
+	prefix_len = colon - peer->hostname + 1;
+
+	/* always look for all possible rails, callers use a prefix of them */
+	for(i=0; i<omx_iface_max && nr<OMX_PEER_RAILS_MAX; i++) {
+		struct omx_iface *iface = rcu_dereference_protected(omx_ifaces[i], 1);
+		if (!iface || iface == home || iface->status != OMX_IFACE_STATUS_OK)
+			continue;
+
+		for(j=0; j<omx_peer_next_nr; j++) {
+			struct omx_peer *other = rcu_dereference_protected(omx_peer_array[j], 1);
+			if (!other || other == peer || other->local_iface || !other->hostname
+			    || strncmp(other->hostname, peer->hostname, prefix_len)
+			    || strchr(other->hostname + prefix_len, ':')
+			    || iface->reverse_peer_indexes[j] == OMX_UNKNOWN_REVERSE_PEER_INDEX)
+				continue;
+
+			/* each remote iface is only used by one rail */
+			for(k=0; k<nr; k++)
+				if (rails_peer_indexes[k] == j)
+					break;
+			if (k < nr)
+				continue;
+
+			rails_iface_indexes[nr] = i;
+			rails_peer_indexes[nr] = j;
+			nr++;
+			break;
+		}
+	}
+
+ out_with_cache:
+	spin_lock(&peer->rails_lock);
+	peer->rails_generation = generation;
+	peer->rails_home = home->index;
+	peer->rails_nr = nr;
+	memcpy(peer->rails_iface_indexes, rails_iface_indexes, nr * sizeof(rails_iface_indexes[0]));
+	memcpy(peer->rails_peer_indexes, rails_peer_indexes, nr * sizeof(rails_peer_indexes[0]));
+	spin_unlock(&peer->rails_lock);
+
+	if (nr > max)
+		nr = max;
+	for(i=0; i<nr; i++) {
+		ifaces[i] = rcu_dereference_protected(omx_ifaces[rails_iface_indexes[i]], 1);
+		omx_iface_reacquire(ifaces[i]);
+		peer_indexes[i] = rails_peer_indexes[i];
+	}
+
+ out_with_lock:
+	omx_ifaces_peers_unlock();
+	return nr;
+}
+
 /******************************
  * Host Query/Reply Management
  */
@@ -990,6 +1177,7 @@ omx_process_host_queries_and_replies_workfunc(omx_work_struct_data_t data)
 			}
 			peer->hostname = new_hostname;
 			kfree(old_hostname);
+			omx_peer_rails_invalidate();
 
 			/* update the peer reverse index */
 			reverse_peer_index = OMX_NTOH_16(reply_n->src_dst_peer_index);
@@ -1119,6 +1307,8 @@ omx_peers_clear_names(void)
 	/* increase the magic to avoid obsolete host_reply packets */
 	omx_host_query_magic++;
 
+	omx_peer_rails_invalidate();
+
 	omx_ifaces_peers_unlock();
 }
 
@@ -20,6 +20,7 @@
 #define __omx_peer_h__
 
 #include <linux/rcupdate.h>
+#include <linux/spinlock.h>
 
 struct omx_iface;
 struct omx_pkt_head;
@@ -48,9 +49,14 @@ extern int omx_peer_lookup_by_index(uint32_t index, uint64_t *board_addr, char *
 extern int omx_peer_lookup_by_addr(uint64_t board_addr, char *hostname, uint32_t *index);
 extern int omx_peer_lookup_by_hostname(const char *hostname, uint64_t *board_addr, uint32_t *index);
 extern struct omx_peer * omx_peer_lookup_by_addr_locked(uint64_t board_addr);
+extern struct omx_peer * omx_peer_lookup_by_index_locked(uint32_t index);
+extern int omx_peer_get_rails(uint16_t index, const struct omx_iface *home, struct omx_iface **ifaces, uint16_t *peer_indexes, int max);
 
 #define OMX_UNKNOWN_REVERSE_PEER_INDEX ((uint32_t)-1)
 
+/* maximal number of other local ifaces cached as rails towards a peer */
+#define OMX_PEER_RAILS_MAX 3
+
 struct omx_peer {
 	uint64_t board_addr;
 	char *hostname;
@@ -60,9 +66,38 @@ struct omx_peer {
 
 	struct list_head host_query_list_elt;
 
+	/* adaptive pull state, shared by all pull handles towards this peer */
+	spinlock_t pull_lock;
+	uint32_t pull_srtt; /* smoothed block rtt in usecs, scaled by 8, 0 until the first sample */
+	uint32_t pull_rttvar; /* block rtt variation in usecs, scaled by 4 */
+	uint32_t pull_window; /* number of blocks in flight, 0 for the whole pipeline */
+	uint32_t pull_window_good_blocks; /* blocks completed without loss at the current window */
+
+	/* rails found by omx_peer_get_rails(), valid while the generation did not change */
+	spinlock_t rails_lock;
+	int rails_generation;
+	int rails_home; /* index of the iface they were computed for, -1 if none yet */
+	int rails_nr;
+	uint16_t rails_iface_indexes[OMX_PEER_RAILS_MAX];
+	uint16_t rails_peer_indexes[OMX_PEER_RAILS_MAX];
+
 	struct rcu_head rcu_head; /* rcu deferred free callback */
 };
 
+/* start with the whole pull pipeline, no rtt estimate and no rails */
+static inline void
+omx_peer_pull_init(struct omx_peer *peer)
+{
+	spin_lock_init(&peer->pull_lock);
+	peer->pull_srtt = 0;
+	peer->pull_rttvar = 0;
+	peer->pull_window = 0;
+	peer->pull_window_good_blocks = 0;
+	spin_lock_init(&peer->rails_lock);
+	peer->rails_home = -1;
+	peer->rails_nr = 0;
+}
+
 #endif /* __omx_peer_h__ */
 
 /*
@@ -22,6 +22,7 @@
 #include <linux/kref.h>
 #include <linux/timer.h>
 #include <linux/workqueue.h>
+#include <linux/ktime.h>
 
 #include "omx_misc.h"
 #include "omx_hal.h"
@@ -38,8 +39,13 @@
  * Pull-specific Constants
  */
 
+/* initial timeout until the peer rtt is known, and upper bound of the backoff */
 #define OMX_PULL_RETRANSMIT_TIMEOUT_MS	1000
 #define OMX_PULL_RETRANSMIT_TIMEOUT_JIFFIES (OMX_PULL_RETRANSMIT_TIMEOUT_MS*HZ/1000)
+/* lower bound of the rtt-based timeout, at least 2 jiffies to survive timer granularity */
+#define OMX_PULL_RETRANSMIT_TIMEOUT_MIN_MS	20
+#define OMX_PULL_RETRANSMIT_TIMEOUT_MIN_JIFFIES \
+	(OMX_PULL_RETRANSMIT_TIMEOUT_MIN_MS*HZ/1000 > 2 ? OMX_PULL_RETRANSMIT_TIMEOUT_MIN_MS*HZ/1000 : 2)
 
 #ifdef OMX_MX_WIRE_COMPAT
 #if OMX_PULL_REPLY_LENGTH_MAX >= 65536
@@ -49,6 +55,20 @@
 
 #define OMX_ENDPOINT_PULL_MAGIC_XOR 0x21071980
 
+/*
+ * Requests sent on another rail carry the rail number and the home iface
+ * in their magic since the replies and nacks come back on the rail iface.
+ * The home rail keeps the plain endpoint index.
+ */
+#define OMX_PULL_MAGIC_ENDPOINT(value) ((value) & 0xff)
+#define OMX_PULL_MAGIC_RAIL(value) (((value) >> 8) & 0xff)
+#define OMX_PULL_MAGIC_HOME_IFACE(value) ((value) >> 16) /* iface index + 1 */
+
+/* maximal number of ifaces a single pull is striped across, including the home one */
+#define OMX_PULL_RAILS_MAX 4
+/* consecutive timeouts of blocks on a rail before we stop using it */
+#define OMX_PULL_RAIL_TIMEOUTS_MAX 2
+
 /**********************
  * Pull-specific Types
  */
@@ -97,6 +117,18 @@ struct omx_pull_block_desc {
 	uint32_t block_length;
 	uint32_t first_frame_offset;
 	omx_block_frame_bitmask_t frames_missing_bitmap; /* frames not received at all */
+	uint32_t nr_requests; /* only blocks requested once give rtt samples */
+	ktime_t last_request_time;
+	uint8_t rail; /* chosen when first requested */
+};
+
+struct omx_pull_rail {
+	struct omx_iface * iface; /* acquired, except for the home rail */
+	struct omx_pkt_head head; /* eth and peer index to reach the pulled host through this iface */
+	uint32_t magic;
+	uint32_t nr_blocks; /* blocks in flight on this rail */
+	uint32_t nr_timeouts; /* consecutive timeouts since the last block done */
+	int down;
 };
 
 struct omx_pull_handle {
@@ -114,6 +146,7 @@ struct omx_pull_handle {
 	struct omx_user_region * region;
 	uint32_t total_length;
 	uint32_t pulled_rdma_offset;
+	uint32_t puller_rdma_offset;
 
 	/* current status */
 	spinlock_t lock;
@@ -127,6 +160,15 @@ struct omx_pull_handle {
 	uint32_t already_rerequested_blocks; /* amount of first blocks that were requested again since the last timer */
 	struct omx_pull_block_desc block_desc[OMX_PULL_BLOCK_DESCS_NR];
 
+	/* adaptive pipeline, cached from the peer */
+	uint16_t peer_index;
+	uint32_t window; /* number of blocks to keep in flight */
+	unsigned long retransmit_timeout_jiffies;
+
+	/* multi-rail striping, rail 0 is the endpoint iface */
+	uint32_t nr_rails;
+	struct omx_pull_rail rails[OMX_PULL_RAILS_MAX];
+
 	/* synchronous host copies */
 	uint32_t host_copy_nr_frames; /* frames received but not copied yet*/
 
@@ -146,6 +188,7 @@ struct omx_pull_handle {
 };
 
 static void omx_pull_handle_timeout_handler(unsigned long data);
+static void omx_pull_handle_rails_exit(struct omx_pull_handle *handle);
 
 #ifdef OMX_HAVE_DMA_ENGINE
 static void omx_pull_handle_poll_dma_completions(struct omx_pull_handle *handle);
@@ -185,8 +228,10 @@ static void omx_pull_handle_deferred_dma_completions_wait_workfunc(omx_work_stru
 /*
  * Notes about retransmission:
  *
- * The puller requests OMX_PULL_BLOCK_DESCS_NR blocks of data, and waits for
- * OMX_PULL_REPLY_PER_BLOCK replies for each of them.
+ * The puller requests up to OMX_PULL_BLOCK_DESCS_NR blocks of data, and waits for
+ * OMX_PULL_REPLY_PER_BLOCK replies for each of them. The actual number of blocks
+ * in flight is a per-peer window. It grows by one block once a window worth of
+ * blocks completed without any loss, and it is halved on each loss.
  *
  * A timer is set to detect when nothing has been received for a while.  It is
  * updated every time a new reply is received. This timer repost requests to
@@ -200,7 +245,29 @@ static void omx_pull_handle_deferred_dma_completions_wait_workfunc(omx_work_stru
  * In the end, the timer is only called if:
  * + one packet is lost in all outstanding blocks
  * + or one packet is missing in the first block after one optimistic re-request.
- * So the timeout doesn't need to be short, 1 second is enough.
+ *
+ * The timeout is computed per peer like TCP does, srtt + 4*rttvar, from the
+ * time it takes to complete blocks that were requested only once (Karn).
+ * It starts at 1 second until the first sample, and it doubles each time
+ * the timer expires for a handle.
+ */
+
+/*
+ * Notes about multi-rail striping:
+ *
+ * When several local ifaces reach the pulled host (up to the pullrails module
+ * parameter), each new block is requested through the rail with the fewest
+ * blocks in flight. Nothing changes on the wire: the request targets the
+ * pulled host iface on this rail, and the pulled driver finds the endpoint
+ * on its other ifaces thanks to the session id if needed. Replies come back
+ * on the rail iface and are copied by msg offset as usual, while the magic
+ * tells which home iface owns the handle.
+ *
+ * Blocks on different rails may complete out of order, so an early block
+ * completion only means a loss for previous blocks on the same rail.
+ * A rail is not used anymore once it received a nack or its blocks timed
+ * out too many times in a row, or when its iface goes away. Its pending
+ * blocks are requested again through the home iface.
  */
 
 #ifdef OMX_DRIVER_DEBUG
@@ -244,6 +311,8 @@ __omx_pull_handle_last_release(struct kref * kref)
 	/* release the region now that we are sure that nobody else uses it */
 	omx_user_region_release(handle->region);
 
+	omx_pull_handle_rails_exit(handle);
+
 	kfree(handle);
 }
 
@@ -515,6 +584,358 @@ omx_endpoint_pull_handles_exit(struct omx_endpoint * endpoint)
 	omx_pull_handle_slots_exit(endpoint);
 }
 
+/*****************************************
+ * Adaptive window and retransmit timeout
+ */
+
+static INLINE unsigned long
+omx_pull_peer_retransmit_timeout(const struct omx_peer * peer)
+{
+	unsigned long rto;
+
+	if (!peer->pull_srtt)
+		return OMX_PULL_RETRANSMIT_TIMEOUT_JIFFIES;
+
+	/* srtt is scaled by 8 and rttvar by 4, so this is srtt + 4*rttvar */
+	rto = usecs_to_jiffies((peer->pull_srtt >> 3) + peer->pull_rttvar);
+	if (rto < OMX_PULL_RETRANSMIT_TIMEOUT_MIN_JIFFIES)
+		rto = OMX_PULL_RETRANSMIT_TIMEOUT_MIN_JIFFIES;
+	else if (rto > OMX_PULL_RETRANSMIT_TIMEOUT_JIFFIES)
+		rto = OMX_PULL_RETRANSMIT_TIMEOUT_JIFFIES;
+	return rto;
+}
+
+static INLINE uint32_t
+omx_pull_peer_window(const struct omx_peer * peer)
+{
+	return peer->pull_window ? peer->pull_window : OMX_PULL_BLOCK_DESCS_NR;
+}
+
+/* Called with the handle locked when creating it */
+static INLINE void
+omx_pull_handle_get_peer_state(struct omx_pull_handle * handle)
+{
+	struct omx_peer * peer;
+
+	handle->window = OMX_PULL_BLOCK_DESCS_NR;
+	handle->retransmit_timeout_jiffies = OMX_PULL_RETRANSMIT_TIMEOUT_JIFFIES;
+
+	rcu_read_lock();
+	peer = omx_peer_lookup_by_index_locked(handle->peer_index);
+	if (likely(peer)) {
+		spin_lock_bh(&peer->pull_lock);
+		handle->window = omx_pull_peer_window(peer);
+		handle->retransmit_timeout_jiffies = omx_pull_peer_retransmit_timeout(peer);
+		spin_unlock_bh(&peer->pull_lock);
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Called with the handle locked when a block completes.
+ * Blocks that were requested only once update the peer rtt estimation
+ * and let the window grow.
+ */
+static void
+omx_pull_handle_block_done(struct omx_pull_handle * handle,
+			   const struct omx_pull_block_desc * desc)
+{
+	struct omx_iface * iface = handle->endpoint->iface;
+	struct omx_peer * peer;
+	uint32_t rtt, window;
+	long delta;
+
+	if (handle->nr_rails > 1) {
+		handle->rails[desc->rail].nr_blocks--;
+		handle->rails[desc->rail].nr_timeouts = 0;
+	}
+
+	if (desc->nr_requests != 1)
+		return;
+
+	rtt = ktime_to_us(ktime_sub(ktime_get(), desc->last_request_time));
+	if (!rtt)
+		rtt = 1; /* a null srtt means no sample */
+
+	rcu_read_lock();
+	peer = omx_peer_lookup_by_index_locked(handle->peer_index);
+	if (unlikely(!peer))
+		/* the peer went away, keep the cached values */
+		goto out_with_rcu;
+
+	spin_lock_bh(&peer->pull_lock);
+
+	if (!peer->pull_srtt) {
+		peer->pull_srtt = rtt << 3;
+		peer->pull_rttvar = rtt << 1;
+	} else {
+		/* srtt = 7/8 srtt + 1/8 rtt, rttvar = 3/4 rttvar + 1/4 |rtt - srtt| */
+		delta = (long) rtt - (long) (peer->pull_srtt >> 3);
+		peer->pull_srtt += delta;
+		if (delta < 0)
+			delta = -delta;
+		peer->pull_rttvar += delta - (long) (peer->pull_rttvar >> 2);
+	}
+	omx_counter_inc(iface, PULL_RTT_SAMPLE);
+
+	window = omx_pull_peer_window(peer);
+	if (window < OMX_PULL_BLOCK_DESCS_NR
+	    && ++peer->pull_window_good_blocks >= window) {
+		peer->pull_window = ++window;
+		peer->pull_window_good_blocks = 0;
+		omx_counter_inc(iface, PULL_WINDOW_GROW);
+	}
+
+	handle->window = window;
+	handle->retransmit_timeout_jiffies = omx_pull_peer_retransmit_timeout(peer);
+
+	omx_counter_set(iface, PULL_LAST_SRTT_US, peer->pull_srtt >> 3);
+	omx_counter_set(iface, PULL_LAST_RTO_US, jiffies_to_usecs(handle->retransmit_timeout_jiffies));
+
+	spin_unlock_bh(&peer->pull_lock);
+
+ out_with_rcu:
+	rcu_read_unlock();
+}
+
+/*
+ * Called with the handle locked when some blocks have to be requested again.
+ * Halves the peer window.
+ */
+static void
+omx_pull_handle_loss(struct omx_pull_handle * handle)
+{
+	struct omx_iface * iface = handle->endpoint->iface;
+	struct omx_peer * peer;
+	uint32_t window;
+
+	rcu_read_lock();
+	peer = omx_peer_lookup_by_index_locked(handle->peer_index);
+	if (unlikely(!peer))
+		goto out_with_rcu;
+
+	spin_lock_bh(&peer->pull_lock);
+
+	window = omx_pull_peer_window(peer);
+	if (window > 1) {
+		window /= 2;
+		omx_counter_inc(iface, PULL_WINDOW_SHRINK);
+	}
+	peer->pull_window = window;
+	peer->pull_window_good_blocks = 0;
+	handle->window = window;
+
+	spin_unlock_bh(&peer->pull_lock);
+
+ out_with_rcu:
+	rcu_read_unlock();
+}
+
+/****************************
+ * Multi-rail block striping
+ */
+
+/* Called before the handle is locked since looking for rails may sleep */
+static void
+omx_pull_handle_rails_init(struct omx_endpoint * endpoint,
+			   struct omx_pull_handle * handle,
+			   const struct omx_cmd_pull * cmd)
+{
+	struct omx_iface * ifaces[OMX_PULL_RAILS_MAX-1];
+	uint16_t peer_indexes[OMX_PULL_RAILS_MAX-1];
+	int max = min(omx_pull_rails, OMX_PULL_RAILS_MAX) - 1;
+	int nr, i;
+
+	BUILD_BUG_ON(OMX_PULL_RAILS_MAX-1 > OMX_PEER_RAILS_MAX);
+
+	memset(&handle->rails[0], 0, sizeof(handle->rails[0]));
+	handle->rails[0].iface = endpoint->iface;
+	handle->nr_rails = 1;
+
+	/* nothing to stripe if a single block is needed */
+	if (max <= 0 || cmd->length <= OMX_PULL_BLOCK_LENGTH_MAX)
+		return;
+
+	nr = omx_peer_get_rails(cmd->peer_index, endpoint->iface, ifaces, peer_indexes, max);
+	for(i=0; i<nr; i++) {
+		struct omx_pull_rail * rail = &handle->rails[handle->nr_rails];
+		struct ethhdr * eh = &rail->head.eth;
+
+		memset(rail, 0, sizeof(*rail));
+		if (omx_set_target_peer(&rail->head, ifaces[i], peer_indexes[i]) < 0) {
+			omx_iface_release(ifaces[i]);
+			continue;
+		}
+		eh->h_proto = __constant_cpu_to_be16(ETH_P_OMX);
+		memcpy(eh->h_source, ifaces[i]->eth_ifp->dev_addr, sizeof (eh->h_source));
+
+		rail->iface = ifaces[i];
+		rail->magic = (endpoint->endpoint_index
+			       | (handle->nr_rails << 8)
+			       | ((endpoint->iface->index + 1) << 16))
+			^ OMX_ENDPOINT_PULL_MAGIC_XOR;
+		handle->nr_rails++;
+	}
+
+	if (handle->nr_rails > 1)
+		dprintk(PULL, "striping pull handle %p across %d rails\n",
+			handle, handle->nr_rails);
+}
+
+static void
+omx_pull_handle_rails_exit(struct omx_pull_handle * handle)
+{
+	int i;
+
+	for(i=1; i<handle->nr_rails; i++)
+		omx_iface_release(handle->rails[i].iface);
+	handle->nr_rails = 1;
+}
+
+/* Called with the handle locked */
+static void
+omx_pull_handle_rail_down(struct omx_pull_handle * handle, int irail)
+{
+	struct omx_pull_rail * rail = &handle->rails[irail];
+
+	if (rail->down)
+		return;
+
+	rail->down = 1;
+	omx_counter_inc(handle->endpoint->iface, PULL_RAIL_DOWN);
+	dprintk(PULL, "pull handle %p stops using rail #%d (iface %s)\n",
+		handle, irail, rail->iface->eth_ifp->name);
+}
+
+/*
+ * Called with the handle locked when requesting a block.
+ * New blocks go to the least loaded rail, blocks requested again
+ * stay on their rail unless it is down.
+ */
+static INLINE void
+omx_pull_handle_block_rail(struct omx_pull_handle * handle,
+			   struct omx_pull_block_desc * desc)
+{
+	struct omx_pull_rail * rail;
+	int i, best;
+
+	if (likely(handle->nr_rails == 1))
+		return;
+
+	if (desc->nr_requests) {
+		if (!desc->rail)
+			return;
+
+		rail = &handle->rails[desc->rail];
+		if (unlikely(rail->iface->status != OMX_IFACE_STATUS_OK))
+			omx_pull_handle_rail_down(handle, desc->rail);
+		if (likely(!rail->down))
+			return;
+
+		/* move the block back to the home rail */
+		rail->nr_blocks--;
+		desc->rail = 0;
+		handle->rails[0].nr_blocks++;
+		return;
+	}
+
+	best = 0;
+	for(i=1; i<handle->nr_rails; i++) {
+		rail = &handle->rails[i];
+		if (unlikely(rail->iface->status != OMX_IFACE_STATUS_OK))
+			omx_pull_handle_rail_down(handle, i);
+		if (rail->down)
+			continue;
+		if (rail->nr_blocks < handle->rails[best].nr_blocks)
+			best = i;
+	}
+	desc->rail = best;
+	handle->rails[best].nr_blocks++;
+}
+
+/*
+ * Called with the handle locked when the timer expires.
+ * Rails whose blocks keep timing out are not used anymore.
+ */
+static INLINE void
+omx_pull_handle_rails_timeout(struct omx_pull_handle * handle)
+{
+	uint32_t timedout = 0;
+	int i;
+
+	if (likely(handle->nr_rails == 1))
+		return;
+
+	for(i=0; i<handle->nr_valid_block_descs; i++)
+		if (handle->block_desc[i].frames_missing_bitmap)
+			timedout |= 1U << handle->block_desc[i].rail;
+
+	for(i=1; i<handle->nr_rails; i++)
+		if ((timedout & (1U << i))
+		    && ++handle->rails[i].nr_timeouts >= OMX_PULL_RAIL_TIMEOUTS_MAX)
+			omx_pull_handle_rail_down(handle, i);
+}
+
+/*
+ * Called with the handle locked when block idesc completed before block i.
+ * Blocks on other rails may just be slower.
+ */
+static INLINE int
+omx_pull_handle_block_maybe_lost(const struct omx_pull_handle * handle,
+				 int i, int idesc)
+{
+	uint8_t rail = handle->block_desc[i].rail;
+
+	return handle->nr_rails == 1
+		|| rail == handle->block_desc[idesc].rail
+		|| handle->rails[rail].down;
+}
+
+static INLINE int
+omx_pull_handle_blocks_maybe_lost(const struct omx_pull_handle * handle,
+				  int idesc)
+{
+	int i;
+
+	if (likely(handle->nr_rails == 1))
+		return 1;
+
+	for(i=handle->already_rerequested_blocks; i<idesc; i++)
+		if (handle->block_desc[i].frames_missing_bitmap
+		    && omx_pull_handle_block_maybe_lost(handle, i, idesc))
+			return 1;
+	return 0;
+}
+
+/*
+ * Acquire the endpoint owning a pull handle from the magic
+ * of a reply or nack that arrived on iface.
+ */
+static struct omx_endpoint *
+omx_pull_magic_acquire_endpoint(struct omx_iface * iface, uint32_t magic)
+{
+	uint32_t value = magic ^ OMX_ENDPOINT_PULL_MAGIC_XOR;
+	uint32_t home = OMX_PULL_MAGIC_HOME_IFACE(value);
+	struct omx_endpoint * endpoint;
+
+	if (likely(!home))
+		return omx_endpoint_acquire_by_iface_index(iface, OMX_PULL_MAGIC_ENDPOINT(value));
+
+	/* came through another rail, the endpoint is attached to the home iface */
+	if (unlikely(home > omx_iface_max))
+		return ERR_PTR(-EINVAL);
+
+	rcu_read_lock();
+	iface = rcu_dereference(omx_ifaces[home-1]);
+	if (likely(iface))
+		endpoint = omx_endpoint_acquire_by_iface_index(iface, OMX_PULL_MAGIC_ENDPOINT(value));
+	else
+		endpoint = ERR_PTR(-ENOENT);
+	rcu_read_unlock();
+
+	return endpoint;
+}
+
 /************************
  * Pull handles creation
  */
@@ -590,6 +1011,9 @@ omx_pull_handle_create(struct omx_endpoint * endpoint,
 	/* initialize the lock, we will acquire it soon */
 	spin_lock_init(&handle->lock);
 
+	/* look for other rails while we may still sleep */
+	omx_pull_handle_rails_init(endpoint, handle, cmd);
+
 	spin_lock_bh(&endpoint->pull_handles_lock);
 
 	err = omx_pull_handle_alloc_slot(endpoint, handle);
@@ -609,6 +1033,7 @@ omx_pull_handle_create(struct omx_endpoint * endpoint,
 	handle->region = (struct omx_user_region *) region;
 	handle->total_length = cmd->length;
 	handle->pulled_rdma_offset = cmd->pulled_rdma_offset;
+	handle->puller_rdma_offset = cmd->puller_rdma_offset;
 
 	/* initialize variable stuff */
 	handle->status = OMX_PULL_HANDLE_STATUS_OK;
@@ -622,6 +1047,8 @@ omx_pull_handle_create(struct omx_endpoint * endpoint,
 		handle->block_desc[i].frames_missing_bitmap = 0; /* make sure the invalid block descs are easy to check */
 	handle->already_rerequested_blocks = 0;
 	handle->last_retransmit_jiffies = get_jiffies_64() + cmd->resend_timeout_jiffies;
+	handle->peer_index = cmd->peer_index;
+	omx_pull_handle_get_peer_state(handle);
 
 	handle->host_copy_nr_frames = 0;
 
@@ -667,6 +1094,7 @@ omx_pull_handle_create(struct omx_endpoint * endpoint,
 	spin_unlock_bh(&endpoint->pull_handles_lock);
 	spin_unlock(&handle->lock);
  out_with_handle:
+	omx_pull_handle_rails_exit(handle);
 	kfree(handle);
  out:
 	return ERR_PTR(err);
@@ -775,6 +1203,8 @@ omx_pull_handle_append_needed_frames(struct omx_pull_handle * handle,
 	desc->block_length = block_length;
 	desc->first_frame_offset = first_frame_offset;
 	desc->frames_missing_bitmap = new_mask;
+	desc->nr_requests = 0;
+	desc->rail = 0;
 
 	handle->nr_requested_frames += new_frames;
 	handle->nr_missing_frames += new_frames;
@@ -810,11 +1240,16 @@ omx_pull_handle_first_block_done(struct omx_pull_handle * handle)
  * Sending pull requests
  */
 
-/* Called with the handle acquired and locked */
+/*
+ * Called with the handle acquired and locked.
+ * If the block goes through another rail, its iface is returned as acquired
+ * in rail_iface since the handle may go away before the request is sent.
+ */
 static INLINE struct sk_buff *
-omx_fill_pull_block_request(const struct omx_pull_handle * handle, int desc_nr)
+omx_fill_pull_block_request(struct omx_pull_handle * handle, int desc_nr,
+			    struct omx_iface ** rail_iface)
 {
-	const struct omx_pull_block_desc * desc = &handle->block_desc[desc_nr];
+	struct omx_pull_block_desc * desc = &handle->block_desc[desc_nr];
 	struct omx_iface * iface = handle->endpoint->iface;
 	uint32_t frame_index = desc->frame_index;
 	uint32_t block_length = desc->block_length;
@@ -839,6 +1274,17 @@ omx_fill_pull_block_request(const struct omx_pull_handle * handle, int desc_nr)
 	/* copy common pkt hdrs from the handle */
 	memcpy(mh, &handle->pkt_hdr, sizeof(handle->pkt_hdr));
 
+	omx_pull_handle_block_rail(handle, desc);
+	if (desc->rail) {
+		struct omx_pull_rail * rail = &handle->rails[desc->rail];
+
+		memcpy(&mh->head, &rail->head, sizeof(rail->head));
+		OMX_HTON_32(pull_n->src_magic, rail->magic);
+		omx_iface_reacquire(rail->iface);
+		*rail_iface = rail->iface;
+		omx_counter_inc(iface, PULL_RAIL_REQ);
+	}
+
 #ifdef OMX_MX_WIRE_COMPAT
 	OMX_HTON_16(pull_n->block_length, block_length);
 	OMX_HTON_16(pull_n->first_frame_offset, first_frame_offset);
@@ -848,6 +1294,9 @@ omx_fill_pull_block_request(const struct omx_pull_handle * handle, int desc_nr)
 #endif
 	OMX_HTON_32(pull_n->frame_index, frame_index);
 
+	desc->nr_requests++;
+	desc->last_request_time = ktime_get();
+
 	omx_send_dprintk(&mh->head.eth, "PULL handle %lx magic %lx length %ld out of %ld, frame index %ld first_frame_offset %ld",
 			 (unsigned long) OMX_NTOH_32(pull_n->src_pull_handle),
 			 (unsigned long) OMX_NTOH_32(pull_n->src_magic),
@@ -859,6 +1308,31 @@ omx_fill_pull_block_request(const struct omx_pull_handle * handle, int desc_nr)
 	return skb;
 }
 
+/*
+ * Send the requests prepared by omx_fill_pull_block_request(),
+ * on the home iface or on the iface of their rail.
+ * Called without the handle lock since the loopback device may cause reentrancy.
+ */
+static INLINE void
+omx_pull_xmit_block_requests(struct omx_iface * iface,
+			     struct sk_buff ** skbs,
+			     struct omx_iface ** rail_ifaces)
+{
+	int i;
+
+	for(i=0; i<OMX_PULL_BLOCK_DESCS_NR; i++) {
+		if (unlikely(!skbs[i]))
+			continue;
+
+		if (likely(!rail_ifaces[i])) {
+			omx_queue_xmit(iface, skbs[i], PULL_REQ);
+		} else {
+			omx_queue_xmit(rail_ifaces[i], skbs[i], PULL_REQ);
+			omx_iface_release(rail_ifaces[i]);
+		}
+	}
+}
+
 int
 omx_ioctl_pull(struct omx_endpoint * endpoint,
 	       void __user * uparam)
@@ -868,6 +1342,7 @@ omx_ioctl_pull(struct omx_endpoint * endpoint,
 	struct omx_user_region * region;
 	struct omx_iface * iface = endpoint->iface;
 	struct sk_buff * skb, * skbs[] = { [0 ... OMX_PULL_BLOCK_DESCS_NR-1] = NULL };
+	struct omx_iface * rail_ifaces[] = { [0 ... OMX_PULL_BLOCK_DESCS_NR-1] = NULL };
 	uint32_t block_length;
 	uint32_t pulled_rdma_offset_in_frame;
 	int i;
@@ -929,7 +1404,7 @@ omx_ioctl_pull(struct omx_endpoint * endpoint,
 	omx_pull_handle_append_needed_frames(handle, block_length, pulled_rdma_offset_in_frame);
 
 	/* prepare as many new blocks as needed */
-	while (handle->nr_valid_block_descs < OMX_PULL_BLOCK_DESCS_NR
+	while (handle->nr_valid_block_descs < handle->window
 	       && handle->remaining_length) {
 		/* prepare the next block */
 		block_length = OMX_PULL_BLOCK_LENGTH_MAX;
@@ -945,7 +1420,7 @@ omx_ioctl_pull(struct omx_endpoint * endpoint,
 		else
 			dprintk(PULL, "queueing pull block request\n");
 
-		skb = omx_fill_pull_block_request(handle, i);
+		skb = omx_fill_pull_block_request(handle, i, &rail_ifaces[i]);
 		if (unlikely(IS_ERR(skb))) {
 			BUG_ON(PTR_ERR(skb) != -ENOMEM);
 			/* let the timeout expire and resend */
@@ -959,7 +1434,7 @@ omx_ioctl_pull(struct omx_endpoint * endpoint,
 	/* schedule the timeout handler now that we are ready to send the requests */
 	/* timer not pending yet, use the regular mod_timer() */
 	mod_timer(&handle->retransmit_timer,
-		  get_jiffies_64() + OMX_PULL_RETRANSMIT_TIMEOUT_JIFFIES);
+		  get_jiffies_64() + handle->retransmit_timeout_jiffies);
 
 	/*
 	 * do not keep the lock while sending
@@ -967,9 +1442,7 @@ omx_ioctl_pull(struct omx_endpoint * endpoint,
 	 */
 	spin_unlock(&handle->lock);
 
-	for(i=0; i<OMX_PULL_BLOCK_DESCS_NR; i++)
-		if (likely(skbs[i]))
-			omx_queue_xmit(iface, skbs[i], PULL_REQ);
+	omx_pull_xmit_block_requests(iface, skbs, rail_ifaces);
 
 	return 0;
 
@@ -988,6 +1461,7 @@ omx_progress_pull_on_handle_timeout_handle_locked(struct omx_iface * iface,
 						  struct omx_pull_handle * handle)
 {
 	struct sk_buff *skb, *skbs[] = { [0 ... OMX_PULL_BLOCK_DESCS_NR-1] = NULL };
+	struct omx_iface *rail_ifaces[] = { [0 ... OMX_PULL_BLOCK_DESCS_NR-1] = NULL };
 	int i;
 
 	/* tell the sparse checker that the lock has been taken by the caller */
@@ -996,7 +1470,16 @@ omx_progress_pull_on_handle_timeout_handle_locked(struct omx_iface * iface,
 	/* request the first block again */
 	omx_counter_inc(iface, PULL_TIMEOUT_HANDLER_FIRST_BLOCK);
 
-	skb = omx_fill_pull_block_request(handle, 0);
+	/* something got lost, reduce the window and back off */
+	omx_pull_handle_loss(handle);
+	handle->retransmit_timeout_jiffies = min(handle->retransmit_timeout_jiffies * 2,
+						 (unsigned long) OMX_PULL_RETRANSMIT_TIMEOUT_JIFFIES);
+	omx_counter_inc(iface, PULL_RTO_BACKOFF);
+
+	/* stop using rails that keep losing requests, their blocks go back home */
+	omx_pull_handle_rails_timeout(handle);
+
+	skb = omx_fill_pull_block_request(handle, 0, &rail_ifaces[0]);
 	if (unlikely(IS_ERR(skb))) {
 		BUG_ON(PTR_ERR(skb) != -ENOMEM);
 		goto skbs_ready; /* don't try to submit more */
@@ -1015,7 +1498,7 @@ omx_progress_pull_on_handle_timeout_handle_locked(struct omx_iface * iface,
 		if (handle->block_desc[i].frames_missing_bitmap) {
 			omx_counter_inc(iface, PULL_TIMEOUT_HANDLER_NONFIRST_BLOCK);
 
-			skb = omx_fill_pull_block_request(handle, i);
+			skb = omx_fill_pull_block_request(handle, i, &rail_ifaces[i]);
 			if (unlikely(IS_ERR(skb))) {
 				BUG_ON(PTR_ERR(skb) != -ENOMEM);
 				goto skbs_ready; /* don't try to submit more */
@@ -1032,7 +1515,7 @@ omx_progress_pull_on_handle_timeout_handle_locked(struct omx_iface * iface,
 	/* reschedule another timeout handler */
 	/* timer already expired, use the regular mod_timer() */
 	mod_timer(&handle->retransmit_timer,
-		  get_jiffies_64() + OMX_PULL_RETRANSMIT_TIMEOUT_JIFFIES);
+		  get_jiffies_64() + handle->retransmit_timeout_jiffies);
 
 	/*
 	 * do not keep the lock while sending
@@ -1040,9 +1523,7 @@ omx_progress_pull_on_handle_timeout_handle_locked(struct omx_iface * iface,
 	 */
 	spin_unlock(&handle->lock);
 
-	for(i=0; i<OMX_PULL_BLOCK_DESCS_NR; i++)
-		if (likely(skbs[i]))
-			omx_queue_xmit(iface, skbs[i], PULL_REQ);
+	omx_pull_xmit_block_requests(iface, skbs, rail_ifaces);
 }
 
 /*
@@ -1122,6 +1603,46 @@ omx_send_pull_reply_skb_destructor(struct sk_buff *skb)
 	omx_user_region_release(region);
 }
 
+/*
+ * Acquire the pulled endpoint. A multi-rail puller may target the
+ * endpoint through another iface than the one it is attached to,
+ * so look for the session on the other ifaces before giving up.
+ */
+static struct omx_endpoint *
+omx_pull_request_acquire_endpoint(struct omx_iface * iface,
+				  uint8_t index, uint32_t session_id)
+{
+	struct omx_endpoint * endpoint, * other;
+	int i;
+
+	endpoint = omx_endpoint_acquire_by_iface_index(iface, index);
+	if (likely(!IS_ERR(endpoint) && endpoint->session_id == session_id))
+		return endpoint;
+
+	rcu_read_lock();
+	for(i=0; i<omx_iface_max; i++) {
+		struct omx_iface * other_iface = rcu_dereference(omx_ifaces[i]);
+		if (!other_iface || other_iface == iface)
+			continue;
+
+		other = omx_endpoint_acquire_by_iface_index(other_iface, index);
+		if (IS_ERR(other))
+			continue;
+		if (other->session_id == session_id) {
+			rcu_read_unlock();
+			if (!IS_ERR(endpoint))
+				omx_endpoint_release(endpoint);
+			omx_counter_inc(iface, PULL_RAIL_REMOTE_ENDPOINT);
+			return other;
+		}
+		omx_endpoint_release(other);
+	}
+	rcu_read_unlock();
+
+	/* let the caller nack as usual */
+	return endpoint;
+}
+
 int
 omx_recv_pull_request(struct omx_iface * iface,
 		      struct omx_hdr * pull_mh,
@@ -1157,12 +1678,15 @@ omx_recv_pull_request(struct omx_iface * iface,
 	struct ethhdr *reply_eh;
 	size_t reply_hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_pull_reply);
 	struct omx_user_region *region;
+	struct sk_buff_head batch;
 	uint32_t current_frame_seqnum, current_msg_offset, block_remaining_length;
 	int replies, i;
 	int err = 0;
 
 	BUILD_BUG_ON(OMX_PULL_REPLY_PACKET_SIZE_OF_PAYLOAD(OMX_PULL_REPLY_LENGTH_MAX) > OMX_MTU);
 
+	__skb_queue_head_init(&batch);
+
 	omx_counter_inc(iface, RECV_PULL_REQ);
 
         /* check the peer index */
@@ -1176,7 +1700,7 @@ omx_recv_pull_request(struct omx_iface * iface,
 	}
 
 	/* get the destination endpoint */
-	endpoint = omx_endpoint_acquire_by_iface_index(iface, dst_endpoint);
+	endpoint = omx_pull_request_acquire_endpoint(iface, dst_endpoint, session_id);
 	if (unlikely(IS_ERR(endpoint))) {
 		omx_counter_inc(iface, DROP_BAD_ENDPOINT);
 		omx_drop_dprintk(pull_eh, "PULL packet for unknown endpoint %d",
@@ -1339,7 +1863,7 @@ omx_recv_pull_request(struct omx_iface * iface,
 				 (unsigned long) frame_length,
 				 (unsigned long) current_msg_offset);
 
-		omx_queue_xmit(iface, skb, PULL_REPLY);
+		omx_queue_xmit_batch(iface, &batch, skb, PULL_REPLY);
 
 		/* update fields now */
 		current_frame_seqnum++;
@@ -1347,6 +1871,8 @@ omx_recv_pull_request(struct omx_iface * iface,
 		block_remaining_length -= frame_length;
 	}
 
+	omx_xmit_batch_flush(iface, &batch);
+
 	/* release the main reference on the region */
 	omx_user_region_release(region);
 	omx_endpoint_release(endpoint);
@@ -1354,6 +1880,8 @@ omx_recv_pull_request(struct omx_iface * iface,
 	return 0;
 
  out_with_region:
+	/* the replies that were ready are valid, send them anyway */
+	omx_xmit_batch_flush(iface, &batch);
 	/* release the main reference on the region */
 	omx_user_region_release(region);
  out_with_endpoint:
@@ -1564,18 +2092,24 @@ omx_progress_pull_on_recv_pull_reply_locked(struct omx_iface * iface,
 					    int idesc)
 {
 	struct sk_buff * skb, * skbs[] = { [0 ... OMX_PULL_BLOCK_DESCS_NR-1] = NULL };
+	struct omx_iface * rail_ifaces[] = { [0 ... OMX_PULL_BLOCK_DESCS_NR-1] = NULL };
+	struct omx_iface * home_iface = handle->endpoint->iface; /* iface may be another rail */
 	int completed_block = !handle->block_desc[idesc].frames_missing_bitmap;
 	int i;
 
 	/* tell the sparse checker that the lock has been taken by the caller */
 	__acquire(&handle->lock);
 
+	if (completed_block)
+		omx_pull_handle_block_done(handle, &handle->block_desc[idesc]);
+
 	if (handle->block_desc[0].frames_missing_bitmap) {
 		/*
 		 * current first block not done, we basically just need to release the handle
 		 */
 
-		if (completed_block && idesc > 0 && handle->already_rerequested_blocks < idesc) {
+		if (completed_block && idesc > 0 && handle->already_rerequested_blocks < idesc
+		    && omx_pull_handle_blocks_maybe_lost(handle, idesc)) {
 
 			/* a later block is done without the first ones,
 			 * we assume some packet got lost in the first ones,
@@ -1583,13 +2117,15 @@ omx_progress_pull_on_recv_pull_reply_locked(struct omx_iface * iface,
 			 */
 
 			omx_counter_inc(iface, PULL_NONFIRST_BLOCK_DONE_EARLY);
+			omx_pull_handle_loss(handle);
 
 			dprintk(PULL, "pull handle %p second block done without first, requesting first block again\n",
 				handle);
 
 			for(i=handle->already_rerequested_blocks; i<idesc; i++) {
-				if (handle->block_desc[i].frames_missing_bitmap) {
-					skb = omx_fill_pull_block_request(handle, i);
+				if (handle->block_desc[i].frames_missing_bitmap
+				    && omx_pull_handle_block_maybe_lost(handle, i, idesc)) {
+					skb = omx_fill_pull_block_request(handle, i, &rail_ifaces[i]);
 					if (unlikely(IS_ERR(skb))) {
 						BUG_ON(PTR_ERR(skb) != -ENOMEM);
 						goto skbs_ready; /* don't try to submit more */
@@ -1619,7 +2155,7 @@ omx_progress_pull_on_recv_pull_reply_locked(struct omx_iface * iface,
 		first_block = handle->nr_valid_block_descs;
 
 		/* prepare as many new blocks as needed */
-		while (handle->nr_valid_block_descs < OMX_PULL_BLOCK_DESCS_NR
+		while (handle->nr_valid_block_descs < handle->window
 		       && handle->remaining_length) {
 			uint32_t block_length;
 			/* prepare the next block */
@@ -1639,7 +2175,7 @@ omx_progress_pull_on_recv_pull_reply_locked(struct omx_iface * iface,
 			else
 				dprintk(PULL, "queueing next pull block request\n");
 
-			skb = omx_fill_pull_block_request(handle, i);
+			skb = omx_fill_pull_block_request(handle, i, &rail_ifaces[i]);
 			if (unlikely(IS_ERR(skb))) {
 				BUG_ON(PTR_ERR(skb) != -ENOMEM);
 				/* let the timeout expire and resend */
@@ -1659,7 +2195,7 @@ omx_progress_pull_on_recv_pull_reply_locked(struct omx_iface * iface,
 	/* reschedule the timeout handler now that we are ready to send the requests */
 	/* timer still pending, use the mod_timer_pending() */
 	omx_mod_timer_pending(&handle->retransmit_timer,
-			      get_jiffies_64() + OMX_PULL_RETRANSMIT_TIMEOUT_JIFFIES);
+			      get_jiffies_64() + handle->retransmit_timeout_jiffies);
 
 	/*
 	 * do not keep the lock while sending
@@ -1667,9 +2203,7 @@ omx_progress_pull_on_recv_pull_reply_locked(struct omx_iface * iface,
 	 */
 	spin_unlock(&handle->lock);
 
-	for(i=0; i<OMX_PULL_BLOCK_DESCS_NR; i++)
-		if (likely(skbs[i]))
-			omx_queue_xmit(iface, skbs[i], PULL_REQ);
+	omx_pull_xmit_block_requests(home_iface, skbs, rail_ifaces);
 }
 
 int
@@ -1713,7 +2247,7 @@ omx_recv_pull_reply(struct omx_iface * iface,
 	}
 
 	/* acquire the endpoint */
-	endpoint = omx_endpoint_acquire_by_iface_index(iface, dst_magic ^ OMX_ENDPOINT_PULL_MAGIC_XOR);
+	endpoint = omx_pull_magic_acquire_endpoint(iface, dst_magic);
 	if (unlikely(IS_ERR(endpoint))) {
 		omx_counter_inc(iface, DROP_PULL_REPLY_BAD_MAGIC_ENDPOINT);
 		omx_drop_dprintk(&mh->head.eth, "PULL REPLY packet with bad endpoint index within magic %ld",
@@ -1805,7 +2339,9 @@ omx_recv_pull_reply(struct omx_iface * iface,
 	if (omx_dmaengine
 	    && frame_length >= omx_dma_async_frag_min
 	    && handle->total_length >= omx_dma_async_min) {
-		remaining_copy = omx_pull_handle_reply_try_dma_copy(iface, handle, skb, msg_offset, frame_length);
+		remaining_copy = omx_pull_handle_reply_try_dma_copy(iface, handle, skb,
+								    handle->puller_rdma_offset + msg_offset,
+								    frame_length);
 		if (likely(remaining_copy != frame_length))
 			free_skb = 0;
 	}
@@ -1825,10 +2361,11 @@ omx_recv_pull_reply(struct omx_iface * iface,
 		dprintk(PULL, "copying PULL_REPLY %ld bytes for msg_offset %ld at region offset %ld\n",
 		       (unsigned long) frame_length,
 		       (unsigned long) msg_offset,
-		       (unsigned long) msg_offset);
+		       (unsigned long) (handle->puller_rdma_offset + msg_offset));
 		err = omx_user_region_fill_pages(handle->region,
-						 msg_offset,
+						 handle->puller_rdma_offset + msg_offset,
 						 skb,
+						 sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_pull_reply),
 						 frame_length);
 		if (unlikely(err < 0)) {
 			omx_counter_inc(iface, PULL_REPLY_FILL_FAILED);
@@ -1892,6 +2429,53 @@ omx_recv_pull_reply(struct omx_iface * iface,
  * Recv pull nacks
  */
 
+/*
+ * Called with the handle acquired and locked when the pulled host nacked a request
+ * sent through another rail, which may not be supported there.
+ * Marks the rail down and requests its blocks again on the home iface.
+ * Unlocks the handle before sending and returning.
+ */
+static void
+omx_progress_pull_on_rail_nack_locked(struct omx_pull_handle * handle, int irail)
+{
+	struct sk_buff *skb, *skbs[] = { [0 ... OMX_PULL_BLOCK_DESCS_NR-1] = NULL };
+	struct omx_iface *rail_ifaces[] = { [0 ... OMX_PULL_BLOCK_DESCS_NR-1] = NULL };
+	struct omx_iface * iface = handle->endpoint->iface;
+	int i;
+
+	/* tell the sparse checker that the lock has been taken by the caller */
+	__acquire(&handle->lock);
+
+	if (unlikely(irail >= handle->nr_rails))
+		goto skbs_ready;
+
+	omx_pull_handle_rail_down(handle, irail);
+
+	for(i=0; i<handle->nr_valid_block_descs; i++) {
+		struct omx_pull_block_desc * desc = &handle->block_desc[i];
+
+		if (desc->rail != irail || !desc->frames_missing_bitmap)
+			continue;
+
+		skb = omx_fill_pull_block_request(handle, i, &rail_ifaces[i]);
+		if (unlikely(IS_ERR(skb))) {
+			BUG_ON(PTR_ERR(skb) != -ENOMEM);
+			/* let the timeout expire and resend */
+			break;
+		}
+		skbs[i] = skb;
+	}
+
+ skbs_ready:
+	/*
+	 * do not keep the lock while sending
+	 * since the loopback device may cause reentrancy
+	 */
+	spin_unlock(&handle->lock);
+
+	omx_pull_xmit_block_requests(iface, skbs, rail_ifaces);
+}
+
 int
 omx_recv_nack_mcp(struct omx_iface * iface,
 		  struct omx_hdr * mh,
@@ -1905,6 +2489,7 @@ omx_recv_nack_mcp(struct omx_iface * iface,
 	uint32_t dst_magic = OMX_NTOH_32(nack_mcp_n->src_magic);
 	struct omx_endpoint * endpoint;
 	struct omx_pull_handle * handle;
+	uint8_t rail;
 	int err = 0;
 
 	omx_counter_inc(iface, RECV_NACK_MCP);
@@ -1946,7 +2531,7 @@ omx_recv_nack_mcp(struct omx_iface * iface,
 	}
 
 	/* acquire the endpoint */
-	endpoint = omx_endpoint_acquire_by_iface_index(iface, dst_magic ^ OMX_ENDPOINT_PULL_MAGIC_XOR);
+	endpoint = omx_pull_magic_acquire_endpoint(iface, dst_magic);
 	if (unlikely(IS_ERR(endpoint))) {
 		omx_counter_inc(iface, DROP_PULL_REPLY_BAD_MAGIC_ENDPOINT);
 		omx_drop_dprintk(&mh->head.eth, "NACK MCP packet with bad endpoint index within magic %ld",
@@ -1981,6 +2566,17 @@ omx_recv_nack_mcp(struct omx_iface * iface,
 		goto out_with_endpoint;
 	}
 
+	rail = OMX_PULL_MAGIC_RAIL(dst_magic ^ OMX_ENDPOINT_PULL_MAGIC_XOR);
+	if (unlikely(rail)) {
+		/* only give up once the home iface nacks too */
+		omx_progress_pull_on_rail_nack_locked(handle, rail);
+		/* tell the sparse checker that the lock has been released by omx_progress_pull_on_rail_nack_locked() */
+		__release(&handle->lock);
+		omx_pull_handle_release(handle);
+		err = 0;
+		goto out_with_endpoint;
+	}
+
 	/* complete the handle */
 	omx_pull_handle_mark_completed(handle, nack_type);
 	/* nobody is going to use this handle, no need to lock anymore */
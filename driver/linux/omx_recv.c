@@ -20,6 +20,15 @@
 
 #include <linux/kernel.h>
 #include <linux/skbuff.h>
+#include <linux/interrupt.h>
+#include <linux/percpu.h>
+#include <linux/topology.h>
+#include <linux/smp.h>
+#include <linux/sched.h>
+#include <linux/cpu.h>
+#ifdef OMX_HAVE_CPUHP_SETUP_STATE
+#include <linux/cpuhotplug.h>
+#endif
 
 #include "omx_misc.h"
 #include "omx_hal.h"
@@ -482,9 +491,40 @@ omx_recv_medium_frag(struct omx_iface * iface,
 		goto out_with_endpoint;
 	}
 
+	/* fill event */
+	event.id = 0;
+	event.type = OMX_EVT_RECV_MEDIUM_FRAG;
+	event.peer_index = peer_index;
+	event.src_endpoint = src_endpoint;
+	event.match_info = OMX_NTOH_MATCH_INFO(medium_n);
+	event.seqnum = lib_seqnum;
+	event.piggyack = lib_piggyack;
+#ifdef OMX_MX_WIRE_COMPAT
+	event.specific.medium_frag.msg_length = OMX_NTOH_16(medium_n->length);
+	event.specific.medium_frag.frag_pipeline = OMX_NTOH_8(medium_n->frag_pipeline);
+#else
+	event.specific.medium_frag.msg_length = OMX_NTOH_32(medium_n->length);
+#endif
+	event.specific.medium_frag.frag_length = frag_length;
+	event.specific.medium_frag.frag_seqnum = OMX_NTOH_8(medium_n->frag_seqnum);
+	event.specific.medium_frag.checksum = OMX_NTOH_16(medium_n->checksum);
+	event.specific.medium_frag.recvq_offset = recvq_offset;
+	event.specific.medium_frag.exp_slot = 0;
+	event.specific.medium_frag.exp_flags = 0;
+
+	omx_recv_dprintk(eh, "MEDIUM_FRAG length %ld", (unsigned long) frag_length);
+
+#ifndef OMX_NORECVCOPY
+	/* copy straight into the posted receive buffer if the library armed one */
+	if (omx_recv_medium_frag_exp(endpoint, &event, skb, hdr_len)) {
+		omx_counter_inc(iface, RECV_MEDIUM_FRAG_EXP);
+		remaining_copy = 0;
+	}
+#endif
+
 #if (defined OMX_HAVE_DMA_ENGINE) && !(defined OMX_NORECVCOPY)
 	/* try to submit the dma copy */
-	if (omx_dmaengine && frag_length >= omx_dma_sync_min) {
+	if (remaining_copy && omx_dmaengine && frag_length >= omx_dma_sync_min) {
 		dma_chan = omx_dma_chan_get();
 		if (dma_chan) {
 			/* if multiple pages per ring entry:
@@ -509,27 +549,6 @@ omx_recv_medium_frag(struct omx_iface * iface,
 	}
 #endif
 
-	/* fill event */
-	event.id = 0;
-	event.type = OMX_EVT_RECV_MEDIUM_FRAG;
-	event.peer_index = peer_index;
-	event.src_endpoint = src_endpoint;
-	event.match_info = OMX_NTOH_MATCH_INFO(medium_n);
-	event.seqnum = lib_seqnum;
-	event.piggyack = lib_piggyack;
-#ifdef OMX_MX_WIRE_COMPAT
-	event.specific.medium_frag.msg_length = OMX_NTOH_16(medium_n->length);
-	event.specific.medium_frag.frag_pipeline = OMX_NTOH_8(medium_n->frag_pipeline);
-#else
-	event.specific.medium_frag.msg_length = OMX_NTOH_32(medium_n->length);
-#endif
-	event.specific.medium_frag.frag_length = frag_length;
-	event.specific.medium_frag.frag_seqnum = OMX_NTOH_8(medium_n->frag_seqnum);
-	event.specific.medium_frag.checksum = OMX_NTOH_16(medium_n->checksum);
-	event.specific.medium_frag.recvq_offset = recvq_offset;
-
-	omx_recv_dprintk(eh, "MEDIUM_FRAG length %ld", (unsigned long) frag_length);
-
 #ifndef OMX_NORECVCOPY
 	/* copy what's remaining */
 	if (remaining_copy) {
@@ -823,6 +842,32 @@ omx_recv_truc(struct omx_iface * iface,
 		err = omx_notify_unexp_event(endpoint, &liback_event, sizeof(liback_event));
 		break;
 	}
+	case OMX_PKT_TRUC_DATA_TYPE_PUSH_SACK: {
+		struct omx_evt_recv_push_sack push_sack_event;
+		int i;
+
+		if (unlikely(data_length < OMX_PKT_TRUC_PUSH_SACK_DATA_LENGTH)) {
+			omx_counter_inc(iface, DROP_BAD_DATALEN);
+			omx_drop_dprintk(eh, "TRUC PUSH SACK packet too short (data length %d)",
+					 (unsigned) data_length);
+			err = -EINVAL;
+			goto out_with_endpoint;
+		}
+
+		/* fill event */
+		push_sack_event.id = 0;
+		push_sack_event.type = OMX_EVT_RECV_PUSH_SACK;
+		push_sack_event.peer_index = peer_index;
+		push_sack_event.src_endpoint = src_endpoint;
+		push_sack_event.frag_base = OMX_NTOH_8(truc_n->push_sack.frag_base);
+		push_sack_event.lib_seqnum = OMX_NTOH_16(truc_n->push_sack.lib_seqnum);
+		for(i=0; i<OMX_PUSH_SACK_MASK_NR; i++)
+			push_sack_event.frags_mask[i] = OMX_NTOH_32(truc_n->push_sack.frags_mask[i]);
+
+		/* notify the event */
+		err = omx_notify_unexp_event(endpoint, &push_sack_event, sizeof(push_sack_event));
+		break;
+	}
 	default:
 		omx_drop_dprintk(eh, "TRUC packet because of unknown truc type %d",
 				 truc_type);
@@ -835,7 +880,10 @@ omx_recv_truc(struct omx_iface * iface,
 		goto out_with_endpoint;
 	}
 
-	omx_counter_inc(iface, RECV_LIBACK);
+	if (truc_type == OMX_PKT_TRUC_DATA_TYPE_PUSH_SACK)
+		omx_counter_inc(iface, RECV_PUSH_SACK);
+	else
+		omx_counter_inc(iface, RECV_LIBACK);
 	omx_endpoint_release(endpoint);
 	dev_kfree_skb(skb);
 	return 0;
@@ -1042,32 +1090,16 @@ omx_pkt_types_init(void)
  * Main receive routine
  */
 
-static int
-omx_recv(struct sk_buff *skb, struct net_device *ifp, struct packet_type *pt,
-	  struct net_device *orig_dev)
+/* parse the header and invoke the packet type handler, which consumes the skb */
+static void
+omx_recv_dispatch(struct omx_iface *iface, struct sk_buff *skb)
 {
-	struct omx_iface *iface;
 	struct omx_hdr linear_header;
 	struct omx_hdr *mh;
 	omx_packet_type_t ptype;
 	size_t hdr_len;
 	int err;
 
-	skb = skb_share_check(skb, GFP_ATOMIC);
-	if (unlikely(skb == NULL))
-		return 0;
-
-	/* len doesn't include header */
-	skb_push(skb, ETH_HLEN);
-
-	iface = omx_iface_find_by_ifp(ifp);
-	if (unlikely(!iface)) {
-		/* at least the ethhdr is linear in the skb */
-		omx_drop_dprintk(&omx_skb_mac_header(skb)->head.eth, "packet on non-Open-MX interface %s",
-				 ifp->name);
-		goto out;
-	}
-
 	/* pointer to the data, assuming it is linear */
 	mh = omx_skb_mac_header(skb);
 
@@ -1078,7 +1110,7 @@ omx_recv(struct sk_buff *skb, struct net_device *ifp, struct packet_type *pt,
 	if (skb->len < ETH_ZLEN) {
 		omx_counter_inc(iface, DROP_BAD_HEADER_DATALEN);
 		omx_drop_dprintk(&mh->head.eth, "packet smaller than ETH_ZLEN (%d)", ETH_ZLEN);
-		goto out;
+		goto out_with_skb;
 	}
 #endif
 
@@ -1095,7 +1127,7 @@ omx_recv(struct sk_buff *skb, struct net_device *ifp, struct packet_type *pt,
 		if (unlikely(err < 0)) {
 			omx_counter_inc(iface, DROP_BAD_HEADER_DATALEN);
 			omx_drop_dprintk(&mh->head.eth, "couldn't get packet type");
-			goto out;
+			goto out_with_skb;
 		}
 	}
 
@@ -1117,6 +1149,414 @@ omx_recv(struct sk_buff *skb, struct net_device *ifp, struct packet_type *pt,
 	 * for all erroneous values
 	 */
 	omx_pkt_type_handler[ptype](iface, mh, skb);
+	return;
+
+ out_with_skb:
+	dev_kfree_skb(skb);
+}
+
+/*******************
+ * Receive steering
+ *
+ * The NIC interrupt may be processed on a core far away from the process
+ * that owns the destination endpoint, making the recvq and eventq cache
+ * lines bounce between sockets. When recvsteer is enabled, packets whose
+ * destination endpoint owner runs in another package are queued on the
+ * per-cpu backlog of the owner's core, and processed there by a tasklet
+ * that an IPI schedules, much like RPS does for IP.
+ *
+ * The owner core is recorded when the endpoint is opened, and refreshed
+ * each time the owner enters the driver through an endpoint ioctl.
+ *
+ * Packets of an endpoint must not overtake each other, so while some of
+ * them are still queued on a backlog, the next ones go to the same backlog,
+ * even if the owner moved meanwhile. If this backlog is full, they are
+ * dropped and the sender resends them. A packet is only processed where it
+ * arrives when nothing is pending for its endpoint.
+ * Pull replies and nacks do not carry the destination endpoint index and
+ * are always processed where they arrive.
+ *
+ * If the IPI cannot be sent, or if the core goes offline, the backlog
+ * tasklet is scheduled on the current core instead. Tasklets never run
+ * concurrently with themselves, so the order is preserved anyway.
+ */
+
+#ifdef OMX_HAVE_SMP_CALL_FUNCTION_SINGLE_ASYNC
+
+#define OMX_RECV_STEER_BACKLOG_MAX 1024
+
+struct omx_recv_steer_backlog {
+	struct sk_buff_head queue;
+	int kicked; /* an IPI or the tasklet is pending, protected by the queue lock */
+	struct tasklet_struct tasklet;
+#ifdef OMX_HAVE_CALL_SINGLE_DATA_T
+	call_single_data_t csd;
+#else
+	struct call_single_data csd;
+#endif
+};
+
+static DEFINE_PER_CPU(struct omx_recv_steer_backlog, omx_recv_steer_backlogs);
+
+/* steered skbs keep a reference on their endpoint in their control buffer */
+#define OMX_RECV_STEER_SKB_ENDPOINT(skb) (*(struct omx_endpoint **) (skb)->cb)
+
+static INLINE void
+omx_recv_steer_done(struct omx_endpoint *endpoint)
+{
+	spin_lock(&endpoint->recv_steer_lock);
+	endpoint->recv_steer_pending--;
+	spin_unlock(&endpoint->recv_steer_lock);
+	omx_endpoint_release(endpoint);
+}
+
+/* runs on the target cpu from the IPI */
+static void
+omx_recv_steer_ipi(void *data)
+{
+	struct omx_recv_steer_backlog *backlog = data;
+	tasklet_schedule(&backlog->tasklet);
+}
+
+static void
+omx_recv_steer_tasklet(unsigned long data)
+{
+	struct omx_recv_steer_backlog *backlog = (struct omx_recv_steer_backlog *) data;
+	struct sk_buff_head queue;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&queue);
+
+	spin_lock(&backlog->queue.lock);
+	skb_queue_splice_init(&backlog->queue, &queue);
+	backlog->kicked = 0;
+	spin_unlock(&backlog->queue.lock);
+
+	/* handlers expect to run within the RCU section of the network stack */
+	rcu_read_lock();
+	while ((skb = __skb_dequeue(&queue)) != NULL) {
+		struct omx_endpoint *endpoint = OMX_RECV_STEER_SKB_ENDPOINT(skb);
+		struct omx_iface *iface = endpoint->iface;
+
+		if (likely(iface->status == OMX_IFACE_STATUS_OK))
+			omx_recv_dispatch(iface, skb);
+		else
+			dev_kfree_skb(skb);
+		/* only once processed, so that the next packets are not processed before */
+		omx_recv_steer_done(endpoint);
+	}
+	rcu_read_unlock();
+}
+
+/* process the backlog of a core that cannot be interrupted on the current one */
+static void
+omx_recv_steer_takeover(struct omx_recv_steer_backlog *backlog)
+{
+	spin_lock_bh(&backlog->queue.lock);
+	backlog->kicked = 1;
+	spin_unlock_bh(&backlog->queue.lock);
+	tasklet_schedule(&backlog->tasklet);
+}
+
+/*
+ * once a core is dead, its IPIs and tasklets are gone,
+ * process what was steered there on the core that took it down
+ */
+static void
+omx_recv_steer_cpu_dead(unsigned int cpu)
+{
+	struct omx_recv_steer_backlog *backlog = &per_cpu(omx_recv_steer_backlogs, cpu);
+	int pending;
+
+	spin_lock_bh(&backlog->queue.lock);
+	pending = backlog->kicked || !skb_queue_empty(&backlog->queue);
+	spin_unlock_bh(&backlog->queue.lock);
+
+	if (pending) {
+		local_bh_disable();
+		omx_recv_steer_takeover(backlog);
+		local_bh_enable();
+	}
+}
+
+#ifdef OMX_HAVE_CPUHP_SETUP_STATE
+
+static int omx_recv_steer_cpuhp_state = -1;
+
+static int
+omx_recv_steer_cpuhp_dead(unsigned int cpu)
+{
+	omx_recv_steer_cpu_dead(cpu);
+	return 0;
+}
+
+static void
+omx_recv_steer_hotplug_init(void)
+{
+	int ret;
+
+	ret = cpuhp_setup_state_nocalls(CPUHP_BP_PREPARE_DYN, "open-mx/recvsteer:dead",
+					NULL, omx_recv_steer_cpuhp_dead);
+	if (ret < 0)
+		printk(KERN_ERR "Open-MX: Failed to register the receive steering cpu hotplug callback, error %d\n", ret);
+	else
+		omx_recv_steer_cpuhp_state = ret;
+}
+
+static void
+omx_recv_steer_hotplug_exit(void)
+{
+	if (omx_recv_steer_cpuhp_state >= 0)
+		cpuhp_remove_state_nocalls(omx_recv_steer_cpuhp_state);
+}
+
+#else /* !OMX_HAVE_CPUHP_SETUP_STATE */
+
+static int
+omx_recv_steer_cpu_notify(struct notifier_block *nb, unsigned long action, void *hcpu)
+{
+	if ((action & ~CPU_TASKS_FROZEN) == CPU_DEAD)
+		omx_recv_steer_cpu_dead((unsigned long) hcpu);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block omx_recv_steer_cpu_notifier = {
+	.notifier_call = omx_recv_steer_cpu_notify,
+};
+
+static void
+omx_recv_steer_hotplug_init(void)
+{
+	register_hotcpu_notifier(&omx_recv_steer_cpu_notifier);
+}
+
+static void
+omx_recv_steer_hotplug_exit(void)
+{
+	unregister_hotcpu_notifier(&omx_recv_steer_cpu_notifier);
+}
+
+#endif /* !OMX_HAVE_CPUHP_SETUP_STATE */
+
+/* cheap check, without acquiring the endpoint, for the common unsteered case */
+static INLINE int
+omx_recv_steer_needed(struct omx_iface *iface, uint8_t dst_endpoint)
+{
+	struct omx_endpoint *endpoint;
+	int cpu, needed = 0;
+
+	if (unlikely(dst_endpoint >= omx_endpoint_max))
+		return 0;
+
+	/* endpoints are only freed after a grace period once detached */
+	rcu_read_lock();
+	endpoint = rcu_dereference(iface->endpoints[dst_endpoint]);
+	if (likely(endpoint)) {
+		cpu = ACCESS_ONCE(endpoint->recv_cpu);
+		/* packets of this endpoint may be pending on another core, let the slow path decide */
+		needed = ACCESS_ONCE(endpoint->recv_steer_pending)
+			|| (cpu >= 0 && !cpumask_test_cpu(smp_processor_id(), topology_core_cpumask(cpu)));
+	}
+	rcu_read_unlock();
+
+	return needed;
+}
+
+/* returns 1 if the skb was queued on another cpu, or dropped to keep ordering */
+static INLINE int
+omx_recv_steer(struct omx_iface *iface, struct sk_buff *skb)
+{
+	struct omx_hdr *mh = omx_skb_mac_header(skb);
+	struct omx_recv_steer_backlog *backlog;
+	struct omx_endpoint *endpoint;
+	uint8_t dst_endpoint;
+	int cpu, kick;
+
+	/* all packet types below have the destination endpoint right after ptype */
+	if (unlikely(skb_headlen(skb) < OMX_HDR_PTYPE_OFFSET + 2))
+		return 0;
+
+	switch (mh->body.generic.ptype) {
+	case OMX_PKT_TYPE_TRUC:
+	case OMX_PKT_TYPE_CONNECT:
+	case OMX_PKT_TYPE_TINY:
+	case OMX_PKT_TYPE_SMALL:
+	case OMX_PKT_TYPE_MEDIUM:
+	case OMX_PKT_TYPE_RNDV:
+	case OMX_PKT_TYPE_PULL:
+	case OMX_PKT_TYPE_NOTIFY:
+		break;
+	default:
+		return 0;
+	}
+
+	dst_endpoint = OMX_NTOH_8(mh->body.generic.dst_endpoint);
+	if (likely(!omx_recv_steer_needed(iface, dst_endpoint)))
+		return 0;
+
+	endpoint = omx_endpoint_acquire_by_iface_index(iface, dst_endpoint);
+	if (IS_ERR(endpoint))
+		return 0;
+
+	spin_lock(&endpoint->recv_steer_lock);
+
+	if (endpoint->recv_steer_pending) {
+		/* earlier packets are still queued there, follow them */
+		cpu = endpoint->recv_steer_cpu;
+		if (unlikely(!cpu_online(cpu)))
+			goto out_drop;
+	} else {
+		cpu = ACCESS_ONCE(endpoint->recv_cpu);
+		/* nothing recorded, or already in the owner package */
+		if (cpu < 0 || !cpu_online(cpu)
+		    || cpumask_test_cpu(smp_processor_id(), topology_core_cpumask(cpu)))
+			goto out_local;
+	}
+
+	backlog = &per_cpu(omx_recv_steer_backlogs, cpu);
+
+	spin_lock(&backlog->queue.lock);
+	if (unlikely(skb_queue_len(&backlog->queue) >= OMX_RECV_STEER_BACKLOG_MAX)) {
+		spin_unlock(&backlog->queue.lock);
+		if (endpoint->recv_steer_pending)
+			goto out_drop;
+		/* nothing of this endpoint is queued, better process it here than drop it */
+		omx_counter_inc(iface, RECV_STEER_BACKLOG_FULL);
+		goto out_local;
+	}
+	OMX_RECV_STEER_SKB_ENDPOINT(skb) = endpoint; /* keep the reference */
+	__skb_queue_tail(&backlog->queue, skb);
+	kick = !backlog->kicked;
+	backlog->kicked = 1;
+	spin_unlock(&backlog->queue.lock);
+
+	endpoint->recv_steer_cpu = cpu;
+	endpoint->recv_steer_pending++;
+	spin_unlock(&endpoint->recv_steer_lock);
+
+	omx_counter_inc(iface, RECV_STEER);
+
+	/*
+	 * the csd cannot be busy since the previous IPI completed
+	 * before the tasklet cleared kicked
+	 */
+	if (kick && unlikely(smp_call_function_single_async(cpu, &backlog->csd) < 0))
+		/* the core went offline meanwhile, nobody else will process this backlog */
+		omx_recv_steer_takeover(backlog);
+
+	return 1;
+
+ out_drop:
+	/* processing it here would reorder it, let the sender resend it */
+	spin_unlock(&endpoint->recv_steer_lock);
+	omx_endpoint_release(endpoint);
+	omx_counter_inc(iface, RECV_STEER_DROP);
+	dev_kfree_skb(skb);
+	return 1;
+
+ out_local:
+	spin_unlock(&endpoint->recv_steer_lock);
+	omx_endpoint_release(endpoint);
+	return 0;
+}
+
+void
+omx_recv_steer_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct omx_recv_steer_backlog *backlog = &per_cpu(omx_recv_steer_backlogs, cpu);
+
+		skb_queue_head_init(&backlog->queue);
+		backlog->kicked = 0;
+		tasklet_init(&backlog->tasklet, omx_recv_steer_tasklet, (unsigned long) backlog);
+		backlog->csd.func = omx_recv_steer_ipi;
+		backlog->csd.info = backlog;
+	}
+
+	omx_recv_steer_hotplug_init();
+}
+
+/* called once incoming packets are disabled */
+void
+omx_recv_steer_exit(void)
+{
+	int cpu;
+
+	omx_recv_steer_hotplug_exit();
+
+	for_each_possible_cpu(cpu) {
+		struct omx_recv_steer_backlog *backlog = &per_cpu(omx_recv_steer_backlogs, cpu);
+		struct sk_buff_head queue;
+		struct sk_buff *skb;
+
+		/* let pending IPIs schedule the tasklet before killing it */
+		while (ACCESS_ONCE(backlog->kicked) && cpu_online(cpu))
+			schedule_timeout_uninterruptible(1);
+		tasklet_kill(&backlog->tasklet);
+
+		__skb_queue_head_init(&queue);
+		spin_lock_bh(&backlog->queue.lock);
+		skb_queue_splice_init(&backlog->queue, &queue);
+		spin_unlock_bh(&backlog->queue.lock);
+
+		local_bh_disable();
+		while ((skb = __skb_dequeue(&queue)) != NULL) {
+			omx_recv_steer_done(OMX_RECV_STEER_SKB_ENDPOINT(skb));
+			kfree_skb(skb);
+		}
+		local_bh_enable();
+	}
+}
+
+#else /* !OMX_HAVE_SMP_CALL_FUNCTION_SINGLE_ASYNC */
+
+static INLINE int
+omx_recv_steer(struct omx_iface *iface, struct sk_buff *skb)
+{
+	return 0;
+}
+
+void
+omx_recv_steer_init(void)
+{
+	if (omx_recv_steer_enabled)
+		printk(KERN_INFO "Open-MX: Receive steering not supported by this kernel\n");
+}
+
+void
+omx_recv_steer_exit(void)
+{
+}
+
+#endif /* !OMX_HAVE_SMP_CALL_FUNCTION_SINGLE_ASYNC */
+
+static int
+omx_recv(struct sk_buff *skb, struct net_device *ifp, struct packet_type *pt,
+	  struct net_device *orig_dev)
+{
+	struct omx_iface *iface;
+
+	skb = skb_share_check(skb, GFP_ATOMIC);
+	if (unlikely(skb == NULL))
+		return 0;
+
+	/* len doesn't include header */
+	skb_push(skb, ETH_HLEN);
+
+	iface = omx_iface_find_by_ifp(ifp);
+	if (unlikely(!iface)) {
+		/* at least the ethhdr is linear in the skb */
+		omx_drop_dprintk(&omx_skb_mac_header(skb)->head.eth, "packet on non-Open-MX interface %s",
+				 ifp->name);
+		goto out;
+	}
+
+	if (omx_recv_steer_enabled && omx_recv_steer(iface, skb))
+		goto out;
+
+	omx_recv_dispatch(iface, skb);
 
  out:
 	return 0;
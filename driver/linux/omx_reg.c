@@ -1386,10 +1386,10 @@ int
 omx_user_region_fill_pages(const struct omx_user_region * region,
 			   unsigned long region_offset,
 			   const struct sk_buff * skb,
+			   unsigned long skb_offset,
 			   unsigned long length)
 {
 	unsigned long segment_offset = region_offset;
-	unsigned long skb_offset = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_pull_reply);
 	unsigned long copied = 0;
 	unsigned long remaining = length;
 	int iseg;
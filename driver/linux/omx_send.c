@@ -85,6 +85,37 @@ omx_new_skb(unsigned long len)
 	return skb;
 }
 
+/***************************
+ * Batched skb transmission
+ *
+ * Pull replies and medium fragments are generated in bursts. Instead of
+ * entering the stack once per skb, they are queued in a local list by
+ * omx_queue_xmit_batch() and sent here all at once, with bottom halves
+ * disabled only once for the whole burst.
+ *
+ * The skbs still go through the qdisc so that they are ordered with the
+ * ones already queued there, and seen by packet taps. Qdiscs that dequeue
+ * in bulk then let the driver ring the NIC doorbell once per burst.
+ */
+
+void
+omx_xmit_batch_flush(struct omx_iface * iface, struct sk_buff_head * batch)
+{
+	struct sk_buff * skb;
+
+	if (skb_queue_empty(batch))
+		return;
+
+	omx_counter_inc(iface, SEND_BATCH);
+	omx_counter_set(iface, SEND_BATCH_LAST_SKBS, skb_queue_len(batch));
+
+	local_bh_disable();
+	while ((skb = __skb_dequeue(batch)) != NULL)
+		dev_queue_xmit(skb);
+
+	local_bh_enable();
+}
+
 /******************************
  * Deferred event notification
  *
@@ -285,15 +316,14 @@ omx_ioctl_send_connect_reply(struct omx_endpoint * endpoint,
 }
 
 int
-omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
-		    void __user * uparam)
+omx_send_tiny(struct omx_endpoint * endpoint,
+	      const struct omx_cmd_send_tiny * cmd)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
 	struct omx_pkt_head *ph;
 	struct ethhdr *eh;
 	struct omx_pkt_msg *tiny_n;
-	struct omx_cmd_send_tiny_hdr cmd;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
 	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_msg);
@@ -301,14 +331,7 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 	int ret;
 	uint8_t length;
 
-	ret = copy_from_user(&cmd, &((struct omx_cmd_send_tiny __user *) uparam)->hdr, sizeof(cmd));
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd hdr\n");
-		ret = -EFAULT;
-		goto out;
-	}
-
-	length = cmd.length;
+	length = cmd->hdr.length;
 	if (unlikely(length > OMX_TINY_MSG_LENGTH_MAX)) {
 		printk(KERN_ERR "Open-MX: Cannot send more than %d as a tiny (tried %d)\n",
 		       OMX_TINY_MSG_LENGTH_MAX, length);
@@ -316,8 +339,8 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 		goto out;
 	}
 
-	if (unlikely(cmd.shared))
-		return omx_shared_send_tiny(endpoint, &cmd, &((struct omx_cmd_send_tiny __user *) uparam)->data);
+	if (unlikely(cmd->hdr.shared))
+		return __omx_shared_send_tiny(endpoint, &cmd->hdr, cmd->data);
 
 	skb = omx_new_skb(/* pad to ETH_ZLEN */
 			  max_t(unsigned long, hdr_len + length, ETH_ZLEN));
@@ -340,7 +363,7 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
 
 	/* set destination peer */
-	ret = omx_set_target_peer(ph, iface, cmd.peer_index);
+	ret = omx_set_target_peer(ph, iface, cmd->hdr.peer_index);
 	if (ret < 0) {
 		printk(KERN_INFO "Open-MX: Failed to fill target peer in tiny header\n");
 		goto out_with_skb;
@@ -348,24 +371,19 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 
 	/* fill omx header */
 	OMX_HTON_8(tiny_n->src_endpoint, endpoint->endpoint_index);
-	OMX_HTON_8(tiny_n->dst_endpoint, cmd.dest_endpoint);
+	OMX_HTON_8(tiny_n->dst_endpoint, cmd->hdr.dest_endpoint);
 	OMX_HTON_8(tiny_n->ptype, OMX_PKT_TYPE_TINY);
 	OMX_HTON_16(tiny_n->length, length);
-	OMX_HTON_16(tiny_n->lib_seqnum, cmd.seqnum);
-	OMX_HTON_16(tiny_n->lib_piggyack, cmd.piggyack);
-	OMX_HTON_32(tiny_n->session, cmd.session_id);
-	OMX_HTON_16(tiny_n->checksum, cmd.checksum);
-	OMX_HTON_MATCH_INFO(tiny_n, cmd.match_info);
+	OMX_HTON_16(tiny_n->lib_seqnum, cmd->hdr.seqnum);
+	OMX_HTON_16(tiny_n->lib_piggyack, cmd->hdr.piggyack);
+	OMX_HTON_32(tiny_n->session, cmd->hdr.session_id);
+	OMX_HTON_16(tiny_n->checksum, cmd->hdr.checksum);
+	OMX_HTON_MATCH_INFO(tiny_n, cmd->hdr.match_info);
 
 	omx_send_dprintk(eh, "TINY length %ld", (unsigned long) length);
 
 	/* copy the data right after the header */
-	ret = copy_from_user(data, &((struct omx_cmd_send_tiny __user *) uparam)->data, length);
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd data\n");
-		ret = -EFAULT;
-		goto out_with_skb;
-	}
+	memcpy(data, cmd->data, length);
 
 #ifdef OMX_DRIVER_DEBUG
 	omx_set_skb_destructor(skb, omx_tiny_skb_debug_destructor, (void *) 0x666);
@@ -381,6 +399,30 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 	return ret;
 }
 
+int
+omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
+		    void __user * uparam)
+{
+	struct omx_cmd_send_tiny cmd;
+	int ret;
+
+	ret = copy_from_user(&cmd.hdr, &((struct omx_cmd_send_tiny __user *) uparam)->hdr, sizeof(cmd.hdr));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd hdr\n");
+		return -EFAULT;
+	}
+
+	/* only read the actual data, omx_send_tiny() rejects invalid lengths */
+	ret = copy_from_user(cmd.data, &((struct omx_cmd_send_tiny __user *) uparam)->data,
+			     min_t(uint8_t, cmd.hdr.length, OMX_TINY_MSG_LENGTH_MAX));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd data\n");
+		return -EFAULT;
+	}
+
+	return omx_send_tiny(endpoint, &cmd);
+}
+
 int
 omx_ioctl_send_small(struct omx_endpoint * endpoint,
 		     void __user * uparam)
@@ -476,9 +518,11 @@ omx_ioctl_send_small(struct omx_endpoint * endpoint,
 	return ret;
 }
 
+/* sends immediately if batch is NULL, otherwise the caller must flush the batch */
 int
-omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
-			     void __user * uparam)
+omx_send_mediumsq_frag(struct omx_endpoint * endpoint,
+		       void __user * uparam,
+		       struct sk_buff_head * batch)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
@@ -653,7 +697,10 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 
 	omx_send_dprintk(eh, "MEDIUMSQ FRAG length %ld", (unsigned long) frag_length);
 
-	_omx_queue_xmit(iface, skb, MEDIUM_FRAG, MEDIUMSQ_FRAG);
+	if (batch)
+		_omx_queue_xmit_batch(iface, batch, skb, MEDIUM_FRAG, MEDIUMSQ_FRAG);
+	else
+		_omx_queue_xmit(iface, skb, MEDIUM_FRAG, MEDIUMSQ_FRAG);
 
 	return 0;
 
@@ -663,6 +710,13 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 	return ret;
 }
 
+int
+omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
+			     void __user * uparam)
+{
+	return omx_send_mediumsq_frag(endpoint, uparam, NULL);
+}
+
 int
 omx_ioctl_send_mediumva(struct omx_endpoint * endpoint,
 			void __user * uparam)
@@ -672,13 +726,16 @@ omx_ioctl_send_mediumva(struct omx_endpoint * endpoint,
 	struct net_device * ifp = iface->eth_ifp;
 	struct sk_buff *skb;
 	struct omx_cmd_user_segment *usegs, *cur_useg;
+	struct sk_buff_head batch;
 	uint32_t msg_length, remaining, cur_useg_remaining;
 	void __user * cur_udata;
 	uint32_t nseg;
 	int ret;
-	int frags_nr;
+	int frags_nr, first_frag, last_frag;
      	int i;
 
+	__skb_queue_head_init(&batch);
+
 	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
 	if (unlikely(ret != 0)) {
 		printk(KERN_ERR "Open-MX: Failed to read send mediumva cmd hdr\n");
@@ -694,10 +751,29 @@ omx_ioctl_send_mediumva(struct omx_endpoint * endpoint,
 		ret = -EINVAL;
 		goto out;
 	}
+#else
+	if (unlikely(msg_length > OMX_PUSH_MSG_LENGTH_MAX)) {
+		printk(KERN_ERR "Open-MX: Cannot send more than %ld as a mediumva (tried %ld)\n",
+		       (unsigned long) OMX_PUSH_MSG_LENGTH_MAX, (unsigned long) msg_length);
+		ret = -EINVAL;
+		goto out;
+	}
 #endif
 	frags_nr = (msg_length+OMX_MEDIUM_FRAG_LENGTH_MAX-1) / OMX_MEDIUM_FRAG_LENGTH_MAX;
 	nseg = cmd.nr_segments;
 
+	/* pushed messages may resend only some of their frags,
+	 * but at least one of them unless the message is empty */
+	first_frag = cmd.first_frag;
+	last_frag = cmd.frags_nr ? first_frag + cmd.frags_nr : frags_nr;
+	if (unlikely(last_frag > frags_nr
+		     || (frags_nr ? first_frag >= last_frag : first_frag != 0))) {
+		printk(KERN_ERR "Open-MX: Cannot send mediumva frags #%d-%d out of %d\n",
+		       first_frag, last_frag-1, frags_nr);
+		ret = -EINVAL;
+		goto out;
+	}
+
 	if (unlikely(cmd.shared))
 		return omx_shared_send_mediumva(endpoint, &cmd);
 
@@ -732,7 +808,26 @@ omx_ioctl_send_mediumva(struct omx_endpoint * endpoint,
 	cur_useg_remaining = cur_useg->len;
 	cur_udata = (__user void *)(unsigned long) cur_useg->vaddr;
 
-	for(i=0; i<frags_nr; i++) {
+	/* skip the frags that do not need to be sent */
+	if (first_frag) {
+		uint32_t skip = first_frag * OMX_MEDIUM_FRAG_LENGTH_MAX;
+		remaining -= skip;
+		while (skip) {
+			uint32_t chunk = skip > cur_useg_remaining ? cur_useg_remaining : skip;
+			if (chunk == cur_useg_remaining) {
+				if (++cur_useg == &usegs[nseg])
+					break;
+				cur_udata = (__user void *)(unsigned long) cur_useg->vaddr;
+				cur_useg_remaining = cur_useg->len;
+			} else {
+				cur_udata += chunk;
+				cur_useg_remaining -= chunk;
+			}
+			skip -= chunk;
+		}
+	}
+
+	for(i=first_frag; i<last_frag; i++) {
 		struct omx_hdr *mh;
 		struct omx_pkt_head *ph;
 		struct ethhdr *eh;
@@ -811,15 +906,18 @@ omx_ioctl_send_mediumva(struct omx_endpoint * endpoint,
 		}
 		remaining -= frag_length;
 
-		_omx_queue_xmit(iface, skb, MEDIUM_FRAG, MEDIUMVA_FRAG);
+		_omx_queue_xmit_batch(iface, &batch, skb, MEDIUM_FRAG, MEDIUMVA_FRAG);
 	}
 
+	omx_xmit_batch_flush(iface, &batch);
 	kfree(usegs);
 	return 0;
 
  out_with_skb:
 	kfree_skb(skb);
  out_with_usegs:
+	/* the frags that were ready are valid, send them anyway */
+	omx_xmit_batch_flush(iface, &batch);
 	kfree(usegs);
  out:
 	return ret;
@@ -911,7 +1009,7 @@ omx_ioctl_send_rndv(struct omx_endpoint * endpoint,
 	OMX_HTON_8(rndv_n->pulled_rdma_id, cmd.pulled_rdma_id);
 	OMX_HTON_8(rndv_n->pulled_rdma_seqnum, cmd.pulled_rdma_seqnum);
 	OMX_HTON_16(rndv_n->msg.checksum, cmd.checksum);
-	OMX_HTON_16(rndv_n->pulled_rdma_offset, 0); /* not needed for Open-MX */
+	OMX_HTON_16(rndv_n->pulled_rdma_offset, cmd.pulled_rdma_offset);
 
 	omx_queue_xmit(iface, skb, RNDV);
 
@@ -924,29 +1022,21 @@ omx_ioctl_send_rndv(struct omx_endpoint * endpoint,
 }
 
 int
-omx_ioctl_send_notify(struct omx_endpoint * endpoint,
-		      void __user * uparam)
+omx_send_notify(struct omx_endpoint * endpoint,
+		const struct omx_cmd_send_notify * cmd)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
 	struct omx_pkt_head *ph;
 	struct ethhdr *eh;
 	struct omx_pkt_notify *notify_n;
-	struct omx_cmd_send_notify cmd;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
 	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_notify);
 	int ret;
 
-	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send notify cmd hdr\n");
-		ret = -EFAULT;
-		goto out;
-	}
-
-	if (unlikely(cmd.shared))
-		return omx_shared_send_notify(endpoint, &cmd);
+	if (unlikely(cmd->shared))
+		return omx_shared_send_notify(endpoint, cmd);
 
 	skb = omx_new_skb(/* pad to ETH_ZLEN */
 			  max_t(unsigned long, hdr_len, ETH_ZLEN));
@@ -967,7 +1057,7 @@ omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
 
 	/* set destination peer */
-	ret = omx_set_target_peer(ph, iface, cmd.peer_index);
+	ret = omx_set_target_peer(ph, iface, cmd->peer_index);
 	if (ret < 0) {
 		printk(KERN_INFO "Open-MX: Failed to fill target peer in notify header\n");
 		goto out_with_skb;
@@ -975,14 +1065,14 @@ omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 
 	/* fill omx header */
 	OMX_HTON_8(notify_n->src_endpoint, endpoint->endpoint_index);
-	OMX_HTON_8(notify_n->dst_endpoint, cmd.dest_endpoint);
+	OMX_HTON_8(notify_n->dst_endpoint, cmd->dest_endpoint);
 	OMX_HTON_8(notify_n->ptype, OMX_PKT_TYPE_NOTIFY);
-	OMX_HTON_32(notify_n->total_length, cmd.total_length);
-	OMX_HTON_16(notify_n->lib_seqnum, cmd.seqnum);
-	OMX_HTON_16(notify_n->lib_piggyack, cmd.piggyack);
-	OMX_HTON_32(notify_n->session, cmd.session_id);
-	OMX_HTON_8(notify_n->pulled_rdma_id, cmd.pulled_rdma_id);
-	OMX_HTON_8(notify_n->pulled_rdma_seqnum, cmd.pulled_rdma_seqnum);
+	OMX_HTON_32(notify_n->total_length, cmd->total_length);
+	OMX_HTON_16(notify_n->lib_seqnum, cmd->seqnum);
+	OMX_HTON_16(notify_n->lib_piggyack, cmd->piggyack);
+	OMX_HTON_32(notify_n->session, cmd->session_id);
+	OMX_HTON_8(notify_n->pulled_rdma_id, cmd->pulled_rdma_id);
+	OMX_HTON_8(notify_n->pulled_rdma_seqnum, cmd->pulled_rdma_seqnum);
 
 	omx_send_dprintk(eh, "NOTIFY");
 
@@ -997,35 +1087,135 @@ omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 }
 
 int
-omx_ioctl_send_liback(struct omx_endpoint * endpoint,
+omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 		      void __user * uparam)
+{
+	struct omx_cmd_send_notify cmd;
+	int ret;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send notify cmd hdr\n");
+		return -EFAULT;
+	}
+
+	return omx_send_notify(endpoint, &cmd);
+}
+
+int
+omx_send_liback(struct omx_endpoint * endpoint,
+		const struct omx_cmd_send_liback * cmd)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
 	struct omx_pkt_head *ph;
 	struct ethhdr *eh;
 	struct omx_pkt_truc *truc_n;
-	struct omx_cmd_send_liback cmd;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
 	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_truc);
 	int ret;
 
+	if (unlikely(cmd->shared))
+		return omx_shared_send_liback(endpoint, cmd);
+
+	skb = omx_new_skb(/* pad to ETH_ZLEN */
+			  max_t(unsigned long, hdr_len, ETH_ZLEN));
+	if (unlikely(skb == NULL)) {
+		omx_counter_inc(iface, SEND_NOMEM_SKB);
+		printk(KERN_INFO "Open-MX: Failed to create truc skb\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* locate headers */
+	mh = omx_skb_mac_header(skb);
+	ph = &mh->head;
+	eh = &ph->eth;
+	truc_n = (struct omx_pkt_truc *) (ph + 1);
+
+	/* fill ethernet header */
+	eh->h_proto = __constant_cpu_to_be16(ETH_P_OMX);
+	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
+
+	/* set destination peer */
+	ret = omx_set_target_peer(ph, iface, cmd->peer_index);
+	if (ret < 0) {
+		printk(KERN_INFO "Open-MX: Failed to fill target peer in truc header\n");
+		goto out_with_skb;
+	}
+
+	/* fill omx header */
+	OMX_HTON_8(truc_n->src_endpoint, endpoint->endpoint_index);
+	OMX_HTON_8(truc_n->dst_endpoint, cmd->dest_endpoint);
+	OMX_HTON_8(truc_n->ptype, OMX_PKT_TYPE_TRUC);
+	OMX_HTON_8(truc_n->length, OMX_PKT_TRUC_LIBACK_DATA_LENGTH);
+	OMX_HTON_32(truc_n->session, cmd->session_id);
+	OMX_HTON_8(truc_n->type, OMX_PKT_TRUC_DATA_TYPE_ACK);
+	OMX_HTON_16(truc_n->liback.lib_seqnum, cmd->lib_seqnum);
+	OMX_HTON_32(truc_n->liback.session_id, cmd->session_id);
+	OMX_HTON_32(truc_n->liback.acknum, cmd->acknum);
+	OMX_HTON_16(truc_n->liback.send_seq, cmd->send_seq);
+	OMX_HTON_8(truc_n->liback.resent, cmd->resent);
+
+	omx_queue_xmit(iface, skb, LIBACK);
+
+	return 0;
+
+ out_with_skb:
+	kfree_skb(skb);
+ out:
+	return ret;
+}
+
+int
+omx_ioctl_send_liback(struct omx_endpoint * endpoint,
+		      void __user * uparam)
+{
+	struct omx_cmd_send_liback cmd;
+	int ret;
+
 	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
 	if (unlikely(ret != 0)) {
 		printk(KERN_ERR "Open-MX: Failed to read send truc cmd hdr\n");
+		return -EFAULT;
+	}
+
+	return omx_send_liback(endpoint, &cmd);
+}
+
+/*
+ * Selective ack of a pushed medium message, tells the sender which frags
+ * were received so that it only resends the missing ones.
+ */
+int
+omx_ioctl_send_push_sack(struct omx_endpoint * endpoint,
+			 void __user * uparam)
+{
+	struct sk_buff *skb;
+	struct omx_hdr *mh;
+	struct omx_pkt_head *ph;
+	struct ethhdr *eh;
+	struct omx_pkt_truc *truc_n;
+	struct omx_cmd_send_push_sack cmd;
+	struct omx_iface * iface = endpoint->iface;
+	struct net_device * ifp = iface->eth_ifp;
+	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_truc);
+	int ret;
+	int i;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send push sack cmd\n");
 		ret = -EFAULT;
 		goto out;
 	}
 
-	if (unlikely(cmd.shared))
-		return omx_shared_send_liback(endpoint, &cmd);
-
 	skb = omx_new_skb(/* pad to ETH_ZLEN */
 			  max_t(unsigned long, hdr_len, ETH_ZLEN));
 	if (unlikely(skb == NULL)) {
 		omx_counter_inc(iface, SEND_NOMEM_SKB);
-		printk(KERN_INFO "Open-MX: Failed to create truc skb\n");
+		printk(KERN_INFO "Open-MX: Failed to create push sack skb\n");
 		ret = -ENOMEM;
 		goto out;
 	}
@@ -1043,7 +1233,7 @@ omx_ioctl_send_liback(struct omx_endpoint * endpoint,
 	/* set destination peer */
 	ret = omx_set_target_peer(ph, iface, cmd.peer_index);
 	if (ret < 0) {
-		printk(KERN_INFO "Open-MX: Failed to fill target peer in truc header\n");
+		printk(KERN_INFO "Open-MX: Failed to fill target peer in push sack header\n");
 		goto out_with_skb;
 	}
 
@@ -1051,16 +1241,15 @@ omx_ioctl_send_liback(struct omx_endpoint * endpoint,
 	OMX_HTON_8(truc_n->src_endpoint, endpoint->endpoint_index);
 	OMX_HTON_8(truc_n->dst_endpoint, cmd.dest_endpoint);
 	OMX_HTON_8(truc_n->ptype, OMX_PKT_TYPE_TRUC);
-	OMX_HTON_8(truc_n->length, OMX_PKT_TRUC_LIBACK_DATA_LENGTH);
+	OMX_HTON_8(truc_n->length, OMX_PKT_TRUC_PUSH_SACK_DATA_LENGTH);
 	OMX_HTON_32(truc_n->session, cmd.session_id);
-	OMX_HTON_8(truc_n->type, OMX_PKT_TRUC_DATA_TYPE_ACK);
-	OMX_HTON_16(truc_n->liback.lib_seqnum, cmd.lib_seqnum);
-	OMX_HTON_32(truc_n->liback.session_id, cmd.session_id);
-	OMX_HTON_32(truc_n->liback.acknum, cmd.acknum);
-	OMX_HTON_16(truc_n->liback.send_seq, cmd.send_seq);
-	OMX_HTON_8(truc_n->liback.resent, cmd.resent);
+	OMX_HTON_8(truc_n->type, OMX_PKT_TRUC_DATA_TYPE_PUSH_SACK);
+	OMX_HTON_8(truc_n->push_sack.frag_base, cmd.frag_base);
+	OMX_HTON_16(truc_n->push_sack.lib_seqnum, cmd.lib_seqnum);
+	for(i=0; i<OMX_PUSH_SACK_MASK_NR; i++)
+		OMX_HTON_32(truc_n->push_sack.frags_mask[i], cmd.frags_mask[i]);
 
-	omx_queue_xmit(iface, skb, LIBACK);
+	_omx_queue_xmit(iface, skb, LIBACK, PUSH_SACK);
 
 	return 0;
 
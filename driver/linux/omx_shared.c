@@ -37,13 +37,14 @@
  * if the endpoint isn't available or the session is wrong.
  */
 static INLINE struct omx_endpoint *
-omx_shared_get_endpoint_or_nack_type(uint16_t dst_peer_index, uint8_t dst_endpoint_index,
+omx_shared_get_endpoint_or_nack_type(struct omx_endpoint *src_endpoint,
+				     uint16_t dst_peer_index, uint8_t dst_endpoint_index,
 				     uint32_t session_id,
 				     enum omx_nack_type *nack_type)
 {
 	struct omx_endpoint * dst_endpoint;
 
-	dst_endpoint = omx_local_peer_acquire_endpoint(dst_peer_index, dst_endpoint_index);
+	dst_endpoint = omx_shared_acquire_endpoint(src_endpoint, dst_peer_index, dst_endpoint_index);
 
 	if (unlikely(!dst_endpoint)) {
 		/* the peer isn't local, no need to nack */
@@ -105,7 +106,8 @@ omx_shared_get_endpoint_or_notify_nack(struct omx_endpoint *src_endpoint,
 	struct omx_endpoint * dst_endpoint;
 	enum omx_nack_type nack_type = OMX_NACK_TYPE_NONE;
 
-	dst_endpoint = omx_shared_get_endpoint_or_nack_type(dst_peer_index, dst_endpoint_index,
+	dst_endpoint = omx_shared_get_endpoint_or_nack_type(src_endpoint,
+							    dst_peer_index, dst_endpoint_index,
 							    session_id, &nack_type);
 	if (likely(dst_endpoint != NULL))
 		return dst_endpoint;
@@ -136,7 +138,7 @@ omx_shared_try_send_connect_request(struct omx_endpoint *src_endpoint,
 	struct omx_evt_recv_connect_request event;
 	int err;
 
-	dst_endpoint = omx_local_peer_acquire_endpoint(hdr->peer_index, hdr->dest_endpoint);
+	dst_endpoint = omx_shared_acquire_endpoint(src_endpoint, hdr->peer_index, hdr->dest_endpoint);
 	if (unlikely(!dst_endpoint))
 		/* peer isn't local, return 1 to use the network */
 		return 1;
@@ -153,7 +155,7 @@ omx_shared_try_send_connect_request(struct omx_endpoint *src_endpoint,
 	/* feel the event */
 	event.id = 0;
 	event.type = OMX_EVT_RECV_CONNECT_REQUEST;
-	event.peer_index = src_endpoint->iface->peer.index;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
 	event.src_endpoint = src_endpoint->endpoint_index;
 	event.shared = 1;
 	event.seqnum = hdr->seqnum;
@@ -188,7 +190,7 @@ omx_shared_try_send_connect_reply(struct omx_endpoint *src_endpoint,
 	struct omx_evt_recv_connect_reply event;
 	int err;
 
-	dst_endpoint = omx_local_peer_acquire_endpoint(hdr->peer_index, hdr->dest_endpoint);
+	dst_endpoint = omx_shared_acquire_endpoint(src_endpoint, hdr->peer_index, hdr->dest_endpoint);
 	if (unlikely(!dst_endpoint))
 		/* peer isn't local, return 1 to use the network */
 		return 1;
@@ -205,7 +207,7 @@ omx_shared_try_send_connect_reply(struct omx_endpoint *src_endpoint,
 	/* feel the event */
 	event.id = 0;
 	event.type = OMX_EVT_RECV_CONNECT_REPLY;
-	event.peer_index = src_endpoint->iface->peer.index;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
 	event.src_endpoint = src_endpoint->endpoint_index;
 	event.shared = 1;
 	event.seqnum = hdr->seqnum;
@@ -234,15 +236,15 @@ omx_shared_try_send_connect_reply(struct omx_endpoint *src_endpoint,
 }
 
 int
-omx_shared_send_tiny(struct omx_endpoint *src_endpoint,
-		     const struct omx_cmd_send_tiny_hdr *hdr, const void __user * data)
+__omx_shared_send_tiny(struct omx_endpoint *src_endpoint,
+		       const struct omx_cmd_send_tiny_hdr *hdr, const void * data)
 {
 	struct omx_endpoint * dst_endpoint;
 	struct omx_evt_recv_msg event;
 	int length = hdr->length;
 	int err;
 
-	BUG_ON(length > OMX_TINY_MSG_LENGTH_MAX); /* required to shutup gcc 4.4 copy_from_user size checks in 2.6.33/x86_32 */
+	BUG_ON(length > OMX_TINY_MSG_LENGTH_MAX);
 
 	dst_endpoint = omx_shared_get_endpoint_or_notify_nack(src_endpoint, hdr->peer_index,
 							      hdr->dest_endpoint, hdr->session_id,
@@ -253,7 +255,7 @@ omx_shared_send_tiny(struct omx_endpoint *src_endpoint,
 	/* fill the event */
 	event.id = 0;
 	event.type = OMX_EVT_RECV_TINY;
-	event.peer_index = src_endpoint->iface->peer.index;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
 	event.src_endpoint = src_endpoint->endpoint_index;
 	event.match_info = hdr->match_info;
 	event.seqnum = hdr->seqnum;
@@ -263,12 +265,7 @@ omx_shared_send_tiny(struct omx_endpoint *src_endpoint,
 
 #ifndef OMX_NORECVCOPY
 	/* copy the data */
-	err = copy_from_user(&event.specific.tiny.data, data, length);
-	if (unlikely(err != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read shared send tiny cmd data\n");
-		err = -EFAULT;
-		goto out_with_endpoint;
-	}
+	memcpy(&event.specific.tiny.data, data, length);
 #endif
 
 	/* notify the event */
@@ -289,6 +286,25 @@ omx_shared_send_tiny(struct omx_endpoint *src_endpoint,
 	return err;
 }
 
+int
+omx_shared_send_tiny(struct omx_endpoint *src_endpoint,
+		     const struct omx_cmd_send_tiny_hdr *hdr, const void __user * data)
+{
+	char buffer[OMX_TINY_MSG_LENGTH_MAX];
+	int length = hdr->length;
+
+	BUG_ON(length > OMX_TINY_MSG_LENGTH_MAX); /* required to shutup gcc 4.4 copy_from_user size checks in 2.6.33/x86_32 */
+
+#ifndef OMX_NORECVCOPY
+	if (unlikely(copy_from_user(buffer, data, length) != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read shared send tiny cmd data\n");
+		return -EFAULT;
+	}
+#endif
+
+	return __omx_shared_send_tiny(src_endpoint, hdr, buffer);
+}
+
 int
 omx_shared_send_small(struct omx_endpoint *src_endpoint,
 		      const struct omx_cmd_send_small *hdr)
@@ -327,7 +343,7 @@ omx_shared_send_small(struct omx_endpoint *src_endpoint,
 	/* fill and notify the event */
 	event.id = 0;
 	event.type = OMX_EVT_RECV_SMALL;
-	event.peer_index = src_endpoint->iface->peer.index;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
 	event.src_endpoint = src_endpoint->endpoint_index;
 	event.match_info = hdr->match_info;
 	event.seqnum = hdr->seqnum;
@@ -425,7 +441,7 @@ omx_shared_send_mediumsq_frag(struct omx_endpoint *src_endpoint,
 	/* fill the dst event */
 	dst_event.id = 0;
 	dst_event.type = OMX_EVT_RECV_MEDIUM_FRAG;
-	dst_event.peer_index = src_endpoint->iface->peer.index;
+	dst_event.peer_index = omx_shared_peer_index(src_endpoint);
 	dst_event.src_endpoint = src_endpoint->endpoint_index;
 	dst_event.match_info = hdr->match_info;
 	dst_event.seqnum = hdr->seqnum;
@@ -435,6 +451,8 @@ omx_shared_send_mediumsq_frag(struct omx_endpoint *src_endpoint,
 	dst_event.specific.medium_frag.frag_seqnum = hdr->frag_seqnum;
 	dst_event.specific.medium_frag.frag_pipeline = hdr->frag_pipeline;
 	dst_event.specific.medium_frag.checksum = hdr->checksum;
+	dst_event.specific.medium_frag.exp_slot = 0;
+	dst_event.specific.medium_frag.exp_flags = 0;
 	dst_event.specific.medium_frag.recvq_offset = recvq_offset;
 
 	/* make sure the copy is done */
@@ -547,13 +565,15 @@ omx_shared_send_mediumva(struct omx_endpoint *src_endpoint,
 	}
 
 	/* fill the dst event */
-	dst_event.peer_index = src_endpoint->iface->peer.index;
+	dst_event.peer_index = omx_shared_peer_index(src_endpoint);
 	dst_event.src_endpoint = src_endpoint->endpoint_index;
 	dst_event.match_info = hdr->match_info;
 	dst_event.seqnum = hdr->seqnum;
 	dst_event.piggyack = hdr->piggyack;
 	dst_event.specific.medium_frag.msg_length = hdr->length;
 	dst_event.specific.medium_frag.checksum = hdr->checksum;
+	dst_event.specific.medium_frag.exp_slot = 0;
+	dst_event.specific.medium_frag.exp_flags = 0;
 	dst_event.specific.medium_frag.frag_pipeline = OMX_RECVQ_ENTRY_SHIFT;
 
 #ifndef OMX_NORECVCOPY
@@ -644,7 +664,7 @@ omx_shared_send_rndv(struct omx_endpoint *src_endpoint,
 	/* fill the event */
 	event.id = 0;
 	event.type = OMX_EVT_RECV_RNDV;
-	event.peer_index = src_endpoint->iface->peer.index;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
 	event.src_endpoint = src_endpoint->endpoint_index;
 	event.match_info = hdr->match_info;
 	event.seqnum = hdr->seqnum;
@@ -652,7 +672,7 @@ omx_shared_send_rndv(struct omx_endpoint *src_endpoint,
 	event.specific.rndv.msg_length = hdr->msg_length;
 	event.specific.rndv.pulled_rdma_id = hdr->pulled_rdma_id;
 	event.specific.rndv.pulled_rdma_seqnum = hdr->pulled_rdma_seqnum;
-	event.specific.rndv.pulled_rdma_offset = 0; /* not needed in Open-MX */
+	event.specific.rndv.pulled_rdma_offset = hdr->pulled_rdma_offset;
 	event.specific.rndv.checksum = hdr->checksum;
 
 	/* make sure the region is marked as pinning before reporting the event */
@@ -730,7 +750,8 @@ omx_shared_pull(struct omx_endpoint *src_endpoint,
 		goto out;
 	}
 
-	dst_endpoint = omx_shared_get_endpoint_or_nack_type(hdr->peer_index, hdr->dest_endpoint,
+	dst_endpoint = omx_shared_get_endpoint_or_nack_type(src_endpoint,
+							    hdr->peer_index, hdr->dest_endpoint,
 							    hdr->session_id, &nack_type);
 	if (unlikely(dst_endpoint == NULL)) {
 		if (nack_type == OMX_NACK_TYPE_NONE) {
@@ -753,7 +774,7 @@ omx_shared_pull(struct omx_endpoint *src_endpoint,
 #ifndef OMX_NORECVCOPY
 	/* pull from the dst region into the src region */
 	err = omx_copy_between_user_regions(dst_region, hdr->pulled_rdma_offset,
-					    src_region, 0,
+					    src_region, hdr->puller_rdma_offset,
 					    hdr->length);
 	event.status = err < 0 ? OMX_EVT_PULL_DONE_ABORTED : OMX_EVT_PULL_DONE_SUCCESS;
 #else
@@ -809,7 +830,7 @@ omx_shared_send_notify(struct omx_endpoint *src_endpoint,
 	/* fill the event */
 	event.id = 0;
 	event.type = OMX_EVT_RECV_NOTIFY;
-	event.peer_index = src_endpoint->iface->peer.index;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
 	event.src_endpoint = src_endpoint->endpoint_index;
 	event.seqnum = hdr->seqnum;
 	event.piggyack = hdr->piggyack;
@@ -844,7 +865,8 @@ omx_shared_send_liback(struct omx_endpoint *src_endpoint,
 	int err;
 
 	/* don't notify a nack if the endpoint is invalid */
-	dst_endpoint = omx_shared_get_endpoint_or_nack_type(hdr->peer_index, hdr->dest_endpoint,
+	dst_endpoint = omx_shared_get_endpoint_or_nack_type(src_endpoint,
+							    hdr->peer_index, hdr->dest_endpoint,
 							    hdr->session_id, NULL);
 	if (unlikely(!dst_endpoint))
 		/* endpoint unreachable, just ignore */
@@ -853,7 +875,7 @@ omx_shared_send_liback(struct omx_endpoint *src_endpoint,
 	/* fill the event */
 	event.id = 0;
 	event.type = OMX_EVT_RECV_LIBACK;
-	event.peer_index = src_endpoint->iface->peer.index;
+	event.peer_index = omx_shared_peer_index(src_endpoint);
 	event.src_endpoint = src_endpoint->endpoint_index;
 	event.acknum = hdr->acknum;
 	event.lib_seqnum = hdr->lib_seqnum;
@@ -19,6 +19,17 @@
 #ifndef __omx_shared_h__
 #define __omx_shared_h__
 
+/*
+ * provided by each driver flavor next to omx_endpoint_acquire_by_iface_index(),
+ * so that endpoints without an iface (Xen guests) may use the shared paths
+ */
+extern struct omx_endpoint *
+omx_shared_acquire_endpoint(struct omx_endpoint *src_endpoint,
+			    uint16_t peer_index, uint8_t endpoint_index);
+
+extern uint32_t
+omx_shared_peer_index(const struct omx_endpoint *endpoint);
+
 extern int
 omx_shared_try_send_connect_request(struct omx_endpoint *src_endpoint,
 				    const struct omx_cmd_send_connect_request *hdr);
@@ -27,6 +38,10 @@ extern int
 omx_shared_try_send_connect_reply(struct omx_endpoint *src_endpoint,
 				  const struct omx_cmd_send_connect_reply *hdr);
 
+extern int
+__omx_shared_send_tiny(struct omx_endpoint *src_endpoint,
+		       const struct omx_cmd_send_tiny_hdr *hdr, const void * data);
+
 extern int
 omx_shared_send_tiny(struct omx_endpoint *src_endpoint,
 		     const struct omx_cmd_send_tiny_hdr *hdr, const void __user * data);
@@ -0,0 +1,224 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/jiffies.h>
+#include <asm/uaccess.h>
+
+#include "omx_hal.h"
+#include "omx_io.h"
+#include "omx_common.h"
+#include "omx_iface.h"
+#include "omx_endpoint.h"
+
+/*
+ * Submission ring.
+ *
+ * User-space posts send commands in the mmapped submitq instead of doing
+ * one ioctl per command. A per-endpoint kernel thread polls the ring and
+ * submits them in order. After idle_us microseconds without any command,
+ * it sets submitq_need_wakeup in the endpoint descriptor and sleeps until
+ * the OMX_CMD_SUBMITQ_WAKEUP doorbell ioctl.
+ *
+ * Only tiny, notify and liback commands may be posted here. Their failure
+ * is recovered by the library retransmission, it never learns about it.
+ * Rndv are not since the library must know when pinning failed.
+ */
+
+static INLINE struct omx_submitq_entry *
+omx_submitq_entry(struct omx_endpoint * endpoint)
+{
+	return endpoint->submitq
+		+ ((endpoint->next_submitq_index % OMX_SUBMITQ_ENTRY_NR) << OMX_SUBMITQ_ENTRY_SHIFT);
+}
+
+static INLINE int
+omx_submitq_entry_ready(struct omx_endpoint * endpoint)
+{
+	return ACCESS_ONCE(omx_submitq_entry(endpoint)->status) == OMX_SUBMITQ_ENTRY_STATUS_READY;
+}
+
+static void
+omx_submitq_process_entry(struct omx_endpoint * endpoint, struct omx_submitq_entry * entry)
+{
+	struct omx_submitq_entry copy;
+	int ret;
+
+	/* do not let user-space modify the command while we submit it */
+	smp_rmb();
+	memcpy(&copy, entry, sizeof(copy));
+
+	switch (copy.type) {
+	case OMX_EPCMD_SEND_TINY:
+		ret = omx_send_tiny(endpoint, &copy.cmd.tiny);
+		break;
+	case OMX_EPCMD_SEND_NOTIFY:
+		ret = omx_send_notify(endpoint, &copy.cmd.notify);
+		break;
+	case OMX_EPCMD_SEND_LIBACK:
+		ret = omx_send_liback(endpoint, &copy.cmd.liback);
+		break;
+	default:
+		printk(KERN_ERR "Open-MX: Cannot submit command %d from the submission ring\n",
+		       copy.type);
+		ret = -EINVAL;
+	}
+
+	if (unlikely(ret < 0))
+		omx_counter_inc(endpoint->iface, SUBMITQ_CMD_FAILED);
+	else
+		omx_counter_inc(endpoint->iface, SUBMITQ_CMD);
+
+	/* give the slot back to user-space */
+	smp_mb();
+	entry->status = OMX_SUBMITQ_ENTRY_STATUS_FREE;
+	endpoint->next_submitq_index++;
+}
+
+static int
+omx_submitq_thread(void * data)
+{
+	struct omx_endpoint * endpoint = data;
+	unsigned long idle_jiffies = usecs_to_jiffies(endpoint->submitq_idle_us);
+	unsigned long last_jiffies = jiffies;
+
+	while (!kthread_should_stop()) {
+		struct omx_submitq_entry * entry = omx_submitq_entry(endpoint);
+
+		if (ACCESS_ONCE(entry->status) == OMX_SUBMITQ_ENTRY_STATUS_READY) {
+			omx_submitq_process_entry(endpoint, entry);
+			last_jiffies = jiffies;
+			cond_resched();
+			continue;
+		}
+
+		if (time_before(jiffies, last_jiffies + idle_jiffies)) {
+			cpu_relax();
+			cond_resched();
+			continue;
+		}
+
+		/*
+		 * going to sleep, user-space will ring the doorbell after posting.
+		 * the barrier orders need_wakeup against the status check in
+		 * wait_event, user-space does the opposite
+		 */
+		endpoint->userdesc->submitq_need_wakeup = 1;
+		smp_mb();
+		omx_counter_inc(endpoint->iface, SUBMITQ_SLEEP);
+		wait_event_interruptible(endpoint->submitq_wq,
+					 omx_submitq_entry_ready(endpoint) || kthread_should_stop());
+		endpoint->userdesc->submitq_need_wakeup = 0;
+		last_jiffies = jiffies;
+	}
+
+	/* submit what was posted before closing, the last libacks for instance */
+	while (omx_submitq_entry_ready(endpoint))
+		omx_submitq_process_entry(endpoint, omx_submitq_entry(endpoint));
+
+	return 0;
+}
+
+void
+omx_endpoint_submitq_init(struct omx_endpoint * endpoint)
+{
+	BUILD_BUG_ON(sizeof(struct omx_submitq_entry) != OMX_SUBMITQ_ENTRY_SIZE);
+
+	endpoint->next_submitq_index = 0;
+	endpoint->submitq_task = NULL;
+	init_waitqueue_head(&endpoint->submitq_wq);
+	endpoint->userdesc->submitq_need_wakeup = 0;
+}
+
+/* called once the endpoint is marked as closing, nobody may start the thread anymore */
+void
+omx_endpoint_submitq_exit(struct omx_endpoint * endpoint)
+{
+	struct task_struct * task;
+
+	spin_lock(&endpoint->status_lock);
+	task = endpoint->submitq_task;
+	endpoint->submitq_task = NULL;
+	spin_unlock(&endpoint->status_lock);
+
+	if (task)
+		kthread_stop(task);
+}
+
+int
+omx_ioctl_submitq_start(struct omx_endpoint * endpoint, void __user * uparam)
+{
+	struct omx_cmd_submitq_start cmd;
+	struct task_struct * task;
+	int ret;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read submitq start cmd\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = -EBUSY;
+	if (endpoint->submitq_task)
+		goto out;
+
+	endpoint->submitq_idle_us = cmd.idle_us;
+
+	task = kthread_create(omx_submitq_thread, endpoint, "omx_sq%d.%d",
+			      endpoint->board_index, endpoint->endpoint_index);
+	if (IS_ERR(task)) {
+		ret = PTR_ERR(task);
+		printk(KERN_ERR "Open-MX: Failed to create submission thread, error %d\n", ret);
+		goto out;
+	}
+
+	/* the endpoint may have been closed or started by somebody else meanwhile */
+	spin_lock(&endpoint->status_lock);
+	if (endpoint->status != OMX_ENDPOINT_STATUS_OK || endpoint->submitq_task) {
+		spin_unlock(&endpoint->status_lock);
+		kthread_stop(task);
+		ret = -EBUSY;
+		goto out;
+	}
+	endpoint->submitq_task = task;
+	spin_unlock(&endpoint->status_lock);
+
+	wake_up_process(task);
+	return 0;
+
+ out:
+	return ret;
+}
+
+int
+omx_ioctl_submitq_wakeup(struct omx_endpoint * endpoint)
+{
+	wake_up_interruptible(&endpoint->submitq_wq);
+	return 0;
+}
+
+/*
+ * Local variables:
+ *  tab-width: 8
+ *  c-basic-offset: 8
+ *  c-indent-level: 8
+ * End:
+ */
@@ -219,93 +219,188 @@ omx__handle_nack(struct omx_endpoint *ep,
  * Handle Acks to Send
  */
 
-static omx_return_t
-omx__submit_send_liback(const struct omx_endpoint *ep,
-			struct omx__partner * partner)
+static void
+omx__setup_send_liback(const struct omx_endpoint *ep,
+		       struct omx__partner * partner,
+		       struct omx_cmd_send_liback *liback_param)
 {
-  struct omx_cmd_send_liback liback_param;
   omx__seqnum_t ack_upto = omx__get_partner_needed_ack(ep, partner);
-  int err;
 
   partner->last_send_acknum++;
 
-  liback_param.peer_index = partner->peer_index;
-  liback_param.dest_endpoint = partner->endpoint_index;
-  liback_param.shared = omx__partner_localization_shared(partner);
-  liback_param.session_id = partner->back_session_id;
-  liback_param.acknum = partner->last_send_acknum;
-  liback_param.session_id = partner->back_session_id;
-  liback_param.lib_seqnum = ack_upto;
-  liback_param.send_seq = ack_upto; /* FIXME? partner->send_seq */
-  liback_param.resent = 0; /* FIXME? partner->requeued */
-
-  err = ioctl(ep->fd, OMX_CMD_SEND_LIBACK, &liback_param);
-  if (unlikely(err < 0)) {
-    omx_return_t ret = omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
-							  OMX_SUCCESS,
-							  "send truc message");
+  liback_param->peer_index = partner->peer_index;
+  liback_param->dest_endpoint = partner->endpoint_index;
+  liback_param->shared = omx__partner_localization_shared(partner);
+  liback_param->session_id = partner->back_session_id;
+  liback_param->acknum = partner->last_send_acknum;
+  liback_param->session_id = partner->back_session_id;
+  liback_param->lib_seqnum = ack_upto;
+  liback_param->send_seq = ack_upto; /* FIXME? partner->send_seq */
+  liback_param->resent = 0; /* FIXME? partner->requeued */
+}
+
+/*
+ * Send libacks to a set of partners through the submission ring or
+ * within a single ioctl, and mark those that got acked.
+ * Returns OMX_SUCCESS if all of them were acked.
+ */
+static omx_return_t
+omx__submit_send_libacks(struct omx_endpoint *ep,
+			 struct omx__partner **partners, unsigned nr)
+{
+  struct omx_cmd_send_liback liback_params[OMX_SEND_BATCH_NR_MAX];
+  struct omx__send_batch batch;
+  unsigned i, posted = 0, submitted;
+
+  omx__send_batch_init(&batch);
+  for(i=0; i<nr; i++) {
+    omx__setup_send_liback(ep, partners[i], &liback_params[i]);
+    /* once the ring is full, batch all remaining ones so that partners stay in order */
+    if (!batch.cmd.nr
+	&& omx__submitq_post(ep, OMX_EPCMD_SEND_LIBACK, &liback_params[i], sizeof(liback_params[i]))) {
+      posted++;
+      continue;
+    }
+    omx__send_batch_add(&batch, OMX_EPCMD_SEND_LIBACK, &liback_params[i]);
+  }
+
+  submitted = posted + omx__send_batch_submit(ep, &batch);
+  for(i=0; i<submitted; i++)
+    omx__mark_partner_ack_sent(ep, partners[i]);
+
+  if (unlikely(submitted < nr))
     /*
      * no need to call the handler here, we can resend later.
      * but notify the caller anyway so that partner's acking status are updated
      */
-    return ret;
-  }
+    return omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
+					      OMX_SUCCESS,
+					      "send truc message");
 
   return OMX_SUCCESS;
 }
 
+/*
+ * Tell the sender of a partially received medium which frags arrived,
+ * starting at the first missing one, so that it only resends those.
+ */
+void
+omx__send_push_sack(struct omx_endpoint *ep,
+		    struct omx__partner *partner,
+		    const union omx_request *req)
+{
+  struct omx_cmd_send_push_sack sack_param;
+  const uint32_t * received_mask = req->recv.specific.medium.frags_received_mask;
+  unsigned base, i;
+  int err;
+
+  if (!(omx__driver_desc->features & OMX_DRIVER_FEATURE_PUSH)
+      || omx__partner_localization_shared(partner))
+    return;
+
+  /* the base is aligned so that the mask may be copied word by word */
+  for(base=0; base<OMX_PUSH_FRAGS_MAX-32; base+=32)
+    if (~received_mask[base/32])
+      break;
+  if (base > OMX_PUSH_FRAGS_MAX - OMX_PUSH_SACK_FRAGS_NR)
+    base = OMX_PUSH_FRAGS_MAX - OMX_PUSH_SACK_FRAGS_NR;
+
+  sack_param.peer_index = partner->peer_index;
+  sack_param.dest_endpoint = partner->endpoint_index;
+  sack_param.session_id = partner->back_session_id;
+  sack_param.lib_seqnum = req->recv.seqnum;
+  sack_param.frag_base = base;
+  for(i=0; i<OMX_PUSH_SACK_MASK_NR; i++)
+    sack_param.frags_mask[i] = received_mask[base/32 + i];
+
+  omx__debug_printf(ACK, ep, "sending push sack to partner %016llx ep %d for seqnum %d (#%d) from frag %d\n",
+		    (unsigned long long) partner->board_addr, (unsigned) partner->endpoint_index,
+		    (unsigned) OMX__SEQNUM(req->recv.seqnum),
+		    (unsigned) OMX__SESNUM_SHIFTED(req->recv.seqnum),
+		    base);
+
+  err = ioctl(ep->fd, OMX_CMD_SEND_PUSH_SACK, &sack_param);
+  if (unlikely(err < 0))
+    /* the sender will resend everything on timeout anyway */
+    omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
+				       OMX_SUCCESS,
+				       "send push sack message");
+}
+
 void
 omx__process_partners_to_ack(struct omx_endpoint *ep)
 {
-  struct omx__partner *partner, *next;
-  uint64_t now = omx__driver_desc->jiffies;
+  struct omx__partner *partners[OMX_SEND_BATCH_NR_MAX];
+  struct omx__partner *partner;
 
-  /* look at the immediate list */
-  list_for_each_entry_safe(partner, next,
-			   &ep->partners_to_ack_immediate_list, endpoint_partners_to_ack_elt) {
-    omx_return_t ret;
+  /* look at the immediate list, acking as many partners as possible at once */
+  while (ep->partners_to_ack_immediate_nr) {
+    unsigned nr = 0;
 
-    omx__debug_printf(ACK, ep, "acking immediately back to partner %016llx ep %d up to %d (#%d) at jiffies %lld\n",
-		      (unsigned long long) partner->board_addr, (unsigned) partner->endpoint_index,
-		      (unsigned) OMX__SEQNUM(partner->next_frag_recv_seq - 1),
-		      (unsigned) OMX__SESNUM_SHIFTED(partner->next_frag_recv_seq - 1),
-		      (unsigned long long) now);
+    list_for_each_entry(partner, &ep->partners_to_ack_immediate_list, endpoint_partners_to_ack_elt) {
+      omx__debug_printf(ACK, ep, "acking immediately back to partner %016llx ep %d up to %d (#%d) at jiffies %lld\n",
+			(unsigned long long) partner->board_addr, (unsigned) partner->endpoint_index,
+			(unsigned) OMX__SEQNUM(partner->next_frag_recv_seq - 1),
+			(unsigned) OMX__SESNUM_SHIFTED(partner->next_frag_recv_seq - 1),
+			(unsigned long long) omx__driver_desc->jiffies);
 
-    ret = omx__submit_send_liback(ep, partner);
-    if (ret != OMX_SUCCESS)
+      partners[nr++] = partner;
+      if (nr == OMX_SEND_BATCH_NR_MAX)
+	break;
+    }
+
+    if (omx__submit_send_libacks(ep, partners, nr) != OMX_SUCCESS)
       /* failed to send one liback, no need to try more */
       break;
-
-    omx__mark_partner_ack_sent(ep, partner);
   }
 
-  /* no need to bother looking at the delayed list if the time didn't change */
-  if (now == ep->last_partners_acking_jiffies)
-    return;
-  ep->last_partners_acking_jiffies = now;
+  /* no need to notify errors */
+}
 
-  /* look at the delayed list */
-  list_for_each_entry_safe(partner, next,
-			   &ep->partners_to_ack_delayed_list, endpoint_partners_to_ack_elt) {
-    omx_return_t ret;
+/* called by the ack timer when the oldest delayed ack may have to be sent */
+void
+omx__process_partners_to_ack_delayed(struct omx_endpoint *ep)
+{
+  struct omx__partner *partners[OMX_SEND_BATCH_NR_MAX];
+  struct omx__partner *partner;
+  uint64_t now = omx__driver_desc->jiffies;
+  int more = 1;
 
-    if (now - partner->oldest_recv_time_not_acked < omx__globals.ack_delay_jiffies)
-      /* the remaining ones are more recent, no need to ack them yet */
-      break;
+  while (more) {
+    unsigned nr = 0;
 
-    omx__debug_printf(ACK, ep, "delayed acking back to partner %016llx ep %d up to %d (#%d), jiffies %lld >> %lld\n",
-		      (unsigned long long) partner->board_addr, (unsigned) partner->endpoint_index,
-		      (unsigned) OMX__SEQNUM(partner->next_frag_recv_seq - 1),
-		      (unsigned) OMX__SESNUM_SHIFTED(partner->next_frag_recv_seq - 1),
-		      (unsigned long long) now,
-		      (unsigned long long) partner->oldest_recv_time_not_acked);
+    more = 0;
+    list_for_each_entry(partner, &ep->partners_to_ack_delayed_list, endpoint_partners_to_ack_elt) {
+      if (now - partner->oldest_recv_time_not_acked < omx__globals.ack_delay_jiffies)
+	/* the remaining ones are more recent, no need to ack them yet */
+	break;
+
+      if (nr == OMX_SEND_BATCH_NR_MAX) {
+	/* come back for this one once the current batch is sent */
+	more = 1;
+	break;
+      }
+
+      omx__debug_printf(ACK, ep, "delayed acking back to partner %016llx ep %d up to %d (#%d), jiffies %lld >> %lld\n",
+			(unsigned long long) partner->board_addr, (unsigned) partner->endpoint_index,
+			(unsigned) OMX__SEQNUM(partner->next_frag_recv_seq - 1),
+			(unsigned) OMX__SESNUM_SHIFTED(partner->next_frag_recv_seq - 1),
+			(unsigned long long) now,
+			(unsigned long long) partner->oldest_recv_time_not_acked);
 
-    ret = omx__submit_send_liback(ep, partner);
-    if (ret != OMX_SUCCESS)
+      partners[nr++] = partner;
+    }
+
+    if (omx__submit_send_libacks(ep, partners, nr) != OMX_SUCCESS)
       /* failed to send one liback, no need to try more */
       break;
+  }
 
-    omx__mark_partner_ack_sent(ep, partner);
+  /* come back when the oldest remaining one needs an ack */
+  if (!list_empty(&ep->partners_to_ack_delayed_list)) {
+    partner = list_first_entry(&ep->partners_to_ack_delayed_list, struct omx__partner, endpoint_partners_to_ack_elt);
+    omx__timer_arm_earlier(&ep->timers, &ep->ack_timer,
+			   partner->oldest_recv_time_not_acked + omx__globals.ack_delay_jiffies);
   }
 
   /* no need to notify errors */
@@ -317,12 +412,11 @@ omx__flush_partners_to_ack(struct omx_endpoint *ep)
   struct omx__partner *partner, *next;
   /* immediate list should have been emptied at the end of the previous round of progression */
   omx__debug_assert(list_empty(&ep->partners_to_ack_immediate_list));
+  omx__debug_assert(!ep->partners_to_ack_immediate_nr);
 
   /* look at the delayed list */
   list_for_each_entry_safe(partner, next,
 			   &ep->partners_to_ack_delayed_list, endpoint_partners_to_ack_elt) {
-    omx_return_t ret;
-
     omx__debug_printf(ACK, ep, "forcing ack back to partner %016llx ep %d up to %d (#%d), jiffies %lld instead of %lld\n",
 		      (unsigned long long) partner->board_addr, (unsigned) partner->endpoint_index,
 		      (unsigned) OMX__SEQNUM(partner->next_frag_recv_seq - 1),
@@ -330,12 +424,8 @@ omx__flush_partners_to_ack(struct omx_endpoint *ep)
 		      (unsigned long long) omx__driver_desc->jiffies,
 		      (unsigned long long) partner->oldest_recv_time_not_acked);
 
-    ret = omx__submit_send_liback(ep, partner);
-    if (ret != OMX_SUCCESS)
-      /* failed to send one liback, too bad for this peer */
-      continue;
-
-    omx__mark_partner_ack_sent(ep, partner);
+    /* one at a time, so that a failure only affects this peer */
+    omx__submit_send_libacks(ep, &partner, 1);
   }
 
   /* no need to notify errors */
@@ -57,8 +57,8 @@ omx__dump_request(const char *prefix, const union omx_request *req)
   } else {
     printf("%s  match info %llx mask %llx\n",
 	   prefix,
-	   (unsigned long long) req->recv.match_info,
-	   (unsigned long long) req->recv.match_mask);
+	   (unsigned long long) req->recv.match.match_info,
+	   (unsigned long long) req->recv.match.match_mask);
     if (type == OMX_REQUEST_TYPE_RECV_LARGE && !(state & OMX_REQUEST_STATE_RECV_PARTIAL))
       printf("%s  to addr %016llx ep %d peer %d session %d seqnum %d resends %d\n",
 	     prefix,
@@ -90,6 +90,17 @@ omx__dump_req_q(const char * name, const struct list_head *head)
   printf("%d requests\n", count);
 }
 
+static void
+omx__dump_slab(const char * name, const struct omx__slab *slab)
+{
+  printf("  %s: %lld in use (%lld max) out of %lld in %lld chunks, %lld failures\n", name,
+	 (unsigned long long) slab->counters.in_use,
+	 (unsigned long long) slab->counters.high_water,
+	 (unsigned long long) slab->counters.total,
+	 (unsigned long long) slab->counters.chunks,
+	 (unsigned long long) slab->counters.failures);
+}
+
 static void
 omx__dump_req_ctxidq(const char * name, const struct list_head *head, int max, int offset)
 {
@@ -208,6 +219,19 @@ omx__dump_endpoint(struct omx_endpoint *ep, void *data)
   omx__dump_req_q("Non-acked             ", &ep->non_acked_req_q);
   omx__dump_req_q("Unexpected self send  ", &ep->unexp_self_send_req_q);
 
+  if (omx__globals.regcache)
+    printf("  Regcache %lld hits %lld superset hits %lld misses %lld evictions %lld invalidations, %lld bytes cached\n",
+	   (unsigned long long) ep->regcache.counters.hits,
+	   (unsigned long long) ep->regcache.counters.superset_hits,
+	   (unsigned long long) ep->regcache.counters.misses,
+	   (unsigned long long) ep->regcache.counters.evictions,
+	   (unsigned long long) ep->regcache.counters.invalidations,
+	   (unsigned long long) ep->regcache.counters.cached_bytes);
+
+  omx__dump_slab("Requests              ", &ep->request_slab);
+  omx__dump_slab("Early packets         ", &ep->early_slab);
+  omx__dump_slab("Small buffers         ", &ep->small_slab);
+
   printf("\n");
   OMX__ENDPOINT_UNLOCK(ep);
 }
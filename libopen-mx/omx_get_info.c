@@ -372,6 +372,42 @@ omx_get_info(struct omx_endpoint * ep, enum omx_info_key key,
     return OMX_SUCCESS;
   }
 
+  case OMX_INFO_ENDPOINT_REGCACHE_COUNTERS:
+
+    if (!ep)
+      return omx__error(OMX_BAD_ENDPOINT,
+			"Getting regcache counters without an endpoint");
+
+    if (out_len < sizeof(struct omx_regcache_counters))
+      return omx__error(OMX_BAD_INFO_LENGTH,
+			"Getting regcache counters into %ld bytes instead of %z",
+			(unsigned long) out_len, sizeof(struct omx_regcache_counters));
+
+    OMX__ENDPOINT_LOCK(ep);
+    memcpy(out_val, &ep->regcache.counters, sizeof(struct omx_regcache_counters));
+    OMX__ENDPOINT_UNLOCK(ep);
+    return OMX_SUCCESS;
+
+  case OMX_INFO_ENDPOINT_ALLOC_COUNTERS: {
+    struct omx_alloc_counters *counters = out_val;
+
+    if (!ep)
+      return omx__error(OMX_BAD_ENDPOINT,
+			"Getting allocation counters without an endpoint");
+
+    if (out_len < sizeof(struct omx_alloc_counters))
+      return omx__error(OMX_BAD_INFO_LENGTH,
+			"Getting allocation counters into %ld bytes instead of %z",
+			(unsigned long) out_len, sizeof(struct omx_alloc_counters));
+
+    OMX__ENDPOINT_LOCK(ep);
+    counters->requests = ep->request_slab.counters;
+    counters->early_packets = ep->early_slab.counters;
+    counters->small_buffers = ep->small_slab.counters;
+    OMX__ENDPOINT_UNLOCK(ep);
+    return OMX_SUCCESS;
+  }
+
   default:
     return omx__error(OMX_BAD_INFO_KEY,
 		      "Getting info key %ld",
@@ -389,6 +389,29 @@ omx__init_comms(void)
     }
   }
 
+  /* pushing large messages instead of pulling them, disabled by default */
+  omx__globals.push_max = 0;
+  env = getenv("OMX_PUSH_MAX");
+  if (env) {
+#ifdef OMX_MX_WIRE_COMPAT
+    omx__verbose_printf(NULL, "Cannot push large messages in MX wire compatible mode\n");
+#else
+    if (omx__driver_desc->features & OMX_DRIVER_FEATURE_PUSH) {
+      unsigned val = atoi(env);
+      if (val > OMX_PUSH_MSG_LENGTH_MAX) {
+	omx__verbose_printf(NULL, "Cannot push messages larger than %ld\n",
+			    (unsigned long) OMX_PUSH_MSG_LENGTH_MAX);
+	val = OMX_PUSH_MSG_LENGTH_MAX;
+      }
+      omx__globals.push_max = val;
+      omx__verbose_printf(NULL, "Forcing push of large messages up to %d bytes\n",
+			  omx__globals.push_max);
+    } else {
+      omx__verbose_printf(NULL, "Cannot push large messages, the driver does not support it\n");
+    }
+#endif
+  }
+
   /*******************************
    * Retransmission configuration
    */
@@ -502,6 +525,26 @@ omx__init_comms(void)
 			omx__globals.regcache ? "enabled" : "disabled");
   }
 
+  omx__globals.regcache_size = 0;
+  env = getenv("OMX_RCACHE_SIZE");
+  if (env) {
+    omx__globals.regcache_size = strtoull(env, NULL, 10) << 20;
+    omx__verbose_printf(NULL, "Forcing regcache size to %lld MB\n",
+			(unsigned long long) omx__globals.regcache_size >> 20);
+  }
+
+  /************************************
+   * Request and buffer preallocation
+   */
+
+  omx__globals.slab_prealloc = 64;
+  env = getenv("OMX_PREALLOC");
+  if (env) {
+    omx__globals.slab_prealloc = strtoul(env, NULL, 10);
+    omx__verbose_printf(NULL, "Forcing preallocation of %u requests and buffers per endpoint\n",
+			omx__globals.slab_prealloc);
+  }
+
   /******************
    * Process binding
    */
@@ -518,6 +561,56 @@ omx__init_comms(void)
 			omx__globals.medium_sendq ? "enabled" : "disabled");
   }
 
+  /******************
+   * Submission ring
+   */
+  omx__globals.submitq_idle_us = 0;
+  env = getenv("OMX_SUBMITQ");
+  if (env) {
+    omx__globals.submitq_idle_us = atoi(env);
+    if (omx__globals.submitq_idle_us)
+      omx__verbose_printf(NULL, "Forcing submission ring with %u us idle polling\n",
+			  omx__globals.submitq_idle_us);
+    else
+      omx__verbose_printf(NULL, "Forcing submission ring to disabled\n");
+  }
+
+  /******************
+   * Progress thread
+   */
+  omx__globals.progress_thread_spin_us = 0;
+  env = getenv("OMX_PROGRESS_THREAD");
+  if (env) {
+    omx__globals.progress_thread_spin_us = atoi(env);
+    if (omx__globals.progress_thread_spin_us)
+      omx__verbose_printf(NULL, "Forcing progress thread with %u us spinning after activity\n",
+			  omx__globals.progress_thread_spin_us);
+    else
+      omx__verbose_printf(NULL, "Forcing progress thread to disabled\n");
+  }
+
+  omx__globals.progress_thread_cpu = -1;
+  env = getenv("OMX_PROGRESS_THREAD_CPU");
+  if (env) {
+    omx__globals.progress_thread_cpu = atoi(env);
+    omx__verbose_printf(NULL, "Forcing progress thread binding on cpu #%d\n",
+			omx__globals.progress_thread_cpu);
+  }
+
+  /************************
+   * Expected medium slots
+   */
+  omx__globals.exp_medium_min = 0;
+  env = getenv("OMX_MEDIUM_ZCOPY");
+  if (env) {
+    omx__globals.exp_medium_min = atoi(env);
+    if (omx__globals.exp_medium_min)
+      omx__verbose_printf(NULL, "Forcing zero-copy medium receive for buffers of at least %u bytes\n",
+			  omx__globals.exp_medium_min);
+    else
+      omx__verbose_printf(NULL, "Forcing zero-copy medium receive to disabled\n");
+  }
+
   /*********
    * Ctxids
    */
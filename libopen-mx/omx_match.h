@@ -0,0 +1,92 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License in COPYING.LGPL for more details.
+ */
+
+#ifndef __omx_match_h__
+#define __omx_match_h__
+
+#include "omx_lib.h"
+#include "omx_list.h"
+
+/*
+ * Posted receive matching engine.
+ *
+ * Receives with a full match_mask may only match a single match_info,
+ * so they are hashed on it. The others go to a wildcard queue.
+ * Both are kept in post order, and each entry gets a post sequence
+ * number so that an incoming message still matches the first posted
+ * receive that accepts it, as required by MX, while fully-specified
+ * receives are found without walking the whole queue.
+ */
+
+static inline unsigned
+omx__match_hash(uint64_t match_info)
+{
+  uint32_t folded = (uint32_t) (match_info ^ (match_info >> 32));
+  return (folded * 0x9e370001U) >> (32 - OMX__MATCH_HASH_BITS);
+}
+
+static inline void
+omx__match_hash_init(struct list_head *hash)
+{
+  unsigned i;
+
+  for(i=0; i<OMX__MATCH_HASH_SIZE; i++)
+    list_head_init(&hash[i]);
+}
+
+static inline void
+omx__match_post(struct list_head *hash, struct list_head *wildcard_q,
+		struct omx__match_elt *match, uint64_t post_seq)
+{
+  match->post_seq = post_seq;
+  if (likely(match->match_mask == (uint64_t) -1))
+    list_add_tail(&match->elt, &hash[omx__match_hash(match->match_info)]);
+  else
+    list_add_tail(&match->elt, wildcard_q);
+}
+
+static inline void
+omx__match_unpost(struct omx__match_elt *match)
+{
+  list_del(&match->elt);
+}
+
+/* find the first posted entry accepting match_info, without dequeueing it */
+static inline struct omx__match_elt *
+omx__match_find(struct list_head *hash, struct list_head *wildcard_q,
+		uint64_t match_info)
+{
+  struct omx__match_elt *exact = NULL, *match;
+
+  list_for_each_entry(match, &hash[omx__match_hash(match_info)], elt)
+    if (match->match_info == match_info) {
+      exact = match;
+      break;
+    }
+
+  list_for_each_entry(match, wildcard_q, elt) {
+    if (exact && match->post_seq > exact->post_seq)
+      /* posted after the fully-specified one */
+      break;
+    if (match->match_info == (match->match_mask & match_info))
+      return match;
+  }
+
+  return exact;
+}
+
+#endif /* __omx_match_h__ */
@@ -147,6 +147,8 @@ omx__sprintf_reqstate(uint16_t state, char *str)
     str += sprintf(str, "Zombie ");
   if (state & OMX_REQUEST_STATE_INTERNAL)
       str += sprintf(str, "Internal ");
+  if (state & OMX_REQUEST_STATE_RECV_EXP_MEDIUM)
+    str += sprintf(str, "RecvExpMedium ");
 }
 
 /* API omx_strerror */
@@ -276,8 +278,11 @@ omx__cancel_common(omx_endpoint_t ep,
   case OMX_REQUEST_TYPE_RECV: {
     if (req->generic.state & OMX_REQUEST_STATE_RECV_NEED_MATCHING) {
       /* not matched, still in the recv queue */
-      uint32_t ctxid = CTXID_FROM_MATCHING(ep, req->recv.match_info);
-      omx__dequeue_request(&ep->ctxid[ctxid].recv_req_q, req);
+      uint32_t ctxid = CTXID_FROM_MATCHING(ep, req->recv.match.match_info);
+      /* release the slot while still posted, so that it is counted as unarmed when dequeued */
+      if (unlikely(req->generic.state & OMX_REQUEST_STATE_RECV_EXP_MEDIUM))
+	omx__exp_medium_release(ep, req);
+      omx__dequeue_posted_recv(ep, ctxid, req);
       omx_free_segments(ep, &req->send.segs);
       req->generic.state &= ~OMX_REQUEST_STATE_RECV_NEED_MATCHING;
       *result = 1;
@@ -108,7 +108,7 @@ omx_decompose_endpoint_addr_with_session(omx_endpoint_addr_t endpoint_addr,
  */
 
 static void
-omx__partner_reset(struct omx__partner *partner)
+omx__partner_reset(struct omx_endpoint *ep, struct omx__partner *partner)
 {
   list_head_init(&partner->non_acked_req_q);
   list_head_init(&partner->connect_req_q);
@@ -126,12 +126,15 @@ omx__partner_reset(struct omx__partner *partner)
   OMX__SEQNUM_RESET(partner->next_match_recv_seq); /* will force the sender's send seq through the connect */
   partner->next_frag_recv_seq = partner->next_match_recv_seq; /* will force the sender's send seq through the connect */
   partner->last_acked_recv_seq = partner->next_frag_recv_seq; /* nothing to ack yet */
+  omx__exp_medium_set_seqnum(ep, partner, 1);
   partner->connect_seqnum = 0;
   partner->last_send_acknum = 0;
   partner->last_recv_acknum = 0;
   partner->throttling_sends_nr = 0;
 
   if (partner->need_ack != OMX__PARTNER_NEED_NO_ACK) {
+    if (partner->need_ack == OMX__PARTNER_NEED_ACK_IMMEDIATE)
+      ep->partners_to_ack_immediate_nr--;
     partner->need_ack = OMX__PARTNER_NEED_NO_ACK;
     list_del(&partner->endpoint_partners_to_ack_elt);
   }
@@ -145,7 +148,7 @@ omx__partner_create(struct omx_endpoint *ep, uint16_t peer_index,
   struct omx__partner * partner;
   uint32_t partner_index;
 
-  partner = omx_malloc_ep(ep, sizeof(*partner));
+  partner = omx_memalign_ep(ep, OMX__CACHELINE_SIZE, sizeof(*partner));
   if (unlikely(!partner))
     /* let the caller handle the error if retransmission cannot recover this */
     return OMX_NO_RESOURCES;
@@ -158,7 +161,7 @@ omx__partner_create(struct omx_endpoint *ep, uint16_t peer_index,
   partner->need_ack = OMX__PARTNER_NEED_NO_ACK;
   partner->user_context = NULL;
 
-  omx__partner_reset(partner);
+  omx__partner_reset(ep, partner);
 
   partner_index = ((uint32_t) endpoint_index)
     + ((uint32_t) peer_index) * omx__driver_desc->endpoint_max;
@@ -275,6 +278,7 @@ omx__connect_myself(struct omx_endpoint *ep)
   ep->myself->next_acked_send_seq = OMX__SEQNUM(1);
   ep->myself->next_match_recv_seq = OMX__SEQNUM(1);
   ep->myself->next_frag_recv_seq = OMX__SEQNUM(1);
+  omx__exp_medium_set_seqnum(ep, ep->myself, 1);
   ep->myself->true_session_id = ep->desc->session_id;
   ep->myself->back_session_id = ep->desc->session_id;
 
@@ -380,6 +384,7 @@ omx__connect_common(omx_endpoint_t ep,
   /* no need to wait for a done event, connect is synchronous */
   omx__enqueue_request(&ep->connect_req_q, req);
   omx__enqueue_partner_request(&partner->connect_req_q, req);
+  omx__arm_resend_timer(ep, req);
 
   req->generic.partner = partner;
   req->generic.resends_max = ep->req_resends_max;
@@ -682,6 +687,7 @@ omx__process_recv_connect_request(struct omx_endpoint *ep,
     /* setup recv seqnum */
     OMX__SEQNUM_RESET(partner->next_match_recv_seq); /* will force the sender's send seq through the connect */
     OMX__SEQNUM_RESET(partner->next_frag_recv_seq); /* will force the sender's send seq through the connect */
+    omx__exp_medium_set_seqnum(ep, partner, 1);
   }
 
   if (partner->true_session_id != src_session_id) {
@@ -813,8 +819,7 @@ omx__partner_cleanup(struct omx_endpoint *ep, struct omx__partner *partner, int
   omx__foreach_request_safe(&ep->need_resources_send_req_q, req, next) {
     if (req->generic.partner != partner)
       continue;
-    omx___dequeue_request(req);
-    req->generic.state &= ~OMX_REQUEST_STATE_NEED_RESOURCES;
+    omx__dequeue_need_resources_request(ep, req);
     omx__debug_printf(CONNECT, ep, "Dropping need-resources send %p\n", req);
     omx__complete_unsent_send_request(ep, req);
     count++;
@@ -890,8 +895,7 @@ omx__partner_cleanup(struct omx_endpoint *ep, struct omx__partner *partner, int
     omx___dequeue_partner_early_packet(early);
     omx__debug_printf(CONNECT, ep, "Dropping early fragment %p\n", early);
 
-    omx_free_ep(ep, early->data);
-    omx_free_ep(ep, early);
+    omx__early_packet_free(ep, early);
     count++;
   }
   if (count)
@@ -924,7 +928,7 @@ omx__partner_cleanup(struct omx_endpoint *ep, struct omx__partner *partner, int
   /*
    * Reset everything else to zero
    */
-  omx__partner_reset(partner);
+  omx__partner_reset(ep, partner);
 
   if (disconnect) {
     /*
@@ -934,6 +938,7 @@ omx__partner_cleanup(struct omx_endpoint *ep, struct omx__partner *partner, int
     partner->next_frag_recv_seq ^= OMX__SEQNUM(0xcf0f);
     partner->next_match_recv_seq += OMX__SESNUM_ONE;
     partner->next_frag_recv_seq += OMX__SESNUM_ONE;
+    omx__exp_medium_set_seqnum(ep, partner, 1);
     omx__debug_printf(SEQNUM, ep, "disconnect increasing session number to #%d\n",
 		      (unsigned) OMX__SESNUM_SHIFTED(partner->next_match_recv_seq));
 
@@ -946,6 +951,7 @@ omx__partner_cleanup(struct omx_endpoint *ep, struct omx__partner *partner, int
       uint32_t partner_index = ((uint32_t) partner->endpoint_index)
 				+ ((uint32_t) partner->peer_index) * omx__driver_desc->endpoint_max;
       ep->partners[partner_index] = NULL;
+      omx__exp_medium_set_seqnum(ep, partner, 0);
       omx_free_ep(ep, partner);
     }
   }
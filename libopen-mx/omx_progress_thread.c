@@ -0,0 +1,199 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License in COPYING.LGPL for more details.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sched.h>
+
+#include "omx_lib.h"
+
+/*
+ * Optional progress thread.
+ *
+ * Without it, the endpoint only progresses when the application calls
+ * the library. The thread progresses the endpoint on its own, spinning
+ * as long as some events arrived during the last spin_us microseconds,
+ * and sleeping in the driver (like omx__wait) once it became idle.
+ *
+ * It sleeps on progress_thread_cond while progression is disabled, by the
+ * API or because an unexpected handler is running in another thread.
+ * Handlers called by the progress thread itself are invoked by omx__progress
+ * with the lock released, as usual.
+ */
+
+#ifdef OMX_LIB_THREAD_SAFETY
+
+#pragma weak pthread_create
+#pragma weak pthread_join
+
+static uint64_t
+omx__progress_thread_now_us(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/* called with the lock held, returns with the lock held */
+static void
+omx__progress_thread_sleep(struct omx_endpoint *ep)
+{
+  struct omx_cmd_wait_event wait_param;
+  int err;
+
+  /* the driver wakes us up on timers through the descriptor wakeup_jiffies */
+  wait_param.jiffies_expire = OMX_CMD_WAIT_EVENT_TIMEOUT_INFINITE;
+  wait_param.status = OMX_CMD_WAIT_EVENT_STATUS_EVENT;
+  wait_param.next_exp_event_index = ep->next_exp_event_index;
+  wait_param.next_unexp_event_index = ep->next_unexp_event_index;
+  wait_param.user_event_index = ep->desc->user_event_index;
+  omx__prepare_progress_wakeup(ep);
+
+  OMX__ENDPOINT_UNLOCK(ep);
+  err = ioctl(ep->fd, OMX_CMD_WAIT_EVENT, &wait_param);
+  OMX__ENDPOINT_LOCK(ep);
+
+  if (unlikely(err < 0 && errno != EINTR))
+    omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
+				       OMX_SUCCESS,
+				       "wait event in the driver for the progress thread");
+}
+
+static void *
+omx__progress_thread(void *data)
+{
+  struct omx_endpoint *ep = data;
+  int cpu = omx__globals.progress_thread_cpu;
+  uint64_t spin_us = omx__globals.progress_thread_spin_us;
+  uint64_t last_activity;
+
+  if (cpu >= 0) {
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    CPU_SET(cpu, &cs);
+    /* pid 0 is the calling thread */
+    if (sched_setaffinity(0, sizeof(cs), &cs) < 0)
+      omx__verbose_printf(ep, "Failed to bind progress thread on cpu #%d, %m\n", cpu);
+  }
+
+  last_activity = omx__progress_thread_now_us();
+
+  OMX__ENDPOINT_LOCK(ep);
+  while (!ep->progress_thread_stop) {
+    omx_eventq_index_t exp_index = ep->next_exp_event_index;
+    omx_eventq_index_t unexp_index = ep->next_unexp_event_index;
+    uint64_t now;
+
+    if (ep->progression_disabled) {
+      /* signaled by omx_reenable_progression and at the end of handlers */
+      OMX__ENDPOINT_PROGRESS_THREAD_WAIT(ep);
+      last_activity = omx__progress_thread_now_us();
+      continue;
+    }
+
+    omx__progress(ep);
+
+    now = omx__progress_thread_now_us();
+    if (ep->next_exp_event_index != exp_index || ep->next_unexp_event_index != unexp_index) {
+      last_activity = now;
+    } else if (now - last_activity >= spin_us) {
+      omx__progress_thread_sleep(ep);
+      last_activity = omx__progress_thread_now_us();
+      continue;
+    }
+
+    /* let the application threads take the lock while spinning */
+    OMX__ENDPOINT_UNLOCK(ep);
+    sched_yield();
+    OMX__ENDPOINT_LOCK(ep);
+  }
+  OMX__ENDPOINT_UNLOCK(ep);
+
+  return NULL;
+}
+
+void
+omx__progress_thread_start(struct omx_endpoint *ep)
+{
+  int err;
+
+  ep->progress_thread_running = 0;
+  ep->progress_thread_stop = 0;
+
+  if (!omx__globals.progress_thread_spin_us)
+    return;
+
+  if (!pthread_create) {
+    omx__verbose_printf(ep, "Cannot start the progress thread without libpthread\n");
+    return;
+  }
+
+  err = pthread_create(&ep->progress_thread, NULL, omx__progress_thread, ep);
+  if (err) {
+    omx__verbose_printf(ep, "Failed to start the progress thread, %s\n", strerror(err));
+    return;
+  }
+
+  ep->progress_thread_running = 1;
+}
+
+/* called with the lock held, which is released while joining */
+void
+omx__progress_thread_stop(struct omx_endpoint *ep)
+{
+  if (ep->progress_thread_running) {
+    struct omx_cmd_wakeup wakeup;
+    int err;
+
+    ep->progress_thread_stop = 1;
+    OMX__ENDPOINT_PROGRESS_THREAD_SIGNAL(ep);
+
+    /* make the driver return immediately if the thread is not sleeping yet */
+    ep->desc->user_event_index++;
+    wakeup.status = OMX_CMD_WAIT_EVENT_STATUS_WAKEUP;
+    err = ioctl(ep->fd, OMX_CMD_WAKEUP, &wakeup);
+    if (unlikely(err < 0))
+      omx__ioctl_errno_to_return_checked(OMX_SUCCESS,
+					 "wakeup the progress thread in the driver");
+
+    OMX__ENDPOINT_UNLOCK(ep);
+    pthread_join(ep->progress_thread, NULL);
+    OMX__ENDPOINT_LOCK(ep);
+
+    ep->progress_thread_running = 0;
+  }
+}
+
+#else /* !OMX_LIB_THREAD_SAFETY */
+
+void
+omx__progress_thread_start(struct omx_endpoint *ep)
+{
+  if (omx__globals.progress_thread_spin_us)
+    omx__verbose_printf(ep, "Cannot start the progress thread without thread safety support\n");
+}
+
+void
+omx__progress_thread_stop(struct omx_endpoint *ep)
+{
+  /* nothing */
+}
+
+#endif /* !OMX_LIB_THREAD_SAFETY */
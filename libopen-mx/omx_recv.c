@@ -18,10 +18,272 @@
  * See the GNU Lesser General Public License in COPYING.LGPL for more details.
  */
 
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
 #include "omx_lib.h"
 #include "omx_segments.h"
 #include "omx_request.h"
 
+/*************************
+ * Expected medium slots
+ */
+
+/*
+ * When enabled, eligible posted receives get their buffer armed in one
+ * of the driver expected medium slots. The driver then copies the fragments
+ * of the first matching medium straight into this buffer, and tells us
+ * in the event, so that the usual processing does not copy them again.
+ *
+ * The slot is kept as long as the request is posted, or matched to the
+ * medium that came through it. Whenever the request is matched to another
+ * message, completed or cancelled, the slot is released in the driver so
+ * that it does not write into the buffer anymore. The driver frees the slot
+ * by itself once the whole medium has been received. Events from a slot
+ * that we released or re-armed meanwhile are dropped, the sender will
+ * resend them through the recvq.
+ *
+ * The driver gives a medium to the oldest armed slot that matches, so a
+ * slot is never armed while an earlier posted receive that may match the
+ * same messages is not armed, since we would match the message to the
+ * latter. Checking the overlap would mean walking the posted receives on
+ * each irecv, we rather count the unarmed ones of each ctxid and only arm
+ * when there is no other. Receives that are not armed because of this
+ * are still received through the recvq. We also keep the next seqnum we will match for each partner
+ * in a table mapped from the driver, so that duplicates and late fragments
+ * of already matched messages do not claim a slot.
+ */
+
+void
+omx__exp_medium_init(struct omx_endpoint *ep)
+{
+  void *seqnums;
+  int i;
+
+  ep->exp_medium_enabled = 0;
+  ep->exp_medium_cookie = 0;
+  ep->exp_medium_cur_msg = NULL;
+  ep->exp_medium_done_req = NULL;
+  ep->exp_medium_seqnums = NULL;
+  for(i=0; i<OMX_EXP_MEDIUM_SLOT_NR; i++)
+    ep->exp_medium_slots[i].req = NULL;
+
+  if (!omx__globals.exp_medium_min)
+    return;
+
+  if (!(omx__driver_desc->features & OMX_DRIVER_FEATURE_EXP_MEDIUM)) {
+    omx__verbose_printf(ep, "Driver does not support zero-copy medium receive, ignoring\n");
+    return;
+  }
+
+  /* the driver checks seqnums the way we do */
+  BUILD_BUG_ON(OMX__SEQNUM_MASK != OMX_EXP_MEDIUM_SEQNUM_MASK);
+  BUILD_BUG_ON(OMX__EARLY_PACKET_OFFSET_MAX != OMX_EXP_MEDIUM_SEQNUM_EARLY_MAX);
+
+  /* partners are created later, all entries are still invalid */
+  seqnums = mmap(0, OMX_EXP_MEDIUM_SEQNUMS_SIZE(omx__driver_desc->peer_max, omx__driver_desc->endpoint_max),
+		 PROT_READ|PROT_WRITE, MAP_SHARED, ep->fd, OMX_EXP_MEDIUM_SEQNUMS_FILE_OFFSET);
+  if (seqnums == MAP_FAILED) {
+    omx__verbose_printf(ep, "Failed to map the expected medium seqnums (%m), ignoring\n");
+    return;
+  }
+
+  ep->exp_medium_seqnums = seqnums;
+  ep->exp_medium_enabled = 1;
+}
+
+static INLINE void
+omx__exp_medium_detach(struct omx_endpoint *ep, struct omx__exp_medium_slot *slot)
+{
+  union omx_request *req = slot->req;
+
+  omx__debug_assert(req->generic.state & OMX_REQUEST_STATE_RECV_EXP_MEDIUM);
+  req->generic.state &= ~OMX_REQUEST_STATE_RECV_EXP_MEDIUM;
+  if (req->generic.state & OMX_REQUEST_STATE_RECV_NEED_MATCHING)
+    /* still posted */
+    ep->ctxid[CTXID_FROM_MATCHING(ep, req->recv.match.match_info)].recv_unarmed_nr++;
+  omx__put_region(ep, slot->region, NULL);
+  slot->req = NULL;
+}
+
+/* the driver will not write into the request buffer anymore once this returns */
+void
+omx__exp_medium_release(struct omx_endpoint *ep, union omx_request *req)
+{
+  struct omx__exp_medium_slot *slot = &ep->exp_medium_slots[req->recv.exp_medium_slot];
+  struct omx_cmd_release_exp_medium release_param;
+  int err;
+
+  omx__debug_assert(slot->req == req);
+
+  release_param.slot = req->recv.exp_medium_slot;
+  release_param.pad = 0;
+  err = ioctl(ep->fd, OMX_CMD_RELEASE_EXP_MEDIUM, &release_param);
+  if (unlikely(err < 0))
+    omx__ioctl_errno_to_return_checked(OMX_SUCCESS,
+				       "release expected medium slot");
+
+  omx__exp_medium_detach(ep, slot);
+}
+
+/* whether some message may match both receives */
+static INLINE int
+omx__exp_medium_may_match_both(const union omx_request *req1, const union omx_request *req2)
+{
+  uint64_t mask = req1->recv.match.match_mask & req2->recv.match.match_mask;
+
+  return !((req1->recv.match.match_info ^ req2->recv.match.match_info) & mask);
+}
+
+/* pushed messages may also land in a slot */
+static INLINE uint32_t
+omx__exp_medium_length_max(void)
+{
+#ifndef OMX_MX_WIRE_COMPAT
+  if (omx__driver_desc->features & OMX_DRIVER_FEATURE_PUSH)
+    return OMX_PUSH_MSG_LENGTH_MAX;
+#endif
+  return OMX__MX_MEDIUM_MSG_LENGTH_MAX;
+}
+
+static void
+omx__exp_medium_arm(struct omx_endpoint *ep, union omx_request *req)
+{
+  struct omx_cmd_post_exp_medium post_param;
+  struct omx__exp_medium_slot *slot;
+  struct omx__large_region *region;
+  uint32_t ctxid = CTXID_FROM_MATCHING(ep, req->recv.match.match_info);
+  uint32_t length = req->recv.segs.total_length;
+  uint32_t region_offset;
+  omx_return_t ret;
+  int i, err;
+
+  if (length < omx__globals.exp_medium_min
+      || length > omx__exp_medium_length_max()
+      || req->recv.segs.nseg != 1)
+    return;
+
+  for(i=0; i<OMX_EXP_MEDIUM_SLOT_NR; i++)
+    if (!ep->exp_medium_slots[i].req)
+      break;
+  if (i == OMX_EXP_MEDIUM_SLOT_NR)
+    return;
+  slot = &ep->exp_medium_slots[i];
+
+  /* the request was just posted and is counted, all others are earlier */
+  if (ep->ctxid[ctxid].recv_unarmed_nr > 1)
+    return;
+
+  ret = omx__get_region(ep, &req->recv.segs, &region, &region_offset, NULL);
+  if (unlikely(ret != OMX_SUCCESS))
+    return;
+
+  post_param.slot = i;
+  post_param.rdma_id = region->id;
+  post_param.match_info = req->recv.match.match_info;
+  post_param.match_mask = req->recv.match.match_mask;
+  post_param.length = length;
+  post_param.cookie = ++ep->exp_medium_cookie;
+  post_param.region_offset = region_offset;
+  post_param.pad = 0;
+  err = ioctl(ep->fd, OMX_CMD_POST_EXP_MEDIUM, &post_param);
+  if (unlikely(err < 0)) {
+    /* not fatal, mediums will go through the recvq as usual */
+    omx__debug_printf(MEDIUM, ep, "failed to arm expected medium slot %d (%m)\n", i);
+    omx__put_region(ep, region, NULL);
+    return;
+  }
+
+  slot->req = req;
+  slot->region = region;
+  slot->region_offset = region_offset;
+  slot->cookie = post_param.cookie;
+  req->recv.exp_medium_slot = i;
+  req->generic.state |= OMX_REQUEST_STATE_RECV_EXP_MEDIUM;
+  ep->ctxid[ctxid].recv_unarmed_nr--;
+}
+
+/* the request has just been matched to msg */
+static INLINE void
+omx__exp_medium_matched(struct omx_endpoint *ep, union omx_request *req,
+			const struct omx_evt_recv_msg *msg)
+{
+  /* keep the slot if the driver is writing this very message into the buffer */
+  if (msg == ep->exp_medium_cur_msg
+      && msg->specific.medium_frag.exp_slot == req->recv.exp_medium_slot + 1)
+    return;
+
+  omx__exp_medium_release(ep, req);
+}
+
+/*
+ * Called before processing a medium frag event that came through a slot.
+ * Returns where the driver wrote the data, or NULL if the event must be dropped.
+ */
+const void *
+omx__exp_medium_frag_begin(struct omx_endpoint *ep, const struct omx_evt_recv_msg *msg)
+{
+  unsigned index = msg->specific.medium_frag.exp_slot - 1;
+  struct omx__exp_medium_slot *slot;
+  unsigned long frag_seqnum = msg->specific.medium_frag.frag_seqnum;
+#ifdef OMX_MX_WIRE_COMPAT
+  unsigned long offset = frag_seqnum << msg->specific.medium_frag.frag_pipeline;
+#else
+  unsigned long offset = frag_seqnum * OMX_MEDIUM_FRAG_LENGTH_MAX;
+#endif
+  const char *buffer;
+
+  if (unlikely(index >= OMX_EXP_MEDIUM_SLOT_NR))
+    return NULL;
+  slot = &ep->exp_medium_slots[index];
+
+  if (unlikely(!slot->req || slot->cookie != msg->specific.medium_frag.exp_cookie)) {
+    omx__debug_printf(MEDIUM, ep, "dropping medium frag from released expected slot %d\n", index);
+    return NULL;
+  }
+
+  /* the buffer remains valid while processing, the request cannot complete before */
+  buffer = (const char *) OMX_SEG_PTR(&slot->req->recv.segs.single) + offset;
+
+  if (msg->specific.medium_frag.exp_flags & OMX_EVT_MEDIUM_FRAG_EXP_DONE) {
+    /* the driver freed the slot, no need to release it anymore */
+    if (slot->req->generic.state & OMX_REQUEST_STATE_RECV_NEED_MATCHING)
+      /* the message may not be matched to it, check once processed */
+      ep->exp_medium_done_req = slot->req;
+    omx__exp_medium_detach(ep, slot);
+  } else {
+    ep->exp_medium_cur_msg = msg;
+  }
+
+  return buffer;
+}
+
+/* Called after processing a medium frag event that came through a slot */
+void
+omx__exp_medium_frag_end(struct omx_endpoint *ep)
+{
+  union omx_request *req = ep->exp_medium_done_req;
+  union omx_request *later;
+  uint32_t ctxid;
+
+  ep->exp_medium_cur_msg = NULL;
+
+  if (likely(!req))
+    return;
+  ep->exp_medium_done_req = NULL;
+
+  /*
+   * The request lost its slot but is still posted,
+   * later receives that may match the same messages cannot keep theirs.
+   */
+  ctxid = CTXID_FROM_MATCHING(ep, req->recv.match.match_info);
+  omx__foreach_request(&ep->ctxid[ctxid].recv_req_q, later)
+    if ((later->generic.state & OMX_REQUEST_STATE_RECV_EXP_MEDIUM)
+	&& later->recv.match.post_seq > req->recv.match.post_seq
+	&& omx__exp_medium_may_match_both(req, later))
+      omx__exp_medium_release(ep, later);
+}
+
 /*********************
  * Receive completion
  */
@@ -45,6 +307,10 @@ omx__recv_complete(struct omx_endpoint *ep, union omx_request *req,
     }
   }
 
+  /* make sure the driver does not write into the buffer anymore */
+  if (unlikely(req->generic.state & OMX_REQUEST_STATE_RECV_EXP_MEDIUM))
+    omx__exp_medium_release(ep, req);
+
   /* the request is done, we can free the segments */
   omx_free_segments(ep, &req->send.segs);
 
@@ -152,7 +418,7 @@ omx__postpone_early_packet(struct omx_endpoint *ep, struct omx__partner * partne
     /* obsolete early ? ignore */
     return;
 
-  early = omx_malloc_ep(ep, sizeof(*early));
+  early = omx__early_packet_alloc(ep);
   if (unlikely(!early))
     /* cannot store early? just drop, it will be resent */
     return;
@@ -174,9 +440,9 @@ omx__postpone_early_packet(struct omx_endpoint *ep, struct omx__partner * partne
 
   case OMX_EVT_RECV_SMALL: {
     uint16_t length = msg->specific.small.length;
-    char * early_data = omx_malloc_ep(ep, length);
-    if (!early_data) {
-      omx_free_ep(ep, early);
+    char * early_data = omx__small_buffer_alloc(ep);
+    if (unlikely(!early_data)) {
+      omx__early_packet_free(ep, early);
       /* cannot store early? just drop, it will be resent */
       return;
     }
@@ -190,7 +456,7 @@ omx__postpone_early_packet(struct omx_endpoint *ep, struct omx__partner * partne
     uint16_t frag_length = msg->specific.medium_frag.frag_length;
     char * early_data = omx_malloc_ep(ep, frag_length);
     if (unlikely(!early_data)) {
-      omx_free_ep(ep, early);
+      omx__early_packet_free(ep, early);
       /* cannot store early? just drop, it will be resent */
       return;
     }
@@ -299,7 +565,7 @@ omx__process_recv_small(struct omx_endpoint *ep, struct omx__partner *partner,
 static INLINE void
 omx__init_process_recv_medium(union omx_request *req)
 {
-  req->recv.specific.medium.frags_received_mask = 0;
+  memset(req->recv.specific.medium.frags_received_mask, 0, sizeof(req->recv.specific.medium.frags_received_mask));
   req->recv.specific.medium.accumulated_length = 0;
   /* initialize the state to the beginning */
   req->recv.specific.medium.scan_offset = 0;
@@ -307,6 +573,26 @@ omx__init_process_recv_medium(union omx_request *req)
   req->recv.specific.medium.scan_state.offset = 0;
 }
 
+/* returns 1 if all frags after frag_seqnum were received */
+static INLINE int
+omx__medium_frags_received_after(const union omx_request *req,
+				 unsigned long msg_length, unsigned long frag_seqnum)
+{
+#ifdef OMX_MX_WIRE_COMPAT
+  /* no push sack in MX wire */
+  return 0;
+#else
+  const uint32_t * received_mask = req->recv.specific.medium.frags_received_mask;
+  unsigned long frags_nr = (msg_length + OMX_MEDIUM_FRAG_LENGTH_MAX-1) / OMX_MEDIUM_FRAG_LENGTH_MAX;
+  unsigned long i;
+
+  for(i=frag_seqnum+1; i<frags_nr; i++)
+    if (!(received_mask[i/32] & (1U << (i%32))))
+      return 0;
+  return 1;
+#endif
+}
+
 void
 omx__process_recv_medium_frag(struct omx_endpoint *ep, struct omx__partner *partner,
 			      union omx_request *req,
@@ -324,7 +610,8 @@ omx__process_recv_medium_frag(struct omx_endpoint *ep, struct omx__partner *part
   unsigned long offset = frag_seqnum * OMX_MEDIUM_FRAG_LENGTH_MAX;
 #endif
   unsigned long xfer_chunk;
-  int new = (req->recv.specific.medium.frags_received_mask == 0);
+  uint32_t * received_mask = req->recv.specific.medium.frags_received_mask;
+  int new = !(req->generic.state & OMX_REQUEST_STATE_RECV_PARTIAL);
 
   omx__debug_printf(MEDIUM, ep, "got a medium frag seqnum %d length %d offset %d of total %d\n",
 		    (unsigned) frag_seqnum, (unsigned) chunk,
@@ -336,12 +623,15 @@ omx__process_recv_medium_frag(struct omx_endpoint *ep, struct omx__partner *part
   }
   omx__debug_assert(offset + chunk <= msg_length);
 
-  if (unlikely(req->recv.specific.medium.frags_received_mask & (1 << frag_seqnum))) {
+  if (unlikely(received_mask[frag_seqnum/32] & (1U << (frag_seqnum%32)))) {
     /* already received this frag, requeue back */
     omx__debug_printf(MEDIUM, ep, "got a duplicate frag seqnum %d for medium seqnum %d (#%d)\n",
 		      (unsigned) frag_seqnum,
 		      (unsigned) OMX__SEQNUM(req->recv.seqnum),
 		      (unsigned) OMX__SESNUM_SHIFTED(req->recv.seqnum));
+    /* the sender is resending, tell it what is still missing */
+    if (omx__medium_frags_received_after(req, msg_length, frag_seqnum))
+      omx__send_push_sack(ep, partner, req);
     /* keep the request enqueued the same */
     return;
   }
@@ -354,9 +644,12 @@ omx__process_recv_medium_frag(struct omx_endpoint *ep, struct omx__partner *part
   else
     xfer_chunk = 0;
 
-  /* take care of the data chunk */
-  if (likely(req->recv.segs.nseg == 1))
-    memcpy(OMX_SEG_PTR(&req->recv.segs.single) + offset, data, xfer_chunk);
+  /* take care of the data chunk, unless the driver already wrote it there */
+  if (likely(req->recv.segs.nseg == 1)) {
+    char *dst = (char *) OMX_SEG_PTR(&req->recv.segs.single) + offset;
+    if (likely(dst != data))
+      memcpy(dst, data, xfer_chunk);
+  }
   else
     omx_partial_copy_to_segments(ep, &req->recv.segs, data, xfer_chunk,
 				 offset, &req->recv.specific.medium.scan_state,
@@ -373,7 +666,7 @@ omx__process_recv_medium_frag(struct omx_endpoint *ep, struct omx__partner *part
 #endif
 
   /* update and check the accumulated received length */
-  req->recv.specific.medium.frags_received_mask |= 1 << frag_seqnum;
+  received_mask[frag_seqnum/32] |= 1U << (frag_seqnum%32);
   req->recv.specific.medium.accumulated_length += chunk;
 
   if (unlikely(new)) {
@@ -430,6 +723,10 @@ omx__process_recv_medium_frag(struct omx_endpoint *ep, struct omx__partner *part
     omx__debug_printf(MEDIUM, ep, "got one frag of seqnum %d (#%d)\n",
 		      (unsigned) OMX__SEQNUM(req->recv.seqnum),
 		      (unsigned) OMX__SESNUM_SHIFTED(req->recv.seqnum));
+
+    /* the end of a burst arrived while some earlier frags were lost */
+    if (omx__medium_frags_received_after(req, msg_length, frag_seqnum))
+      omx__send_push_sack(ep, partner, req);
   }
 }
 
@@ -479,13 +776,12 @@ omx__match_recv(struct omx_endpoint *ep,
   uint32_t ctxid = CTXID_FROM_MATCHING(ep, match_info);
   union omx_request * req;
 
-  omx__foreach_request(&ep->ctxid[ctxid].recv_req_q, req)
-    if (likely(req->recv.match_info == (req->recv.match_mask & match_info))) {
-      /* matched a posted recv */
-      omx___dequeue_request(req);
-      *reqp = req;
-      break;
-    }
+  req = omx__find_posted_recv(ep, ctxid, match_info);
+  if (likely(req)) {
+    /* matched a posted recv */
+    omx__dequeue_posted_recv(ep, ctxid, req);
+    *reqp = req;
+  }
 }
 
 static INLINE omx_return_t
@@ -571,6 +867,11 @@ omx__try_match_next_recv(struct omx_endpoint *ep,
 
     omx__debug_assert(req->generic.state & OMX_REQUEST_STATE_RECV_NEED_MATCHING);
     req->generic.state &= ~OMX_REQUEST_STATE_RECV_NEED_MATCHING;
+    if (unlikely(req == ep->exp_medium_done_req))
+      ep->exp_medium_done_req = NULL;
+
+    if (unlikely(req->generic.state & OMX_REQUEST_STATE_RECV_EXP_MEDIUM))
+      omx__exp_medium_matched(ep, req, msg);
 
     req->generic.status.msg_length = msg_length;
     xfer_length = req->recv.segs.total_length < msg_length ? req->recv.segs.total_length : msg_length;
@@ -717,6 +1018,7 @@ omx__process_partner_ordered_recv(struct omx_endpoint *ep,
     if (ret == OMX_SUCCESS) {
       /* we matched this seqnum, we now expect the next one */
       OMX__SEQNUM_INCREASE(partner->next_match_recv_seq);
+      omx__exp_medium_set_seqnum(ep, partner, 1);
       omx__update_partner_next_frag_recv_seq(ep, partner);
     }
 
@@ -810,8 +1112,7 @@ omx__process_recv(struct omx_endpoint *ep,
 					    early->recv_func);
 	  /* ignore errors, the packet will be resent anyway, the recv seqnums didn't increase */
 
-	  omx_free_ep(ep, early->data);
-	  omx_free_ep(ep, early);
+	  omx__early_packet_free(ep, early);
 	}
       }
     }
@@ -1039,6 +1340,24 @@ omx__process_recv_liback(struct omx_endpoint *ep,
   omx__handle_liback(ep, partner, liback);
 }
 
+/****************************
+ * Push Sack Message Receive
+ */
+
+void
+omx__process_recv_push_sack(struct omx_endpoint *ep,
+			    const struct omx_evt_recv_push_sack *sack)
+{
+  struct omx__partner *partner;
+
+  omx__partner_recv_lookup(ep, sack->peer_index, sack->src_endpoint,
+			   &partner);
+  if (unlikely(!partner))
+    return;
+
+  omx__handle_push_sack(ep, partner, sack);
+}
+
 /***************************
  * Nack Lib Message Receive
  */
@@ -1231,10 +1550,12 @@ omx__irecv_segs(struct omx_endpoint *ep, const struct omx__req_segs * reqsegs,
   req->generic.type = OMX_REQUEST_TYPE_RECV;
   req->generic.state = OMX_REQUEST_STATE_RECV_NEED_MATCHING;
   req->generic.status.context = context;
-  req->recv.match_info = match_info;
-  req->recv.match_mask = match_mask;
+  req->recv.match.match_info = match_info;
+  req->recv.match.match_mask = match_mask;
 
-  omx__enqueue_request(&ep->ctxid[ctxid].recv_req_q, req);
+  omx__enqueue_posted_recv(ep, ctxid, req);
+  if (unlikely(ep->exp_medium_enabled))
+    omx__exp_medium_arm(ep, req);
   omx__progress(ep);
 
  ok:
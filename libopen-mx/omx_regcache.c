@@ -0,0 +1,359 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License in COPYING.LGPL for more details.
+ */
+
+#include "omx_lib.h"
+
+/*
+ * Registration cache index.
+ *
+ * Cached windows are kept in a treap ordered by start address, where each
+ * node also stores the highest end address of its subtree. Finding a window
+ * that covers a given range, or a window that overlaps an invalidated range,
+ * thus only walks the branches that may contain one instead of all windows.
+ *
+ * Vectorial windows are indexed by the span of their segments, so that
+ * invalidation finds them as well, and hashed on a fingerprint of their
+ * segments so that the same vector may reuse them.
+ */
+
+/**********************
+ * Interval tree (treap)
+ */
+
+static INLINE void
+omx__regcache_node_update(struct omx__regcache_node *node)
+{
+  unsigned long end = node->end;
+
+  if (node->left && node->left->subtree_end > end)
+    end = node->left->subtree_end;
+  if (node->right && node->right->subtree_end > end)
+    end = node->right->subtree_end;
+  node->subtree_end = end;
+}
+
+/* strict ordering by start address, with the node address to break ties */
+static INLINE int
+omx__regcache_node_before(const struct omx__regcache_node *a,
+			  const struct omx__regcache_node *b)
+{
+  return a->start < b->start || (a->start == b->start && a < b);
+}
+
+static INLINE struct omx__regcache_node *
+omx__regcache_rotate_right(struct omx__regcache_node *node)
+{
+  struct omx__regcache_node *left = node->left;
+
+  node->left = left->right;
+  left->right = node;
+  omx__regcache_node_update(node);
+  omx__regcache_node_update(left);
+  return left;
+}
+
+static INLINE struct omx__regcache_node *
+omx__regcache_rotate_left(struct omx__regcache_node *node)
+{
+  struct omx__regcache_node *right = node->right;
+
+  node->right = right->left;
+  right->left = node;
+  omx__regcache_node_update(node);
+  omx__regcache_node_update(right);
+  return right;
+}
+
+static struct omx__regcache_node *
+omx__regcache_tree_insert(struct omx__regcache_node *root,
+			  struct omx__regcache_node *node)
+{
+  if (!root)
+    return node;
+
+  if (omx__regcache_node_before(node, root)) {
+    root->left = omx__regcache_tree_insert(root->left, node);
+    if (root->left->priority > root->priority)
+      return omx__regcache_rotate_right(root);
+  } else {
+    root->right = omx__regcache_tree_insert(root->right, node);
+    if (root->right->priority > root->priority)
+      return omx__regcache_rotate_left(root);
+  }
+
+  omx__regcache_node_update(root);
+  return root;
+}
+
+/* merge two subtrees, all nodes of left being before those of right */
+static struct omx__regcache_node *
+omx__regcache_tree_merge(struct omx__regcache_node *left,
+			 struct omx__regcache_node *right)
+{
+  if (!left)
+    return right;
+  if (!right)
+    return left;
+
+  if (left->priority > right->priority) {
+    left->right = omx__regcache_tree_merge(left->right, right);
+    omx__regcache_node_update(left);
+    return left;
+  } else {
+    right->left = omx__regcache_tree_merge(left, right->left);
+    omx__regcache_node_update(right);
+    return right;
+  }
+}
+
+static struct omx__regcache_node *
+omx__regcache_tree_remove(struct omx__regcache_node *root,
+			  struct omx__regcache_node *node)
+{
+  omx__debug_assert(root);
+
+  if (root == node)
+    return omx__regcache_tree_merge(node->left, node->right);
+
+  if (omx__regcache_node_before(node, root))
+    root->left = omx__regcache_tree_remove(root->left, node);
+  else
+    root->right = omx__regcache_tree_remove(root->right, node);
+
+  omx__regcache_node_update(root);
+  return root;
+}
+
+static INLINE struct omx__large_region *
+omx__regcache_node_region(struct omx__regcache_node *node)
+{
+  return containerof(node, struct omx__large_region, regcache_node);
+}
+
+/* may this cached window be used by a new request? */
+static INLINE int
+omx__regcache_region_available(const struct omx__large_region *region,
+			       const void *reserver)
+{
+  return (!reserver || !region->reserver)
+    && (omx__globals.parallel_regcache || !region->use_count);
+}
+
+/*
+ * Look for an available contigous window covering [start:end), with the
+ * highest start (hence the smallest offset) first.
+ */
+static struct omx__large_region *
+omx__regcache_tree_find_covering(struct omx__regcache_node *node,
+				 unsigned long start, unsigned long end,
+				 unsigned long offset_max,
+				 const void *reserver)
+{
+  struct omx__large_region *region;
+
+  if (!node || node->subtree_end < end)
+    return NULL;
+
+  if (node->start <= start) {
+    region = omx__regcache_tree_find_covering(node->right, start, end, offset_max, reserver);
+    if (region)
+      return region;
+
+    region = omx__regcache_node_region(node);
+    if (node->end >= end
+	&& start - node->start <= offset_max
+	&& region->segs.nseg == 1
+	&& omx__regcache_region_available(region, reserver))
+      return region;
+  }
+
+  return omx__regcache_tree_find_covering(node->left, start, end, offset_max, reserver);
+}
+
+static void
+omx__regcache_tree_foreach_overlapping(struct omx_endpoint *ep,
+				       struct omx__regcache_node *node,
+				       unsigned long begin, unsigned long end,
+				       omx__regcache_func_t func, void *data)
+{
+  if (!node || node->subtree_end <= begin)
+    return;
+
+  omx__regcache_tree_foreach_overlapping(ep, node->left, begin, end, func, data);
+
+  if (node->start >= end)
+    return;
+  if (node->end > begin)
+    func(ep, omx__regcache_node_region(node), data);
+
+  omx__regcache_tree_foreach_overlapping(ep, node->right, begin, end, func, data);
+}
+
+/*********************
+ * Vectorial windows
+ */
+
+static uint32_t
+omx__regcache_fingerprint(const struct omx__req_segs *reqsegs)
+{
+  uint32_t hash = reqsegs->nseg;
+  uint32_t i;
+
+  for(i=0; i<reqsegs->nseg; i++) {
+    const struct omx_cmd_user_segment *seg = &reqsegs->segs[i];
+    hash = (hash ^ (uint32_t) (seg->vaddr ^ (seg->vaddr >> 32))) * 0x9e370001U;
+    hash = (hash ^ (uint32_t) seg->len) * 0x9e370001U;
+  }
+
+  return hash;
+}
+
+static INLINE struct list_head *
+omx__regcache_vect_bucket(struct omx_endpoint *ep, uint32_t fingerprint)
+{
+  return &ep->regcache.vect_hash[fingerprint >> (32 - OMX__REGCACHE_VECT_HASH_BITS)];
+}
+
+static INLINE int
+omx__regcache_same_segments(const struct omx__req_segs *a,
+			    const struct omx__req_segs *b)
+{
+  return a->nseg == b->nseg
+    && !memcmp(a->segs, b->segs, a->nseg * sizeof(*a->segs));
+}
+
+/*************************
+ * Regcache entry points
+ */
+
+void
+omx__regcache_init(struct omx_endpoint *ep)
+{
+  int i;
+
+  ep->regcache.root = NULL;
+  for(i=0; i<OMX__REGCACHE_VECT_HASH_SIZE; i++)
+    list_head_init(&ep->regcache.vect_hash[i]);
+  ep->regcache.seed = 0x12345678;
+  memset(&ep->regcache.counters, 0, sizeof(ep->regcache.counters));
+}
+
+void
+omx__regcache_insert(struct omx_endpoint *ep,
+		     struct omx__large_region *region)
+{
+  struct omx__regcache_node *node = &region->regcache_node;
+  const struct omx__req_segs *segs = &region->segs;
+  uint32_t seed = ep->regcache.seed;
+  uint32_t i;
+
+  node->start = (unsigned long) -1;
+  node->end = 0;
+  for(i=0; i<segs->nseg; i++) {
+    unsigned long begin = segs->segs[i].vaddr;
+    unsigned long end = begin + segs->segs[i].len;
+    if (begin == end)
+      continue;
+    if (begin < node->start)
+      node->start = begin;
+    if (end > node->end)
+      node->end = end;
+  }
+  if (node->start > node->end)
+    /* no data at all, only ever found by the fingerprint */
+    node->start = node->end;
+
+  /* xorshift, we only need the priorities to be spread */
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  ep->regcache.seed = seed;
+
+  node->left = node->right = NULL;
+  node->subtree_end = node->end;
+  node->priority = seed;
+  ep->regcache.root = omx__regcache_tree_insert(ep->regcache.root, node);
+
+  if (segs->nseg > 1) {
+    region->fingerprint = omx__regcache_fingerprint(segs);
+    list_add_tail(&region->regcache_vect_elt,
+		  omx__regcache_vect_bucket(ep, region->fingerprint));
+  }
+
+  region->cached = 1;
+  ep->regcache.counters.cached_bytes += segs->total_length;
+}
+
+void
+omx__regcache_remove(struct omx_endpoint *ep,
+		     struct omx__large_region *region)
+{
+  omx__debug_assert(region->cached);
+
+  ep->regcache.root = omx__regcache_tree_remove(ep->regcache.root, &region->regcache_node);
+  if (region->segs.nseg > 1)
+    list_del(&region->regcache_vect_elt);
+
+  region->cached = 0;
+  ep->regcache.counters.cached_bytes -= region->segs.total_length;
+}
+
+/*
+ * Find an available cached window containing the single segment seg,
+ * at most offset_max bytes after its beginning.
+ */
+struct omx__large_region *
+omx__regcache_find_contig(struct omx_endpoint *ep,
+			  const struct omx_cmd_user_segment *seg,
+			  unsigned long offset_max,
+			  const void *reserver)
+{
+  unsigned long start = seg->vaddr;
+
+  return omx__regcache_tree_find_covering(ep->regcache.root, start, start + seg->len,
+					  offset_max, reserver);
+}
+
+/* find an available cached window with exactly the same segments */
+struct omx__large_region *
+omx__regcache_find_vect(struct omx_endpoint *ep,
+			const struct omx__req_segs *reqsegs,
+			const void *reserver)
+{
+  uint32_t fingerprint = omx__regcache_fingerprint(reqsegs);
+  struct omx__large_region *region;
+
+  list_for_each_entry(region, omx__regcache_vect_bucket(ep, fingerprint), regcache_vect_elt)
+    if (region->fingerprint == fingerprint
+	&& omx__regcache_same_segments(&region->segs, reqsegs)
+	&& omx__regcache_region_available(region, reserver))
+      return region;
+
+  return NULL;
+}
+
+/*
+ * Call func on each cached window whose segments span intersects [begin:end).
+ * func must not modify the cache.
+ */
+void
+omx__regcache_foreach_overlapping(struct omx_endpoint *ep,
+				  unsigned long begin, unsigned long end,
+				  omx__regcache_func_t func, void *data)
+{
+  omx__regcache_tree_foreach_overlapping(ep, ep->regcache.root, begin, end, func, data);
+}
@@ -23,17 +23,40 @@
 
 #include "omx_lib.h"
 #include "omx_list.h"
+#include "omx_match.h"
 
 /*********************
  * Request allocation
  */
 
-static inline void
+static inline omx_return_t
 omx__request_alloc_init(struct omx_endpoint *ep)
 {
+  unsigned prealloc = omx__globals.slab_prealloc;
+  omx_return_t ret;
+
 #ifdef OMX_LIB_DEBUG
   ep->req_alloc_nr = 0;
 #endif
+
+  ret = omx__slab_init(ep, &ep->request_slab, sizeof(union omx_request), prealloc);
+  if (ret != OMX_SUCCESS)
+    goto out;
+  ret = omx__slab_init(ep, &ep->early_slab, sizeof(struct omx__early_packet), prealloc);
+  if (ret != OMX_SUCCESS)
+    goto out_with_request_slab;
+  ret = omx__slab_init(ep, &ep->small_slab, OMX_SMALL_MSG_LENGTH_MAX, prealloc);
+  if (ret != OMX_SUCCESS)
+    goto out_with_early_slab;
+
+  return OMX_SUCCESS;
+
+ out_with_early_slab:
+  omx__slab_exit(ep, &ep->early_slab);
+ out_with_request_slab:
+  omx__slab_exit(ep, &ep->request_slab);
+ out:
+  return ret;
 }
 
 static inline void
@@ -43,6 +66,10 @@ omx__request_alloc_exit(struct omx_endpoint *ep)
   if (ep->req_alloc_nr)
     omx__verbose_printf(ep, "%d requests were not freed on endpoint close\n", ep->req_alloc_nr);
 #endif
+
+  omx__slab_exit(ep, &ep->small_slab);
+  omx__slab_exit(ep, &ep->early_slab);
+  omx__slab_exit(ep, &ep->request_slab);
 }
 
 static inline __malloc union omx_request *
@@ -50,14 +77,13 @@ omx__request_alloc(struct omx_endpoint *ep)
 {
   union omx_request * req;
 
-#ifdef OMX_LIB_DEBUG
-  req = omx_calloc_ep(ep, 1, sizeof(*req));
-#else
-  req = omx_malloc_ep(ep, sizeof(*req));
-#endif
+  req = omx__slab_alloc(ep, &ep->request_slab);
   if (unlikely(!req))
     return NULL;
 
+#ifdef OMX_LIB_DEBUG
+  memset(req, 0, sizeof(*req));
+#endif
   req->generic.state = 0;
   req->generic.status.code = OMX_SUCCESS;
 
@@ -70,12 +96,52 @@ omx__request_alloc(struct omx_endpoint *ep)
 static inline void
 omx__request_free(struct omx_endpoint *ep, union omx_request * req)
 {
-  omx_free_ep(ep, req);
+  omx__slab_free(&ep->request_slab, req);
 #ifdef OMX_LIB_DEBUG
   ep->req_alloc_nr--;
 #endif
 }
 
+/*
+ * Small message buffers, for the copy of small sends and for
+ * early small messages. Tiny messages are always stored inline.
+ */
+
+static inline __malloc void *
+omx__small_buffer_alloc(struct omx_endpoint *ep)
+{
+  return omx__slab_alloc(ep, &ep->small_slab);
+}
+
+static inline void
+omx__small_buffer_free(struct omx_endpoint *ep, void *buffer)
+{
+  omx__slab_free(&ep->small_slab, buffer);
+}
+
+/*
+ * Early packets, with their data in a small buffer or malloc'ed
+ * for medium fragments.
+ */
+
+static inline __malloc struct omx__early_packet *
+omx__early_packet_alloc(struct omx_endpoint *ep)
+{
+  return omx__slab_alloc(ep, &ep->early_slab);
+}
+
+static inline void
+omx__early_packet_free(struct omx_endpoint *ep, struct omx__early_packet *early)
+{
+  if (early->data) {
+    if (early->msg.type == OMX_EVT_RECV_SMALL)
+      omx__small_buffer_free(ep, early->data);
+    else
+      omx_free_ep(ep, early->data);
+  }
+  omx__slab_free(&ep->early_slab, early);
+}
+
 extern void
 omx__request_alloc_check(const struct omx_endpoint *ep);
 
@@ -137,6 +203,97 @@ list_for_each_entry(req, head, generic.queue_elt)
 #define omx__foreach_request_safe(head, req, next)	\
 list_for_each_entry_safe(req, next, head, generic.queue_elt)
 
+/*
+ * The need_resources_send_req_q length is kept in the hot part of the
+ * endpoint so that the progression never touches the queue when empty.
+ */
+static inline void
+omx__enqueue_need_resources_request(struct omx_endpoint *ep,
+				    union omx_request *req)
+{
+  req->generic.state |= OMX_REQUEST_STATE_NEED_RESOURCES;
+  omx__enqueue_request(&ep->need_resources_send_req_q, req);
+  ep->need_resources_send_req_nr++;
+}
+
+static inline void
+omx__requeue_need_resources_request(struct omx_endpoint *ep,
+				    union omx_request *req)
+{
+  req->generic.state |= OMX_REQUEST_STATE_NEED_RESOURCES;
+  omx__requeue_request(&ep->need_resources_send_req_q, req);
+  ep->need_resources_send_req_nr++;
+}
+
+static inline void
+omx__dequeue_need_resources_request(struct omx_endpoint *ep,
+				    union omx_request *req)
+{
+  omx___dequeue_request(req);
+  req->generic.state &= ~OMX_REQUEST_STATE_NEED_RESOURCES;
+  ep->need_resources_send_req_nr--;
+}
+
+static inline int
+omx__empty_need_resources_queue(const struct omx_endpoint *ep)
+{
+  return !ep->need_resources_send_req_nr;
+}
+
+/*
+ * Make sure the resend timer expires when a request just queued
+ * in the non_acked_req_q or the connect_req_q may have to be resent.
+ */
+static inline void
+omx__arm_resend_timer(struct omx_endpoint *ep, const union omx_request *req)
+{
+  omx__timer_arm_earlier(&ep->timers, &ep->resend_timer,
+			 req->generic.last_send_jiffies + omx__globals.resend_delay_jiffies);
+}
+
+/**********************************
+ * Posted receive queue management
+ */
+
+/*
+ * Posted receives stay in their ctxid recv_req_q in post order, and are
+ * also queued in the matching engine by their recv.match.elt.
+ */
+static inline void
+omx__enqueue_posted_recv(struct omx_endpoint *ep, uint32_t ctxid,
+			 union omx_request *req)
+{
+  omx__enqueue_request(&ep->ctxid[ctxid].recv_req_q, req);
+  /* not armed yet */
+  ep->ctxid[ctxid].recv_unarmed_nr++;
+  omx__match_post(ep->recv_match_hash, &ep->ctxid[ctxid].recv_wildcard_q,
+		  &req->recv.match, ep->recv_post_seq++);
+}
+
+static inline void
+omx__dequeue_posted_recv(struct omx_endpoint *ep, uint32_t ctxid,
+			 union omx_request *req)
+{
+  omx__dequeue_request(&ep->ctxid[ctxid].recv_req_q, req);
+  if (likely(!(req->generic.state & OMX_REQUEST_STATE_RECV_EXP_MEDIUM)))
+    ep->ctxid[ctxid].recv_unarmed_nr--;
+  omx__match_unpost(&req->recv.match);
+}
+
+static inline union omx_request *
+omx__find_posted_recv(struct omx_endpoint *ep, uint32_t ctxid,
+		      uint64_t match_info)
+{
+  struct omx__match_elt *match;
+
+  match = omx__match_find(ep->recv_match_hash, &ep->ctxid[ctxid].recv_wildcard_q,
+			  match_info);
+  if (!match)
+    return NULL;
+
+  return containerof(match, union omx_request, recv.match);
+}
+
 /*********************************
  * Request ctxid queue management
  */
@@ -284,6 +441,38 @@ omx__empty_done_anyctxid_queue(const struct omx_endpoint *ep)
   return list_empty(&ep->anyctxid.done_req_q);
 }
 
+/*
+ * Unlocked completion hints, for threads that do not want to wait for
+ * the endpoint lock while another thread is progressing.
+ * These are only racy peeks: the done state and queues are still only
+ * modified and consumed under the endpoint lock, so a positive answer
+ * must be confirmed once the lock is taken.
+ */
+
+static inline int
+omx__request_done_unlocked(const union omx_request *req)
+{
+  return *(const volatile uint16_t *) &req->generic.state & OMX_REQUEST_STATE_DONE;
+}
+
+static inline int
+omx__empty_done_queue_unlocked(const struct omx_endpoint *ep, uint64_t match_info, uint64_t match_mask)
+{
+  if (likely(!HAS_CTXIDS(ep) || MATCHING_CROSS_CTXIDS(ep, match_mask)))
+    return list_empty_unlocked(&ep->anyctxid.done_req_q);
+  else
+    return list_empty_unlocked(&ep->ctxid[CTXID_FROM_MATCHING(ep, match_info)].done_req_q);
+}
+
+static inline int
+omx__empty_unexp_queue_unlocked(const struct omx_endpoint *ep, uint64_t match_info, uint64_t match_mask)
+{
+  if (likely(!HAS_CTXIDS(ep) || MATCHING_CROSS_CTXIDS(ep, match_mask)))
+    return list_empty_unlocked(&ep->anyctxid.unexp_req_q);
+  else
+    return list_empty_unlocked(&ep->ctxid[CTXID_FROM_MATCHING(ep, match_info)].unexp_req_q);
+}
+
 /****************************
  * Partner queues management
  */
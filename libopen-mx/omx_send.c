@@ -53,7 +53,7 @@ omx__send_complete(struct omx_endpoint *ep, union omx_request *req,
 
   switch (req->generic.type) {
   case OMX_REQUEST_TYPE_SEND_SMALL:
-    omx_free_ep(ep, req->send.specific.small.copy);
+    omx__small_buffer_free(ep, req->send.specific.small.copy);
     break;
   case OMX_REQUEST_TYPE_SEND_MEDIUMSQ:
     omx__endpoint_sendq_map_put(ep, req->send.specific.mediumsq.frags_nr, req->send.specific.mediumsq.sendq_map_index);
@@ -70,6 +70,69 @@ omx__send_complete(struct omx_endpoint *ep, union omx_request *req,
   omx__notify_request_done(ep, ctxid, req);
 }
 
+/**************
+ * Send Batches
+ */
+
+/*
+ * Submit all commands of a batch within a single ioctl.
+ * Returns the number of commands that were actually submitted,
+ * errno is set if some were not.
+ */
+unsigned
+omx__send_batch_submit(const struct omx_endpoint *ep, struct omx__send_batch *batch)
+{
+  int err;
+
+  if (unlikely(!batch->cmd.nr))
+    return 0;
+
+  batch->cmd.submitted_nr = 0;
+  err = ioctl(ep->fd, OMX_CMD_SEND_BATCH, &batch->cmd);
+  if (unlikely(err < 0))
+    return batch->cmd.submitted_nr;
+
+  return batch->cmd.nr;
+}
+
+/*******************
+ * Submission Ring
+ */
+
+/*
+ * Post a tiny, notify or liback command in the submission ring so that
+ * the driver submission thread sends it without any ioctl.
+ * Returns 1 if posted, 0 if there is no submission ring or it is full,
+ * the caller should then use the usual ioctl.
+ * Failures are not reported, the retransmission takes care of them.
+ */
+int
+omx__submitq_post(struct omx_endpoint *ep, unsigned type, const void *param, size_t length)
+{
+  struct omx_submitq_entry *entry;
+
+  if (likely(!ep->submitq))
+    return 0;
+
+  entry = (struct omx_submitq_entry *) ep->submitq + ep->next_submitq_index % OMX_SUBMITQ_ENTRY_NR;
+  if (*(volatile uint16_t *) &entry->status != OMX_SUBMITQ_ENTRY_STATUS_FREE)
+    return 0;
+
+  memcpy(&entry->cmd, param, length);
+  entry->type = type;
+  /* the command must be written before the driver sees it ready */
+  __sync_synchronize();
+  *(volatile uint16_t *) &entry->status = OMX_SUBMITQ_ENTRY_STATUS_READY;
+  ep->next_submitq_index++;
+
+  /* the driver sets need_wakeup before checking the ring again, we do the opposite */
+  __sync_synchronize();
+  if (*(volatile uint32_t *) &ep->desc->submitq_need_wakeup)
+    ioctl(ep->fd, OMX_CMD_SUBMITQ_WAKEUP);
+
+  return 1;
+}
+
 /************
  * Send Tiny
  */
@@ -89,7 +152,10 @@ omx__post_isend_tiny(struct omx_endpoint *ep,
 		    (unsigned long long) omx__driver_desc->jiffies);
   tiny_param->hdr.piggyack = ack_upto;
 
-  err = ioctl(ep->fd, OMX_CMD_SEND_TINY, tiny_param);
+  if (omx__submitq_post(ep, OMX_EPCMD_SEND_TINY, tiny_param, sizeof(*tiny_param)))
+    err = 0;
+  else
+    err = ioctl(ep->fd, OMX_CMD_SEND_TINY, tiny_param);
   if (unlikely(err < 0)) {
     omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
 				       OMX_SUCCESS,
@@ -126,6 +192,7 @@ omx__setup_isend_tiny(struct omx_endpoint *ep,
   req->generic.state |= OMX_REQUEST_STATE_NEED_ACK;
   omx__enqueue_request(&ep->non_acked_req_q, req);
   omx__enqueue_partner_request(&partner->non_acked_req_q, req);
+  omx__arm_resend_timer(ep, req);
 
   /* mark the request as done now, it will be resent/zombified later if necessary */
   omx__notify_request_done_early(ep, ctxid, req);
@@ -181,13 +248,12 @@ omx__submit_isend_tiny(struct omx_endpoint *ep,
   req->generic.status.msg_length = length;
   req->generic.status.xfer_length = length; /* truncation not notified to the sender */
 
-  if (likely(omx__empty_queue(&ep->need_resources_send_req_q))) {
+  if (likely(omx__empty_need_resources_queue(ep))) {
     omx__alloc_setup_isend_tiny(ep, partner, req);
   } else {
     /* some requests are delayed, do not submit, queue as well */
     omx__debug_printf(SEND, ep, "delaying send tiny request %p\n", req);
-    req->generic.state |= OMX_REQUEST_STATE_NEED_RESOURCES;
-    omx__enqueue_request(&ep->need_resources_send_req_q, req);
+    omx__enqueue_need_resources_request(ep, req);
   }
 }
 
@@ -247,6 +313,7 @@ omx__setup_isend_small(struct omx_endpoint *ep,
   req->generic.state |= OMX_REQUEST_STATE_NEED_ACK;
   omx__enqueue_request(&ep->non_acked_req_q, req);
   omx__enqueue_partner_request(&partner->non_acked_req_q, req);
+  omx__arm_resend_timer(ep, req);
 
   /* mark the request as done now, it will be resent/zombified later if necessary */
   omx__notify_request_done_early(ep, ctxid, req);
@@ -320,7 +387,7 @@ omx__submit_isend_small(struct omx_endpoint *ep,
   req->generic.status.msg_length = length;
   req->generic.status.xfer_length = length; /* truncation not notified to the sender */
 
-  if (unlikely(!omx__empty_queue(&ep->need_resources_send_req_q)))
+  if (unlikely(!omx__empty_need_resources_queue(ep)))
     /* some requests are delayed, do not submit, queue as well */
     goto delay;
 
@@ -329,8 +396,7 @@ omx__submit_isend_small(struct omx_endpoint *ep,
     omx__debug_assert(ret == OMX_INTERNAL_MISSING_RESOURCES);
 delay:
     omx__debug_printf(SEND, ep, "delaying send small request %p\n", req);
-    req->generic.state |= OMX_REQUEST_STATE_NEED_RESOURCES;
-    omx__enqueue_request(&ep->need_resources_send_req_q, req);
+    omx__enqueue_need_resources_request(ep, req);
   }
 }
 
@@ -338,6 +404,46 @@ delay:
  * Send Medium from VAddr
  */
 
+/*
+ * Send all frags that were not acked by a push sack yet,
+ * with a single ioctl for each contiguous run.
+ */
+static int
+omx__submit_mediumva_frags(struct omx_endpoint *ep,
+			   union omx_request * req)
+{
+  struct omx_cmd_send_mediumva * medium_param = &req->send.specific.mediumva.send_mediumva_ioctl_param;
+  const uint32_t * acked_mask = req->send.specific.mediumva.frags_acked_mask;
+  uint32_t frags_nr = req->send.specific.mediumva.frags_nr;
+  uint32_t first, last;
+  int err = 0;
+
+  for(first=0; first<frags_nr; first=last) {
+    /* skip acked frags, and find the end of the run of missing ones */
+    if (acked_mask[first/32] & (1U << (first%32))) {
+      last = first+1;
+      continue;
+    }
+    for(last=first+1; last<frags_nr; last++)
+      if (acked_mask[last/32] & (1U << (last%32)))
+	break;
+
+    medium_param->first_frag = first;
+    medium_param->frags_nr = (first == 0 && last == frags_nr) ? 0 : last - first;
+
+    err = ioctl(ep->fd, OMX_CMD_SEND_MEDIUMVA, medium_param);
+    if (unlikely(err < 0)) {
+      omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
+					 OMX_SUCCESS,
+					 "send medium vaddr message");
+      /* if OMX_NO_SYSTEM_RESOURCES, let the retransmission try again later */
+      break;
+    }
+  }
+
+  return err;
+}
+
 static INLINE void
 omx__post_isend_mediumva(struct omx_endpoint *ep,
 			 struct omx__partner *partner,
@@ -353,13 +459,7 @@ omx__post_isend_mediumva(struct omx_endpoint *ep,
 		    (unsigned long long) omx__driver_desc->jiffies);
   medium_param->piggyack = ack_upto;
 
-  err = ioctl(ep->fd, OMX_CMD_SEND_MEDIUMVA, medium_param);
-  if (unlikely(err < 0)) {
-    omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
-				       OMX_SUCCESS,
-				       "send medium vaddr message");
-    /* if OMX_NO_SYSTEM_RESOURCES, let the retransmission try again later */
-  }
+  err = omx__submit_mediumva_frags(ep, req);
 
   req->generic.resends++;
   req->generic.last_send_jiffies = omx__driver_desc->jiffies;
@@ -389,6 +489,7 @@ omx__setup_isend_mediumva(struct omx_endpoint *ep,
   req->generic.state |= OMX_REQUEST_STATE_NEED_ACK;
   omx__enqueue_request(&ep->non_acked_req_q, req);
   omx__enqueue_partner_request(&partner->non_acked_req_q, req);
+  omx__arm_resend_timer(ep, req);
 
   /* do not zombify since we did not buffer data */
 }
@@ -410,6 +511,8 @@ omx__alloc_setup_isend_mediumva(struct omx_endpoint *ep,
   medium_param->length = length;
   medium_param->nr_segments = req->send.segs.nseg;
   medium_param->segments = (uintptr_t) req->send.segs.segs;
+  req->send.specific.mediumva.frags_nr = (length + OMX_MEDIUM_FRAG_LENGTH_MAX-1) / OMX_MEDIUM_FRAG_LENGTH_MAX;
+  memset(req->send.specific.mediumva.frags_acked_mask, 0, sizeof(req->send.specific.mediumva.frags_acked_mask));
 
 #ifdef OMX_LIB_DEBUG
   if (omx__globals.debug_checksum)
@@ -441,6 +544,8 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
 			 union omx_request *req)
 {
   struct omx_cmd_send_mediumsq_frag * medium_param = &req->send.specific.mediumsq.send_mediumsq_frag_ioctl_param;
+  struct omx_cmd_send_mediumsq_frag frag_params[OMX_MEDIUM_FRAGS_MAX];
+  struct omx__send_batch batch;
   omx__seqnum_t ack_upto = omx__get_partner_needed_ack(ep, partner);
   uint32_t length = req->generic.status.msg_length;
   uint32_t remaining = length;
@@ -448,7 +553,6 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
   uint32_t frags_nr = req->send.specific.mediumsq.frags_nr;
   uint32_t frag_max = OMX_MEDIUM_FRAG_LENGTH_MAX;
   unsigned i;
-  int err;
 
   omx__debug_printf(ACK, ep, "piggy acking back to partner up to %d (#%d) at jiffies %lld\n",
 		    (unsigned int) OMX__SEQNUM(ack_upto - 1),
@@ -456,6 +560,10 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
 		    (unsigned long long) omx__driver_desc->jiffies);
   medium_param->piggyack = ack_upto;
 
+  /* copy all frags in the sendq first, and submit them at once */
+  BUILD_BUG_ON(OMX_MEDIUM_FRAGS_MAX > OMX_SEND_BATCH_NR_MAX);
+  omx__send_batch_init(&batch);
+
   if (likely(req->send.segs.nseg == 1)) {
     /* optimize the contigous send medium */
     char * data = OMX_SEG_PTR(&req->send.segs.single);
@@ -463,9 +571,10 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
 
     for(i=0; i<frags_nr; i++) {
       unsigned chunk = remaining > frag_max ? frag_max : remaining;
-      medium_param->frag_length = chunk;
-      medium_param->frag_seqnum = i;
-      medium_param->sendq_offset = sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT;
+      frag_params[i] = *medium_param;
+      frag_params[i].frag_length = chunk;
+      frag_params[i].frag_seqnum = i;
+      frag_params[i].sendq_offset = sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT;
       omx__debug_printf(MEDIUM, ep, "sending mediumsq seqnum %d length %d of total %ld\n",
 			i, chunk, (unsigned long) length);
 
@@ -473,20 +582,7 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
       if (likely(!req->generic.resends))
 	memcpy(ep->sendq + (sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT), data + offset, chunk);
 
-      err = ioctl(ep->fd, OMX_CMD_SEND_MEDIUMSQ_FRAG, medium_param);
-      if (unlikely(err < 0)) {
-	/* finish copying frags if not done already */
-	if (likely(!req->generic.resends)) {
-	  unsigned j;
-	  for(j=i+1; j<frags_nr; i++) {
-	    unsigned chunk = remaining > frag_max ? frag_max : remaining;
-	    memcpy(ep->sendq + (sendq_index[j] << OMX_SENDQ_ENTRY_SHIFT), data + offset, chunk);
-	    remaining -= chunk;
-	    offset += chunk;
-	  }
-	}
-	goto err;
-      }
+      omx__send_batch_add(&batch, OMX_EPCMD_SEND_MEDIUMSQ_FRAG, &frag_params[i]);
 
       remaining -= chunk;
       offset += chunk;
@@ -498,9 +594,10 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
 
     for(i=0; i<frags_nr; i++) {
       unsigned chunk = remaining > frag_max ? frag_max : remaining;
-      medium_param->frag_length = chunk;
-      medium_param->frag_seqnum = i;
-      medium_param->sendq_offset = sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT;
+      frag_params[i] = *medium_param;
+      frag_params[i].frag_length = chunk;
+      frag_params[i].frag_seqnum = i;
+      frag_params[i].sendq_offset = sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT;
       omx__debug_printf(MEDIUM, ep, "sending mediumsq seqnum %d length %d of total %ld\n",
 			i, chunk, (unsigned long) length);
 
@@ -510,26 +607,16 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
 						&req->send.segs, chunk,
 						&state);
 
-      err = ioctl(ep->fd, OMX_CMD_SEND_MEDIUMSQ_FRAG, medium_param);
-      if (unlikely(err < 0)) {
-	/* finish copying frags if not done already */
-	if (likely(!req->generic.resends)) {
-	  unsigned j;
-	  for(j=i+1; j<frags_nr; i++) {
-	    unsigned chunk = remaining > frag_max ? frag_max : remaining;
-	    omx_continue_partial_copy_from_segments(ep, ep->sendq + (sendq_index[j] << OMX_SENDQ_ENTRY_SHIFT),
-						    &req->send.segs, chunk,
-						    &state);
-	    remaining -= chunk;
-	  }
-	}
-	goto err;
-      }
+      omx__send_batch_add(&batch, OMX_EPCMD_SEND_MEDIUMSQ_FRAG, &frag_params[i]);
 
       remaining -= chunk;
     }
   }
 
+  i = omx__send_batch_submit(ep, &batch);
+  if (unlikely(i < frags_nr))
+    goto err;
+
   req->send.specific.mediumsq.frags_pending_nr = frags_nr;
 
  ok:
@@ -585,10 +672,12 @@ omx__setup_isend_mediumsq(struct omx_endpoint *ep,
   omx__post_isend_mediumsq(ep, partner, req);
 
   req->generic.state |= OMX_REQUEST_STATE_NEED_ACK;
-  if (req->generic.state & OMX_REQUEST_STATE_DRIVER_MEDIUMSQ_SENDING)
+  if (req->generic.state & OMX_REQUEST_STATE_DRIVER_MEDIUMSQ_SENDING) {
     omx__enqueue_request(&ep->driver_mediumsq_sending_req_q, req);
-  else
+  } else {
     omx__enqueue_request(&ep->non_acked_req_q, req);
+    omx__arm_resend_timer(ep, req);
+  }
   omx__enqueue_partner_request(&partner->non_acked_req_q, req);
 
   /* mark the request as done now, it will be resent/zombified later if necessary */
@@ -660,7 +749,8 @@ omx__submit_isend_medium(struct omx_endpoint *ep,
 			 union omx_request *req)
 {
   uint32_t length = req->send.segs.total_length;
-  int use_sendq = omx__globals.medium_sendq;
+  /* pushed messages may not fit in the sendq */
+  int use_sendq = omx__globals.medium_sendq && length <= OMX_MEDIUM_FRAG_LENGTH_MAX * OMX_MEDIUM_FRAGS_MAX;
   omx_return_t ret;
 
   /* the frag seqnum is stored in uint8_t on the wire */
@@ -690,7 +780,7 @@ omx__submit_isend_medium(struct omx_endpoint *ep,
   req->generic.status.msg_length = length;
   req->generic.status.xfer_length = length; /* truncation not notified to the sender */
 
-  if (unlikely(!omx__empty_queue(&ep->need_resources_send_req_q)))
+  if (unlikely(!omx__empty_need_resources_queue(ep)))
     /* some requests are delayed, do not submit, queue as well */
     goto delay;
 
@@ -703,8 +793,7 @@ omx__submit_isend_medium(struct omx_endpoint *ep,
     omx__debug_assert(ret == OMX_INTERNAL_MISSING_RESOURCES);
 delay:
     omx__debug_printf(SEND, ep, "delaying send medium request %p\n", req);
-    req->generic.state |= OMX_REQUEST_STATE_NEED_RESOURCES;
-    omx__enqueue_request(&ep->need_resources_send_req_q, req);
+    omx__enqueue_need_resources_request(ep, req);
   }
 }
 
@@ -767,6 +856,7 @@ omx__setup_isend_rndv(struct omx_endpoint *ep,
   req->generic.state |= OMX_REQUEST_STATE_NEED_REPLY|OMX_REQUEST_STATE_NEED_ACK;
   omx__enqueue_request(&ep->non_acked_req_q, req);
   omx__enqueue_partner_request(&partner->non_acked_req_q, req);
+  omx__arm_resend_timer(ep, req);
 
   /* cannot mark as done early since data is not buffered */
 }
@@ -780,6 +870,7 @@ omx__alloc_setup_isend_large(struct omx_endpoint *ep,
   struct omx__large_region *region;
   uint32_t length = req->generic.status.msg_length;
   int res = req->generic.missing_resources;
+  uint32_t offset;
   omx_return_t ret;
 
   if (likely(res & OMX_REQUEST_RESOURCE_SEND_LARGE_REGION))
@@ -795,7 +886,7 @@ omx__alloc_setup_isend_large(struct omx_endpoint *ep,
   ep->large_sends_avail_nr--;
 
  need_large_region:
-  ret = omx__get_region(ep, &req->send.segs, &region, req);
+  ret = omx__get_region(ep, &req->send.segs, &region, &offset, req);
   if (unlikely(ret != OMX_SUCCESS)) {
     omx__debug_assert(ret == OMX_INTERNAL_MISSING_RESOURCES);
     return ret;
@@ -814,6 +905,7 @@ omx__alloc_setup_isend_large(struct omx_endpoint *ep,
   rndv_param->msg_length = length;
   rndv_param->pulled_rdma_id = region->id;
   rndv_param->pulled_rdma_seqnum = req->send.specific.large.region_seqnum;
+  rndv_param->pulled_rdma_offset = offset;
 
 #ifdef OMX_LIB_DEBUG
   if (omx__globals.debug_checksum)
@@ -849,7 +941,7 @@ omx__submit_isend_large(struct omx_endpoint *ep,
   req->generic.status.msg_length = length;
   /* will set xfer_length when receiving the notify */
 
-  if (unlikely(!omx__empty_queue(&ep->need_resources_send_req_q)))
+  if (unlikely(!omx__empty_need_resources_queue(ep)))
     /* some requests are delayed, do not submit, queue as well */
     goto delay;
 
@@ -858,8 +950,7 @@ omx__submit_isend_large(struct omx_endpoint *ep,
     omx__debug_assert(ret == OMX_INTERNAL_MISSING_RESOURCES);
 delay:
     omx__debug_printf(SEND, ep, "delaying large send request %p\n", req);
-    req->generic.state |= OMX_REQUEST_STATE_NEED_RESOURCES;
-    omx__enqueue_request(&ep->need_resources_send_req_q, req);
+    omx__enqueue_need_resources_request(ep, req);
   }
 }
 
@@ -882,7 +973,10 @@ omx__post_notify(struct omx_endpoint *ep,
 		    (unsigned long long) omx__driver_desc->jiffies);
   notify_param->piggyack = ack_upto;
 
-  err = ioctl(ep->fd, OMX_CMD_SEND_NOTIFY, notify_param);
+  if (omx__submitq_post(ep, OMX_EPCMD_SEND_NOTIFY, notify_param, sizeof(*notify_param)))
+    err = 0;
+  else
+    err = ioctl(ep->fd, OMX_CMD_SEND_NOTIFY, notify_param);
   if (unlikely(err < 0)) {
     omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
 				       OMX_SUCCESS,
@@ -919,6 +1013,7 @@ omx__setup_notify(struct omx_endpoint *ep,
   req->generic.state |= OMX_REQUEST_STATE_NEED_ACK;
   omx__enqueue_request(&ep->non_acked_req_q, req);
   omx__enqueue_partner_request(&partner->non_acked_req_q, req);
+  omx__arm_resend_timer(ep, req);
 
   /* mark the request as done now, it will be resent/zombified later if necessary */
   omx__notify_request_done_early(ep, ctxid, req);
@@ -960,10 +1055,9 @@ omx__submit_notify(struct omx_endpoint *ep,
   /* type, xfer_length and msg_length already set when the large recv got matched */
   /* no resources needed, just need to wait for all events to be processed */
 
-  if (unlikely(!omx__empty_queue(&ep->need_resources_send_req_q) || delayed)) {
-    req->generic.state |= OMX_REQUEST_STATE_NEED_RESOURCES;
+  if (unlikely(!omx__empty_need_resources_queue(ep) || delayed)) {
     /* queue on top of the delayed queue to avoid being blocked by delayed requests */
-    omx__requeue_request(&ep->need_resources_send_req_q, req);
+    omx__requeue_need_resources_request(ep, req);
   } else {
     omx__alloc_setup_notify(ep, req);
   }
@@ -992,12 +1086,13 @@ omx__isend_req(struct omx_endpoint *ep, struct omx__partner *partner,
   if (likely(length <= OMX_TINY_MSG_LENGTH_MAX)) {
     omx__submit_isend_tiny(ep, partner, req);
   } else if (length <= OMX_SMALL_MSG_LENGTH_MAX) {
-    void *copy = omx_malloc_ep(ep, length);
+    void *copy = omx__small_buffer_alloc(ep);
     if (unlikely(!copy))
       return omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating isend small copy buffer");
     req->send.specific.small.copy = copy;
     omx__submit_isend_small(ep, partner, req);
-  } else if (length <= partner->rndv_threshold) {
+  } else if (length <= partner->rndv_threshold
+	     || (length <= omx__globals.push_max && !omx__partner_localization_shared(partner))) {
     omx__submit_isend_medium(ep, partner, req);
   } else {
     omx__submit_isend_large(ep, partner, req);
@@ -1212,11 +1307,13 @@ omx__process_delayed_requests(struct omx_endpoint *ep)
 {
   union omx_request *req, *next;
 
+  if (likely(omx__empty_need_resources_queue(ep)))
+    return;
+
   omx__foreach_request_safe(&ep->need_resources_send_req_q, req, next) {
     omx_return_t ret;
 
-    req->generic.state &= ~OMX_REQUEST_STATE_NEED_RESOURCES;
-    omx___dequeue_request(req);
+    omx__dequeue_need_resources_request(ep, req);
 
     switch (req->generic.type) {
     case OMX_REQUEST_TYPE_SEND_TINY:
@@ -1275,8 +1372,7 @@ omx__process_delayed_requests(struct omx_endpoint *ep)
       omx__debug_assert(ret == OMX_INTERNAL_MISSING_RESOURCES);
       /* put back at the head of the queue */
       omx__debug_printf(SEND, ep, "requeueing back delayed request %p\n", req);
-      req->generic.state |= OMX_REQUEST_STATE_NEED_RESOURCES;
-      omx__requeue_request(&ep->need_resources_send_req_q, req);
+      omx__requeue_need_resources_request(ep, req);
       break;
     }
   }
@@ -1409,6 +1505,60 @@ omx__complete_unsent_send_request(struct omx_endpoint *ep, union omx_request *re
   }
 }
 
+/*****************************************
+ * Resend the frags missing in a push sack
+ */
+
+void
+omx__handle_push_sack(struct omx_endpoint *ep,
+		      struct omx__partner *partner,
+		      const struct omx_evt_recv_push_sack *sack)
+{
+  omx__seqnum_t seqnum = sack->lib_seqnum;
+  omx__seqnum_t sack_index = OMX__SEQNUM(seqnum - partner->next_acked_send_seq);
+  union omx_request *req;
+  uint32_t *acked_mask;
+  uint32_t frags_nr, i;
+
+  if (unlikely(OMX__SESNUM(seqnum ^ partner->next_send_seq)) != 0)
+    return;
+
+  omx__foreach_partner_request(&partner->non_acked_req_q, req) {
+    omx__seqnum_t req_index = OMX__SEQNUM(req->generic.send_seqnum - partner->next_acked_send_seq);
+
+    if (sack_index < req_index)
+      break;
+
+    if (sack_index == req_index)
+      goto found;
+  }
+
+  omx__debug_printf(ACK, ep, "Failed to find request to push sack for seqnum %d, could be a duplicate, ignoring\n",
+		    (unsigned) seqnum);
+  return;
+
+ found:
+  if (req->generic.type != OMX_REQUEST_TYPE_SEND_MEDIUMVA
+      || !(omx__driver_desc->features & OMX_DRIVER_FEATURE_PUSH))
+    /* mediumsq messages are small enough to be resent entirely */
+    return;
+
+  acked_mask = req->send.specific.mediumva.frags_acked_mask;
+  frags_nr = req->send.specific.mediumva.frags_nr;
+  for(i=0; i<sack->frag_base && i<frags_nr; i++)
+    acked_mask[i/32] |= 1U << (i%32);
+  for(i=0; i<OMX_PUSH_SACK_FRAGS_NR && sack->frag_base+i<frags_nr; i++)
+    if (sack->frags_mask[i/32] & (1U << (i%32)))
+      acked_mask[(sack->frag_base+i)/32] |= 1U << ((sack->frag_base+i)%32);
+
+  omx__debug_printf(SEND, ep, "resending missing frags of push seqnum %d (#%d) after sack from frag %d\n",
+		    (unsigned) OMX__SEQNUM(seqnum), (unsigned) OMX__SESNUM_SHIFTED(seqnum),
+		    (unsigned) sack->frag_base);
+
+  /* do not touch the resend timer, the receiver will sack again if needed */
+  omx__submit_mediumva_frags(ep, req);
+}
+
 /******************
  * Resend messages
  */
@@ -1533,6 +1683,12 @@ omx__process_resend_requests(struct omx_endpoint *ep)
  done_reconnecting:
   /* requeue requests at the end */
   list_spliceall_tail(&tmp_req_q, &ep->connect_req_q);
+
+  /* come back when the oldest remaining ones may need to be resent */
+  if (!omx__empty_queue(&ep->non_acked_req_q))
+    omx__arm_resend_timer(ep, omx__first_request(&ep->non_acked_req_q));
+  if (!omx__empty_queue(&ep->connect_req_q))
+    omx__arm_resend_timer(ep, omx__first_request(&ep->connect_req_q));
 }
 
 /* vim: shiftwidth=2 softtabstop=2
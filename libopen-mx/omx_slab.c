@@ -0,0 +1,91 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License in COPYING.LGPL for more details.
+ */
+
+#include "omx_lib.h"
+
+/*
+ * Per-endpoint object caches.
+ *
+ * Requests, early packets and small message buffers are allocated and
+ * released for every message, so they are carved out of large chunks
+ * instead of going through malloc each time. Objects are rounded up to
+ * a cache line and never go back to malloc before the endpoint is closed,
+ * the free list is LIFO so that the most recently released (and cache-hot)
+ * object is reused first.
+ *
+ * Everything is protected by the endpoint lock.
+ */
+
+/* objects added each time a cache runs out */
+#define OMX__SLAB_CHUNK_NR 64
+
+int
+omx__slab_grow(struct omx_endpoint *ep, struct omx__slab *slab, unsigned nr)
+{
+  char *chunk, *obj;
+  unsigned i;
+
+  /* the chunk link takes the first object slot, objects follow aligned */
+  chunk = omx_malloc_ep(ep, (nr + 1) * slab->obj_size + OMX__CACHELINE_SIZE - 1);
+  if (unlikely(!chunk)) {
+    slab->counters.failures++;
+    return -1;
+  }
+
+  *(void **) chunk = slab->chunks;
+  slab->chunks = chunk;
+
+  obj = (char *) (((unsigned long) chunk + slab->obj_size + OMX__CACHELINE_SIZE - 1)
+		  & ~((unsigned long) OMX__CACHELINE_SIZE - 1));
+  for(i=0; i<nr; i++, obj += slab->obj_size) {
+    *(void **) obj = slab->free_list;
+    slab->free_list = obj;
+  }
+
+  slab->counters.total += nr;
+  slab->counters.chunks++;
+  return 0;
+}
+
+omx_return_t
+omx__slab_init(struct omx_endpoint *ep, struct omx__slab *slab,
+	       size_t size, unsigned prealloc)
+{
+  slab->free_list = NULL;
+  slab->chunks = NULL;
+  slab->obj_size = (size + OMX__CACHELINE_SIZE - 1) & ~((size_t) OMX__CACHELINE_SIZE - 1);
+  slab->chunk_nr = OMX__SLAB_CHUNK_NR;
+  memset(&slab->counters, 0, sizeof(slab->counters));
+
+  if (prealloc && omx__slab_grow(ep, slab, prealloc) < 0)
+    return OMX_NO_RESOURCES;
+
+  return OMX_SUCCESS;
+}
+
+void
+omx__slab_exit(struct omx_endpoint *ep, struct omx__slab *slab)
+{
+  void *chunk, *next;
+
+  for(chunk = slab->chunks; chunk; chunk = next) {
+    next = *(void **) chunk;
+    omx_free_ep(ep, chunk);
+  }
+  slab->chunks = NULL;
+  slab->free_list = NULL;
+}
@@ -100,6 +100,14 @@ omx__wait(struct omx_endpoint *ep,
   return OMX_SUCCESS;
 }
 
+/*
+ * Non-blocking functions use try-lock combining: if another thread holds
+ * the endpoint lock, it is progressing or about to, so do not wait for it
+ * unless the unlocked hints find something to complete.
+ * Only one thread progresses at a time, the others return immediately.
+ * Completing a request still requires the endpoint lock.
+ */
+
 /*********************************************
  * Test/Wait a single request and complete it
  */
@@ -145,7 +153,11 @@ omx_test(struct omx_endpoint *ep, union omx_request **requestp,
   omx_return_t ret = OMX_SUCCESS;
   uint32_t result = 0;
 
-  OMX__ENDPOINT_LOCK(ep);
+  if (unlikely(!OMX__ENDPOINT_TRYLOCK(ep))) {
+    if (!omx__request_done_unlocked(*requestp))
+      goto out;
+    OMX__ENDPOINT_LOCK(ep);
+  }
 
   ret = omx__progress(ep);
   if (unlikely(ret != OMX_SUCCESS))
@@ -155,6 +167,7 @@ omx_test(struct omx_endpoint *ep, union omx_request **requestp,
 
  out_with_lock:
   OMX__ENDPOINT_UNLOCK(ep);
+ out:
   *resultp = result;
   return ret;
 }
@@ -310,7 +323,11 @@ omx_test_any(struct omx_endpoint *ep,
     goto out;
   }
 
-  OMX__ENDPOINT_LOCK(ep);
+  if (unlikely(!OMX__ENDPOINT_TRYLOCK(ep))) {
+    if (omx__empty_done_queue_unlocked(ep, match_info, match_mask))
+      goto out;
+    OMX__ENDPOINT_LOCK(ep);
+  }
 
   ret = omx__progress(ep);
   if (unlikely(ret != OMX_SUCCESS))
@@ -420,7 +437,11 @@ omx_ipeek(struct omx_endpoint *ep, union omx_request **requestp,
   omx_return_t ret = OMX_SUCCESS;
   uint32_t result = 0;
 
-  OMX__ENDPOINT_LOCK(ep);
+  if (unlikely(!OMX__ENDPOINT_TRYLOCK(ep))) {
+    if (list_empty_unlocked(&ep->anyctxid.done_req_q))
+      goto out;
+    OMX__ENDPOINT_LOCK(ep);
+  }
 
   ret = omx__progress(ep);
   if (unlikely(ret != OMX_SUCCESS))
@@ -430,6 +451,7 @@ omx_ipeek(struct omx_endpoint *ep, union omx_request **requestp,
 
  out_with_lock:
   OMX__ENDPOINT_UNLOCK(ep);
+ out:
   *resultp = result;
   return ret;
 }
@@ -606,7 +628,11 @@ omx_iprobe(struct omx_endpoint *ep, uint64_t match_info, uint64_t match_mask,
     goto out;
   }
 
-  OMX__ENDPOINT_LOCK(ep);
+  if (unlikely(!OMX__ENDPOINT_TRYLOCK(ep))) {
+    if (omx__empty_unexp_queue_unlocked(ep, match_info, match_mask))
+      goto out;
+    OMX__ENDPOINT_LOCK(ep);
+  }
 
   ret = omx__progress(ep);
   if (unlikely(ret != OMX_SUCCESS))
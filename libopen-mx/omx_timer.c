@@ -0,0 +1,185 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU Lesser General Public License in COPYING.LGPL for more details.
+ */
+
+#include "omx_lib.h"
+#include "omx_list.h"
+
+/*
+ * Hierarchical timer wheel.
+ *
+ * Level 0 has one slot per jiffy for the next OMX__TIMER_WHEEL_SIZE jiffies,
+ * each upper level has slots OMX__TIMER_WHEEL_SIZE times larger. Timers are
+ * moved down one level (cascaded) when the clock reaches their slot.
+ * Arming, disarming and expiring a timer is O(1), and the clock jumps over
+ * the slots of empty levels, so running the wheel only costs anything when
+ * some timers actually expire.
+ *
+ * Timers further than the last level are parked in its farthest slot and
+ * reinserted with their real deadline when cascaded.
+ *
+ * Everything is protected by the endpoint lock.
+ */
+
+#define OMX__TIMER_WHEEL_MASK (OMX__TIMER_WHEEL_SIZE - 1)
+#define OMX__TIMER_WHEEL_SHIFT(level) (OMX__TIMER_WHEEL_BITS * (level))
+#define OMX__TIMER_WHEEL_RANGE (1ULL << OMX__TIMER_WHEEL_SHIFT(OMX__TIMER_WHEEL_LEVELS))
+
+static void
+omx__timer_wheel_enqueue(struct omx__timer_wheel *wheel, struct omx__timer *timer)
+{
+  uint64_t expires = timer->expires;
+  uint64_t delta;
+  int level;
+
+  if (expires < wheel->clock)
+    /* already expired, run it with the next jiffy */
+    expires = wheel->clock;
+
+  delta = expires - wheel->clock;
+  if (delta >= OMX__TIMER_WHEEL_RANGE)
+    expires = wheel->clock + OMX__TIMER_WHEEL_RANGE - 1;
+
+  for(level=0; level<OMX__TIMER_WHEEL_LEVELS-1; level++)
+    if (delta < 1ULL << OMX__TIMER_WHEEL_SHIFT(level+1))
+      break;
+
+  timer->level = level;
+  wheel->level_nr[level]++;
+  list_add_tail(&timer->elt,
+		&wheel->slots[level][(expires >> OMX__TIMER_WHEEL_SHIFT(level)) & OMX__TIMER_WHEEL_MASK]);
+}
+
+/* move the timers of the upper level slots that the clock just reached */
+static void
+omx__timer_wheel_cascade(struct omx__timer_wheel *wheel)
+{
+  int level;
+
+  for(level=1; level<OMX__TIMER_WHEEL_LEVELS; level++) {
+    unsigned index = (wheel->clock >> OMX__TIMER_WHEEL_SHIFT(level)) & OMX__TIMER_WHEEL_MASK;
+    struct omx__timer *timer, *next;
+    struct list_head tmp;
+
+    list_head_init(&tmp);
+    list_spliceall_tail(&wheel->slots[level][index], &tmp);
+    list_head_init(&wheel->slots[level][index]);
+
+    list_for_each_entry_safe(timer, next, &tmp, elt) {
+      wheel->level_nr[level]--;
+      omx__timer_wheel_enqueue(wheel, timer);
+    }
+
+    if (index)
+      /* the next levels did not reach a new slot */
+      break;
+  }
+}
+
+/* where the clock may jump when level 0 is empty */
+static uint64_t
+omx__timer_wheel_next_cascade(const struct omx__timer_wheel *wheel)
+{
+  int level;
+
+  for(level=1; level<OMX__TIMER_WHEEL_LEVELS; level++)
+    if (wheel->level_nr[level]) {
+      uint64_t mask = (1ULL << OMX__TIMER_WHEEL_SHIFT(level)) - 1;
+      return (wheel->clock | mask) + 1;
+    }
+
+  return (uint64_t) -1;
+}
+
+void
+omx__timer_wheel_init(struct omx__timer_wheel *wheel, uint64_t now)
+{
+  int level, i;
+
+  wheel->clock = now;
+  for(level=0; level<OMX__TIMER_WHEEL_LEVELS; level++) {
+    wheel->level_nr[level] = 0;
+    for(i=0; i<OMX__TIMER_WHEEL_SIZE; i++)
+      list_head_init(&wheel->slots[level][i]);
+  }
+}
+
+void
+omx__timer_init(struct omx__timer *timer, omx__timer_func_t func)
+{
+  timer->func = func;
+  timer->level = -1;
+}
+
+void
+omx__timer_arm(struct omx__timer_wheel *wheel, struct omx__timer *timer,
+	       uint64_t expires)
+{
+  omx__timer_disarm(wheel, timer);
+  timer->expires = expires;
+  omx__timer_wheel_enqueue(wheel, timer);
+}
+
+void
+omx__timer_disarm(struct omx__timer_wheel *wheel, struct omx__timer *timer)
+{
+  if (timer->level < 0)
+    return;
+
+  list_del(&timer->elt);
+  wheel->level_nr[timer->level]--;
+  timer->level = -1;
+}
+
+/*
+ * Run all timers that expired up to now (included).
+ * Timers may be armed again from their callback.
+ */
+void
+omx__timer_wheel_run(struct omx_endpoint *ep, struct omx__timer_wheel *wheel,
+		     uint64_t now)
+{
+  while (wheel->clock <= now) {
+    unsigned index = wheel->clock & OMX__TIMER_WHEEL_MASK;
+    struct omx__timer *timer;
+    struct list_head tmp;
+
+    if (!index)
+      omx__timer_wheel_cascade(wheel);
+
+    if (!wheel->level_nr[0]) {
+      /* nothing may expire before the next cascade */
+      uint64_t next = omx__timer_wheel_next_cascade(wheel);
+      wheel->clock = next <= now ? next : now + 1;
+      continue;
+    }
+
+    list_head_init(&tmp);
+    list_spliceall_tail(&wheel->slots[0][index], &tmp);
+    list_head_init(&wheel->slots[0][index]);
+
+    /* timers armed again for this jiffy will go to the next one */
+    wheel->clock++;
+
+    while (!list_empty(&tmp)) {
+      timer = list_first_entry(&tmp, struct omx__timer, elt);
+      list_del(&timer->elt);
+      wheel->level_nr[0]--;
+      timer->level = -1;
+      timer->func(ep, timer);
+    }
+  }
+}
@@ -37,6 +37,18 @@ struct list_head
   struct list_head *nxt;
 };
 
+/* posted receive entry in the matching engine, see omx_match.h */
+struct omx__match_elt {
+  /* queued in a hash bucket if fully-specified, in the ctxid wildcard queue otherwise */
+  struct list_head elt;
+  uint64_t match_info;
+  uint64_t match_mask;
+  uint64_t post_seq;
+};
+
+#define OMX__MATCH_HASH_BITS 10
+#define OMX__MATCH_HASH_SIZE (1U << OMX__MATCH_HASH_BITS)
+
 struct omx__req_segs {
   struct omx_cmd_user_segment single; /* optimization to store the single segment */
   uint32_t nseg;
@@ -59,14 +71,63 @@ struct omx__sendq_map {
   } * array;
 };
 
+/* registration cache interval tree node, see omx_regcache.c */
+struct omx__regcache_node {
+  struct omx__regcache_node *left, *right;
+  unsigned long start, end; /* [start:end) span of the region segments */
+  unsigned long subtree_end; /* highest end in this subtree */
+  uint32_t priority; /* treap heap key */
+};
+
+#define OMX__REGCACHE_VECT_HASH_BITS 6
+#define OMX__REGCACHE_VECT_HASH_SIZE (1U << OMX__REGCACHE_VECT_HASH_BITS)
+
+#define OMX__CACHELINE_SIZE 64
+#define __omx__cacheline_aligned __attribute__((aligned(OMX__CACHELINE_SIZE)))
+
+/* endpoint timers, see omx_timer.c */
+struct omx_endpoint;
+struct omx__timer;
+typedef void (*omx__timer_func_t)(struct omx_endpoint *ep, struct omx__timer *timer);
+
+struct omx__timer {
+  struct list_head elt;
+  uint64_t expires; /* in jiffies */
+  omx__timer_func_t func;
+  int level; /* wheel level, -1 if not pending */
+};
+
+#define OMX__TIMER_WHEEL_BITS 6
+#define OMX__TIMER_WHEEL_SIZE (1U << OMX__TIMER_WHEEL_BITS)
+#define OMX__TIMER_WHEEL_LEVELS 4
+
+struct omx__timer_wheel {
+  uint64_t clock; /* next jiffy to process */
+  unsigned level_nr[OMX__TIMER_WHEEL_LEVELS]; /* pending timers per level */
+  struct list_head slots[OMX__TIMER_WHEEL_LEVELS][OMX__TIMER_WHEEL_SIZE];
+};
+
+/* per-endpoint cache of fixed-size objects, see omx_slab.c */
+struct omx__slab {
+  void *free_list; /* free objects, linked through their first word */
+  void *chunks; /* allocated chunks, linked through their first word */
+  size_t obj_size; /* rounded up to a cache line */
+  unsigned chunk_nr; /* objects added when growing */
+  struct omx_slab_counters counters;
+};
+
 struct omx__large_region_map {
   int first_free;
   int nr_free;
   struct omx__large_region_slot {
     int next_free;
     struct omx__large_region {
-      struct list_head reg_elt; /* linked into the endpoint reg_list or reg_vect_list */
-      struct list_head reg_unused_elt; /* linked into the endpoint reg_unused_list if contigous, unused and cached */
+      struct list_head reg_elt; /* linked into the endpoint reg_list */
+      struct list_head reg_unused_elt; /* linked into the endpoint reg_unused_list if unused and cached */
+      struct omx__regcache_node regcache_node; /* indexed in the endpoint regcache tree if cached */
+      struct list_head regcache_vect_elt; /* linked into the regcache fingerprint hash if cached and vectorial */
+      uint32_t fingerprint; /* hash of the segments, for vectorial regions */
+      int cached;
       int use_count;
       uint8_t id;
       uint8_t last_seqnum;
@@ -124,44 +185,13 @@ enum omx__partner_need_ack {
 };
 
 struct omx__partner {
-  uint64_t board_addr;
-  uint16_t peer_index;
-  uint8_t endpoint_index;
-  uint8_t localization;
-  uint32_t rndv_threshold;
-
-  /* the main session id, obtained from the our actual connect */
-  uint32_t true_session_id;
-  /* another session id that we get from the connect request and use for
-   * messages that can go back before we connect back (ack, pull and notify)
+  /*
+   * Hot sequence numbers and ack state, used for every message sent to
+   * or received from this partner, on a single cache line
    */
-  uint32_t back_session_id;
-
-  /* seq num of the last connect request to this partner */
-  uint8_t connect_seqnum;
-
-  /* ack seqnums of last sent and recv explicit ack */
-  uint32_t last_send_acknum;
-  uint32_t last_recv_acknum;
-
-  /* list of non-acked request (queued by their partner_elt) */
-  struct list_head non_acked_req_q;
-  /* pending connect requests (queued by their partner_elt) */
-  struct list_head connect_req_q;
-  /* list of request matched but not entirely received (queued by their partner_elt) */
-  struct list_head partial_medium_recv_req_q;
-  /* delayed send because of throttling (too many acks missing) (queued by their partner_elt) */
-  struct list_head need_seqnum_send_req_q;
-
-  /* early packets (queued by their partner_elt) */
-  struct list_head early_recv_q;
-
-  /* throttling state */
-  uint32_t throttling_sends_nr;
-  struct list_head endpoint_throttling_partners_elt;
 
   /* seqnum of the next send */
-  omx__seqnum_t next_send_seq;
+  omx__seqnum_t next_send_seq __omx__cacheline_aligned;
 
   /* seqnum of the next send to be acked by the partner */
   omx__seqnum_t next_acked_send_seq;
@@ -194,12 +224,56 @@ struct omx__partner {
    * if changing next_frag_recv_seq, ack all the previous seqnums
    */
 
+  uint16_t peer_index;
+  uint8_t endpoint_index;
+  uint8_t localization;
+
+  /* seq num of the last connect request to this partner */
+  uint8_t connect_seqnum;
+
   /* acks */
-  struct list_head endpoint_partners_to_ack_elt;
   enum omx__partner_need_ack need_ack;
+
+  /* the main session id, obtained from the our actual connect */
+  uint32_t true_session_id;
+  /* another session id that we get from the connect request and use for
+   * messages that can go back before we connect back (ack, pull and notify)
+   */
+  uint32_t back_session_id;
+
+  uint32_t rndv_threshold;
+
+  /* throttling state */
+  uint32_t throttling_sends_nr;
+
+  /* ack seqnums of last sent and recv explicit ack */
+  uint32_t last_send_acknum;
+  uint32_t last_recv_acknum;
+
   /* when a ack is need but not immediately (need_ack == ACK_DELAYED) */
   uint64_t oldest_recv_time_not_acked;
 
+  uint64_t board_addr;
+
+  /*
+   * Queues, only touched when they are not empty
+   */
+
+  /* list of non-acked request (queued by their partner_elt) */
+  struct list_head non_acked_req_q;
+  /* pending connect requests (queued by their partner_elt) */
+  struct list_head connect_req_q;
+  /* list of request matched but not entirely received (queued by their partner_elt) */
+  struct list_head partial_medium_recv_req_q;
+  /* delayed send because of throttling (too many acks missing) (queued by their partner_elt) */
+  struct list_head need_seqnum_send_req_q;
+
+  /* early packets (queued by their partner_elt) */
+  struct list_head early_recv_q;
+
+  struct list_head endpoint_throttling_partners_elt;
+  struct list_head endpoint_partners_to_ack_elt;
+
   /* user private data for get/set_endpoint_addr_context */
   void * user_context;
 };
@@ -238,33 +312,43 @@ enum omx__request_resource {
 #define OMX_REQUEST_PULL_RESOURCES (OMX_REQUEST_RESOURCE_EXP_EVENT | OMX_REQUEST_RESOURCE_LARGE_REGION | OMX_REQUEST_RESOURCE_PULL_HANDLE)
 
 struct omx_endpoint {
+  /*
+   * Hot progression state, read by every progression pass and
+   * completion check, on its own cache line (see omx__check_layout())
+   */
+  omx_eventq_index_t next_exp_event_index __omx__cacheline_aligned;
+  omx_eventq_index_t next_unexp_event_index;
+  uint32_t avail_exp_events;
+  int progression_disabled;
+  /* queue lengths so that the progression may skip them without touching their heads */
+  uint32_t need_resources_send_req_nr;
+  uint32_t partners_to_ack_immediate_nr;
   int fd;
-  unsigned endpoint_index, board_index;
-  struct omx_board_info board_info;
-  char board_addr_str[OMX_BOARD_ADDR_STRLEN];
-  uint32_t app_key;
-  struct omx__lock lock;
+  const void * exp_eventq, * unexp_eventq;
+  struct omx_endpoint_desc * desc;
+
+  /* the lock is bounced between threads, keep it away from the progression state */
+  struct omx__lock lock __omx__cacheline_aligned;
+  struct omx__cond in_handler_cond;
+  struct omx__cond progress_thread_cond;
+
+  /*
+   * Send and receive paths state
+   */
+  void * sendq __omx__cacheline_aligned;
+  void * submitq; /* NULL if the submission ring is not used */
 #if OMX_LIB_DLMALLOC
   void * malloc_data;
 #endif
-  int progression_disabled;
-  struct omx__cond in_handler_cond;
-  omx_unexp_handler_t unexp_handler;
-  void * unexp_handler_context;
-  struct omx_endpoint_desc * desc;
-  uint32_t check_status_delay_jiffies;
-  uint64_t last_check_jiffies;
-#ifdef OMX_LIB_DEBUG
-  uint64_t last_progress_jiffies;
-#endif
-  void * sendq;
+  uint32_t next_submitq_index;
   const void * recvq;
-  const void * exp_eventq, * unexp_eventq;
-  omx_eventq_index_t next_exp_event_index, next_unexp_event_index;
-  uint32_t avail_exp_events;
+  struct omx__partner ** partners;
+  struct omx__partner * myself;
   uint32_t req_resends_max;
   uint32_t pull_resend_timeout_jiffies;
   uint32_t zombies, zombie_max;
+  int large_sends_avail_nr; /* number of simultaneous large send that may be posted,
+			     * limited to prevent deadlocks */
 
   /* context ids */
   uint8_t ctxid_bits;
@@ -287,11 +371,20 @@ struct omx_endpoint {
     /* posted non-matched receive (queued by their queue_elt) */
     /* (we could queue by the ctxid_elt but we would need another recv_req_q to ensure conservation of matter) */
     struct list_head recv_req_q;
+    /* number of recv_req_q requests without an expected medium slot */
+    uint32_t recv_unarmed_nr;
+    /* posted non-matched receive with a partial match_mask (queued by their recv.match.elt) */
+    struct list_head recv_wildcard_q;
 
     /* done requests (queued by their ctxid_elt, only if there are multiple ctxids) */
     struct list_head done_req_q;
   } * ctxid;
 
+  /* post order of receives, to match in order across the hash and the wildcard queues */
+  uint64_t recv_post_seq;
+  /* posted non-matched receive with a full match_mask, hashed on match_info (queued by their recv.match.elt) */
+  struct list_head recv_match_hash[OMX__MATCH_HASH_SIZE];
+
   /* non multiplexed queues */
   /* SEND req with state = NEED_RESOURCES (queued by their queue_elt) */
   struct list_head need_resources_send_req_q;
@@ -320,23 +413,61 @@ struct omx_endpoint {
   struct list_head internal_done_req_q;
 #endif
 
-  struct omx__sendq_map sendq_map;
-  struct omx__large_region_map large_region_map;
-  struct omx__partner ** partners;
-  struct omx__partner * myself;
-
-  uint64_t last_partners_acking_jiffies;
   struct list_head partners_to_ack_immediate_list;
   struct list_head partners_to_ack_delayed_list;
   struct list_head throttling_partners_list;
 
   struct list_head sleepers;
 
-  struct list_head reg_list; /* registered single-segment windows */
-  struct list_head reg_unused_list; /* unused registered single-segment windows, LRU in front */
-  struct list_head reg_vect_list; /* registered vectorial windows (uncached) */
-  int large_sends_avail_nr; /* number of simultaneous large send that may be posted,
-			     * limited to prevent deadlocks */
+  struct omx__sendq_map sendq_map;
+  struct omx__large_region_map large_region_map;
+
+  struct list_head reg_list; /* registered windows */
+  struct list_head reg_unused_list; /* unused cached windows, LRU in front */
+  struct {
+    struct omx__regcache_node *root; /* cached windows, by address span */
+    struct list_head vect_hash[OMX__REGCACHE_VECT_HASH_SIZE]; /* cached vectorial windows, by fingerprint */
+    uint32_t seed;
+    struct omx_regcache_counters counters;
+  } regcache;
+  struct omx__slab request_slab; /* union omx_request */
+  struct omx__slab early_slab; /* struct omx__early_packet */
+  struct omx__slab small_slab; /* OMX_SMALL_MSG_LENGTH_MAX data buffers */
+  struct omx__timer_wheel timers;
+  struct omx__timer resend_timer; /* oldest non-acked or connect request to resend */
+  struct omx__timer ack_timer; /* oldest delayed ack to send */
+  struct omx__timer check_timer; /* periodic endpoint descriptor status check */
+
+  /* expected medium slots, armed with posted receive buffers */
+  int exp_medium_enabled;
+  uint32_t exp_medium_cookie; /* incremented for each arming */
+  const struct omx_evt_recv_msg * exp_medium_cur_msg; /* event being processed that came through a slot */
+  union omx_request * exp_medium_done_req; /* still posted receive whose slot the driver freed in this event */
+  uint32_t * exp_medium_seqnums; /* next matched seqnum of each partner, mapped for the driver */
+  struct omx__exp_medium_slot {
+    union omx_request * req; /* NULL if the slot is free */
+    struct omx__large_region * region;
+    uint32_t region_offset;
+    uint32_t cookie;
+  } exp_medium_slots[OMX_EXP_MEDIUM_SLOT_NR];
+
+  /*
+   * Cold state, only used when opening/closing, in handlers or errors
+   */
+  unsigned endpoint_index, board_index;
+  struct omx_board_info board_info;
+  char board_addr_str[OMX_BOARD_ADDR_STRLEN];
+  uint32_t app_key;
+  omx_unexp_handler_t unexp_handler;
+  void * unexp_handler_context;
+  uint32_t check_status_delay_jiffies;
+#ifdef OMX_LIB_DEBUG
+  uint64_t last_progress_jiffies;
+#endif
+#ifdef OMX_LIB_THREAD_SAFETY
+  pthread_t progress_thread;
+  int progress_thread_running, progress_thread_stop;
+#endif
 
   omx_error_handler_t error_handler;
 
@@ -350,8 +481,14 @@ struct omx_endpoint {
 
 #define OMX__ENDPOINT_LOCK(ep) omx__lock(&(ep)->lock)
 #define OMX__ENDPOINT_UNLOCK(ep) omx__unlock(&(ep)->lock)
+#define OMX__ENDPOINT_TRYLOCK(ep) omx__trylock(&(ep)->lock)
 #define OMX__ENDPOINT_HANDLER_DONE_WAIT(ep) omx__cond_wait(&(ep)->in_handler_cond, &(ep)->lock)
-#define OMX__ENDPOINT_HANDLER_DONE_SIGNAL(ep) omx__cond_signal(&(ep)->in_handler_cond)
+#define OMX__ENDPOINT_HANDLER_DONE_SIGNAL(ep) do {	\
+  omx__cond_signal(&(ep)->in_handler_cond);		\
+  omx__cond_signal(&(ep)->progress_thread_cond);	\
+} while (0)
+#define OMX__ENDPOINT_PROGRESS_THREAD_WAIT(ep) omx__cond_wait(&(ep)->progress_thread_cond, &(ep)->lock)
+#define OMX__ENDPOINT_PROGRESS_THREAD_SIGNAL(ep) omx__cond_signal(&(ep)->progress_thread_cond)
 
 enum omx__request_type {
   OMX_REQUEST_TYPE_NONE=0,
@@ -438,10 +575,23 @@ enum omx__request_state {
   /* request has been completed by the application and should not be notified when done for real (including acked) */
   OMX_REQUEST_STATE_ZOMBIE = (1<<11),
   /* request is internal, should not be queued in the doneq for peek/test_any */
-  OMX_REQUEST_STATE_INTERNAL = (1<<12)
+  OMX_REQUEST_STATE_INTERNAL = (1<<12),
+  /* posted receive whose buffer is armed in an expected medium slot of the driver */
+  OMX_REQUEST_STATE_RECV_EXP_MEDIUM = (1<<13)
 };
 
 struct omx__generic_request {
+  /* the completion check and resend fields come first, on the first cache line of the slab object */
+  uint16_t state;
+  uint16_t missing_resources;
+  enum omx__request_type type;
+  struct omx__partner * partner;
+
+  omx__seqnum_t send_seqnum; /* seqnum of the sent message associated with the request, either for a usual send request, or the notify message for recv large */
+  uint32_t resends_max;
+  uint32_t resends;
+  uint64_t last_send_jiffies;
+
   /* main queue elt, linked to one of the endpoint queues */
   struct list_head queue_elt;
   /* done queue elt, queued to the endpoint main doneq when ready to be completed */
@@ -451,16 +601,6 @@ struct omx__generic_request {
   /* partner specific queue elt, either for partial receive, or for non-acked request (cannot be both) */
   struct list_head partner_elt;
 
-  struct omx__partner * partner;
-  enum omx__request_type type;
-  uint16_t state;
-  uint16_t missing_resources;
-
-  omx__seqnum_t send_seqnum; /* seqnum of the sent message associated with the request, either for a usual send request, or the notify message for recv large */
-  uint64_t last_send_jiffies;
-  uint32_t resends_max;
-  uint32_t resends;
-
   struct omx_status status;
 };
 
@@ -497,6 +637,8 @@ union omx_request {
       } mediumsq;
       struct {
 	struct omx_cmd_send_mediumva send_mediumva_ioctl_param;
+	uint32_t frags_nr;
+	uint32_t frags_acked_mask[OMX_PUSH_FRAGS_MAX/32]; /* only updated by push sacks */
       } mediumva;
       struct {
 	struct omx_cmd_send_rndv send_rndv_ioctl_param;
@@ -509,13 +651,13 @@ union omx_request {
   struct omx__recv_request {
     struct omx__generic_request generic;
     struct omx__req_segs segs;
-    uint64_t match_info;
-    uint64_t match_mask;
+    struct omx__match_elt match;
     uint16_t checksum; /* checksum given by sender in incoming send */
     omx__seqnum_t seqnum; /* seqnum of the incoming matched send */
+    uint8_t exp_medium_slot; /* only valid with state RECV_EXP_MEDIUM */
     union {
       struct {
-	uint32_t frags_received_mask;
+	uint32_t frags_received_mask[OMX_PUSH_FRAGS_MAX/32];
 	uint32_t accumulated_length; /* the actual received length, not the transfered one */
 	uint32_t scan_offset;
 	struct omx_segscan_state scan_state;
@@ -523,6 +665,7 @@ union omx_request {
       struct {
 	struct omx_cmd_send_notify send_notify_ioctl_param;
 	struct omx__large_region * local_region;
+	uint32_t local_region_offset;
 	uint8_t pulled_rdma_id;
 	uint8_t pulled_rdma_seqnum;
 	uint16_t pulled_rdma_offset;
@@ -563,6 +706,8 @@ struct omx__globals {
   int verbdebug;
   int regcache;
   int parallel_regcache;
+  uint64_t regcache_size; /* cached bytes budget, 0 if unlimited */
+  unsigned slab_prealloc; /* objects preallocated in each endpoint slab */
   int waitspin;
   int connect_pollall;
   int zombie_max;
@@ -572,11 +717,16 @@ struct omx__globals {
   int debug_checksum;
   int check_request_alloc;
   int medium_sendq;
+  unsigned submitq_idle_us; /* 0 if the submission ring is disabled */
+  unsigned progress_thread_spin_us; /* 0 if the progress thread is disabled */
+  int progress_thread_cpu; /* -1 if not bound */
+  unsigned exp_medium_min; /* 0 if expected medium slots are disabled */
   uint32_t any_endpoint_id;
   int selfcomms;
   int sharedcomms;
   unsigned rndv_threshold;
   unsigned shared_rndv_threshold;
+  unsigned push_max; /* 0 if large messages are never pushed */
   unsigned ack_delay_jiffies;
   unsigned resend_delay_jiffies;
   unsigned req_resends_max;
@@ -18,6 +18,7 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -320,6 +321,72 @@ omx__check_mmap(const char * string)
 
 static int omx_comms_initialized = 0;
 
+/*
+ * Map the submission ring and start the driver submission thread if wanted.
+ * Failing is not fatal, send commands just go through ioctls.
+ */
+static void
+omx__endpoint_submitq_init(struct omx_endpoint *ep)
+{
+  struct omx_cmd_submitq_start start_param;
+  void *submitq;
+  int err;
+
+  ep->submitq = NULL;
+  ep->next_submitq_index = 0;
+
+  if (!omx__globals.submitq_idle_us)
+    return;
+
+  if (!(omx__driver_desc->features & OMX_DRIVER_FEATURE_SUBMITQ)) {
+    omx__verbose_printf(ep, "Driver does not support the submission ring, ignoring\n");
+    return;
+  }
+
+  submitq = mmap(0, OMX_SUBMITQ_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, ep->fd, OMX_SUBMITQ_FILE_OFFSET);
+  if (submitq == MAP_FAILED) {
+    omx__verbose_printf(ep, "Failed to map the submission ring (%m), ignoring\n");
+    return;
+  }
+
+  start_param.idle_us = omx__globals.submitq_idle_us;
+  start_param.pad = 0;
+  err = ioctl(ep->fd, OMX_CMD_SUBMITQ_START, &start_param);
+  if (err < 0) {
+    omx__verbose_printf(ep, "Failed to start the submission ring (%m), ignoring\n");
+    munmap(submitq, OMX_SUBMITQ_SIZE);
+    return;
+  }
+
+  ep->submitq = submitq;
+}
+
+/*
+ * Lock the cache line layout of the structures used in the critical path.
+ * Only compile-time checks, nothing to do at runtime.
+ */
+static INLINE void
+omx__check_layout(void)
+{
+  /* the progression state fits in the first cache line of the endpoint */
+  BUILD_BUG_ON(offsetof(struct omx_endpoint, next_exp_event_index) != 0);
+  BUILD_BUG_ON(offsetof(struct omx_endpoint, desc) + sizeof(void *) > OMX__CACHELINE_SIZE);
+  /* the lock and the send/recv state start their own cache lines */
+  BUILD_BUG_ON(offsetof(struct omx_endpoint, lock) != OMX__CACHELINE_SIZE);
+  BUILD_BUG_ON(offsetof(struct omx_endpoint, sendq) % OMX__CACHELINE_SIZE != 0);
+  BUILD_BUG_ON(offsetof(struct omx_endpoint, anyctxid) + sizeof(((struct omx_endpoint *) 0)->anyctxid)
+	       > offsetof(struct omx_endpoint, sendq) + 2 * OMX__CACHELINE_SIZE);
+
+  /* the partner seqnums and ack state fit in its first cache line, before the queues */
+  BUILD_BUG_ON(offsetof(struct omx__partner, next_send_seq) != 0);
+  BUILD_BUG_ON(offsetof(struct omx__partner, board_addr) + sizeof(uint64_t) > OMX__CACHELINE_SIZE);
+  BUILD_BUG_ON(offsetof(struct omx__partner, non_acked_req_q) < OMX__CACHELINE_SIZE);
+
+  /* the request state and queue_elt fit in the first cache line of the slab object */
+  BUILD_BUG_ON(offsetof(struct omx__generic_request, state) != 0);
+  BUILD_BUG_ON(offsetof(struct omx__generic_request, queue_elt) + sizeof(struct list_head) > OMX__CACHELINE_SIZE);
+}
+
 /* API omx_open_endpoint */
 omx_return_t
 omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
@@ -398,7 +465,7 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   }
 
   omx__lock(&omx__global_lock);
-  ep = omx_malloc(sizeof(struct omx_endpoint));
+  ep = omx_memalign(OMX__CACHELINE_SIZE, sizeof(struct omx_endpoint));
   omx__unlock(&omx__global_lock);
   if (!ep) {
     ret = omx__error(OMX_NO_RESOURCES, "Allocating new endpoint");
@@ -498,6 +565,8 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
 
   BUILD_BUG_ON(sizeof(struct omx_evt_recv_msg) != OMX_EVENTQ_ENTRY_SIZE);
   BUILD_BUG_ON(sizeof(union omx_evt) != OMX_EVENTQ_ENTRY_SIZE);
+  BUILD_BUG_ON(sizeof(struct omx_submitq_entry) != OMX_SUBMITQ_ENTRY_SIZE);
+  omx__check_layout();
 
   omx__debug_printf(ENDPOINT, NULL, "desc at %p sendq at %p, recvq at %p, exp eventq at %p, unexp at %p\n",
 		    desc, sendq, recvq, exp_eventq, unexp_eventq);
@@ -513,7 +582,6 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   ep->req_resends_max = omx__globals.req_resends_max;
   ep->pull_resend_timeout_jiffies = omx__globals.resend_delay_jiffies * omx__globals.req_resends_max;
   ep->check_status_delay_jiffies = omx__driver_desc->hz; /* once per second */
-  ep->last_check_jiffies = 0;
 #ifdef OMX_LIB_DEBUG
   ep->last_progress_jiffies = 0;
 #endif
@@ -524,16 +592,27 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   ep->message_prefix = omx__create_message_prefix(ep); /* needs endpoint_index to be set */
   omx__unlock(&omx__global_lock);
 
+  /* map the optional submission ring once verbose messages may be prefixed */
+  omx__endpoint_submitq_init(ep);
+  omx__exp_medium_init(ep);
+
   /* initialize some sub-structures */
-  omx__request_alloc_init(ep);
   omx__lock_init(&ep->lock);
   omx__cond_init(&ep->in_handler_cond);
+  omx__cond_init(&ep->progress_thread_cond);
+
+  /* prepare the request and buffer caches */
+  ret = omx__request_alloc_init(ep);
+  if (ret != OMX_SUCCESS) {
+    ret = omx__error(ret, "Preallocating new endpoint requests");
+    goto out_with_message_prefix;
+  }
 
   /* prepare the large regions */
   ret = omx__endpoint_large_region_map_init(ep);
   if (ret != OMX_SUCCESS) {
     ret = omx__error(ret, "Initializing new endpoint large region map");
-    goto out_with_message_prefix;
+    goto out_with_request_alloc;
   }
 
   /* allocate partners */
@@ -569,14 +648,19 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
 
   list_head_init(&ep->anyctxid.done_req_q);
   list_head_init(&ep->anyctxid.unexp_req_q);
+  omx__match_hash_init(ep->recv_match_hash);
+  ep->recv_post_seq = 0;
 
   for(i=0; i<ep->ctxid_max; i++) {
     list_head_init(&ep->ctxid[i].unexp_req_q);
     list_head_init(&ep->ctxid[i].recv_req_q);
+    ep->ctxid[i].recv_unarmed_nr = 0;
+    list_head_init(&ep->ctxid[i].recv_wildcard_q);
     list_head_init(&ep->ctxid[i].done_req_q);
   }
 
   list_head_init(&ep->need_resources_send_req_q);
+  ep->need_resources_send_req_nr = 0;
   list_head_init(&ep->driver_mediumsq_sending_req_q);
   list_head_init(&ep->large_send_need_reply_req_q);
   list_head_init(&ep->driver_pulling_req_q);
@@ -592,10 +676,12 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
 #endif
 
   list_head_init(&ep->partners_to_ack_immediate_list);
-  ep->last_partners_acking_jiffies = 0;
+  ep->partners_to_ack_immediate_nr = 0;
   list_head_init(&ep->partners_to_ack_delayed_list);
   list_head_init(&ep->throttling_partners_list);
 
+  omx__init_progress_timers(ep);
+
   list_head_init(&ep->sleepers);
 
   ep->desc->user_event_index = 0;
@@ -604,6 +690,9 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
 
   omx__progress(ep);
 
+  /* start the optional progress thread once everything is ready */
+  omx__progress_thread_start(ep);
+
   *epp = ep;
 
   return OMX_SUCCESS;
@@ -614,7 +703,14 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   omx_free_ep(ep, ep->partners);
  out_with_large_regions:
   omx__endpoint_large_region_map_exit(ep);
+ out_with_request_alloc:
+  omx__request_alloc_exit(ep);
  out_with_message_prefix:
+  if (ep->exp_medium_seqnums)
+    munmap(ep->exp_medium_seqnums, OMX_EXP_MEDIUM_SEQNUMS_SIZE(omx__driver_desc->peer_max,
+							       omx__driver_desc->endpoint_max));
+  if (ep->submitq)
+    munmap(ep->submitq, OMX_SUBMITQ_SIZE);
   omx__lock(&omx__global_lock);
   omx_free(ep->message_prefix);
   omx__unlock(&omx__global_lock);
@@ -638,6 +734,7 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
  out_with_ep:
   omx__lock_destroy(&ep->lock);
   omx__cond_destroy(&ep->in_handler_cond);
+  omx__cond_destroy(&ep->progress_thread_cond);
   omx__lock(&omx__global_lock);
   omx_free(ep);
   omx__unlock(&omx__global_lock);
@@ -662,6 +759,9 @@ omx_close_endpoint(struct omx_endpoint *ep)
     goto out_with_lock;
   }
 
+  /* the progress thread needs the lock to exit */
+  omx__progress_thread_stop(ep);
+
   ret = omx__remove_endpoint_from_list(ep);
   if (ret != OMX_SUCCESS) {
     ret = omx__error(ret, "Closing endpoint");
@@ -683,6 +783,11 @@ omx_close_endpoint(struct omx_endpoint *ep)
   omx__lock(&omx__global_lock);
   omx_free(ep->message_prefix);
   omx__unlock(&omx__global_lock);
+  if (ep->exp_medium_seqnums)
+    munmap(ep->exp_medium_seqnums, OMX_EXP_MEDIUM_SEQNUMS_SIZE(omx__driver_desc->peer_max,
+							       omx__driver_desc->endpoint_max));
+  if (ep->submitq)
+    munmap(ep->submitq, OMX_SUBMITQ_SIZE);
   munmap((void *) ep->unexp_eventq, OMX_UNEXP_EVENTQ_SIZE);
   munmap((void *) ep->exp_eventq, OMX_EXP_EVENTQ_SIZE);
   munmap((void *) ep->recvq, OMX_RECVQ_SIZE);
@@ -696,6 +801,7 @@ omx_close_endpoint(struct omx_endpoint *ep)
   close(ep->fd);
   omx__lock_destroy(&ep->lock);
   omx__cond_destroy(&ep->in_handler_cond);
+  omx__cond_destroy(&ep->progress_thread_cond);
   omx__lock(&omx__global_lock);
   omx_free(ep);
   omx__unlock(&omx__global_lock);
@@ -742,7 +848,7 @@ omx__destroy_unlinked_request_on_close(struct omx_endpoint *ep, union omx_reques
     break;
 
   case OMX_REQUEST_TYPE_SEND_SMALL:
-    omx_free_ep(ep, req->send.specific.small.copy);
+    omx__small_buffer_free(ep, req->send.specific.small.copy);
     omx_free_segments(ep, &req->send.segs);
     break;
 
@@ -816,8 +922,7 @@ omx__destroy_requests_on_close(struct omx_endpoint *ep)
     /* free early packets */
     omx__foreach_partner_early_packet_safe(partner, early, next_early) {
       omx___dequeue_partner_early_packet(early);
-      omx_free_ep(ep, early->data);
-      omx_free_ep(ep, early);
+      omx__early_packet_free(ep, early);
     }
 
     /* free throttling requests */
@@ -883,7 +988,7 @@ omx__destroy_requests_on_close(struct omx_endpoint *ep)
 
   /* free need_resources reqs */
   omx__foreach_request_safe(&ep->need_resources_send_req_q, req, next) {
-    omx___dequeue_request(req);
+    omx__dequeue_need_resources_request(ep, req);
     /* cannot be done */
     omx__destroy_unlinked_request_on_close(ep, req);
   }
@@ -59,7 +59,7 @@ omx__endpoint_large_region_map_init(struct omx_endpoint * ep)
 
   list_head_init(&ep->reg_list);
   list_head_init(&ep->reg_unused_list);
-  list_head_init(&ep->reg_vect_list);
+  omx__regcache_init(ep);
   ep->large_sends_avail_nr = OMX_USER_REGION_MAX/2;
 
   return OMX_SUCCESS;
@@ -119,15 +119,11 @@ omx__endpoint_large_region_map_exit(struct omx_endpoint * ep)
   struct omx__large_region *region, *next;
 
   list_for_each_entry_safe(region, next, &ep->reg_list, reg_elt) {
-    if (!region->use_count)
+    if (region->cached && !region->use_count)
       list_del(&region->reg_unused_elt);
     omx__destroy_region(ep, region);
   }
 
-  list_for_each_entry_safe(region, next, &ep->reg_vect_list, reg_elt) {
-    omx__destroy_region(ep, region);
-  }
-
   omx_free_ep(ep, ep->large_region_map.array);
 }
 
@@ -195,18 +191,49 @@ omx__deregister_region(const struct omx_endpoint *ep,
  * Registration Cache Layer
  */
 
+/* rndv messages only carry 16bits of offset within the pulled region */
+#define OMX__REGCACHE_RNDV_OFFSET_MAX 0xffffUL
+
 static void
 omx__destroy_region(struct omx_endpoint *ep,
 		    struct omx__large_region *region)
 {
   omx__deregister_region(ep, region);
   list_del(&region->reg_elt);
-  /* no need to free the reqseqs segment array since the request owns it
-   * (see omx__create_region())
-   */
+  if (region->cached) {
+    omx__regcache_remove(ep, region);
+    /* cached vectorial regions own a copy of the segment array
+     * (see omx__create_region())
+     */
+    omx_free_segments(ep, &region->segs);
+  }
   omx__endpoint_large_region_free(ep, region);
 }
 
+/* release the least recently used unused region of the cache */
+static INLINE void
+omx__regcache_evict(struct omx_endpoint *ep)
+{
+  struct omx__large_region *region;
+
+  region = list_first_entry(&ep->reg_unused_list, struct omx__large_region, reg_unused_elt);
+  omx__debug_printf(LARGE, ep, "regcache releasing unused region %d\n", region->id);
+  list_del(&region->reg_unused_elt);
+  ep->regcache.counters.evictions++;
+  omx__debug_printf(LARGE, ep, "destroying region %d\n", region->id);
+  omx__destroy_region(ep, region);
+}
+
+/* release unused regions until the cache fits in its budget again */
+static INLINE void
+omx__regcache_enforce_size(struct omx_endpoint *ep)
+{
+  while (omx__globals.regcache_size
+	 && ep->regcache.counters.cached_bytes > omx__globals.regcache_size
+	 && !list_empty(&ep->reg_unused_list))
+    omx__regcache_evict(ep);
+}
+
 static INLINE omx_return_t
 omx__endpoint_large_region_alloc(struct omx_endpoint *ep, struct omx__large_region **regionp)
 {
@@ -218,12 +245,7 @@ omx__endpoint_large_region_alloc(struct omx_endpoint *ep, struct omx__large_regi
   if (unlikely(ret == OMX_INTERNAL_MISSING_RESOURCES && omx__globals.regcache)) {
     /* try to free some unused region in the cache */
     if (!list_empty(&ep->reg_unused_list)) {
-      struct omx__large_region *region;
-      region = list_first_entry(&ep->reg_unused_list, struct omx__large_region, reg_unused_elt);
-      omx__debug_printf(LARGE, ep, "regcache releasing unused region %d\n", region->id);
-      list_del(&region->reg_unused_elt);
-      omx__debug_printf(LARGE, ep, "destroying region %d\n", region->id);
-      omx__destroy_region(ep, region);
+      omx__regcache_evict(ep);
 
       /* try again now, it should work */
       ret = omx__endpoint_large_region_try_alloc(ep, regionp);
@@ -247,25 +269,45 @@ omx__create_region(struct omx_endpoint *ep,
     /* let the caller handle the error */
     goto out;
 
-  /* Just clone the reqsegs structure.
-   * We should normally duplicate the segment array as well
-   * since it will be freed with the caller request while the
-   * regcache could still be using it.
-   * However, this array is only allocated in case of vectorial
-   * regions, and there's no regcache in this case, so we just
-   * don't duplicate and let the request free the array.
+  /* Clone the reqsegs structure.
+   * The segment array is only allocated in case of vectorial regions,
+   * and it will be freed with the caller request. Without regcache,
+   * the region goes away with the request, so we just don't duplicate
+   * the array. Otherwise the regcache may keep the region longer,
+   * so it needs its own copy.
    */
   omx_clone_segments(&region->segs, reqsegs);
+  if (omx__globals.regcache && reqsegs->nseg > 1) {
+    size_t size = reqsegs->nseg * sizeof(*reqsegs->segs);
+
+    region->segs.segs = omx_malloc_ep(ep, size);
+    if (!region->segs.segs) {
+      /* let the caller try again later */
+      ret = OMX_INTERNAL_MISSING_RESOURCES;
+      goto out_with_region;
+    }
+    memcpy(region->segs.segs, reqsegs->segs, size);
+  }
 
   ret = omx__register_region(ep, region);
   if (ret != OMX_SUCCESS)
     /* let the caller handle the error */
-    goto out_with_region;
+    goto out_with_segs;
 
   region->reserver = NULL;
+  region->cached = 0;
+  list_add_tail(&region->reg_elt, &ep->reg_list);
+  if (omx__globals.regcache) {
+    omx__regcache_insert(ep, region);
+    ep->regcache.counters.misses++;
+  }
+
   *regionp = region;
   return OMX_SUCCESS;
 
+ out_with_segs:
+  if (omx__globals.regcache)
+    omx_free_segments(ep, &region->segs);
  out_with_region:
   omx__endpoint_large_region_free(ep, region);
  out:
@@ -276,8 +318,10 @@ static INLINE omx_return_t
 omx__get_contigous_region(struct omx_endpoint *ep,
 			  const struct omx__req_segs *reqsegs,
 			  struct omx__large_region **regionp,
+			  uint32_t *offsetp,
 			  const void *reserver)
 {
+  const struct omx_cmd_user_segment *seg = &reqsegs->single;
   struct omx__large_region *region = NULL;
   omx_return_t ret;
 
@@ -287,18 +331,22 @@ omx__get_contigous_region(struct omx_endpoint *ep,
     omx__debug_printf(LARGE, ep, "need a region without reserving it\n");
 
   if (omx__globals.regcache) {
-    const struct omx_cmd_user_segment *seg = &reqsegs->single;
-    list_for_each_entry(region, &ep->reg_list, reg_elt) {
-      if ((!reserver || !region->reserver)
-	  && (omx__globals.parallel_regcache || !region->use_count)
-	  && region->segs.single.vaddr == seg->vaddr
-	  && region->segs.single.len >= seg->len) {
-
-	if (!(region->use_count++))
-	  list_del(&region->reg_unused_elt);
-	omx__debug_printf(LARGE, ep, "regcache reusing region %d (usecount %d)\n", region->id, region->use_count);
-	goto found;
-      }
+    /* reserved regions are pulled by the peer, at an offset sent in the rndv */
+    region = omx__regcache_find_contig(ep, seg,
+				       reserver ? OMX__REGCACHE_RNDV_OFFSET_MAX : UINT32_MAX,
+				       reserver);
+    if (region) {
+      *offsetp = seg->vaddr - region->segs.single.vaddr;
+      if (*offsetp || region->segs.single.len != seg->len)
+	ep->regcache.counters.superset_hits++;
+      else
+	ep->regcache.counters.hits++;
+
+      if (!(region->use_count++))
+	list_del(&region->reg_unused_elt);
+      omx__debug_printf(LARGE, ep, "regcache reusing region %d at offset %ld (usecount %d)\n",
+			region->id, (unsigned long) *offsetp, region->use_count);
+      goto found;
     }
   }
 
@@ -307,7 +355,7 @@ omx__get_contigous_region(struct omx_endpoint *ep,
     /* let the caller handle the error */
     goto out;
 
-  list_add_tail(&region->reg_elt, &ep->reg_list);
+  *offsetp = 0;
   region->use_count++;
   omx__debug_printf(LARGE, ep, "created contigous region %d (usecount %d)\n", region->id, region->use_count);
 
@@ -339,17 +387,27 @@ omx__get_vect_region(struct omx_endpoint *ep,
   else
     omx__debug_printf(LARGE, ep, "need a region without reserving it\n");
 
-  /* no regcache for vectorials */
+  if (omx__globals.regcache) {
+    /* only reuse vectorial regions with the exact same segments */
+    region = omx__regcache_find_vect(ep, reqsegs, reserver);
+    if (region) {
+      ep->regcache.counters.hits++;
+      if (!(region->use_count++))
+	list_del(&region->reg_unused_elt);
+      omx__debug_printf(LARGE, ep, "regcache reusing vectorial region %d (usecount %d)\n", region->id, region->use_count);
+      goto found;
+    }
+  }
 
   ret = omx__create_region(ep, reqsegs, &region);
   if (ret != OMX_SUCCESS)
     /* let the caller handle the error */
     goto out;
 
-  list_add_tail(&region->reg_elt, &ep->reg_vect_list);
   region->use_count++;
   omx__debug_printf(LARGE, ep, "created vectorial region %d (usecount %d)\n", region->id, region->use_count);
 
+ found:
   if (reserver) {
     omx__debug_assert(!region->reserver);
     omx__debug_printf(LARGE, ep, "reserving region %d for object %p\n", region->id, reserver);
@@ -367,13 +425,15 @@ omx_return_t
 omx__get_region(struct omx_endpoint *ep,
 		const struct omx__req_segs *reqsegs,
 		struct omx__large_region **regionp,
+		uint32_t *offsetp,
 		const void *reserver)
 {
   uint32_t nseg = reqsegs->nseg;
   if (nseg > 1) {
+    *offsetp = 0;
     return omx__get_vect_region(ep, reqsegs, regionp, reserver);
   } else {
-    return omx__get_contigous_region(ep, reqsegs, regionp, reserver);
+    return omx__get_contigous_region(ep, reqsegs, regionp, offsetp, reserver);
   }
 }
 
@@ -390,10 +450,12 @@ omx__put_region(struct omx_endpoint *ep,
     region->reserver = NULL;
   }
 
-  if (omx__globals.regcache && region->segs.nseg == 1) {
-    if (!region->use_count)
-      list_add_tail(&region->reg_unused_elt, &ep->reg_unused_list);
+  if (region->cached) {
     omx__debug_printf(LARGE, ep, "regcache keeping region %d (usecount %d)\n", region->id, region->use_count);
+    if (!region->use_count) {
+      list_add_tail(&region->reg_unused_elt, &ep->reg_unused_list);
+      omx__regcache_enforce_size(ep);
+    }
   } else {
     omx__debug_printf(LARGE, ep, "destroying region %d\n", region->id);
     omx__destroy_region(ep, region);
@@ -418,36 +480,59 @@ omx__segments_intersect(unsigned long begin1, unsigned long end1,
 
 struct omx_regcache_clean_segment {
   unsigned long begin, end;
+  struct list_head regions; /* unused regions to destroy in the current endpoint */
 };
 
+static void
+omx__endpoint_regcache_clean_region(struct omx_endpoint *ep,
+				    struct omx__large_region *region,
+				    void *data)
+{
+  struct omx_regcache_clean_segment *inval_seg = data;
+  unsigned long reg_begin = 0, reg_end = 0;
+  uint32_t i;
+
+  /* vectorial regions are indexed by their whole span, check their actual segments */
+  for(i=0; i<region->segs.nseg; i++) {
+    reg_begin = region->segs.segs[i].vaddr;
+    reg_end = reg_begin + region->segs.segs[i].len;
+    if (omx__segments_intersect(inval_seg->begin, inval_seg->end, reg_begin, reg_end))
+      break;
+  }
+  if (i == region->segs.nseg)
+    return;
+
+  if (region->use_count)
+    /* Invalidating a region that's being used is an application bug */
+    omx__abort(ep, "Application is freeing segment [%lx:%lx] under use by region %d segment [%lx:%lx]\n",
+	       inval_seg->begin, inval_seg->end,
+	       (unsigned) region->id,
+	       reg_begin, reg_end);
+
+  omx__verbose_printf(ep, "cleaning regcache [0x%lx:0x%lx] for region #%d segment [0x%lx:0x%lx]\n",
+		      inval_seg->begin, inval_seg->end,
+		      (unsigned) region->id,
+		      reg_begin, reg_end);
+
+  /* the cache cannot be modified while walking it, destroy later */
+  list_del(&region->reg_unused_elt);
+  list_add_tail(&region->reg_unused_elt, &inval_seg->regions);
+}
+
 static void
 omx__endpoint_regcache_clean(struct omx_endpoint *ep, void *data)
 {
+  struct omx_regcache_clean_segment *inval_seg = data;
   struct omx__large_region *region, *next;
-  struct omx_regcache_clean_segment *inval_seg = (void *)data;
 
   OMX__ENDPOINT_LOCK(ep);
-  list_for_each_entry_safe(region, next, &ep->reg_list, reg_elt) {
-    unsigned long reg_begin = region->segs.single.vaddr;
-    unsigned long reg_end = reg_begin + region->segs.single.len;
-
-    /* If the invalidated segment intersects the region segment */
-    if (omx__segments_intersect(inval_seg->begin, inval_seg->end, reg_begin, reg_end)) {
-
-      if (region->use_count)
-	/* Invalidating a region that's being used is an application bug */
-	omx__abort(ep, "Application is freeing segment [%lx:%lx] under use by region %d segment [%lx:%lx]\n",
-		   inval_seg->begin, inval_seg->end,
-		   (unsigned) region->id,
-		   reg_begin, reg_end);
-
-      omx__verbose_printf(ep, "cleaning regcache [0x%lx:0x%lx] for region #%d segment [0x%lx:0x%lx]\n",
-			  inval_seg->begin, inval_seg->end,
-			  (unsigned) region->id,
-			  reg_begin, reg_end);
-      list_del(&region->reg_unused_elt);
-      omx__destroy_region(ep, region);
-    }
+  list_head_init(&inval_seg->regions);
+  omx__regcache_foreach_overlapping(ep, inval_seg->begin, inval_seg->end,
+				    omx__endpoint_regcache_clean_region, inval_seg);
+  list_for_each_entry_safe(region, next, &inval_seg->regions, reg_unused_elt) {
+    list_del(&region->reg_unused_elt);
+    ep->regcache.counters.invalidations++;
+    omx__destroy_region(ep, region);
   }
   OMX__ENDPOINT_UNLOCK(ep);
 }
@@ -501,14 +586,17 @@ omx__alloc_setup_pull(struct omx_endpoint * ep,
 
  need_region:
   /* FIXME: could register xfer_length instead of the whole segments */
-  ret = omx__get_region(ep, &req->recv.segs, &region, NULL);
+  ret = omx__get_region(ep, &req->recv.segs, &region,
+			&req->recv.specific.large.local_region_offset, NULL);
   if (unlikely(ret != OMX_SUCCESS)) {
     omx__debug_assert(ret == OMX_INTERNAL_MISSING_RESOURCES);
     return ret;
   }
+  req->recv.specific.large.local_region = region;
   req->generic.missing_resources &= ~OMX_REQUEST_RESOURCE_LARGE_REGION;
 
  need_pull:
+  region = req->recv.specific.large.local_region;
   pull_param.peer_index = partner->peer_index;
   pull_param.dest_endpoint = partner->endpoint_index;
   pull_param.shared = omx__partner_localization_shared(partner);
@@ -516,6 +604,7 @@ omx__alloc_setup_pull(struct omx_endpoint * ep,
   pull_param.session_id = partner->back_session_id;
   pull_param.lib_cookie = (uintptr_t) req;
   pull_param.puller_rdma_id = region->id;
+  pull_param.puller_rdma_offset = req->recv.specific.large.local_region_offset;
   pull_param.pulled_rdma_id = req->recv.specific.large.pulled_rdma_id;
   pull_param.pulled_rdma_seqnum = req->recv.specific.large.pulled_rdma_seqnum;
   pull_param.pulled_rdma_offset = req->recv.specific.large.pulled_rdma_offset;
@@ -535,7 +624,6 @@ omx__alloc_setup_pull(struct omx_endpoint * ep,
   req->generic.missing_resources &= ~OMX_REQUEST_RESOURCE_PULL_HANDLE;
   omx__debug_assert(!req->generic.missing_resources);
 
-  req->recv.specific.large.local_region = region;
   req->generic.state |= OMX_REQUEST_STATE_DRIVER_PULLING;
   omx__enqueue_request(&ep->driver_pulling_req_q, req);
 
@@ -555,8 +643,7 @@ omx__submit_pull(struct omx_endpoint * ep,
     if (unlikely(ret != OMX_SUCCESS)) {
       omx__debug_assert(ret == OMX_INTERNAL_MISSING_RESOURCES);
       omx__debug_printf(SEND, ep, "queueing large request %p\n", req);
-      req->generic.state |= OMX_REQUEST_STATE_NEED_RESOURCES;
-      omx__enqueue_request(&ep->need_resources_send_req_q, req);
+      omx__enqueue_need_resources_request(ep, req);
     }
 
   } else {
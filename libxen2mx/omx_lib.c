@@ -65,10 +65,22 @@ omx__process_event(struct omx_endpoint * ep, const union omx_evt * evt)
 
   case OMX_EVT_RECV_MEDIUM_FRAG: {
     const struct omx_evt_recv_msg * msg = &evt->recv_msg;
-    const char * recvq_buffer = ep->recvq + msg->specific.medium_frag.recvq_offset;
+    const char * buffer;
+
+    if (unlikely(msg->specific.medium_frag.exp_slot)) {
+      /* the driver copied the data in the buffer of a posted receive */
+      buffer = omx__exp_medium_frag_begin(ep, msg);
+      if (!buffer)
+	break;
+    } else {
+      buffer = ep->recvq + msg->specific.medium_frag.recvq_offset;
+    }
+
     omx__process_recv(ep,
-		      msg, recvq_buffer, msg->specific.medium_frag.msg_length,
+		      msg, buffer, msg->specific.medium_frag.msg_length,
 		      omx__process_recv_medium_frag);
+    if (unlikely(msg->specific.medium_frag.exp_slot))
+      omx__exp_medium_frag_end(ep);
     break;
   }
 
@@ -105,9 +117,10 @@ omx__process_event(struct omx_endpoint * ep, const union omx_evt * evt)
     req->generic.state &= ~OMX_REQUEST_STATE_DRIVER_MEDIUMSQ_SENDING;
     omx__dequeue_request(&ep->driver_mediumsq_sending_req_q, req);
 
-    if (likely(req->generic.state & OMX_REQUEST_STATE_NEED_ACK))
+    if (likely(req->generic.state & OMX_REQUEST_STATE_NEED_ACK)) {
       omx__enqueue_request(&ep->non_acked_req_q, req);
-    else
+      omx__arm_resend_timer(ep, req);
+    } else
       omx__send_complete(ep, req, OMX_SUCCESS);
 
     break;
@@ -130,6 +143,11 @@ omx__process_event(struct omx_endpoint * ep, const union omx_evt * evt)
     break;
   }
 
+  case OMX_EVT_RECV_PUSH_SACK: {
+    omx__process_recv_push_sack(ep, &evt->recv_push_sack);
+    break;
+  }
+
   case OMX_EVT_IGNORE:
     break;
 
@@ -143,18 +161,14 @@ omx__process_event(struct omx_endpoint * ep, const union omx_evt * evt)
  * Progression
  */
 
-static INLINE void
-omx__check_endpoint_desc(struct omx_endpoint * ep)
+static void
+omx__check_endpoint_desc(struct omx_endpoint * ep, struct omx__timer *timer)
 {
-  uint64_t now = omx__driver_desc->jiffies;
-  uint64_t last = ep->last_check_jiffies;
   uint64_t driver_status;
   struct omx__partner *partner;
 
   /* check once every second */
-  if (now - last < ep->check_status_delay_jiffies)
-    return;
-  ep->last_check_jiffies = now;
+  omx__timer_arm(&ep->timers, timer, omx__driver_desc->jiffies + ep->check_status_delay_jiffies);
 
   driver_status = ep->desc->status;
   /* could be racy... could be fixed using atomic ops... */
@@ -192,6 +206,32 @@ omx__check_endpoint_desc(struct omx_endpoint * ep)
     omx__verbose_printf(ep, "Partner not acking enough, throttling %d send requests\n", partner->throttling_sends_nr);
 }
 
+static void
+omx__resend_timer_func(struct omx_endpoint *ep, struct omx__timer *timer)
+{
+  omx__process_resend_requests(ep);
+}
+
+static void
+omx__ack_timer_func(struct omx_endpoint *ep, struct omx__timer *timer)
+{
+  omx__process_partners_to_ack_delayed(ep);
+}
+
+void
+omx__init_progress_timers(struct omx_endpoint *ep)
+{
+  uint64_t now = omx__driver_desc->jiffies;
+
+  omx__timer_wheel_init(&ep->timers, now);
+  omx__timer_init(&ep->resend_timer, omx__resend_timer_func);
+  omx__timer_init(&ep->ack_timer, omx__ack_timer_func);
+  omx__timer_init(&ep->check_timer, omx__check_endpoint_desc);
+
+  /* check the endpoint descriptor during the first progression */
+  omx__timer_arm(&ep->timers, &ep->check_timer, now);
+}
+
 static INLINE void
 omx__check_enough_progression(struct omx_endpoint * ep)
 {
@@ -208,11 +248,24 @@ omx__check_enough_progression(struct omx_endpoint * ep)
 #endif
 }
 
+/*
+ * Event slots are released by publishing the index of the next event to
+ * consume in the endpoint descriptor. The driver only reads it when a queue
+ * looks full, so releasing is a plain store instead of an ioctl.
+ */
+static inline void
+omx__release_event_slots(volatile omx_eventq_index_t *consumed_index, omx_eventq_index_t index)
+{
+  /* make sure we are done reading the events before the driver may overwrite them */
+  __sync_synchronize();
+  *consumed_index = index;
+}
+
 omx_return_t
 omx__progress(struct omx_endpoint * ep)
 {
   omx_eventq_index_t index;
-  int err;
+  uint64_t now;
 
   if (unlikely(ep->progression_disabled))
     return OMX_SUCCESS;
@@ -235,15 +288,15 @@ omx__progress(struct omx_endpoint * ep)
     /* next event */
     index++;
 
-    /* Acknowledgement per batch of event slots */
+    /* Release event slots per batch while processing many events */
     BUILD_BUG_ON(OMX_UNEXP_RELEASE_SLOTS_BATCH_NR < 1); /* make sure we release something */
-    if (unlikely(index % OMX_UNEXP_RELEASE_SLOTS_BATCH_NR == 0)) {
-      err = ioctl(ep->fd, OMX_CMD_RELEASE_UNEXP_SLOTS);
-      if (err < 0)
-	omx__abort(ep, "Failed to release a batch of unexpected slots\n");
-    }
+    if (unlikely(index % OMX_UNEXP_RELEASE_SLOTS_BATCH_NR == 0))
+      omx__release_event_slots(&ep->desc->unexp_eventq_consumed_index, index);
+  }
+  if (index != ep->next_unexp_event_index) {
+    omx__release_event_slots(&ep->desc->unexp_eventq_consumed_index, index);
+    ep->next_unexp_event_index = index;
   }
-  ep->next_unexp_event_index = index;
 
   /* process expected events then */
   index = ep->next_exp_event_index;
@@ -259,28 +312,31 @@ omx__progress(struct omx_endpoint * ep)
     /* next event */
     index++;
 
-    /* Acknowledgement per batch of event slots */
+    /* Release event slots per batch while processing many events */
     BUILD_BUG_ON(OMX_EXP_RELEASE_SLOTS_BATCH_NR < 1); /* make sure we release something */
-    if (unlikely(index % OMX_EXP_RELEASE_SLOTS_BATCH_NR == 0)) {
-      err = ioctl(ep->fd, OMX_CMD_RELEASE_EXP_SLOTS);
-      if (err < 0)
-	omx__abort(ep, "Failed to release a batch of expected slots\n");
-    }
+    if (unlikely(index % OMX_EXP_RELEASE_SLOTS_BATCH_NR == 0))
+      omx__release_event_slots(&ep->desc->exp_eventq_consumed_index, index);
+  }
+  if (index != ep->next_exp_event_index) {
+    omx__release_event_slots(&ep->desc->exp_eventq_consumed_index, index);
+    ep->next_exp_event_index = index;
   }
-  ep->next_exp_event_index = index;
 
-  /* resend requests that didn't get acked/replied */
-  omx__process_resend_requests(ep);
+  /*
+   * resend requests that didn't get acked/replied, ack partners that
+   * didn't get acked recently, and check the endpoint descriptor,
+   * only when their timer expired, thus never twice in the same jiffy
+   */
+  now = omx__driver_desc->jiffies;
+  if (now >= ep->timers.clock)
+    omx__timer_wheel_run(ep, &ep->timers, now);
 
   /* post delayed requests */
   omx__process_delayed_requests(ep);
 
-  /* ack partners that didn't get acked recently */
+  /* ack partners that need it immediately */
   omx__process_partners_to_ack(ep);
 
-  /* check the endpoint descriptor */
-  omx__check_endpoint_desc(ep);
-
 #ifdef OMX_LIB_DEBUG
   /* check if we leaked some requests */
   if (omx__globals.check_request_alloc)
@@ -311,7 +367,9 @@ omx_progress(omx_endpoint_t ep)
 {
   omx_return_t ret = OMX_SUCCESS;
 
-  OMX__ENDPOINT_LOCK(ep);
+  /* another thread holding the lock will progress for us */
+  if (unlikely(!OMX__ENDPOINT_TRYLOCK(ep)))
+    return OMX_SUCCESS;
 
   ret = omx__progress(ep);
 
@@ -361,6 +419,7 @@ omx_reenable_progression(struct omx_endpoint *ep)
   }
 
   ep->progression_disabled &= ~OMX_PROGRESSION_DISABLED_BY_API;
+  OMX__ENDPOINT_PROGRESS_THREAD_SIGNAL(ep);
 
 #ifdef OMX_LIB_DEBUG
   {
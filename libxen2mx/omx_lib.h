@@ -20,6 +20,7 @@
 #define __omx_lib_h__
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <string.h>
@@ -43,6 +44,7 @@
 #include "dlmalloc.h"
 #define omx_malloc dlmalloc
 #define omx_calloc dlcalloc
+#define omx_memalign dlmemalign
 #define omx_free   dlfree
 static inline omx_return_t omx__init_ep_malloc(struct omx_endpoint *ep) {
   ep->malloc_data = create_mspace(0, 0);
@@ -51,15 +53,21 @@ static inline omx_return_t omx__init_ep_malloc(struct omx_endpoint *ep) {
 #define omx__exit_ep_malloc(ep) destroy_mspace((ep)->malloc_data)
 #define omx_malloc_ep(ep,size) mspace_malloc((ep)->malloc_data, size)
 #define omx_calloc_ep(ep,nb_elt,size_elt) mspace_calloc((ep)->malloc_data, nb_elt, size_elt)
+#define omx_memalign_ep(ep,align,size) mspace_memalign((ep)->malloc_data, align, size)
 #define omx_free_ep(ep,ptr) mspace_free((ep)->malloc_data, ptr)
 #else /* !OMX_LIB_DLMALLOC */
 #define omx_malloc malloc
 #define omx_calloc calloc
 #define omx_free   free
+static inline void * omx_memalign(size_t align, size_t size) {
+  void *ptr;
+  return posix_memalign(&ptr, align, size) ? NULL : ptr;
+}
 static inline int omx__init_ep_malloc(struct omx_endpoint *ep) { return OMX_SUCCESS; }
 #define omx__exit_ep_malloc(ep) do { /* nothing */ } while (0)
 #define omx_malloc_ep(ep,size) malloc(size)
 #define omx_calloc_ep(ep,nb_elt,size_elt) calloc(nb_elt,size_elt)
+#define omx_memalign_ep(ep,align,size) omx_memalign(align, size)
 #define omx_free_ep(ep,ptr) free(ptr)
 #endif /* !OMX_LIB_DLMALLOC */
 
@@ -118,6 +126,34 @@ omx__timeout_ms_to_absolute_jiffies(uint32_t ms)
 		: now + (ms * hz + 1023)/1024;
 }
 
+/* endpoint timers */
+
+extern void
+omx__timer_wheel_init(struct omx__timer_wheel *wheel, uint64_t now);
+
+extern void
+omx__timer_init(struct omx__timer *timer, omx__timer_func_t func);
+
+extern void
+omx__timer_arm(struct omx__timer_wheel *wheel, struct omx__timer *timer,
+	       uint64_t expires);
+
+extern void
+omx__timer_disarm(struct omx__timer_wheel *wheel, struct omx__timer *timer);
+
+extern void
+omx__timer_wheel_run(struct omx_endpoint *ep, struct omx__timer_wheel *wheel,
+		     uint64_t now);
+
+/* make sure the timer expires no later than expires */
+static inline void
+omx__timer_arm_earlier(struct omx__timer_wheel *wheel, struct omx__timer *timer,
+		       uint64_t expires)
+{
+  if (timer->level < 0 || expires < timer->expires)
+    omx__timer_arm(wheel, timer, expires);
+}
+
 /**************************
  * Partner-related helpers
  */
@@ -161,6 +197,18 @@ omx__partner_recv_lookup(const struct omx_endpoint *ep,
   *partnerp = ep->partners[partner_index];
 }
 
+/* tell the driver which seqnums may still claim an expected medium slot */
+static inline void
+omx__exp_medium_set_seqnum(const struct omx_endpoint *ep, const struct omx__partner *partner,
+			   int valid)
+{
+  uint32_t partner_index = ((uint32_t) partner->endpoint_index)
+    + ((uint32_t) partner->peer_index) * omx__driver_desc->endpoint_max;
+
+  if (unlikely(ep->exp_medium_seqnums))
+    ep->exp_medium_seqnums[partner_index] = valid ? OMX_EXP_MEDIUM_SEQNUM_VALID | partner->next_match_recv_seq : 0;
+}
+
 static inline void
 omx__mark_partner_need_ack_delayed(struct omx_endpoint *ep,
 				   struct omx__partner *partner)
@@ -171,6 +219,8 @@ omx__mark_partner_need_ack_delayed(struct omx_endpoint *ep,
     partner->need_ack = OMX__PARTNER_NEED_ACK_DELAYED;
     partner->oldest_recv_time_not_acked = omx__driver_desc->jiffies;
     list_add_tail(&partner->endpoint_partners_to_ack_elt, &ep->partners_to_ack_delayed_list);
+    omx__timer_arm_earlier(&ep->timers, &ep->ack_timer,
+			   partner->oldest_recv_time_not_acked + omx__globals.ack_delay_jiffies);
   }
 }
 
@@ -189,6 +239,7 @@ omx__mark_partner_need_ack_immediate(struct omx_endpoint *ep,
     }
 
     partner->need_ack = OMX__PARTNER_NEED_ACK_IMMEDIATE;
+    ep->partners_to_ack_immediate_nr++;
   }
 }
 
@@ -205,6 +256,8 @@ omx__mark_partner_ack_sent(struct omx_endpoint *ep,
 {
   /* drop the previous DELAYED or IMMEDIATE ack */
   if (partner->need_ack != OMX__PARTNER_NEED_NO_ACK) {
+    if (partner->need_ack == OMX__PARTNER_NEED_ACK_IMMEDIATE)
+      ep->partners_to_ack_immediate_nr--;
     partner->need_ack = OMX__PARTNER_NEED_NO_ACK;
     list_del(&partner->endpoint_partners_to_ack_elt);
   }
@@ -347,12 +400,46 @@ omx__endpoint_sendq_map_user(const struct omx_endpoint * ep,
   return user;
 }
 
+/**************
+ * Send batches
+ */
+
+/* several send commands submitted to the driver within a single ioctl */
+struct omx__send_batch {
+  struct omx_cmd_send_batch cmd;
+  struct omx_cmd_send_batch_entry entries[OMX_SEND_BATCH_NR_MAX];
+};
+
+static inline void
+omx__send_batch_init(struct omx__send_batch *batch)
+{
+  batch->cmd.nr = 0;
+  batch->cmd.entries = (uintptr_t) batch->entries;
+}
+
+/* the param must remain valid until the batch is submitted */
+static inline void
+omx__send_batch_add(struct omx__send_batch *batch, uint32_t type, const void *param)
+{
+  struct omx_cmd_send_batch_entry *entry = &batch->entries[batch->cmd.nr++];
+
+  omx__debug_assert(batch->cmd.nr <= OMX_SEND_BATCH_NR_MAX);
+  entry->type = type;
+  entry->param = (uintptr_t) param;
+}
+
 /******************************
  * Various internal prototypes
  */
 
 /* sending messages */
 
+extern unsigned
+omx__send_batch_submit(const struct omx_endpoint *ep, struct omx__send_batch *batch);
+
+extern int
+omx__submitq_post(struct omx_endpoint *ep, unsigned type, const void *param, size_t length);
+
 extern void
 omx__submit_notify(struct omx_endpoint *ep,
 		   union omx_request *req,
@@ -384,6 +471,18 @@ extern void
 omx__recv_complete(struct omx_endpoint *ep, union omx_request *req,
 		   omx_return_t status);
 
+extern void
+omx__exp_medium_init(struct omx_endpoint *ep);
+
+extern void
+omx__exp_medium_release(struct omx_endpoint *ep, union omx_request *req);
+
+extern const void *
+omx__exp_medium_frag_begin(struct omx_endpoint *ep, const struct omx_evt_recv_msg *msg);
+
+extern void
+omx__exp_medium_frag_end(struct omx_endpoint *ep);
+
 extern void
 omx__process_recv(struct omx_endpoint *ep,
 		  const struct omx_evt_recv_msg *msg, const void *data, uint32_t msg_length,
@@ -431,6 +530,10 @@ extern void
 omx__process_recv_nack_lib(struct omx_endpoint *ep,
 			   const struct omx_evt_recv_nack_lib *nack_lib);
 
+extern void
+omx__process_recv_push_sack(struct omx_endpoint *ep,
+			    const struct omx_evt_recv_push_sack *sack);
+
 /* progression */
 
 extern omx_return_t
@@ -479,6 +582,16 @@ omx__handle_liback(struct omx_endpoint *ep,
 		   struct omx__partner *partner,
 		   const struct omx_evt_recv_liback *liback);
 
+extern void
+omx__handle_push_sack(struct omx_endpoint *ep,
+		      struct omx__partner *partner,
+		      const struct omx_evt_recv_push_sack *sack);
+
+extern void
+omx__send_push_sack(struct omx_endpoint *ep,
+		    struct omx__partner *partner,
+		    const union omx_request *req);
+
 extern void
 omx__handle_nack(struct omx_endpoint *ep,
                  struct omx__partner *partner, omx__seqnum_t seqnum,
@@ -492,6 +605,9 @@ omx__mark_request_acked(struct omx_endpoint *ep,
 extern void
 omx__process_resend_requests(struct omx_endpoint *ep);
 
+extern void
+omx__init_progress_timers(struct omx_endpoint *ep);
+
 extern void
 omx__process_delayed_requests(struct omx_endpoint *ep);
 
@@ -507,12 +623,21 @@ omx__complete_unsent_send_request(struct omx_endpoint *ep,
 extern void
 omx__process_partners_to_ack(struct omx_endpoint *ep);
 
+extern void
+omx__process_partners_to_ack_delayed(struct omx_endpoint *ep);
+
 extern void
 omx__flush_partners_to_ack(struct omx_endpoint *ep);
 
 extern void
 omx__prepare_progress_wakeup(struct omx_endpoint *ep);
 
+extern void
+omx__progress_thread_start(struct omx_endpoint *ep);
+
+extern void
+omx__progress_thread_stop(struct omx_endpoint *ep);
+
 extern void
 omx__partner_cleanup(struct omx_endpoint *ep,
 		     struct omx__partner *partner, int disconnect);
@@ -529,6 +654,7 @@ extern omx_return_t
 omx__get_region(struct omx_endpoint *ep,
 		const struct omx__req_segs *segs,
 		struct omx__large_region **regionp,
+		uint32_t *offsetp,
 		const void * reserver);
 
 extern omx_return_t
@@ -539,6 +665,76 @@ omx__put_region(struct omx_endpoint *ep,
 extern void
 omx__regcache_clean(void *ptr, size_t size);
 
+/* registration cache index */
+
+typedef void (*omx__regcache_func_t)(struct omx_endpoint *ep,
+				     struct omx__large_region *region,
+				     void *data);
+
+extern void
+omx__regcache_init(struct omx_endpoint *ep);
+
+extern void
+omx__regcache_insert(struct omx_endpoint *ep,
+		     struct omx__large_region *region);
+
+extern void
+omx__regcache_remove(struct omx_endpoint *ep,
+		     struct omx__large_region *region);
+
+extern struct omx__large_region *
+omx__regcache_find_contig(struct omx_endpoint *ep,
+			  const struct omx_cmd_user_segment *seg,
+			  unsigned long offset_max,
+			  const void *reserver);
+
+extern struct omx__large_region *
+omx__regcache_find_vect(struct omx_endpoint *ep,
+			const struct omx__req_segs *reqsegs,
+			const void *reserver);
+
+extern void
+omx__regcache_foreach_overlapping(struct omx_endpoint *ep,
+				  unsigned long begin, unsigned long end,
+				  omx__regcache_func_t func, void *data);
+
+/* per-endpoint object caches */
+
+extern omx_return_t
+omx__slab_init(struct omx_endpoint *ep, struct omx__slab *slab,
+	       size_t size, unsigned prealloc);
+
+extern void
+omx__slab_exit(struct omx_endpoint *ep, struct omx__slab *slab);
+
+extern int
+omx__slab_grow(struct omx_endpoint *ep, struct omx__slab *slab, unsigned nr);
+
+static inline __malloc void *
+omx__slab_alloc(struct omx_endpoint *ep, struct omx__slab *slab)
+{
+  void *obj = slab->free_list;
+
+  if (unlikely(!obj)) {
+    if (omx__slab_grow(ep, slab, slab->chunk_nr) < 0)
+      return NULL;
+    obj = slab->free_list;
+  }
+  slab->free_list = *(void **) obj;
+
+  if (++slab->counters.in_use > slab->counters.high_water)
+    slab->counters.high_water = slab->counters.in_use;
+  return obj;
+}
+
+static inline void
+omx__slab_free(struct omx__slab *slab, void *obj)
+{
+  *(void **) obj = slab->free_list;
+  slab->free_list = obj;
+  slab->counters.in_use--;
+}
+
 /* board management */
 
 extern omx_return_t
@@ -85,6 +85,16 @@ list_empty(const struct list_head *list)
 	return (list->nxt == list);
 }
 
+/*
+ * Racy emptiness check without holding the lock that protects the list.
+ * A non-empty result must be confirmed once the lock is taken.
+ */
+static inline int
+list_empty_unlocked(const struct list_head *list)
+{
+	return (*(struct list_head * const volatile *) &list->nxt == list);
+}
+
 #define list_first_entry(list, type, field) \
 	containerof((list)->nxt, type, field)
 
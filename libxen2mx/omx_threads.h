@@ -36,6 +36,8 @@ struct omx__cond {
 #define omx__lock_destroy(lock) pthread_mutex_destroy(&(lock)->_mutex)
 #define omx__lock(lock) pthread_mutex_lock(&(lock)->_mutex)
 #define omx__unlock(lock) pthread_mutex_unlock(&(lock)->_mutex)
+/* without libpthread, there cannot be any contention */
+#define omx__trylock(lock) (!pthread_mutex_trylock || !pthread_mutex_trylock(&(lock)->_mutex))
 
 #define omx__cond_init(cond) pthread_cond_init(&(cond)->_cond, NULL)
 #define omx__cond_destroy(cond) pthread_cond_destroy(&(cond)->_cond)
@@ -46,6 +48,7 @@ struct omx__cond {
 #pragma weak pthread_mutex_destroy
 #pragma weak pthread_mutex_lock
 #pragma weak pthread_mutex_unlock
+#pragma weak pthread_mutex_trylock
 
 #pragma weak pthread_cond_init
 #pragma weak pthread_cond_destroy
@@ -61,6 +64,7 @@ struct omx__cond { /* nothing */ };
 #define omx__lock_destroy(lock) do { /* nothing */ } while (0)
 #define omx__lock(lock) do { /* nothing */ } while (0)
 #define omx__unlock(lock) do { /* nothing */ } while (0)
+#define omx__trylock(lock) (1)
 
 #define omx__cond_init(cond) do { /* nothing */ } while (0)
 #define omx__cond_destroy(cond) do { /* nothing */ } while (0)
@@ -0,0 +1,188 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Cost of matching a message against a posted receive queue of varying
+ * depth, with the hashed matching engine and with a linear walk of the
+ * same queue in post order.
+ */
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include <getopt.h>
+
+#include "omx_lib.h"
+#include "omx_match.h"
+
+#define ITER 1000000
+#define DEPTH_MAX 65536
+
+struct entry {
+  struct omx__match_elt match;
+  struct list_head linear_elt;
+};
+
+static struct entry entries[DEPTH_MAX];
+static struct list_head hash[OMX__MATCH_HASH_SIZE];
+static struct list_head wildcard_q;
+static struct list_head linear_q;
+static uint64_t post_seq;
+
+static void
+usage(int argc, char *argv[])
+{
+  fprintf(stderr, "%s [options]\n", argv[0]);
+  fprintf(stderr, " -d <n>\tmaximal queue depth [%d]\n", DEPTH_MAX);
+  fprintf(stderr, " -w <n>\tpercentage of wildcard receives [0]\n");
+  fprintf(stderr, " -N <n>\tnumber of matches per depth [%d]\n", ITER);
+}
+
+/* per-peer/per-tag receives as pre-posted by MPI codes */
+static uint64_t
+entry_match_info(int i)
+{
+  return ((uint64_t) (i % 256) << 32) | (i / 256);
+}
+
+static void
+post(struct entry *e, int i, int wildcard_percent)
+{
+  e->match.match_info = entry_match_info(i);
+  e->match.match_mask = (uint64_t) -1;
+  if (rand() % 100 < wildcard_percent) {
+    /* any tag from this peer */
+    e->match.match_mask = 0xffffffff00000000ULL;
+    e->match.match_info &= e->match.match_mask;
+  }
+  omx__match_post(hash, &wildcard_q, &e->match, post_seq++);
+  list_add_tail(&e->linear_elt, &linear_q);
+}
+
+static void
+unpost(struct entry *e)
+{
+  omx__match_unpost(&e->match);
+  list_del(&e->linear_elt);
+}
+
+static struct entry *
+linear_find(uint64_t match_info)
+{
+  struct entry *e;
+
+  list_for_each_entry(e, &linear_q, linear_elt)
+    if (e->match.match_info == (e->match.match_mask & match_info))
+      return e;
+  return NULL;
+}
+
+static unsigned long long
+now_us(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec*1000000ULL + tv.tv_usec;
+}
+
+/*
+ * Match a message for a random posted receive and repost it right away,
+ * so that the depth stays constant.
+ */
+static unsigned long long
+bench(int depth, int iter, int wildcard_percent, int linear)
+{
+  unsigned long long start, total;
+  int i;
+
+  for(i=0; i<depth; i++)
+    post(&entries[i], i, wildcard_percent);
+
+  srand(depth);
+  start = now_us();
+  for(i=0; i<iter; i++) {
+    int target = rand() % depth;
+    uint64_t match_info = entry_match_info(target);
+    struct entry *e;
+
+    if (linear) {
+      e = linear_find(match_info);
+    } else {
+      struct omx__match_elt *match = omx__match_find(hash, &wildcard_q, match_info);
+      e = match ? containerof(match, struct entry, match) : NULL;
+    }
+    assert(e);
+    unpost(e);
+    post(e, e - entries, wildcard_percent);
+  }
+  total = now_us() - start;
+
+  for(i=0; i<depth; i++)
+    unpost(&entries[i]);
+
+  return total;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int depth_max = DEPTH_MAX;
+  int wildcard_percent = 0;
+  int iter = ITER;
+  int depth;
+  int c;
+
+  while ((c = getopt(argc, argv, "d:w:N:h")) != -1)
+    switch (c) {
+    case 'd':
+      depth_max = atoi(optarg);
+      if (depth_max < 1 || depth_max > DEPTH_MAX) {
+	fprintf(stderr, "Depth must be between 1 and %d\n", DEPTH_MAX);
+	exit(-1);
+      }
+      break;
+    case 'w':
+      wildcard_percent = atoi(optarg);
+      break;
+    case 'N':
+      iter = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Unknown option -%c\n", c);
+    case 'h':
+      usage(argc, argv);
+      exit(-1);
+      break;
+    }
+
+  omx__match_hash_init(hash);
+  list_head_init(&wildcard_q);
+  list_head_init(&linear_q);
+
+  printf("%% wildcard receives: %d\n", wildcard_percent);
+  printf("  depth\thashed (ns)\tlinear (ns)\n");
+  for(depth=1; depth<=depth_max; depth*=4) {
+    /* do not spend ages in the linear walk of deep queues */
+    int linear_iter = depth > 1024 ? iter / (depth / 1024) : iter;
+    unsigned long long hashed = bench(depth, iter, wildcard_percent, 0);
+    unsigned long long linear = bench(depth, linear_iter, wildcard_percent, 1);
+
+    printf("%7d\t%11.1f\t%11.1f\n", depth,
+	   hashed * 1000. / iter, linear * 1000. / linear_iter);
+  }
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Check that the posted receive matching engine always returns the first
+ * posted receive accepting a message, as a linear walk of the post order
+ * does.
+ */
+
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "omx_lib.h"
+#include "omx_match.h"
+
+#define ENTRIES 4096
+#define ROUNDS 200000
+
+struct entry {
+  struct omx__match_elt match;
+  int posted;
+};
+
+static struct entry entries[ENTRIES];
+static struct list_head hash[OMX__MATCH_HASH_SIZE];
+static struct list_head wildcard_q;
+static uint64_t post_seq;
+
+/* few distinct values so that we get collisions and several matches */
+static uint64_t
+random_match_info(void)
+{
+  return ((uint64_t) (rand() % 8) << 32) | (rand() % 64);
+}
+
+static void
+post(struct entry *e)
+{
+  uint64_t match_info = random_match_info();
+  uint64_t match_mask;
+
+  switch (rand() % 4) {
+  case 0:
+    /* any tag from a given high part */
+    match_mask = 0xffffffff00000000ULL;
+    break;
+  case 1:
+    /* wildcard */
+    match_mask = 0;
+    break;
+  default:
+    /* fully-specified */
+    match_mask = (uint64_t) -1;
+  }
+
+  e->match.match_info = match_info & match_mask;
+  e->match.match_mask = match_mask;
+  e->posted = 1;
+  omx__match_post(hash, &wildcard_q, &e->match, post_seq++);
+}
+
+static void
+unpost(struct entry *e)
+{
+  omx__match_unpost(&e->match);
+  e->posted = 0;
+}
+
+/* reference: first posted entry accepting match_info */
+static struct entry *
+linear_find(uint64_t match_info)
+{
+  struct entry *best = NULL;
+  int i;
+
+  for(i=0; i<ENTRIES; i++) {
+    struct entry *e = &entries[i];
+    if (!e->posted)
+      continue;
+    if (e->match.match_info != (e->match.match_mask & match_info))
+      continue;
+    if (!best || e->match.post_seq < best->match.post_seq)
+      best = e;
+  }
+
+  return best;
+}
+
+int
+main(int argc, char *argv[])
+{
+  unsigned seed = 0;
+  unsigned long matched = 0;
+  int i, c;
+
+  while ((c = getopt(argc, argv, "s:h")) != -1)
+    switch (c) {
+    case 's':
+      seed = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Unknown option -%c\n", c);
+    case 'h':
+      fprintf(stderr, "%s [-s <seed>]\n", argv[0]);
+      exit(-1);
+    }
+
+  srand(seed);
+  omx__match_hash_init(hash);
+  list_head_init(&wildcard_q);
+
+  for(i=0; i<ROUNDS; i++) {
+    struct entry *e = &entries[rand() % ENTRIES];
+
+    if (rand() % 3) {
+      /* post or cancel a receive */
+      if (e->posted)
+	unpost(e);
+      else
+	post(e);
+    } else {
+      /* deliver a message */
+      uint64_t match_info = random_match_info();
+      struct entry *expected = linear_find(match_info);
+      struct omx__match_elt *found = omx__match_find(hash, &wildcard_q, match_info);
+
+      if ((expected ? &expected->match : NULL) != found) {
+	fprintf(stderr, "Message %016llx matched post #%lld instead of #%lld\n",
+		(unsigned long long) match_info,
+		found ? (long long) found->post_seq : -1LL,
+		expected ? (long long) expected->match.post_seq : -1LL);
+	exit(1);
+      }
+
+      if (expected) {
+	unpost(expected);
+	matched++;
+      }
+    }
+  }
+
+  printf("Matched %lu messages in post order\n", matched);
+  return 0;
+}
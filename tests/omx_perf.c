@@ -43,6 +43,8 @@
 #define BUFFER_ALIGN (64*1024) /* page-aligned on any arch */
 #define UNIDIR 0
 #define SYNC 0
+#define WINDOW 0
+#define WINDOW_MAX 256
 #define YIELD 0
 #define PAUSE_MS 100
 
@@ -91,6 +93,42 @@ omx_isend_or_issend(int sync,
     return omx_isend(ep, buffer, length, dest_endpoint, match_info, context, request);
 }
 
+/* post window sends or receives on the same buffer and wait for all of them */
+static omx_return_t
+omx_post_window_and_wait(int recv, int window, int sync, int wait, int yield,
+			 omx_endpoint_t ep, void *buffer, size_t length,
+			 omx_endpoint_addr_t addr, omx_request_t *reqs)
+{
+  omx_status_t status;
+  uint32_t result;
+  omx_return_t ret;
+  int j;
+
+  for(j=0; j<window; j++) {
+    if (recv)
+      ret = omx_irecv(ep, buffer, length,
+		      0, 0,
+		      NULL, &reqs[j]);
+    else
+      ret = omx_isend_or_issend(sync,
+				ep, buffer, length,
+				addr, 0x1234567887654321ULL,
+				NULL, &reqs[j]);
+    if (ret != OMX_SUCCESS)
+      return ret;
+  }
+
+  for(j=0; j<window; j++) {
+    ret = omx_test_or_wait(wait, yield, ep, &reqs[j], &status, &result);
+    if (ret != OMX_SUCCESS)
+      return ret;
+    if (status.code != OMX_SUCCESS)
+      return status.code;
+  }
+
+  return OMX_SUCCESS;
+}
+
 static void
 usage(int argc, char *argv[])
 {
@@ -115,6 +153,7 @@ usage(int argc, char *argv[])
   fprintf(stderr, " -P <n>\tpause (in milliseconds) between lengths [%d]\n", PAUSE_MS);
   fprintf(stderr, " -U\tswitch to undirectional mode (receiver sends 0-byte replies)\n");
   fprintf(stderr, " -Y\tswitch to synchronous communication mode\n");
+  fprintf(stderr, " -B <n>\tswitch to bandwidth mode with <n> messages in flight (receiver sends 0-byte acks) [%d]\n", WINDOW);
 }
 
 struct param {
@@ -131,6 +170,8 @@ struct param {
   uint8_t align;
   uint8_t unidir;
   uint8_t sync;
+  uint8_t pad1;
+  uint32_t window;
 };
 
 #define HTON_DU32(dstlow, dsthigh, val) do { \
@@ -157,6 +198,8 @@ int main(int argc, char *argv[])
   unsigned long long increment = INCREMENT;
   int unidir = UNIDIR;
   int sync = SYNC;
+  int window = WINDOW;
+  omx_request_t window_reqs[WINDOW_MAX];
   int yield = YIELD;
   int slave = 0;
   char my_hostname[OMX_HOSTNAMELEN_MAX];
@@ -171,7 +214,7 @@ int main(int argc, char *argv[])
   int wait = 0;
   int pause_ms = PAUSE_MS;
 
-  while ((c = getopt(argc, argv, "e:r:d:b:S:E:M:I:N:W:P:swUYyvah")) != -1)
+  while ((c = getopt(argc, argv, "e:r:d:b:S:E:M:I:N:W:P:B:swUYyvah")) != -1)
     switch (c) {
     case 'b':
       bid = atoi(optarg);
@@ -226,6 +269,13 @@ int main(int argc, char *argv[])
     case 'Y':
       sync = 1;
       break;
+    case 'B':
+      window = atoi(optarg);
+      if (window < 0 || window > WINDOW_MAX) {
+	fprintf(stderr, "Cannot keep more than %d messages in flight\n", WINDOW_MAX);
+	exit(-1);
+      }
+      break;
     case 'y':
       yield = 1;
       break;
@@ -316,6 +366,7 @@ int main(int argc, char *argv[])
     param.align = align;
     param.unidir = unidir;
     param.sync = sync;
+    param.window = htonl(window);
     ret = omx_issend(ep, &param, sizeof(param),
 		     addr, 0x1234567887654321ULL,
 		     NULL, &req);
@@ -337,8 +388,8 @@ int main(int argc, char *argv[])
     }
 
     if (verbose)
-      printf("Sent parameters (iter=%d, warmup=%d, min=%lld, max=%lld, mult=%lld, incr=%lld, unidir=%d) to peer %s\n",
-	     iter, warmup, min, max, multiplier, increment, unidir, dest_hostname);
+      printf("Sent parameters (iter=%d, warmup=%d, min=%lld, max=%lld, mult=%lld, incr=%lld, unidir=%d, window=%d) to peer %s\n",
+	     iter, warmup, min, max, multiplier, increment, unidir, window, dest_hostname);
 
     /* wait for the ok message */
     ret = omx_irecv(ep, NULL, 0,
@@ -384,30 +435,42 @@ int main(int argc, char *argv[])
 	if (i == warmup)
 	  gettimeofday(&tv1, NULL);
 
-	/* sending a message */
-	ret = omx_isend_or_issend(sync,
-				  ep, sendbuffer, length,
-				  addr, 0x1234567887654321ULL,
-				  NULL, &req);
-	if (ret != OMX_SUCCESS) {
-	  fprintf(stderr, "Failed to send (%s)\n",
-		  omx_strerror(ret));
-	  goto out_with_ep;
-	}
-	ret = omx_test_or_wait(wait, yield, ep, &req, &status, &result);
-	if (ret != OMX_SUCCESS || !result) {
-	  fprintf(stderr, "Failed to wait (%s)\n",
-		  omx_strerror(ret));
-	  goto out_with_ep;
-	}
-	if (status.code != OMX_SUCCESS) {
-	  fprintf(stderr, "send failed with status (%s)\n",
-		  omx_strerror(status.code));
-		  goto out_with_ep;
+	if (window) {
+	  /* streaming a window of messages */
+	  ret = omx_post_window_and_wait(0, window, sync, wait, yield,
+					 ep, sendbuffer, length,
+					 addr, window_reqs);
+	  if (ret != OMX_SUCCESS) {
+	    fprintf(stderr, "Failed to send window (%s)\n",
+		    omx_strerror(ret));
+	    goto out_with_ep;
+	  }
+	} else {
+	  /* sending a message */
+	  ret = omx_isend_or_issend(sync,
+				    ep, sendbuffer, length,
+				    addr, 0x1234567887654321ULL,
+				    NULL, &req);
+	  if (ret != OMX_SUCCESS) {
+	    fprintf(stderr, "Failed to send (%s)\n",
+		    omx_strerror(ret));
+	    goto out_with_ep;
+	  }
+	  ret = omx_test_or_wait(wait, yield, ep, &req, &status, &result);
+	  if (ret != OMX_SUCCESS || !result) {
+	    fprintf(stderr, "Failed to wait (%s)\n",
+		    omx_strerror(ret));
+	    goto out_with_ep;
+	  }
+	  if (status.code != OMX_SUCCESS) {
+	    fprintf(stderr, "send failed with status (%s)\n",
+		    omx_strerror(status.code));
+		    goto out_with_ep;
+	  }
 	}
 
 	/* wait for an incoming message */
-	ret = omx_irecv(ep, recvbuffer, unidir ? 0 : length,
+	ret = omx_irecv(ep, recvbuffer, unidir || window ? 0 : length,
 			0, 0,
 			NULL, &req);
 	if (ret != OMX_SUCCESS) {
@@ -435,9 +498,14 @@ int main(int argc, char *argv[])
       us = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
       if (verbose)
 	printf("Total Duration: %lld us\n", us);
-      printf("length % 9lld:\t%.3f us\t%.2f MB/s\t %.2f MiB/s\n",
-	     length, ((float) us)/(2.-unidir)/iter,
-	     (2.-unidir)*iter*length/us, (2.-unidir)*iter*length/us/1.048576);
+      if (window)
+	printf("length % 9lld:\t%d in flight\t%.2f MB/s\t %.2f MiB/s\n",
+	       length, window,
+	       ((double) window)*iter*length/us, ((double) window)*iter*length/us/1.048576);
+      else
+	printf("length % 9lld:\t%.3f us\t%.2f MB/s\t %.2f MiB/s\n",
+	       length, ((float) us)/(2.-unidir)/iter,
+	       (2.-unidir)*iter*length/us, (2.-unidir)*iter*length/us/1.048576);
 
       free(sendbuffer);
       free(recvbuffer);
@@ -496,6 +564,11 @@ int main(int argc, char *argv[])
     align = param.align;
     unidir = param.unidir;
     sync = param.sync;
+    window = ntohl(param.window);
+    if (window > WINDOW_MAX) {
+      fprintf(stderr, "Cannot receive more than %d messages in flight\n", WINDOW_MAX);
+      goto out_with_ep;
+    }
 
     ret = omx_decompose_endpoint_addr(status.addr, &board_addr, &endpoint_index);
     if (ret != OMX_SUCCESS) {
@@ -509,8 +582,8 @@ int main(int argc, char *argv[])
       strcpy(src_hostname, "<unknown peer>");
 
     if (verbose)
-      printf("Got parameters (iter=%d, warmup=%d, min=%lld, max=%lld, mult=%lld, incr=%lld, unidir=%d) from peer %s\n",
-	     iter, warmup, min, max, multiplier, increment, unidir, src_hostname);
+      printf("Got parameters (iter=%d, warmup=%d, min=%lld, max=%lld, mult=%lld, incr=%lld, unidir=%d, window=%d) from peer %s\n",
+	     iter, warmup, min, max, multiplier, increment, unidir, window, src_hostname);
 
     /* connect back, using iconnect for fun */
     ret = omx_iconnect(ep, board_addr, endpoint_index, 0x12345678,
@@ -571,30 +644,42 @@ int main(int argc, char *argv[])
 	if (verbose)
 	  printf("Iteration %d/%d\n", i-warmup, iter);
 
-	/* wait for an incoming message */
-	ret = omx_irecv(ep, sendbuffer, length,
-			0, 0,
-			NULL, &req);
-	if (ret != OMX_SUCCESS) {
-	  fprintf(stderr, "Failed to irecv (%s)\n",
-		  omx_strerror(ret));
-	  goto out_with_ep;
-	}
-	ret = omx_test_or_wait(wait, yield, ep, &req, &status, &result);
-	if (ret != OMX_SUCCESS || !result) {
-	  fprintf(stderr, "Failed to wait (%s)\n",
-		  omx_strerror(ret));
-	  goto out_with_ep;
-	}
-	if (status.code != OMX_SUCCESS) {
-	  fprintf(stderr, "irecv failed with status (%s)\n",
-		  omx_strerror(status.code));
-		  goto out_with_ep;
+	if (window) {
+	  /* receiving a window of messages */
+	  ret = omx_post_window_and_wait(1, window, sync, wait, yield,
+					 ep, sendbuffer, length,
+					 addr, window_reqs);
+	  if (ret != OMX_SUCCESS) {
+	    fprintf(stderr, "Failed to receive window (%s)\n",
+		    omx_strerror(ret));
+	    goto out_with_ep;
+	  }
+	} else {
+	  /* wait for an incoming message */
+	  ret = omx_irecv(ep, sendbuffer, length,
+			  0, 0,
+			  NULL, &req);
+	  if (ret != OMX_SUCCESS) {
+	    fprintf(stderr, "Failed to irecv (%s)\n",
+		    omx_strerror(ret));
+	    goto out_with_ep;
+	  }
+	  ret = omx_test_or_wait(wait, yield, ep, &req, &status, &result);
+	  if (ret != OMX_SUCCESS || !result) {
+	    fprintf(stderr, "Failed to wait (%s)\n",
+		    omx_strerror(ret));
+	    goto out_with_ep;
+	  }
+	  if (status.code != OMX_SUCCESS) {
+	    fprintf(stderr, "irecv failed with status (%s)\n",
+		    omx_strerror(status.code));
+		    goto out_with_ep;
+	  }
 	}
 
 	/* sending a message */
 	ret = omx_isend_or_issend(sync,
-				  ep, recvbuffer, unidir ? 0 : length,
+				  ep, recvbuffer, unidir || window ? 0 : length,
 				  addr, 0x1234567887654321ULL,
 				  NULL, &req);
 	if (ret != OMX_SUCCESS) {
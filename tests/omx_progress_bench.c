@@ -0,0 +1,139 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Cost of a progression pass as a function of the number of outstanding
+ * requests: sends that are not acked yet (the peer endpoint never makes
+ * progress) and posted receives that never match.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <getopt.h>
+#include <assert.h>
+
+#include "open-mx.h"
+
+#define BID 0
+#define ITER 100000
+#define DEPTH_MAX 4096
+
+static void
+usage(int argc, char *argv[])
+{
+  fprintf(stderr, "%s [options]\n", argv[0]);
+  fprintf(stderr, " -b <n>\tchange local board id [%d]\n", BID);
+  fprintf(stderr, " -d <n>\tmaximal number of outstanding sends and receives [%d]\n", DEPTH_MAX);
+  fprintf(stderr, " -N <n>\tnumber of progression passes per depth [%d]\n", ITER);
+}
+
+static unsigned long long
+now_us(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec*1000000ULL + tv.tv_usec;
+}
+
+int
+main(int argc, char *argv[])
+{
+  omx_endpoint_t ep, peer_ep;
+  omx_endpoint_addr_t peer_addr;
+  omx_request_t req;
+  omx_status_t status;
+  uint64_t board_addr;
+  uint32_t peer_index, result;
+  int board_index = BID;
+  int depth_max = DEPTH_MAX;
+  int iter = ITER;
+  int depth, outstanding = 0;
+  omx_return_t ret;
+  int i, c;
+
+  while ((c = getopt(argc, argv, "b:d:N:h")) != -1)
+    switch (c) {
+    case 'b':
+      board_index = atoi(optarg);
+      break;
+    case 'd':
+      depth_max = atoi(optarg);
+      break;
+    case 'N':
+      iter = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Unknown option -%c\n", c);
+    case 'h':
+      usage(argc, argv);
+      exit(-1);
+      break;
+    }
+
+  ret = omx_init();
+  assert(ret == OMX_SUCCESS);
+
+  ret = omx_board_number_to_nic_id(board_index, &board_addr);
+  assert(ret == OMX_SUCCESS);
+
+  ret = omx_open_endpoint(board_index, OMX_ANY_ENDPOINT, 0x12345678, NULL, 0, &ep);
+  assert(ret == OMX_SUCCESS);
+  ret = omx_open_endpoint(board_index, OMX_ANY_ENDPOINT, 0x12345678, NULL, 0, &peer_ep);
+  assert(ret == OMX_SUCCESS);
+
+  ret = omx_get_endpoint_addr(peer_ep, &peer_addr);
+  assert(ret == OMX_SUCCESS);
+  ret = omx_decompose_endpoint_addr(peer_addr, &board_addr, &peer_index);
+  assert(ret == OMX_SUCCESS);
+
+  /* connect, the peer has to make progress for the connect to complete */
+  ret = omx_iconnect(ep, board_addr, peer_index, 0x12345678, 0, NULL, &req);
+  assert(ret == OMX_SUCCESS);
+  do {
+    omx_progress(peer_ep);
+    ret = omx_test(ep, &req, &status, &result);
+    assert(ret == OMX_SUCCESS);
+  } while (!result);
+  assert(status.code == OMX_SUCCESS);
+  peer_addr = status.addr;
+
+  printf("  depth\tprogress (ns)\n");
+  for(depth=1; depth<=depth_max; depth*=4) {
+    unsigned long long start, total;
+
+    /* the peer never progresses from now on, so sends are never acked */
+    for(; outstanding<depth; outstanding++) {
+      ret = omx_isend(ep, NULL, 0, peer_addr, outstanding, NULL, &req);
+      assert(ret == OMX_SUCCESS);
+      omx_forget(ep, &req);
+      ret = omx_irecv(ep, NULL, 0, 0xdeadbeef00000000ULL | outstanding, (uint64_t) -1, NULL, &req);
+      assert(ret == OMX_SUCCESS);
+    }
+
+    start = now_us();
+    for(i=0; i<iter; i++)
+      omx_progress(ep);
+    total = now_us() - start;
+
+    printf("%7d\t%13.1f\n", depth, total * 1000. / iter);
+  }
+
+  omx_close_endpoint(peer_ep);
+  omx_close_endpoint(ep);
+  return 0;
+}
@@ -33,34 +33,15 @@
 static int verbose = 0;
 
 static omx_return_t
-one_iteration(omx_endpoint_t ep, omx_endpoint_addr_t addr,
-	      int length, int parallel, int seed)
+transfer(omx_endpoint_t ep, omx_endpoint_addr_t addr,
+	 char *buffer, char *buffer2, int length, int parallel)
 {
   omx_request_t sreq[parallel], rreq[parallel], req;
-  char *buffer, *buffer2;
   omx_status_t status;
   omx_return_t ret;
   uint32_t result;
   int i;
 
-  buffer = malloc(length);
-  if (!buffer)
-    goto out;
-  buffer2 = malloc(length);
-  if (!buffer2) {
-    free(buffer);
-    goto out;
-  }
-
-  /* initialize buffers to different values
-   * so that it's easy to check bytes correctness
-   * after the transfer
-   */
-  for(i=0; i<length; i++) {
-    buffer[i] = (seed+i)%26+'a';
-    buffer2[i] = (seed+i+13)%26+'a';
-  }
-
   /* post N sends */
   for(i=0; i<parallel; i++) {
     ret = omx_isend(ep, buffer, length,
@@ -69,7 +50,7 @@ one_iteration(omx_endpoint_t ep, omx_endpoint_addr_t addr,
     if (ret != OMX_SUCCESS) {
       fprintf(stderr, "Failed to send message length %d (%s)\n",
 	      length, omx_strerror(ret));
-      goto out_with_buffers;
+      return OMX_BAD_ERROR;
     }
   }
 
@@ -81,14 +62,14 @@ one_iteration(omx_endpoint_t ep, omx_endpoint_addr_t addr,
     if (ret != OMX_SUCCESS) {
       fprintf(stderr, "Failed to post a recv for a tiny message (%s)\n",
 	      omx_strerror(ret));
-      goto out_with_buffers;
+      return OMX_BAD_ERROR;
     }
 
     ret = omx_wait(ep, &rreq[i], &status, &result, OMX_TIMEOUT_INFINITE);
     if (ret != OMX_SUCCESS || !result) {
       fprintf(stderr, "Failed to wait for completion (%s)\n",
 	      omx_strerror(ret));
-      goto out_with_buffers;
+      return OMX_BAD_ERROR;
     }
   }
 
@@ -97,7 +78,7 @@ one_iteration(omx_endpoint_t ep, omx_endpoint_addr_t addr,
   if (ret != OMX_SUCCESS || !result) {
     fprintf(stderr, "Failed to wait for completion (%s)\n",
             omx_strerror(ret));
-    goto out_with_buffers;
+    return OMX_BAD_ERROR;
   }
 
   /* use peek to wait for the sends to complete */
@@ -106,20 +87,19 @@ one_iteration(omx_endpoint_t ep, omx_endpoint_addr_t addr,
     if (ret != OMX_SUCCESS || !result) {
       fprintf(stderr, "Failed to peek (%s)\n",
               omx_strerror(ret));
-      goto out_with_buffers;
+      return OMX_BAD_ERROR;
     }
     if (req != sreq[i]) {
       fprintf(stderr, "Peek got request %p instead of %p\n",
               req, sreq[i]);
-      ret = OMX_BAD_ERROR;
-      goto out_with_buffers;
+      return OMX_BAD_ERROR;
     }
 
     ret = omx_test(ep, &sreq[i], &status, &result);
     if (ret != OMX_SUCCESS || !result) {
       fprintf(stderr, "Failed to wait for completion (%s)\n",
               omx_strerror(ret));
-      goto out_with_buffers;
+      return OMX_BAD_ERROR;
     }
   }
 
@@ -128,12 +108,69 @@ one_iteration(omx_endpoint_t ep, omx_endpoint_addr_t addr,
     if (buffer[i] != buffer2[i]) {
       fprintf(stderr, "buffer invalid at offset %d, got '%c' instead of '%c'\n",
 	      i, buffer2[i], buffer[i]);
-      goto out_with_buffers;
+      return OMX_BAD_ERROR;
     }
   }
 
   if (verbose)
-    fprintf(stderr, "Successfully transferred %d bytes 4 times\n", length);
+    fprintf(stderr, "Successfully transferred %d bytes %d times\n", length, parallel);
+
+  return OMX_SUCCESS;
+}
+
+static omx_return_t
+one_iteration(omx_endpoint_t ep, omx_endpoint_addr_t addr,
+	      int length, int parallel, int subrange, int seed)
+{
+  char *buffer, *buffer2;
+  omx_return_t ret;
+  int i;
+
+  buffer = malloc(length);
+  if (!buffer)
+    goto out;
+  buffer2 = malloc(length);
+  if (!buffer2) {
+    free(buffer);
+    goto out;
+  }
+
+  /* initialize buffers to different values
+   * so that it's easy to check bytes correctness
+   * after the transfer
+   */
+  for(i=0; i<length; i++) {
+    buffer[i] = (seed+i)%26+'a';
+    buffer2[i] = (seed+i+13)%26+'a';
+  }
+
+  ret = transfer(ep, addr, buffer, buffer2, length, parallel);
+  if (ret != OMX_SUCCESS)
+    goto out_with_buffers;
+
+  if (subrange) {
+    /* transfer the middle of the same buffers,
+     * the regcache should reuse the windows at an offset
+     */
+    int offset = length/4;
+
+    for(i=0; i<length; i++)
+      buffer2[i] = (seed+i+13)%26+'a';
+
+    ret = transfer(ep, addr, buffer+offset, buffer2+offset, length-2*offset, parallel);
+    if (ret != OMX_SUCCESS)
+      goto out_with_buffers;
+
+    /* check that nothing was written outside of the sub-range */
+    for(i=0; i<length; i++) {
+      if (i >= offset && i < length-offset)
+	continue;
+      if (buffer2[i] != (seed+i+13)%26+'a') {
+	fprintf(stderr, "buffer modified at offset %d outside of sub-range\n", i);
+	goto out_with_buffers;
+      }
+    }
+  }
 
   free(buffer2);
   free(buffer);
@@ -154,6 +191,7 @@ usage(int argc, char *argv[])
   fprintf(stderr, " -e <n>\tchange local endpoint id [%d]\n", EID);
   fprintf(stderr, " -l <n>\tuse length [%d]\n", LENGTH);
   fprintf(stderr, " -P <n>\tsend multiple messages in parallel [%d]\n", PARALLEL);
+  fprintf(stderr, " -o\talso transfer sub-ranges of the buffers\n");
   fprintf(stderr, " -R\tdo not enable regcache\n");
   fprintf(stderr, " -s\tuse shared communication instead of native networking\n");
   fprintf(stderr, " -S\tuse self communication instead of shared or native networking\n");
@@ -180,11 +218,12 @@ int main(int argc, char *argv[])
   int self = 0;
   int shared = 0;
   int parallel = PARALLEL;
+  int subrange = 0;
   int c;
   int i;
   omx_return_t ret;
 
-  while ((c = getopt(argc, argv, "e:b:l:P:RsSvh")) != -1)
+  while ((c = getopt(argc, argv, "e:b:l:P:oRsSvh")) != -1)
     switch (c) {
     case 'b':
       board_index = atoi(optarg);
@@ -198,6 +237,9 @@ int main(int argc, char *argv[])
     case 'P':
       parallel = atoi(optarg);
       break;
+    case 'o':
+      subrange = 1;
+      break;
     case 'R':
       rcache = 0;
       break;
@@ -276,7 +318,7 @@ int main(int argc, char *argv[])
   gettimeofday(&tv1, NULL);
   for(i=0; i<ITER; i++) {
     /* send a large message */
-    ret = one_iteration(ep, addr, length, parallel, i);
+    ret = one_iteration(ep, addr, length, parallel, subrange, i);
     if (ret != OMX_SUCCESS)
       goto out_with_ep;
   }
@@ -284,6 +326,24 @@ int main(int argc, char *argv[])
   printf("message (%d bytes) latency %lld us\n", length,
 	 (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec));
 
+  if (rcache) {
+    struct omx_regcache_counters counters;
+
+    ret = omx_get_info(ep, OMX_INFO_ENDPOINT_REGCACHE_COUNTERS, NULL, 0,
+		       &counters, sizeof(counters));
+    if (ret != OMX_SUCCESS) {
+      fprintf(stderr, "Failed to get regcache counters (%s)\n",
+	      omx_strerror(ret));
+      goto out_with_ep;
+    }
+    printf("regcache %lld hits %lld superset hits %lld misses %lld evictions %lld invalidations\n",
+	   (unsigned long long) counters.hits,
+	   (unsigned long long) counters.superset_hits,
+	   (unsigned long long) counters.misses,
+	   (unsigned long long) counters.evictions,
+	   (unsigned long long) counters.invalidations);
+  }
+
   omx_close_endpoint(ep);
   return 0;
 
@@ -0,0 +1,152 @@
+/*
+ * Xen2MX
+ * Copyright © Anastassios Nanos 2012
+ * (see AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Check that the endpoint timer wheel runs every timer exactly once,
+ * during the first run of the wheel that reaches its deadline, whatever
+ * the level it was queued in.
+ */
+
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "omx_lib.h"
+
+#define TIMERS 1024
+#define ROUNDS 200000
+
+struct entry {
+  struct omx__timer timer;
+  int armed;
+  unsigned long fired;
+};
+
+static struct entry entries[TIMERS];
+static struct omx__timer_wheel wheel;
+static uint64_t now;
+static unsigned long expired;
+
+/*
+ * spread deadlines over all levels of the wheel, and beyond,
+ * always after the current jiffy since the wheel already ran for it
+ */
+static uint64_t
+random_delay(void)
+{
+  switch (rand() % 5) {
+  case 0:
+    return rand() % OMX__TIMER_WHEEL_SIZE;
+  case 1:
+    return rand() % (OMX__TIMER_WHEEL_SIZE * OMX__TIMER_WHEEL_SIZE);
+  case 2:
+    return rand() % (1 << 18);
+  case 3:
+    return rand() % (1 << 24);
+  default:
+    return (uint64_t) rand() % (1ULL << 26);
+  }
+}
+
+static void
+timer_func(struct omx_endpoint *ep, struct omx__timer *timer)
+{
+  struct entry *e = containerof(timer, struct entry, timer);
+
+  if (!e->armed) {
+    fprintf(stderr, "Timer #%d ran while not armed\n", (int) (e - entries));
+    exit(1);
+  }
+  if (timer->expires > now) {
+    fprintf(stderr, "Timer #%d expiring at %lld ran at %lld\n", (int) (e - entries),
+	    (unsigned long long) timer->expires, (unsigned long long) now);
+    exit(1);
+  }
+
+  e->armed = 0;
+  e->fired++;
+  expired++;
+
+  /* some timers are periodic */
+  if (rand() % 4 == 0) {
+    e->armed = 1;
+    omx__timer_arm(&wheel, timer, now + 1 + random_delay());
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  unsigned seed = 0;
+  int i, c;
+
+  while ((c = getopt(argc, argv, "s:h")) != -1)
+    switch (c) {
+    case 's':
+      seed = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Unknown option -%c\n", c);
+    case 'h':
+      fprintf(stderr, "%s [-s <seed>]\n", argv[0]);
+      exit(-1);
+    }
+
+  srand(seed);
+  now = rand();
+  omx__timer_wheel_init(&wheel, now);
+  for(i=0; i<TIMERS; i++)
+    omx__timer_init(&entries[i].timer, timer_func);
+
+  for(i=0; i<ROUNDS; i++) {
+    struct entry *e = &entries[rand() % TIMERS];
+    int j;
+
+    switch (rand() % 4) {
+    case 0:
+      /* disarm */
+      omx__timer_disarm(&wheel, &e->timer);
+      e->armed = 0;
+      break;
+    case 1:
+      /* only move the deadline earlier */
+      if (e->armed) {
+	omx__timer_arm_earlier(&wheel, &e->timer, now + 1 + random_delay());
+	break;
+      }
+      /* fallthrough */
+    case 2:
+      /* (re)arm */
+      omx__timer_arm(&wheel, &e->timer, now + 1 + random_delay());
+      e->armed = 1;
+      break;
+    default:
+      /* advance the clock, sometimes by a lot */
+      now += rand() % 8 ? rand() % 16 : random_delay();
+      omx__timer_wheel_run(NULL, &wheel, now);
+
+      for(j=0; j<TIMERS; j++)
+	if (entries[j].armed && entries[j].timer.expires <= now) {
+	  fprintf(stderr, "Timer #%d expiring at %lld did not run at %lld\n", j,
+		  (unsigned long long) entries[j].timer.expires, (unsigned long long) now);
+	  exit(1);
+	}
+    }
+  }
+
+  printf("Expired %lu timers on time\n", expired);
+  return 0;
+}
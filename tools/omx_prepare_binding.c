@@ -31,11 +31,54 @@
 #include "omx_lib.h"
 
 static int verbose = 0;
+static int set_affinity = 0;
 static uint32_t emax;
 
 #define OMX_PROC_INTERRUPTS_LENGTH_MAX 256
 #define OMX_IFACE_SLICE_MAX 128
 
+/* bind each slice interrupt to its own core, round-robin over online cores */
+static int
+omx__set_slice_affinities(const int *slice_irq, unsigned slicemax)
+{
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned j;
+
+  if (ncpus <= 0) {
+    fprintf(stderr, "Failed to get the number of online cpus, %m\n");
+    return -1;
+  }
+  if (ncpus > 64)
+    /* the binding file only supports 64-bit masks */
+    ncpus = 64;
+
+  for(j=0; j<slicemax; j++) {
+    char smp_affinity_path[10+strlen("/proc/irq/*/smp_affinity")];
+    unsigned cpu = j % ncpus;
+    FILE *file;
+
+    if (!slice_irq[j])
+      continue;
+
+    sprintf(smp_affinity_path, "/proc/irq/%d/smp_affinity", slice_irq[j]);
+    file = fopen(smp_affinity_path, "w");
+    if (!file) {
+      fprintf(stderr, "Failed to open %s for writing, %m\n", smp_affinity_path);
+      return -1;
+    }
+    fprintf(file, "%llx\n", 1ULL << cpu);
+    if (fclose(file) < 0) {
+      fprintf(stderr, "Failed to set irq %d affinity to cpu #%u, %m\n", slice_irq[j], cpu);
+      return -1;
+    }
+
+    if (verbose)
+      fprintf(stderr, "    Bound irq %d for slice %u on cpu #%u\n", slice_irq[j], j, cpu);
+  }
+
+  return 0;
+}
+
 static int
 omx__try_prepare_board(FILE *output, uint32_t board_index)
 {
@@ -152,6 +195,9 @@ omx__try_prepare_board(FILE *output, uint32_t board_index)
     }
   }
 
+  if (set_affinity && omx__set_slice_affinities(slice_irq, slicemax) < 0)
+    return -1;
+
   for(j=0; j<emax; j++) {
     char smp_affinity_path[10+strlen("/proc/irq/*/smp_affinity")];
     char line[OMX_PROCESS_BINDING_LENGTH_MAX], *end;
@@ -205,6 +251,7 @@ usage(int argc, char *argv[])
 {
   fprintf(stderr, "%s [options] [file]\n", argv[0]);
   fprintf(stderr, "  default output file is %s\n", OMX_PROCESS_BINDING_FILE);
+  fprintf(stderr, "  -a\tbind each interface interrupt to its own core first\n");
   fprintf(stderr, "  -v\tverbose messages\n");
 }
 
@@ -218,8 +265,11 @@ int main(int argc, char *argv[])
   unsigned found, i;
   int c;
 
-  while ((c = getopt(argc, argv, "vh")) != -1)
+  while ((c = getopt(argc, argv, "avh")) != -1)
     switch (c) {
+    case 'a':
+      set_affinity = 1;
+      break;
     case 'v':
       verbose = 1;
       break;